@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+#include "alloc_counter.h"
+#include "lenet5.h"
+#include "lenet5_incremental.h"
+#include "lenet5_int8.h"
+#include "layer_graph.h"
+#include "dataset_reader.h"
+
+static std::atomic<long long> allocations(0);
+
+void count_allocation() {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+long long allocation_count() {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+// replacements of the global allocation functions: count, then malloc / free
+// (the over-aligned forms keep the library versions; nothing here allocates over-aligned types with new)
+
+static void* counted_malloc(size_t bytes) {
+    count_allocation();
+    return malloc(bytes ? bytes : 1);
+}
+
+void* operator new(size_t bytes) {
+    void* ptr = counted_malloc(bytes);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t bytes) {
+    void* ptr = counted_malloc(bytes);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept {
+    return counted_malloc(bytes);
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t&) noexcept {
+    return counted_malloc(bytes);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    free(ptr);
+}
+
+// "lenet5 allocs"
+
+void print_alloc_check_usage() {
+    printf("usage: lenet5 allocs [options]              check that every inference path allocates no memory after warm-up\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -d dataset         CSV or MNIST IDX images file (default ./dataset/*.csv)\n");
+}
+
+bool parse_alloc_check_args(int argc, char* argv[], AllocCheckOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_alloc_check(const AllocCheckOptions& options) {
+
+    Arena imageArena;
+    std::vector<ImageMap*> images;
+    if (!read_report_images(images, imageArena, options.dataset_path))
+        return false;
+
+    // a full batch tile and a partial one, so that the batch buffers have grown to their largest size in the warm-up
+    std::vector<ImageMap*> tile = cycle_images(images, Lenet5Model::BATCH_TILE + 3);
+    std::vector<int> digits(tile.size());
+
+    struct Path {
+        const char* name;
+        const char* conv;       // set_conv_algorithms
+        const char* precision;  // set_precision
+        SparseFormat sparse;
+        bool batch;
+    };
+    const Path paths[] = {
+        { "direct", "direct", "fp32", SPARSE_NONE, false },
+        { "winograd4", "winograd4", "fp32", SPARSE_NONE, false },
+        { "fft", "fft", "fp32", SPARSE_NONE, false },
+        { "fp16+act", "direct", "fp16+act", SPARSE_NONE, false },
+        { "bf16+act", "direct", "bf16+act", SPARSE_NONE, false },
+        { "csr", "direct", "fp32", SPARSE_CSR, false },
+        { "block", "direct", "fp32", SPARSE_BLOCK, false },
+        { "batch direct", "direct", "fp32", SPARSE_NONE, true },
+        { "batch winograd4", "winograd4", "fp32", SPARSE_NONE, true },
+        { "batch bf16+act", "direct", "bf16+act", SPARSE_NONE, true },
+        { "batch csr", "direct", "fp32", SPARSE_CSR, true },
+    };
+
+    printf("heap allocations per inference after warm-up (%s kernels)\n", simd_level_name(simd_kernels().level));
+    const int passes = 10;
+    bool ok = true;
+    for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); ++p) {
+        const Path& path = paths[p];
+        Lenet5Model lenet5(options.model_path);
+        lenet5.set_conv_algorithms(path.conv);
+        lenet5.set_precision(path.precision);
+        if (path.sparse != SPARSE_NONE) {
+            lenet5.prune(0.8f);
+            lenet5.set_sparse(path.sparse);
+        }
+        InferenceContext context;
+
+        size_t before = 0;
+        for (int pass = 0; pass <= passes; ++pass) {
+            if (pass == 1)
+                before = allocation_count();    // pass 0 is the warm-up
+            if (path.batch)
+                lenet5.run_inference_batch(&tile[0], (int)tile.size(), &digits[0], context);
+            else
+                for (size_t b = 0; b < images.size(); ++b)
+                    lenet5.run_inference(images[b], context);
+        }
+        size_t allocations = allocation_count() - before;
+        printf("  %-16s %6d  (arena: %d KB in %d blocks)\n", path.name, (int)allocations,
+            (int)(context.get_arena().bytes_reserved() >> 10), (int)context.get_arena().num_blocks());
+        ok = ok && allocations == 0;
+    }
+
+    // the layer graph of lenet-5
+    {
+        const LayerGraph graph("params/lenet5.graph", options.model_path);
+        GraphContext context;
+        size_t before = 0;
+        for (int pass = 0; graph.is_loaded() && pass <= passes; ++pass) {
+            if (pass == 1)
+                before = allocation_count();
+            for (size_t b = 0; b < images.size(); ++b)
+                graph.run_inference(images[b], context);
+        }
+        size_t allocations = allocation_count() - before;
+        printf("  %-16s %6d  (arena: %d KB in %d blocks)\n", "graph", (int)allocations,
+            (int)(context.get_arena().bytes_reserved() >> 10), (int)context.get_arena().num_blocks());
+        ok = ok && graph.is_loaded() && allocations == 0;
+    }
+
+    // incremental inference, the images as one stream
+    {
+        const Lenet5Model lenet5(options.model_path);
+        IncrementalContext context;
+        size_t before = 0;
+        for (int pass = 0; pass <= passes; ++pass) {
+            if (pass == 1)
+                before = allocation_count();
+            for (size_t b = 0; b < images.size(); ++b)
+                lenet5.run_inference_incremental(images[b], context);
+        }
+        size_t allocations = allocation_count() - before;
+        printf("  %-16s %6d  (arena: %d KB in %d blocks)\n", "incremental", (int)allocations,
+            (int)(context.get_arena().bytes_reserved() >> 10), (int)context.get_arena().num_blocks());
+        ok = ok && allocations == 0;
+    }
+
+    // the int8 network
+    {
+        const Lenet5Model lenet5(options.model_path);
+        const Lenet5Int8Model lenet5Int8(lenet5, images);
+        Int8InferenceContext context;
+        size_t before = 0;
+        for (int pass = 0; pass <= passes; ++pass) {
+            if (pass == 1)
+                before = allocation_count();
+            for (size_t b = 0; b < images.size(); ++b)
+                lenet5Int8.run_inference(images[b], context);
+        }
+        size_t allocations = allocation_count() - before;
+        printf("  %-16s %6d  (arena: %d KB in %d blocks)\n", "int8", (int)allocations,
+            (int)(context.get_arena().bytes_reserved() >> 10), (int)context.get_arena().num_blocks());
+        ok = ok && allocations == 0;
+    }
+
+    if (!ok)
+        fprintf(stderr, "inference allocated memory after warm-up\n");
+    return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+// Process-wide count of heap allocations, for checking that inference does not allocate once warmed up
+// ("lenet5 allocs"). alloc_counter.cpp replaces the global operator new / new[] (plain and nothrow),
+// and aligned_malloc (tensor.h) and the Arena blocks count themselves.
+// The count is a relaxed atomic increment, cheap enough to stay on in every build.
+
+void count_allocation();
+long long allocation_count();
+
+struct AllocCheckOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;   // nullptr: the two CSV files
+
+    AllocCheckOptions() : model_path(nullptr), dataset_path(nullptr) {}
+};
+
+// parses the arguments of "lenet5 allocs" (argv[0] is the first one after the command)
+bool parse_alloc_check_args(int argc, char* argv[], AllocCheckOptions& options);
+void print_alloc_check_usage();
+
+// runs the images through every inference path, and fails if any allocates after its warm-up pass
+bool run_alloc_check(const AllocCheckOptions& options);
+
+#endif
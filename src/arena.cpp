@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "arena.h"
+#include "alloc_counter.h"
+#ifdef _MSC_VER
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+Arena::Arena(size_t blockSize, bool hugePages) : current(0), offset(0), block_size(blockSize), huge_pages(hugePages) {
+    if (huge_pages && block_size < ARENA_HUGE_PAGE_SIZE)
+        block_size = ARENA_HUGE_PAGE_SIZE;
+}
+
+Arena::~Arena() {
+    for (size_t b = 0; b < blocks.size(); ++b) {
+#ifdef _MSC_VER
+        _aligned_free(blocks[b].data);
+#else
+        free(blocks[b].data);
+#endif
+    }
+}
+
+void Arena::add_block(size_t minBytes) {
+
+    size_t size = (minBytes > block_size) ? minBytes : block_size;
+    size_t alignment = 4096;
+    if (huge_pages) {
+        size = (size + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+        alignment = ARENA_HUGE_PAGE_SIZE;
+    }
+
+    count_allocation();
+#ifdef _MSC_VER
+    void* data = _aligned_malloc(size, alignment);
+#else
+    void* data = nullptr;
+    if (posix_memalign(&data, alignment, size) != 0)
+        data = nullptr;
+#endif
+    if (data == nullptr)
+        throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+    if (huge_pages)
+        madvise(data, size, MADV_HUGEPAGE);     // a hint: without THP support the block keeps small pages
+#endif
+
+    Block block = { (char*)data, size };
+    blocks.push_back(block);
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment) {
+
+    // the remaining blocks (after a reset) are tried in order before adding one
+    while (current < blocks.size()) {
+        size_t start = (offset + alignment - 1) & ~(alignment - 1);
+        if (start + bytes <= blocks[current].size) {
+            offset = start + bytes;
+            return blocks[current].data + start;
+        }
+        ++current;
+        offset = 0;
+    }
+    add_block(bytes);
+    current = blocks.size() - 1;
+    offset = bytes;
+    return blocks[current].data;
+}
+
+void Arena::reset() {
+    current = 0;
+    offset = 0;
+}
+
+size_t Arena::bytes_reserved() const {
+    size_t bytes = 0;
+    for (size_t b = 0; b < blocks.size(); ++b)
+        bytes += blocks[b].size;
+    return bytes;
+}
+
+size_t Arena::bytes_used() const {
+    size_t bytes = offset;
+    for (size_t b = 0; b < current && b < blocks.size(); ++b)
+        bytes += blocks[b].size;
+    return bytes;
+}
+
+bool arena_huge_pages() {
+    static const bool enabled = [] {
+        const char* env = getenv("LENET5_HUGE_PAGES");
+        return env != NULL && strcmp(env, "0") != 0;
+    }();
+    return enabled;
+}
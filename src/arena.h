@@ -0,0 +1,59 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <vector>
+
+#define ARENA_BLOCK_SIZE (1 << 20)          // default size of a block
+#define ARENA_HUGE_PAGE_SIZE (2 << 20)      // x86-64 transparent huge page
+
+// Bump allocator: memory is carved sequentially out of large blocks and only given back all at once
+// (reset or destruction), so an allocation is a pointer increment and never touches the heap
+// once the blocks exist. Requests larger than a block get a block of their own.
+//
+// With huge pages, blocks are rounded up to and aligned on 2 MB and marked for transparent huge pages
+// (madvise MADV_HUGEPAGE on Linux; elsewhere the flag is ignored), so the activations of
+// a whole batch are covered by a few TLB entries.
+//
+// Not thread-safe: one arena per thread / InferenceContext.
+class Arena {
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t current;     // block being carved
+    size_t offset;      // first free byte in it
+    size_t block_size;
+    bool huge_pages;
+
+    void add_block(size_t minBytes);
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+public:
+    // hugePages: see above; the LENET5_HUGE_PAGES environment variable (0 / 1) sets the default of arena_huge_pages()
+    explicit Arena(size_t blockSize = ARENA_BLOCK_SIZE, bool hugePages = false);
+    ~Arena();
+
+    // bytes of uninitialized memory aligned on alignment (a power of 2, at most 4096)
+    void* allocate(size_t bytes, size_t alignment = 64);
+    template<class T> T* allocate_array(size_t count) {
+        return (T*)allocate(count * sizeof(T), (alignof(T) > 64) ? alignof(T) : 64);
+    }
+
+    // forgets every allocation and keeps the blocks for the next ones
+    void reset();
+
+    bool uses_huge_pages() const { return huge_pages; }
+    size_t num_blocks() const { return blocks.size(); }
+    size_t bytes_reserved() const;  // sum of the block sizes
+    size_t bytes_used() const;      // up to the current allocation point, including alignment padding
+};
+
+// default of the inference contexts: LENET5_HUGE_PAGES=1
+bool arena_huge_pages();
+
+#endif
@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include "benchmark.h"
+#include "lenet5.h"
+#include "lenet5_int8.h"
+#include "lenet5_numa.h"
+#include "dataset_reader.h"
+#include "thread_pool.h"
+
+#define BENCH_SYNTHETIC_IMAGES 256      // distinct random images, cycled through by the requests
+#define BENCH_MAX_REAL_IMAGES 10000     // real images kept in memory, cycled likewise
+#define BENCH_CALIBRATION_IMAGES 100    // images the int8 engine is calibrated on
+
+// one set of input images
+struct BenchInput {
+    std::string name;
+    std::vector<std::unique_ptr<ImageMap>> images;
+};
+
+// results of one run
+struct BenchResult {
+    int engine;
+    std::string input;
+    int batch;
+    int threads;
+    int images;
+    int requests;
+    double seconds;
+    // latency of a request, in microseconds
+    double mean, p50, p90, p99, p999, max;
+    LayerProfile profile;                       // all threads
+    std::vector<LayerProfile> thread_profiles;  // each thread of the pool
+};
+
+// per-worker state of all engines
+struct BenchWorker {
+    InferenceContext context;
+    Int8InferenceContext contextInt8;
+    std::vector<int> digits;
+};
+
+struct BenchEngines {
+    const Lenet5Model* model;
+    const Lenet5Int8Model* modelInt8;
+    const Lenet5NumaReplicas* replicas;
+};
+
+const char* benchmark_engine_name(int engine) {
+    switch (engine) {
+    case BENCH_FLOAT: return "float";
+    case BENCH_BATCH: return "batch";
+    case BENCH_INT8: return "int8";
+    case BENCH_NUMA: return "numa";
+    default: return "?";
+    }
+}
+
+BenchmarkOptions::BenchmarkOptions() : model_path(nullptr), dataset_path("./dataset/test_dataset.csv"), json_path(nullptr),
+    conv_algorithms(nullptr), synthetic(true), images(2000), warmup_images(200)
+{
+    for (int e = 0; e < BENCH_NUMA; ++e)
+        engines.push_back(e);
+    batch_sizes.push_back(1);
+    batch_sizes.push_back(32);
+    thread_counts.push_back(1);
+    thread_counts.push_back(0);
+}
+
+void print_benchmark_usage() {
+    printf("usage: lenet5 bench [options]\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -d dataset         real inputs, CSV or MNIST IDX images file (default ./dataset/test_dataset.csv, 'none' to skip)\n");
+    printf("  -i inputs          synthetic,real (default both)\n");
+    printf("  -e engines         float,batch,int8,numa (default float,batch,int8)\n");
+    printf("  -c algorithms      C1 / C3 convolution of float and batch, e.g. winograd4 or c1=direct,c3=fft (default direct)\n");
+    printf("  -b sizes           images per request, e.g. 1,8,32 (default 1,32)\n");
+    printf("  -t threads         thread counts, 0 = one per hardware thread (default 1,0)\n");
+    printf("  -n images          measured images per run (default 2000)\n");
+    printf("  -w images          warm-up images per run (default 200)\n");
+    printf("  -j file.json       write the results as JSON ('-' for stdout)\n");
+}
+
+// "1,8,32" -> { 1, 8, 32 }
+static bool parse_int_list(const char* arg, int min, std::vector<int>& values) {
+
+    values.clear();
+    const char* p = arg;
+    while (*p != '\0') {
+        char* end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value < min || (*end != ',' && *end != '\0'))
+            return false;
+        values.push_back((int)value);
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return !values.empty();
+}
+
+// "float,int8" -> { BENCH_FLOAT, BENCH_INT8 }, "synthetic,real" likewise
+static bool parse_name_list(const char* arg, const char* const* names, int numNames, std::vector<int>& values) {
+
+    values.clear();
+    std::string list(arg);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string name = list.substr(start, end - start);
+        int found = -1;
+        for (int i = 0; i < numNames; ++i) {
+            if (name == names[i])
+                found = i;
+        }
+        if (found < 0)
+            return false;
+        values.push_back(found);
+        start = end + 1;
+    }
+    return !values.empty();
+}
+
+bool parse_benchmark_args(int argc, char* argv[], BenchmarkOptions& options) {
+
+    const char* engineNames[BENCH_ENGINE_COUNT];
+    for (int e = 0; e < BENCH_ENGINE_COUNT; ++e)
+        engineNames[e] = benchmark_engine_name(e);
+    const char* inputNames[] = { "synthetic", "real" };
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        std::vector<int> list;
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = (strcmp(value, "none") == 0) ? nullptr : value;
+        }
+        else if (strcmp(arg, "-i") == 0) {
+            if (!parse_name_list(value, inputNames, 2, list))
+                return false;
+            options.synthetic = std::find(list.begin(), list.end(), 0) != list.end();
+            if (std::find(list.begin(), list.end(), 1) == list.end())
+                options.dataset_path = nullptr;
+        }
+        else if (strcmp(arg, "-e") == 0) {
+            if (!parse_name_list(value, engineNames, BENCH_ENGINE_COUNT, options.engines))
+                return false;
+        }
+        else if (strcmp(arg, "-c") == 0) {
+            options.conv_algorithms = value;
+        }
+        else if (strcmp(arg, "-b") == 0) {
+            if (!parse_int_list(value, 1, options.batch_sizes))
+                return false;
+        }
+        else if (strcmp(arg, "-t") == 0) {
+            if (!parse_int_list(value, 0, options.thread_counts))
+                return false;
+        }
+        else if (strcmp(arg, "-n") == 0) {
+            options.images = atoi(value);
+            if (options.images <= 0)
+                return false;
+        }
+        else if (strcmp(arg, "-w") == 0) {
+            options.warmup_images = atoi(value);
+            if (options.warmup_images < 0)
+                return false;
+        }
+        else if (strcmp(arg, "-j") == 0) {
+            options.json_path = value;
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// random strokes on a black background, roughly as sparse as a handwritten digit
+static void make_synthetic_input(BenchInput& input) {
+
+    input.name = "synthetic";
+    unsigned int seed = 12345;
+    for (int n = 0; n < BENCH_SYNTHETIC_IMAGES; ++n) {
+        ImageMap* image = new ImageMap(Lenet5Dims::IN_LEN);
+        memset(image->data(), 0, Lenet5Dims::IN_LEN * Lenet5Dims::IN_LEN);
+        for (int i = 0; i < DATASET_IMAGE_LEN; ++i) {
+            for (int j = 0; j < DATASET_IMAGE_LEN; ++j) {
+                seed = seed * 1664525u + 1013904223u;   // LCG, the same images on every run
+                unsigned int r = seed >> 24;
+                if (r < 64)
+                    image->set_cell((unsigned char)(r * 4 + 3), i + DATASET_PADDING, j + DATASET_PADDING);
+            }
+        }
+        image->set_label((char)('0' + n % 10));
+        input.images.push_back(std::unique_ptr<ImageMap>(image));
+    }
+}
+
+static bool load_real_input(const char* path, BenchInput& input) {
+
+    input.name = "real";
+    DatasetReader reader;
+    if (!reader.open(path))
+        return false;
+    while (input.images.size() < BENCH_MAX_REAL_IMAGES) {
+        std::unique_ptr<ImageMap> image(new ImageMap(Lenet5Dims::IN_LEN));
+        if (!reader.next(image.get()))
+            break;
+        input.images.push_back(std::move(image));
+    }
+    if (input.images.empty()) {
+        fprintf(stderr, "no images in '%s'\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void run_request(int engine, const BenchEngines& engines, const ImageMap* const* images, int n, BenchWorker& worker,
+    int workerIndex) {
+
+    switch (engine) {
+    case BENCH_FLOAT:
+        for (int i = 0; i < n; ++i)
+            engines.model->run_inference(images[i], worker.context);
+        break;
+    case BENCH_BATCH:
+        worker.digits.resize(n);
+        engines.model->run_inference_batch(images, n, worker.digits.data(), worker.context);
+        break;
+    case BENCH_INT8:
+        for (int i = 0; i < n; ++i)
+            engines.modelInt8->run_inference(images[i], worker.contextInt8);
+        break;
+    case BENCH_NUMA:
+        for (int i = 0; i < n; ++i)
+            engines.replicas->model(workerIndex).run_inference(images[i], worker.context);
+        break;
+    }
+}
+
+// nearest-rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0.0;
+    size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+    rank = (rank < 1) ? 1 : ((rank > sorted.size()) ? sorted.size() : rank);
+    return sorted[rank - 1];
+}
+
+static BenchResult run_config(int engine, const BenchEngines& engines, const BenchInput& input, int batch, int numThreads,
+    const BenchmarkOptions& options)
+{
+    BenchResult result;
+    result.engine = engine;
+    result.input = input.name;
+    result.batch = batch;
+
+    // request r runs images [r * batch, (r + 1) * batch) of the input cycled to the run length
+    int numRequests = (options.images + batch - 1) / batch;
+    std::vector<const ImageMap*> order(numRequests * batch);
+    for (int i = 0; i < (int)order.size(); ++i)
+        order[i] = input.images[i % input.images.size()].get();
+
+    // every worker allocates its state on its own thread (numa: after pinning itself, so the state is node-local)
+    std::vector<std::unique_ptr<BenchWorker>> workers(numThreads);
+    ThreadPool pool(numThreads, [&](int worker) {
+        if (engine == BENCH_NUMA)
+            engines.replicas->pin_worker(worker);
+        workers[worker].reset(new BenchWorker());
+    });
+    result.threads = pool.size();
+
+    std::vector<double> latencies(numRequests);
+    auto run_requests = [&](int count, bool record) {
+        int grain = count / (pool.size() * 8);
+        pool.parallel_for(count, grain, [&](int begin, int end, int worker) {
+            for (int r = begin; r < end; ++r) {
+                auto start = std::chrono::high_resolution_clock::now();
+                run_request(engine, engines, &order[(r % numRequests) * batch], batch, *workers[worker], worker);
+                auto stop = std::chrono::high_resolution_clock::now();
+                if (record)
+                    latencies[r] = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() * 1e-3;
+            }
+        });
+    };
+
+    // warm-up: caches, page faults of the scratch buffers, thread start-up
+    if (options.warmup_images > 0)
+        run_requests((options.warmup_images + batch - 1) / batch, false);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    run_requests(numRequests, true);
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    result.images = numRequests * batch;
+    result.requests = numRequests;
+    result.seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() * 1e-9;
+
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0.0;
+    for (int r = 0; r < numRequests; ++r)
+        sum += latencies[r];
+    result.mean = sum / numRequests;
+    result.p50 = percentile(latencies, 50.0);
+    result.p90 = percentile(latencies, 90.0);
+    result.p99 = percentile(latencies, 99.0);
+    result.p999 = percentile(latencies, 99.9);
+    result.max = latencies.back();
+
+    // time (and hardware counters) per layer, in a separate pass so the clock reads do not add to the latencies
+    // each worker records into its own profile, merged afterwards
+    result.thread_profiles.resize(pool.size());
+    for (int w = 0; w < pool.size(); ++w) {
+        workers[w]->context.set_profile(&result.thread_profiles[w]);
+        workers[w]->contextInt8.set_profile(&result.thread_profiles[w]);
+    }
+    pool.parallel_for(numRequests, numRequests / (pool.size() * 8), [&](int begin, int end, int worker) {
+        for (int r = begin; r < end; ++r)
+            run_request(engine, engines, &order[r * batch], batch, *workers[worker], worker);
+    });
+    for (int w = 0; w < pool.size(); ++w) {
+        workers[w]->context.set_profile(nullptr);
+        workers[w]->contextInt8.set_profile(nullptr);
+        result.profile.add(result.thread_profiles[w]);
+    }
+
+    return result;
+}
+
+static double layer_us(const LayerProfile& profile, int layer) {
+    return (profile.images > 0) ? profile.seconds[layer] * 1e6 / profile.images : 0.0;
+}
+
+#ifdef LENET5_PERF_COUNTERS
+static double per_image(const LayerProfile& profile, int layer, int event) {
+    return (profile.images > 0) ? (double)profile.counters[layer][event] / profile.images : 0.0;
+}
+
+static double ratio(uint64_t num, uint64_t den) {
+    return (den > 0) ? (double)num / den : 0.0;
+}
+
+// cycles and instructions per image, IPC, L1D miss rate, LLC and branch misses per image of every layer
+static void print_counters(const LayerProfile& profile, const char* title) {
+
+    if (!profile.counters_valid) {
+        printf("       %s: hardware counters not available\n", title);
+        return;
+    }
+    printf("       %s:\n", title);
+    printf("       %-8s %12s %12s %6s %9s %11s %11s\n", "layer", "cycles/img", "instrs/img", "IPC", "L1D miss", "LLC miss/img", "br miss/img");
+    for (int l = 0; l < LAYER_COUNT; ++l) {
+        if (profile.fused[l])
+            continue;
+        const uint64_t* c = profile.counters[l];
+        printf("       %-8s %12.0f %12.0f %6.2f %8.2f%% %11.2f %11.2f\n", layer_name(l),
+            per_image(profile, l, PERF_CYCLES), per_image(profile, l, PERF_INSTRUCTIONS),
+            ratio(c[PERF_INSTRUCTIONS], c[PERF_CYCLES]), ratio(c[PERF_L1D_MISSES], c[PERF_L1D_LOADS]) * 100.0,
+            per_image(profile, l, PERF_LLC_MISSES), per_image(profile, l, PERF_BRANCH_MISSES));
+    }
+}
+
+// one JSON object with the counters per image of every layer (null for fused layers)
+static void write_json_counters(FILE* fp, const LayerProfile& profile) {
+
+    if (!profile.counters_valid) {
+        fprintf(fp, "null");
+        return;
+    }
+    fprintf(fp, "{");
+    for (int l = 0; l < LAYER_COUNT; ++l) {
+        fprintf(fp, "%s \"%s\": ", (l > 0) ? "," : "", layer_name(l));
+        if (profile.fused[l]) {
+            fprintf(fp, "null");
+            continue;
+        }
+        fprintf(fp, "{");
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+            fprintf(fp, "%s \"%s\": %.2f", (e > 0) ? "," : "", perf_event_name(e), per_image(profile, l, e));
+        fprintf(fp, " }");
+    }
+    fprintf(fp, " }");
+}
+#endif
+
+// throughput of each batch run against the float run of the same input and threads: batching
+// must never cost images/s, so a ratio below 1 is flagged
+static void print_batch_speedup(const std::vector<BenchResult>& results) {
+
+    for (int i = 0; i < (int)results.size(); ++i) {
+        const BenchResult& batch = results[i];
+        if (batch.engine != BENCH_BATCH)
+            continue;
+        for (int j = 0; j < (int)results.size(); ++j) {
+            const BenchResult& single = results[j];
+            if (single.engine != BENCH_FLOAT || single.input != batch.input || single.threads != batch.threads || single.batch != batch.batch)
+                continue;
+            double ratio = (batch.images / batch.seconds) / (single.images / single.seconds);
+            printf("batch vs float: %.2fx images/s (%s input, batch %d, %d thread(s))%s\n", ratio, batch.input.c_str(), batch.batch,
+                batch.threads, ratio < 1.0 ? "  <- batch slower than single-image" : "");
+        }
+    }
+}
+
+static void print_result(const BenchResult& r) {
+
+    printf("%-6s %-10s %6d %7d %12.1f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", benchmark_engine_name(r.engine), r.input.c_str(),
+        r.batch, r.threads, r.images / r.seconds, r.mean, r.p50, r.p90, r.p99, r.p999, r.max);
+    printf("       layers (us/image):");
+    for (int l = 0; l < LAYER_COUNT; ++l) {
+        if (r.profile.fused[l])
+            printf(" %s (in %s)", layer_name(l), layer_name(l - 1));
+        else
+            printf(" %s %.2f", layer_name(l), layer_us(r.profile, l));
+    }
+    printf("\n");
+#ifdef LENET5_PERF_COUNTERS
+    print_counters(r.profile, "counters per layer, all threads");
+    if (r.thread_profiles.size() > 1) {
+        for (int t = 0; t < (int)r.thread_profiles.size(); ++t) {
+            char title[64];
+            sprintf_s(title, "counters per layer, thread %d (%lld images)", t, r.thread_profiles[t].images);
+            print_counters(r.thread_profiles[t], title);
+        }
+    }
+#endif
+}
+
+static bool write_json(const char* path, const std::vector<BenchResult>& results, const BenchmarkOptions& options,
+    const Lenet5Model& model)
+{
+
+    FILE* fp = stdout;
+    if (strcmp(path, "-") != 0) {
+        errno_t err;
+        if ((err = fopen_s(&fp, path, "w")) != 0) {
+            fprintf(stderr, "cannot open file '%s'\n", path);
+            return false;
+        }
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"timestamp\": %lld,\n", (long long)time(NULL));
+    fprintf(fp, "  \"simd\": \"%s\",\n", simd_level_name(simd_kernels().level));
+    fprintf(fp, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+    fprintf(fp, "  \"model\": \"%s\",\n", options.model_path != nullptr ? options.model_path : "params");
+    fprintf(fp, "  \"warmup_images\": %d,\n", options.warmup_images);
+    fprintf(fp, "  \"conv\": { \"C1\": \"%s\", \"C3\": \"%s\" },\n", conv_algorithm_name(model.get_conv_algorithm(LAYER_C1)),
+        conv_algorithm_name(model.get_conv_algorithm(LAYER_C3)));
+    fprintf(fp, "  \"runs\": [");
+    for (int i = 0; i < (int)results.size(); ++i) {
+        const BenchResult& r = results[i];
+        fprintf(fp, "%s\n    {\n", (i > 0) ? "," : "");
+        fprintf(fp, "      \"engine\": \"%s\", \"input\": \"%s\", \"batch\": %d, \"threads\": %d,\n",
+            benchmark_engine_name(r.engine), r.input.c_str(), r.batch, r.threads);
+        fprintf(fp, "      \"images\": %d, \"requests\": %d, \"seconds\": %.6f, \"images_per_sec\": %.2f,\n",
+            r.images, r.requests, r.seconds, r.images / r.seconds);
+        fprintf(fp, "      \"latency_us\": { \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p99_9\": %.3f, \"max\": %.3f },\n",
+            r.mean, r.p50, r.p90, r.p99, r.p999, r.max);
+        // layers fused into the previous one have no time of their own
+        fprintf(fp, "      \"layers_us_per_image\": {");
+        for (int l = 0; l < LAYER_COUNT; ++l) {
+            if (r.profile.fused[l])
+                fprintf(fp, "%s \"%s\": null", (l > 0) ? "," : "", layer_name(l));
+            else
+                fprintf(fp, "%s \"%s\": %.3f", (l > 0) ? "," : "", layer_name(l), layer_us(r.profile, l));
+        }
+#ifdef LENET5_PERF_COUNTERS
+        // hardware events per image of every layer, for all threads and then for each thread
+        fprintf(fp, " },\n      \"counters_per_image\": ");
+        write_json_counters(fp, r.profile);
+        fprintf(fp, ",\n      \"thread_counters_per_image\": [");
+        for (int t = 0; t < (int)r.thread_profiles.size(); ++t) {
+            fprintf(fp, "%s\n        ", (t > 0) ? "," : "");
+            write_json_counters(fp, r.thread_profiles[t]);
+        }
+        fprintf(fp, "\n      ]\n    }");
+#else
+        fprintf(fp, " }\n    }");
+#endif
+    }
+    fprintf(fp, "\n  ]\n}\n");
+
+    if (fp != stdout)
+        fclose(fp);
+    return true;
+}
+
+bool run_benchmark(const BenchmarkOptions& options) {
+
+    std::vector<std::unique_ptr<BenchInput>> inputs;
+    if (options.synthetic) {
+        inputs.push_back(std::unique_ptr<BenchInput>(new BenchInput()));
+        make_synthetic_input(*inputs.back());
+    }
+    if (options.dataset_path != nullptr) {
+        std::unique_ptr<BenchInput> real(new BenchInput());
+        if (!load_real_input(options.dataset_path, *real))
+            return false;
+        inputs.push_back(std::move(real));
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "no inputs to benchmark\n");
+        return false;
+    }
+
+    // one copy of each engine, shared by every run; int8 is calibrated on the real images when there are some
+    Lenet5Model model(options.model_path);
+    if (options.conv_algorithms != nullptr && !model.set_conv_algorithms(options.conv_algorithms))
+        return false;
+    std::unique_ptr<Lenet5Int8Model> modelInt8;
+    if (std::find(options.engines.begin(), options.engines.end(), (int)BENCH_INT8) != options.engines.end()) {
+        const BenchInput& calibration = *inputs.back();
+        std::vector<ImageMap*> images;
+        for (int i = 0; i < (int)calibration.images.size() && i < BENCH_CALIBRATION_IMAGES; ++i)
+            images.push_back(calibration.images[i].get());
+        modelInt8.reset(new Lenet5Int8Model(model, images));
+    }
+    std::unique_ptr<Lenet5NumaReplicas> replicas;
+    if (std::find(options.engines.begin(), options.engines.end(), (int)BENCH_NUMA) != options.engines.end()) {
+        replicas.reset(new Lenet5NumaReplicas(options.model_path, options.conv_algorithms));
+        if (!replicas->is_loaded())
+            return false;
+        printf("%s", replicas->placement().c_str());
+    }
+    BenchEngines engines = { &model, modelInt8.get(), replicas.get() };
+
+    // 0 threads = one per hardware thread, and each thread count only once
+    std::vector<int> threadCounts;
+    for (int i = 0; i < (int)options.thread_counts.size(); ++i) {
+        int threads = options.thread_counts[i];
+        if (threads == 0)
+            threads = (std::thread::hardware_concurrency() > 0) ? (int)std::thread::hardware_concurrency() : 1;
+        if (std::find(threadCounts.begin(), threadCounts.end(), threads) == threadCounts.end())
+            threadCounts.push_back(threads);
+    }
+
+    printf("benchmark: %s kernels, %s / %s convolution, %u hardware threads, %d images per run after %d warm-up images\n",
+        simd_level_name(simd_kernels().level), conv_algorithm_name(model.get_conv_algorithm(LAYER_C1)),
+        conv_algorithm_name(model.get_conv_algorithm(LAYER_C3)), std::thread::hardware_concurrency(), options.images, options.warmup_images);
+    printf("%-6s %-10s %6s %7s %12s %9s %9s %9s %9s %9s %9s\n", "engine", "input", "batch", "threads", "images/s",
+        "mean us", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+
+    std::vector<BenchResult> results;
+    for (int e = 0; e < (int)options.engines.size(); ++e) {
+        for (int i = 0; i < (int)inputs.size(); ++i) {
+            for (int b = 0; b < (int)options.batch_sizes.size(); ++b) {
+                for (int t = 0; t < (int)threadCounts.size(); ++t) {
+                    results.push_back(run_config(options.engines[e], engines, *inputs[i], options.batch_sizes[b], threadCounts[t], options));
+                    print_result(results.back());
+                }
+            }
+        }
+    }
+    print_batch_speedup(results);
+
+    if (options.json_path != nullptr)
+        return write_json(options.json_path, results, options, model);
+    return true;
+}
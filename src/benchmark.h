@@ -0,0 +1,45 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <vector>
+
+// Benchmark of the inference engines
+//
+// Every combination of engine x input x batch size x thread count is one run:
+// requests of batch-size images are spread over a thread pool after a few warm-up requests
+// that are not measured, and the run reports images per second and the latency percentiles
+// of a request. The time per layer is measured in a separate single-threaded pass over the
+// same requests, so reading the clock between layers does not disturb the latencies.
+
+enum BenchmarkEngine {
+    BENCH_FLOAT,    // Lenet5Model::run_inference, one image at a time
+    BENCH_BATCH,    // Lenet5Model::run_inference_batch, packed GEMMs over the whole request
+    BENCH_INT8,     // Lenet5Int8Model::run_inference, one image at a time
+    BENCH_NUMA,     // float on pinned workers with one model replica per NUMA node (Lenet5NumaReplicas)
+    BENCH_ENGINE_COUNT
+};
+
+const char* benchmark_engine_name(int engine);
+
+struct BenchmarkOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;   // real inputs (CSV or MNIST IDX), nullptr: synthetic inputs only
+    const char* json_path;      // machine-readable results, nullptr: none, "-": stdout
+    const char* conv_algorithms;    // C1 / C3 convolution algorithms of the float engines (see Lenet5Model::set_conv_algorithms)
+    bool synthetic;             // also run on random images
+    std::vector<int> engines;
+    std::vector<int> batch_sizes;
+    std::vector<int> thread_counts;     // 0: one per hardware thread
+    int images;                 // measured images per run
+    int warmup_images;          // images run (and discarded) before measuring
+
+    BenchmarkOptions();
+};
+
+// parses the arguments of "lenet5 bench" (argv[0] is the first one after "bench")
+bool parse_benchmark_args(int argc, char* argv[], BenchmarkOptions& options);
+void print_benchmark_usage();
+
+bool run_benchmark(const BenchmarkOptions& options);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+
+// Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's array queue)
+//
+// Every cell carries a sequence number that tells producers and consumers whose turn it is, so a push or a pop
+// is one compare-and-swap on the shared position plus one store to the cell, without locks. try_push fails
+// when the queue is full and try_pop when it is empty; waiting (and backpressure) is up to the caller.
+// T must be cheap to copy (e.g. an index into a pool of items).
+template<class T>
+class BoundedQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_pos;    // producers and consumers on separate cache lines
+    alignas(64) std::atomic<size_t> dequeue_pos;
+
+    BoundedQueue(const BoundedQueue&);
+    BoundedQueue& operator=(const BoundedQueue&);
+
+public:
+    // capacity is rounded up to a power of 2
+    explicit BoundedQueue(size_t capacity) : enqueue_pos(0), dequeue_pos(0) {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    bool try_push(const T& value) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+            if (diff == 0) {
+                // the cell is free for position pos: claim it
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false;   // full: the cell still holds the value of the previous lap
+            }
+            else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.data;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);     // free for the next lap
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false;   // empty
+            }
+            else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "dataset_reader.h"
+#include "lenet5_dims.h"
+#include "model_file.h"
+
+static_assert(DATASET_IMAGE_LEN + 2 * DATASET_PADDING == Lenet5Dims::IN_LEN, "padded images are the network input");
+
+#define IDX_IMAGES_MAGIC 0x00000803     // unsigned byte, 3 dimensions
+#define IDX_LABELS_MAGIC 0x00000801     // unsigned byte, 1 dimension
+#define IDX_IMAGES_HEADER 16
+#define IDX_LABELS_HEADER 8
+
+static unsigned int read_be32(const unsigned char* p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+}
+
+// zero rows above and below the image, and the zero columns on both sides of every row
+static void clear_padding(unsigned char* data) {
+
+    const int len = Lenet5Dims::IN_LEN;
+    memset(data, 0, DATASET_PADDING * len);
+    memset(data + (len - DATASET_PADDING) * len, 0, DATASET_PADDING * len);
+    for (int i = DATASET_PADDING; i < len - DATASET_PADDING; ++i) {
+        memset(data + i * len, 0, DATASET_PADDING);
+        memset(data + i * len + len - DATASET_PADDING, 0, DATASET_PADDING);
+    }
+}
+
+DatasetReader::DatasetReader() : _format(DATASET_CSV), _pos(0), _count(0), _index(0), _record(0), _row(0),
+    _released(0) {}
+
+bool DatasetReader::open(const char* filename, const char* labels_filename) {
+
+    close();
+    if (!_images.open(filename, true))
+        return false;
+    _filename = filename;
+
+    if (_images.size() >= 4 && read_be32(_images.data()) == IDX_IMAGES_MAGIC) {
+        _format = DATASET_IDX;
+        if (!open_idx(labels_filename)) {
+            close();
+            return false;
+        }
+        _pos = IDX_IMAGES_HEADER;
+    }
+    else {
+        _format = DATASET_CSV;
+        _pos = 0;
+    }
+
+    return true;
+}
+
+bool DatasetReader::open_idx(const char* labels_filename) {
+
+    if (_images.size() < IDX_IMAGES_HEADER) {
+        fprintf(stderr, "'%s' is not an IDX images file\n", _filename.c_str());
+        return false;
+    }
+    const unsigned char* header = _images.data();
+    _count = read_be32(header + 4);
+    if (read_be32(header + 8) != DATASET_IMAGE_LEN || read_be32(header + 12) != DATASET_IMAGE_LEN
+        || IDX_IMAGES_HEADER + _count * DATASET_IMAGE_LEN * DATASET_IMAGE_LEN > _images.size()) {
+        fprintf(stderr, "'%s' does not hold %dx%d images\n", _filename.c_str(), DATASET_IMAGE_LEN, DATASET_IMAGE_LEN);
+        return false;
+    }
+
+    std::string labels;
+    if (labels_filename != nullptr) {
+        labels = labels_filename;
+    }
+    else {
+        // t10k-images-idx3-ubyte -> t10k-labels-idx1-ubyte (also for the "images.idx3" spelling)
+        labels = _filename;
+        size_t at = labels.rfind("images");
+        if (at == std::string::npos || at + 11 > labels.size() || labels.compare(at + 7, 4, "idx3") != 0) {
+            fprintf(stderr, "cannot find the labels file of '%s'\n", _filename.c_str());
+            return false;
+        }
+        labels.replace(at, 6, "labels");
+        labels.replace(at + 7, 4, "idx1");
+    }
+
+    if (!_labels.open(labels.c_str(), true))
+        return false;
+    if (_labels.size() < IDX_LABELS_HEADER || read_be32(_labels.data()) != IDX_LABELS_MAGIC
+        || read_be32(_labels.data() + 4) != _count || IDX_LABELS_HEADER + _count > _labels.size()) {
+        fprintf(stderr, "'%s' is not an IDX labels file for the %d images of '%s'\n", labels.c_str(), (int)_count, _filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void DatasetReader::close() {
+    _images.close();
+    _labels.close();
+    _pos = 0;
+    _count = 0;
+    _index = 0;
+    _record = 0;
+    _row = 0;
+    _released = 0;
+}
+
+bool DatasetReader::next(ImageMap* image) {
+
+    if (!_images.is_open())
+        return false;
+
+    // the pixels go straight into the padded image
+    const int len = Lenet5Dims::IN_LEN;
+    unsigned char* data = image->data();
+    clear_padding(data);
+    char label;
+    if (!next_pixels(data + DATASET_PADDING * len + DATASET_PADDING, len, label))
+        return false;
+    image->set_label(label);
+    return true;
+}
+
+bool DatasetReader::next_raw(unsigned char* pixels, char& label) {
+
+    if (!_images.is_open())
+        return false;
+    return next_pixels(pixels, DATASET_IMAGE_LEN, label);
+}
+
+bool DatasetReader::next_pixels(unsigned char* dst, int stride, char& label) {
+
+    bool read = (_format == DATASET_IDX) ? next_idx(dst, stride, label) : next_csv(dst, stride, label);
+    if (read) {
+        ++_index;
+        release_consumed();
+    }
+    return read;
+}
+
+bool DatasetReader::next_idx(unsigned char* dst, int stride, char& label) {
+
+    if (_index >= _count)
+        return false;
+
+    const unsigned char* pixels = _images.data() + _pos;
+    for (int i = 0; i < DATASET_IMAGE_LEN; ++i)
+        memcpy(dst + i * stride, pixels + i * DATASET_IMAGE_LEN, DATASET_IMAGE_LEN);
+    label = (char)('0' + _labels.data()[IDX_LABELS_HEADER + _index]);
+    _pos += DATASET_IMAGE_LEN * DATASET_IMAGE_LEN;
+    ++_record;
+
+    return true;
+}
+
+bool DatasetReader::next_csv(unsigned char* dst, int stride, char& label) {
+
+    const char* text = (const char*)_images.data();
+    const char* end = text + _images.size();
+
+    for (;;) {
+        const char* p = text + _pos;
+        // skip empty lines
+        while (p < end && (*p == '\n' || *p == '\r')) {
+            _row += (*p == '\n');
+            ++p;
+        }
+        if (p == end) {
+            _pos = _images.size();
+            return false;
+        }
+
+        // label: first character of the first field
+        label = *p;
+        while (p < end && *p != ',' && *p != '\n')
+            ++p;
+
+        // pixels, row by row
+        int count = 0;
+        unsigned char* row = dst;
+        int col = 0;
+        while (p < end && *p == ',') {
+            ++p;
+            int value = 0;
+            while (p < end && (unsigned)(*p - '0') < 10) {
+                value = value * 10 + (*p - '0');
+                ++p;
+            }
+            if (count < DATASET_IMAGE_LEN * DATASET_IMAGE_LEN) {
+                row[col] = (unsigned char)((value > 255) ? 255 : value);
+                if (++col == DATASET_IMAGE_LEN) {
+                    row += stride;
+                    col = 0;
+                }
+            }
+            ++count;
+        }
+
+        // rest of the line (e.g. "\r")
+        while (p < end && *p != '\n')
+            ++p;
+        if (p < end)
+            ++p;
+        _pos = p - text;
+        ++_row;
+        ++_record;
+
+        if (count == DATASET_IMAGE_LEN * DATASET_IMAGE_LEN)
+            return true;
+        fprintf(stderr, "%s:%d: expected %d pixels, found %d; skipping the row\n", _filename.c_str(), (int)_row,
+            DATASET_IMAGE_LEN * DATASET_IMAGE_LEN, count);
+    }
+}
+
+void pad_dataset_image(const unsigned char* pixels, unsigned char* padded) {
+
+    const int len = Lenet5Dims::IN_LEN;
+    clear_padding(padded);
+    for (int i = 0; i < DATASET_IMAGE_LEN; ++i)
+        memcpy(padded + (i + DATASET_PADDING) * len + DATASET_PADDING, pixels + i * DATASET_IMAGE_LEN, DATASET_IMAGE_LEN);
+}
+
+bool read_dataset(std::vector<ImageMap*>& images, const char* filename, Arena& arena) {
+
+    DatasetReader reader;
+    if (!reader.open(filename))
+        return false;
+
+    const int pixels = Lenet5Dims::IN_LEN * Lenet5Dims::IN_LEN;
+    ImageMap image(Lenet5Dims::IN_LEN);
+    while (reader.next(&image)) {
+        unsigned char* data = arena.allocate_array<unsigned char>(pixels);
+        memcpy(data, image.data(), pixels);
+        images.push_back(new (arena.allocate(sizeof(ImageMap), alignof(ImageMap)))
+            ImageMap(data, Lenet5Dims::IN_LEN, image.get_label()));
+    }
+
+    return true;
+}
+
+bool read_report_images(std::vector<ImageMap*>& images, Arena& arena, const char* dataset_path) {
+
+    if (dataset_path != nullptr)
+        read_dataset(images, dataset_path, arena);
+    else {
+        read_dataset(images, "./dataset/test_dataset.csv", arena);
+        read_dataset(images, "./dataset/test_dataset_2.csv", arena);
+    }
+    if (images.empty()) {
+        fprintf(stderr, "no images to run\n");
+        return false;
+    }
+    return true;
+}
+
+std::vector<ImageMap*> cycle_images(const std::vector<ImageMap*>& images, size_t count) {
+
+    std::vector<ImageMap*> cycled;
+    for (size_t b = 0; b < count && !images.empty(); ++b)
+        cycled.push_back(images[b % images.size()]);
+    return cycled;
+}
+
+size_t DatasetReader::num_records() const {
+
+    if (!_images.is_open())
+        return 0;
+    if (_format == DATASET_IDX)
+        return _count;
+
+    // non-empty lines, like next_csv
+    const char* text = (const char*)_images.data();
+    const char* end = text + _images.size();
+    size_t records = 0;
+    for (const char* p = text; p < end; ) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        const char* next = (eol != nullptr) ? eol + 1 : end;
+        if (p < next && *p != '\n' && *p != '\r')
+            ++records;
+        p = next;
+    }
+    return records;
+}
+
+uint64_t DatasetReader::fingerprint() const {
+
+    uint64_t size = _images.size();
+    uint64_t hash = ModelFile::checksum(&size, sizeof(size));
+    return ModelFile::checksum(_images.data(), (_images.size() < 65536) ? _images.size() : 65536, hash);
+}
+
+bool DatasetReader::skip(size_t numRecords) {
+
+    if (!_images.is_open())
+        return false;
+
+    if (_format == DATASET_IDX) {
+        if (numRecords > _count - _index)
+            return false;
+        _index += numRecords;
+        _record += numRecords;
+        _pos += numRecords * DATASET_IMAGE_LEN * DATASET_IMAGE_LEN;
+    }
+    else {
+        const char* text = (const char*)_images.data();
+        const char* end = text + _images.size();
+        for (size_t r = 0; r < numRecords; ++r) {
+            const char* p = text + _pos;
+            while (p < end && (*p == '\n' || *p == '\r')) {
+                _row += (*p == '\n');
+                ++p;
+            }
+            if (p == end) {
+                _pos = _images.size();
+                return false;
+            }
+            const char* eol = (const char*)memchr(p, '\n', end - p);
+            _pos = (eol != nullptr) ? eol + 1 - text : _images.size();
+            ++_row;
+            ++_record;
+        }
+    }
+    release_consumed();
+    return true;
+}
+
+void DatasetReader::release_consumed() {
+
+    if (_pos - _released < DATASET_RELEASE_BYTES)
+        return;
+    _images.release(_released, _pos);
+    _released = _pos;
+}
+
+ImageRing::ImageRing(int numSlots) : _busy(numSlots > 0 ? numSlots : 1, false), _next(0) {
+    for (int i = 0; i < (int)_busy.size(); ++i)
+        _slots.push_back(std::unique_ptr<ImageMap>(new ImageMap(Lenet5Dims::IN_LEN)));
+}
+
+int ImageRing::acquire() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    int slot = (int)(_next % _slots.size());
+    _freed.wait(lock, [this, slot] { return !_busy[slot]; });
+    _busy[slot] = true;
+    ++_next;
+    return slot;
+}
+
+void ImageRing::release(int slot) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _busy[slot] = false;
+    }
+    _freed.notify_all();
+}
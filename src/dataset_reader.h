@@ -0,0 +1,122 @@
+#ifndef DATASET_READER_H
+#define DATASET_READER_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "imagemap.h"
+#include "mapped_file.h"
+#include "arena.h"
+
+// Streaming reader of a digit dataset, one zero-padded 32x32 image at a time
+//
+// CSV:       one image per row, "label,p0,p1,...,p783" (28x28 pixels, row-major)
+// MNIST IDX: an images file (magic 0x00000803, then big-endian n, 28, 28 and n x 28 x 28 bytes)
+//            and its labels file (magic 0x00000801, then n and n bytes),
+//            e.g. t10k-images-idx3-ubyte and t10k-labels-idx1-ubyte
+//
+// The files are memory-mapped and parsed in place. Pages behind the read position are
+// handed back to the OS as the reader moves on, so datasets larger than RAM can be streamed.
+
+#define DATASET_IMAGE_LEN 28
+#define DATASET_PADDING 2   // zero border around each image: 28x28 -> 32x32
+#define DATASET_RELEASE_BYTES (1 << 20)     // consumed bytes released to the OS at a time
+
+enum DatasetFormat {
+    DATASET_CSV,
+    DATASET_IDX
+};
+
+class DatasetReader {
+private:
+    MappedFile _images;
+    MappedFile _labels;     // IDX only
+    DatasetFormat _format;
+    std::string _filename;
+    size_t _pos;            // offset of the next row / image in _images
+    size_t _count;          // IDX: number of images
+    size_t _index;          // number of images read so far
+    size_t _record;         // number of records (IDX images / non-empty CSV rows) read or skipped so far
+    size_t _row;            // CSV: line number of the next row, for messages
+    size_t _released;       // bytes of _images already released
+
+    bool open_idx(const char* labels_filename);
+    // the 28 x 28 pixels of the next image, rows stride bytes apart
+    bool next_pixels(unsigned char* dst, int stride, char& label);
+    bool next_csv(unsigned char* dst, int stride, char& label);
+    bool next_idx(unsigned char* dst, int stride, char& label);
+    void release_consumed();
+
+    // not copyable, owns the mappings
+    DatasetReader(const DatasetReader&);
+    DatasetReader& operator=(const DatasetReader&);
+
+public:
+    DatasetReader();
+
+    // maps a CSV or IDX images file (detected from its contents)
+    // the IDX labels file defaults to the images file name with "images-idx3" replaced by "labels-idx1"
+    bool open(const char* filename, const char* labels_filename = nullptr);
+    void close();
+
+    DatasetFormat format() const { return _format; }
+    // number of images read so far
+    size_t count() const { return _index; }
+    // number of records read or skipped so far: the record index of the next image
+    // (records are the images of an IDX file or the non-empty rows of a CSV file, malformed rows included)
+    size_t record() const { return _record; }
+
+    // number of records in the whole dataset (CSV: scans the file once)
+    size_t num_records() const;
+    // checksum of the size and the first 64 KB of the images file, to tell datasets apart without reading them
+    uint64_t fingerprint() const;
+
+    // reads the next image and its label into image (32x32, padding included), skipping malformed rows
+    // returns false at the end of the dataset
+    bool next(ImageMap* image);
+    // the same without the padding: 28 x 28 pixels (see pad_dataset_image)
+    bool next_raw(unsigned char* pixels, char& label);
+    // moves past the next numRecords records without decoding them; returns false at the end of the dataset
+    bool skip(size_t numRecords);
+};
+
+// 28 x 28 pixels -> the zero-padded 32 x 32 network input
+void pad_dataset_image(const unsigned char* pixels, unsigned char* padded);
+
+// reads a whole dataset (CSV or MNIST IDX) into memory; the images and their pixels are carved from arena,
+// so they are freed with it (not deleted one by one)
+bool read_dataset(std::vector<ImageMap*>& images, const char* filename, Arena& arena);
+// the images of the reports (lenet5 int8, conv, half, ...): the dataset at dataset_path, or by default
+// ./dataset/test_dataset.csv and ./dataset/test_dataset_2.csv; false, with a message, if there are none
+bool read_report_images(std::vector<ImageMap*>& images, Arena& arena, const char* dataset_path = nullptr);
+// count images taken from images in order, starting over at the end (e.g. a full batch tile to time)
+std::vector<ImageMap*> cycle_images(const std::vector<ImageMap*>& images, size_t count);
+
+// Fixed ring of reusable images between the thread reading a dataset and the workers running inference.
+// Slots are handed out in ring order; a slot is reused only after the image it last held was released,
+// so at most size() images are in memory no matter how large the dataset is.
+class ImageRing {
+private:
+    std::vector<std::unique_ptr<ImageMap>> _slots;
+    std::vector<bool> _busy;
+    size_t _next;           // sequence number of the next image
+    std::mutex _mutex;
+    std::condition_variable _freed;
+
+    ImageRing(const ImageRing&);
+    ImageRing& operator=(const ImageRing&);
+
+public:
+    explicit ImageRing(int numSlots);
+
+    int size() const { return (int)_slots.size(); }
+    ImageMap* image(int slot) { return _slots[slot].get(); }
+
+    // slot of the next image (sequence number % size()), waits until that slot is released
+    int acquire();
+    void release(int slot);
+};
+
+#endif
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include "fast_conv.h"
+#include "lenet5.h"
+#include "dataset_reader.h"
+
+#define CONV_KERNEL 5   // every convolution layer of LeNet-5 uses 5x5 kernels
+
+const char* conv_algorithm_name(int algorithm) {
+    switch (algorithm) {
+    case CONV_DIRECT: return "direct";
+    case CONV_WINOGRAD_2X2: return "winograd2";
+    case CONV_WINOGRAD_4X4: return "winograd4";
+    case CONV_FFT: return "fft";
+    default: return "?";
+    }
+}
+
+bool parse_conv_algorithm(const char* name, ConvAlgorithm& algorithm) {
+    for (int a = 0; a < CONV_ALGORITHM_COUNT; ++a) {
+        if (strcmp(name, conv_algorithm_name(a)) == 0) {
+            algorithm = (ConvAlgorithm)a;
+            return true;
+        }
+    }
+    return false;
+}
+
+FastConv* create_fast_conv(ConvAlgorithm algorithm, const float* kernels, const float* bias,
+    int numOutputs, int numInputs, int inLength)
+{
+    switch (algorithm) {
+    case CONV_WINOGRAD_2X2: return new WinogradConv<2>(kernels, bias, numOutputs, numInputs, inLength);
+    case CONV_WINOGRAD_4X4: return new WinogradConv<4>(kernels, bias, numOutputs, numInputs, inLength);
+    case CONV_FFT: return new FftConv(kernels, bias, numOutputs, numInputs, inLength);
+    default: return nullptr;
+    }
+}
+
+
+// Winograd
+
+// Y = T X T^T for a Rows x Cols matrix T and a Cols x Cols matrix X (Y is Rows x Rows)
+template<int Rows, int Cols, class Real>
+static inline void transform(const Real* T, const Real* X, Real* Y) {
+
+    Real tmp[Rows * Cols];
+    for (int i = 0; i < Rows; ++i) {
+        for (int j = 0; j < Cols; ++j) {
+            Real sum = 0;
+            for (int k = 0; k < Cols; ++k)
+                sum += T[i * Cols + k] * X[k * Cols + j];
+            tmp[i * Cols + j] = sum;
+        }
+    }
+    for (int i = 0; i < Rows; ++i) {
+        for (int j = 0; j < Rows; ++j) {
+            Real sum = 0;
+            for (int k = 0; k < Cols; ++k)
+                sum += tmp[i * Cols + k] * T[j * Cols + k];
+            Y[i * Rows + j] = sum;
+        }
+    }
+}
+
+// Toom-Cook matrices of the 1-D correlation F(m, r): y = AT [(G g) . (BT d)], with alpha = m + r - 1
+// The linear convolution s = u * g (u of length m) is evaluated at alpha - 1 points and infinity:
+//  s = C [(G g) . (A u)], A[j][i] = p_j^i, G[j][k] = p_j^k / f_j, f_j = prod over l != j of (p_j - p_l)
+//  C[., j] = coefficients of prod over l != j of (x - p_l), C[., alpha - 1] = coefficients of prod over all l of (x - p_l)
+// and the correlation is its transpose: AT = A^T, BT = C^T
+static void winograd_matrices(int m, int r, double* AT, double* G, double* BT) {
+
+    const double points[] = { 0.0, 1.0, -1.0, 2.0, -2.0, 0.5, -0.5, 4.0, -4.0 };
+    int alpha = m + r - 1;
+    int numPoints = alpha - 1;
+
+    for (int j = 0; j < alpha; ++j) {
+        // coefficients of prod over the points l != j (all of them for the point at infinity)
+        double poly[16] = { 1.0 };
+        int degree = 0;
+        for (int l = 0; l < numPoints; ++l) {
+            if (l == j)
+                continue;
+            for (int i = degree + 1; i > 0; --i)
+                poly[i] = poly[i - 1] - points[l] * poly[i];
+            poly[0] = -points[l] * poly[0];
+            ++degree;
+        }
+        for (int i = 0; i < alpha; ++i)
+            BT[j * alpha + i] = (i <= degree) ? poly[i] : 0.0;
+
+        if (j == numPoints) {
+            // infinity: the leading coefficients
+            for (int i = 0; i < m; ++i)
+                AT[i * alpha + j] = (i == m - 1) ? 1.0 : 0.0;
+            for (int k = 0; k < r; ++k)
+                G[j * r + k] = (k == r - 1) ? 1.0 : 0.0;
+            continue;
+        }
+
+        double f = 1.0;
+        for (int l = 0; l < numPoints; ++l) {
+            if (l != j)
+                f *= points[j] - points[l];
+        }
+        for (int i = 0; i < m; ++i)
+            AT[i * alpha + j] = pow(points[j], i);
+        for (int k = 0; k < r; ++k)
+            G[j * r + k] = pow(points[j], k) / f;
+    }
+}
+
+template<int TileSize>
+WinogradConv<TileSize>::WinogradConv(const float* kernels, const float* bias, int numOutputs, int numInputs, int inLength) :
+    numOutputs(numOutputs), numInputs(numInputs), inLength(inLength), outLength(inLength - CONV_KERNEL + 1),
+    U(1, ALPHA * ALPHA, numOutputs, numInputs), bias(bias, bias + numOutputs)
+{
+    const int KSIZE = CONV_KERNEL * CONV_KERNEL;
+    tilesPerRow = (outLength + TileSize - 1) / TileSize;
+
+    double at[TileSize * ALPHA], g[ALPHA * CONV_KERNEL], bt[ALPHA * ALPHA];
+    winograd_matrices(TileSize, CONV_KERNEL, at, g, bt);
+    for (int i = 0; i < TileSize * ALPHA; ++i)
+        AT[i] = (float)at[i];
+    for (int i = 0; i < ALPHA * ALPHA; ++i)
+        BT[i] = (float)bt[i];
+
+    // U[xi][k][c] = (G g G^T)[xi], transformed in double
+    for (int k = 0; k < numOutputs; ++k) {
+        for (int c = 0; c < numInputs; ++c) {
+            double kernel[KSIZE], u[ALPHA * ALPHA];
+            for (int i = 0; i < KSIZE; ++i)
+                kernel[i] = kernels[(k * numInputs + c) * KSIZE + i];
+            transform<ALPHA, CONV_KERNEL>(g, kernel, u);
+            for (int xi = 0; xi < ALPHA * ALPHA; ++xi)
+                U[(xi * numOutputs + k) * numInputs + c] = (float)u[xi];
+        }
+    }
+}
+
+// dst = init + sum of coefs[i] * src[i * srcStride] over the count sources with a non-zero coefficient
+// (rows of Length floats); the sum is kept in a local array so the compiler keeps it in vector registers
+template<int Length>
+static inline void combine_rows(float* dst, float init, const float* coefs, int coefStride, int count,
+    const float* src, int srcStride)
+{
+    float acc[Length];
+    for (int t = 0; t < Length; ++t)
+        acc[t] = init;
+    for (int i = 0; i < count; ++i) {
+        float coef = coefs[i * coefStride];
+        if (coef == 0.f)
+            continue;
+        const float* row = src + i * srcStride;
+        for (int t = 0; t < Length; ++t)
+            acc[t] += coef * row[t];
+    }
+    memcpy(dst, acc, Length * sizeof(float));
+}
+
+template<int TileSize>
+void WinogradConv<TileSize>::run(const float* in, int numImages, float* out, bool relu, FastConvScratch& scratch) const {
+
+    const int ELEMS = ALPHA * ALPHA;
+    int tilesPerImage = tilesPerRow * tilesPerRow;
+    int numTiles = numImages * tilesPerImage;
+
+    // V: ELEMS x numInputs x TILE_BLOCK, M: ELEMS x numOutputs x TILE_BLOCK
+    // d, tmp: ELEMS x TILE_BLOCK tiles being transformed
+    // every transform works on a whole block of tiles at once, so its inner loops run over the tiles
+    // (a constant count: the last block is padded with zero tiles) and skip the coefficients that are 0
+    scratch.input.init(1, ELEMS, numInputs, TILE_BLOCK);
+    scratch.product.init(1, ELEMS, numOutputs, TILE_BLOCK);
+    scratch.work.init(1, 2, ELEMS, TILE_BLOCK);
+    float* V = scratch.input.data();
+    float* M = scratch.product.data();
+    float* d = scratch.work.plane(0, 0);
+    float* tmp = scratch.work.plane(0, 1);
+
+    for (int t0 = 0; t0 < numTiles; t0 += TILE_BLOCK) {
+        int nt = (numTiles - t0 < TILE_BLOCK) ? numTiles - t0 : TILE_BLOCK;
+
+        // input transform: BT d B of every ALPHA x ALPHA input tile (zero beyond the map)
+        for (int c = 0; c < numInputs; ++c) {
+            for (int t = 0; t < TILE_BLOCK; ++t) {
+                int b = (t0 + t) / tilesPerImage;
+                int ty = (t0 + t) % tilesPerImage / tilesPerRow;
+                int tx = (t0 + t) % tilesPerRow;
+                const float* map = in + (c * numImages + b) * inLength * inLength;
+                for (int i = 0; i < ALPHA; ++i) {
+                    int y = ty * TileSize + i;
+                    for (int j = 0; j < ALPHA; ++j) {
+                        int x = tx * TileSize + j;
+                        d[(i * ALPHA + j) * TILE_BLOCK + t] = (t < nt && y < inLength && x < inLength) ? map[y * inLength + x] : 0.f;
+                    }
+                }
+            }
+
+            // tmp = BT d, then V = tmp B
+            for (int a = 0; a < ALPHA; ++a) {
+                for (int j = 0; j < ALPHA; ++j)
+                    combine_rows<TILE_BLOCK>(tmp + (a * ALPHA + j) * TILE_BLOCK, 0.f, BT + a * ALPHA, 1, ALPHA, d + j * TILE_BLOCK, ALPHA * TILE_BLOCK);
+            }
+            for (int a = 0; a < ALPHA; ++a) {
+                for (int b = 0; b < ALPHA; ++b)
+                    combine_rows<TILE_BLOCK>(V + ((a * ALPHA + b) * numInputs + c) * TILE_BLOCK, 0.f, BT + b * ALPHA, 1, ALPHA, tmp + a * ALPHA * TILE_BLOCK, TILE_BLOCK);
+            }
+        }
+
+        // element-wise products, summed over the input maps: M[xi] = U[xi] V[xi], an (outputs x inputs) * (inputs x tiles) GEMM
+        // with few inputs, skipping the zero kernels of unconnected maps
+        for (int xi = 0; xi < ELEMS; ++xi) {
+            for (int k = 0; k < numOutputs; ++k) {
+                combine_rows<TILE_BLOCK>(M + (xi * numOutputs + k) * TILE_BLOCK, 0.f, U.data() + (xi * numOutputs + k) * numInputs, 1, numInputs,
+                    V + xi * numInputs * TILE_BLOCK, TILE_BLOCK);
+            }
+        }
+
+        // output transform: tmp = AT m, then d = bias + tmp A, cropped at the edge of the map
+        for (int k = 0; k < numOutputs; ++k) {
+            for (int i = 0; i < TileSize; ++i) {
+                for (int b = 0; b < ALPHA; ++b)
+                    combine_rows<TILE_BLOCK>(tmp + (i * ALPHA + b) * TILE_BLOCK, 0.f, AT + i * ALPHA, 1, ALPHA, M + (b * numOutputs + k) * TILE_BLOCK, ALPHA * numOutputs * TILE_BLOCK);
+            }
+            for (int i = 0; i < TileSize; ++i) {
+                for (int j = 0; j < TileSize; ++j)
+                    combine_rows<TILE_BLOCK>(d + (i * TileSize + j) * TILE_BLOCK, bias[k], AT + j * ALPHA, 1, ALPHA, tmp + i * ALPHA * TILE_BLOCK, TILE_BLOCK);
+            }
+
+            for (int t = 0; t < nt; ++t) {
+                int b = (t0 + t) / tilesPerImage;
+                int ty = (t0 + t) % tilesPerImage / tilesPerRow;
+                int tx = (t0 + t) % tilesPerRow;
+                float* map = out + (k * numImages + b) * outLength * outLength;
+                for (int i = 0; i < TileSize && ty * TileSize + i < outLength; ++i) {
+                    for (int j = 0; j < TileSize && tx * TileSize + j < outLength; ++j) {
+                        float value = d[(i * TileSize + j) * TILE_BLOCK + t];
+                        map[(ty * TileSize + i) * outLength + tx * TileSize + j] = (relu && value < 0.f) ? 0.f : value;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template class WinogradConv<2>;
+template class WinogradConv<4>;
+
+
+// FFT
+
+FftConv::FftConv(const float* kernels, const float* bias, int numOutputs, int numInputs, int inLength) :
+    numOutputs(numOutputs), numInputs(numInputs), inLength(inLength), outLength(inLength - CONV_KERNEL + 1),
+    bias(bias, bias + numOutputs)
+{
+    const int KSIZE = CONV_KERNEL * CONV_KERNEL;
+
+    // a circular correlation of size N >= inLength equals the valid linear one on the first outLength outputs
+    size = 2;
+    while (size < inLength)
+        size *= 2;
+    half = size / 2 + 1;
+
+    int bits = 0;
+    while ((1 << bits) < size)
+        ++bits;
+    bit_reverse.resize(size);
+    for (int i = 0; i < size; ++i) {
+        int r = 0;
+        for (int b = 0; b < bits; ++b)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        bit_reverse[i] = r;
+    }
+    twiddle_re.resize(size / 2);
+    twiddle_im.resize(size / 2);
+    for (int j = 0; j < size / 2; ++j) {
+        double angle = -2.0 * 3.14159265358979323846 * j / size;
+        twiddle_re[j] = (float)cos(angle);
+        twiddle_im[j] = (float)sin(angle);
+    }
+
+    // the kernels are numOutputs * numInputs maps of one image, so their spectra come out as
+    // (frequency) x (output) x (input); correlating with g is multiplying by the conjugate of its spectrum
+    int numKernels = numOutputs * numInputs;
+    kernels_re.init(1, size, half, numKernels);
+    kernels_im.init(1, size, half, numKernels);
+    std::vector<float> work(2 * size * numKernels);
+    forward(kernels, numKernels, 1, 0, 1, 1, CONV_KERNEL, kernels_re.data(), kernels_im.data(), &work[0]);
+    for (size_t s = 0; s < kernels_im.size(); ++s)
+        kernels_im[s] = -kernels_im[s];
+
+    connected.assign(numKernels, 0);
+    for (int kc = 0; kc < numKernels; ++kc) {
+        for (int i = 0; i < KSIZE; ++i)
+            connected[kc] |= (kernels[kc * KSIZE + i] != 0.f);
+    }
+}
+
+// radix-2 butterflies (a, b) <- (a + w b, a - w b) on Length lanes, through local arrays so they stay in vector registers
+template<int Length>
+static inline void butterflies(float* ar, float* ai, float* br, float* bi, float wr, float wi) {
+
+    float xr[Length], xi[Length], yr[Length], yi[Length];
+    memcpy(xr, ar, Length * sizeof(float));
+    memcpy(xi, ai, Length * sizeof(float));
+    memcpy(yr, br, Length * sizeof(float));
+    memcpy(yi, bi, Length * sizeof(float));
+    for (int l = 0; l < Length; ++l) {
+        float tr = yr[l] * wr - yi[l] * wi;
+        float ti = yr[l] * wi + yi[l] * wr;
+        yr[l] = xr[l] - tr;
+        yi[l] = xi[l] - ti;
+        xr[l] += tr;
+        xi[l] += ti;
+    }
+    memcpy(ar, xr, Length * sizeof(float));
+    memcpy(ai, xi, Length * sizeof(float));
+    memcpy(br, yr, Length * sizeof(float));
+    memcpy(bi, yi, Length * sizeof(float));
+}
+
+void FftConv::fft(float* re, float* im, int stride, int lanes, bool inverse) const {
+
+    for (int i = 0; i < size; ++i) {
+        int j = bit_reverse[i];
+        if (i >= j)
+            continue;
+        for (int l = 0; l < lanes; ++l) {
+            float t = re[i * stride + l]; re[i * stride + l] = re[j * stride + l]; re[j * stride + l] = t;
+            t = im[i * stride + l]; im[i * stride + l] = im[j * stride + l]; im[j * stride + l] = t;
+        }
+    }
+
+    for (int len = 2; len <= size; len *= 2) {
+        int h = len / 2;
+        int step = size / len;
+        for (int i = 0; i < size; i += len) {
+            for (int j = 0; j < h; ++j) {
+                float wr = twiddle_re[j * step];
+                float wi = inverse ? -twiddle_im[j * step] : twiddle_im[j * step];
+                float* ar = re + (i + j) * stride;
+                float* ai = im + (i + j) * stride;
+                float* br = re + (i + j + h) * stride;
+                float* bi = im + (i + j + h) * stride;
+                int l = 0;
+                for (; l + IMAGE_BLOCK <= lanes; l += IMAGE_BLOCK)
+                    butterflies<IMAGE_BLOCK>(ar + l, ai + l, br + l, bi + l, wr, wi);
+                for (; l < lanes; ++l)
+                    butterflies<1>(ar + l, ai + l, br + l, bi + l, wr, wi);
+            }
+        }
+    }
+}
+
+void FftConv::forward(const float* in, int numMaps, int numImages, int b0, int nb, int blockImages, int length,
+    float* re, float* im, float* work) const
+{
+    int lanes = numMaps * blockImages;
+    float* rowRe = work;
+    float* rowIm = work + size * lanes;
+
+    // rows: the first length rows are the map rows zero padded to N, the others are all zero
+    for (int i = 0; i < size; ++i) {
+        if (i >= length) {
+            memset(re + i * half * lanes, 0, half * lanes * sizeof(float));
+            memset(im + i * half * lanes, 0, half * lanes * sizeof(float));
+            continue;
+        }
+        for (int j = 0; j < size; ++j) {
+            for (int c = 0; c < numMaps; ++c) {
+                for (int b = 0; b < blockImages; ++b) {
+                    const float* map = in + (c * numImages + b0 + b) * length * length;
+                    rowRe[j * lanes + c * blockImages + b] = (j < length && b < nb) ? map[i * length + j] : 0.f;
+                }
+            }
+        }
+        memset(rowIm, 0, size * lanes * sizeof(float));
+        fft(rowRe, rowIm, lanes, lanes, false);
+        memcpy(re + i * half * lanes, rowRe, half * lanes * sizeof(float));
+        memcpy(im + i * half * lanes, rowIm, half * lanes * sizeof(float));
+    }
+
+    // columns
+    for (int v = 0; v < half; ++v)
+        fft(re + v * lanes, im + v * lanes, half * lanes, lanes, false);
+}
+
+void FftConv::inverse(float* re, float* im, int numImages, int b0, int nb, int blockImages, bool relu, float* out, float* work) const {
+
+    int lanes = numOutputs * blockImages;
+    float* rowRe = work;
+    float* rowIm = work + size * lanes;
+    float scale = 1.f / ((float)size * size);
+
+    // columns
+    for (int v = 0; v < half; ++v)
+        fft(re + v * lanes, im + v * lanes, half * lanes, lanes, true);
+
+    // rows of the output: the rows are real, so the missing half of each row spectrum
+    // is the conjugate of the stored one
+    for (int i = 0; i < outLength; ++i) {
+        memcpy(rowRe, re + i * half * lanes, half * lanes * sizeof(float));
+        memcpy(rowIm, im + i * half * lanes, half * lanes * sizeof(float));
+        for (int v = half; v < size; ++v) {
+            for (int l = 0; l < lanes; ++l) {
+                rowRe[v * lanes + l] = rowRe[(size - v) * lanes + l];
+                rowIm[v * lanes + l] = -rowIm[(size - v) * lanes + l];
+            }
+        }
+        fft(rowRe, rowIm, lanes, lanes, true);
+
+        for (int k = 0; k < numOutputs; ++k) {
+            for (int b = 0; b < nb; ++b) {
+                float* map = out + (k * numImages + b0 + b) * outLength * outLength;
+                for (int j = 0; j < outLength; ++j) {
+                    float value = rowRe[j * lanes + k * blockImages + b] * scale + bias[k];
+                    map[i * outLength + j] = (relu && value < 0.f) ? 0.f : value;
+                }
+            }
+        }
+    }
+}
+
+// y = sum over the connected inputs c of x[c * stride] * w[c] (complex), on Lanes images
+template<int Lanes>
+static inline void multiply_spectra(float* yRe, float* yIm, const float* xRe, const float* xIm, int stride,
+    const float* wRe, const float* wIm, const char* connected, int numInputs)
+{
+    float accRe[Lanes] = {}, accIm[Lanes] = {};
+    for (int c = 0; c < numInputs; ++c) {
+        if (!connected[c])
+            continue;
+        const float* xr = xRe + c * stride;
+        const float* xi = xIm + c * stride;
+        for (int b = 0; b < Lanes; ++b) {
+            accRe[b] += xr[b] * wRe[c] - xi[b] * wIm[c];
+            accIm[b] += xr[b] * wIm[c] + xi[b] * wRe[c];
+        }
+    }
+    memcpy(yRe, accRe, sizeof(accRe));
+    memcpy(yIm, accIm, sizeof(accIm));
+}
+
+void FftConv::run(const float* in, int numImages, float* out, bool relu, FastConvScratch& scratch) const {
+
+    const int SPECTRUM = size * half;
+    int maxMaps = (numInputs > numOutputs) ? numInputs : numOutputs;
+
+    // spectra of blocks of images: (frequency) x (map) x (image) for the inputs and the outputs,
+    // so the FFTs and the products run over all maps and images of the block at once
+    // (blocks of IMAGE_BLOCK images, the last one padded with zero images; fewer images are one smaller block)
+    int blockImages = (numImages < IMAGE_BLOCK) ? numImages : IMAGE_BLOCK;
+    scratch.input.init(2, SPECTRUM, numInputs, blockImages);
+    scratch.product.init(2, SPECTRUM, numOutputs, blockImages);
+    scratch.work.init(1, 2, size, maxMaps * blockImages);
+    float* xRe = scratch.input.plane(0, 0);
+    float* xIm = scratch.input.plane(1, 0);
+    float* yRe = scratch.product.plane(0, 0);
+    float* yIm = scratch.product.plane(1, 0);
+
+    for (int b0 = 0; b0 < numImages; b0 += blockImages) {
+        int nb = (numImages - b0 < blockImages) ? numImages - b0 : blockImages;
+
+        forward(in, numInputs, numImages, b0, nb, blockImages, inLength, xRe, xIm, scratch.work.data());
+
+        // Y[s][k] = sum over c of X[s][c] * conj(G[s][k][c])
+        for (int s = 0; s < SPECTRUM; ++s) {
+            for (int k = 0; k < numOutputs; ++k) {
+                const float* wr = kernels_re.data() + (s * numOutputs + k) * numInputs;
+                const float* wi = kernels_im.data() + (s * numOutputs + k) * numInputs;
+                float* yr = yRe + (s * numOutputs + k) * blockImages;
+                float* yi = yIm + (s * numOutputs + k) * blockImages;
+                const float* xr = xRe + s * numInputs * blockImages;
+                const float* xi = xIm + s * numInputs * blockImages;
+                if (blockImages == IMAGE_BLOCK) {
+                    multiply_spectra<IMAGE_BLOCK>(yr, yi, xr, xi, blockImages, wr, wi, &connected[k * numInputs], numInputs);
+                }
+                else {
+                    for (int b = 0; b < blockImages; ++b)
+                        multiply_spectra<1>(yr + b, yi + b, xr + b, xi + b, blockImages, wr, wi, &connected[k * numInputs], numInputs);
+                }
+            }
+        }
+
+        inverse(yRe, yIm, numImages, b0, nb, blockImages, relu, out, scratch.work.data());
+    }
+}
+
+void print_conv_usage() {
+    printf("usage: lenet5 conv [options]                compare the Winograd and FFT convolutions with the direct one\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -d dataset         CSV or MNIST IDX images file (default ./dataset/*.csv)\n");
+}
+
+bool parse_conv_args(int argc, char* argv[], ConvReportOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_conv_report(const ConvReportOptions& options) {
+
+    Arena imageArena;
+    std::vector<ImageMap*> images;
+    if (!read_report_images(images, imageArena, options.dataset_path))
+        return false;
+
+    typedef Lenet5Dims D;
+    Lenet5Model lenet5(options.model_path);
+    lenet5.set_conv_algorithm(LAYER_C1, CONV_DIRECT);
+    lenet5.set_conv_algorithm(LAYER_C3, CONV_DIRECT);
+    InferenceContext context;
+    const SimdKernels& simd = simd_kernels();
+
+    // inputs of C1 and C3 for a list of images, with the direct convolutions: (maps) x (images) x length x length
+    auto layer_inputs = [&](const std::vector<ImageMap*>& list, std::vector<float>& in, std::vector<float>& s2) {
+        int n = (int)list.size();
+        std::vector<float> c1(D::C1_MAPS * n * D::C1_LEN * D::C1_LEN);
+        in.resize(n * D::IN_LEN * D::IN_LEN);
+        s2.resize(D::C1_MAPS * n * D::S2_LEN * D::S2_LEN);
+        for (int b = 0; b < n; ++b) {
+            for (int i = 0; i < D::IN_LEN * D::IN_LEN; ++i)
+                in[b * D::IN_LEN * D::IN_LEN + i] = (float)list[b]->data()[i];
+        }
+        lenet5.convolution(LAYER_C1, &in[0], n, &c1[0], true, context);
+        for (int m = 0; m < D::C1_MAPS * n; ++m)
+            simd.max_pool_2x2(&c1[m * D::C1_LEN * D::C1_LEN], &s2[m * D::S2_LEN * D::S2_LEN], D::S2_LEN);
+    };
+    int numImages = (int)images.size();
+    std::vector<float> in, s2;
+    layer_inputs(images, in, s2);
+
+    // the times are measured on one batch of BATCH_TILE images (the dataset cycled)
+    std::vector<ImageMap*> tile = cycle_images(images, Lenet5Model::BATCH_TILE);
+    std::vector<float> tileIn, tileS2;
+    layer_inputs(tile, tileIn, tileS2);
+
+    std::vector<int> digits(numImages), reference(numImages);
+    lenet5.run_inference_batch(&images[0], numImages, &reference[0], context);
+
+    printf("convolution algorithm report (%d images, times on batches of %d)\n", numImages, (int)tile.size());
+    printf("  %-5s %-10s %12s %12s %9s %9s %10s\n", "layer", "algorithm", "max error", "rel. error", "agree", "correct", "us/image");
+
+    Lenet5Layer layers[] = { LAYER_C1, LAYER_C3 };
+    for (int l = 0; l < 2; ++l) {
+        Lenet5Layer layer = layers[l];
+        const float* layerIn = (layer == LAYER_C1) ? &in[0] : &s2[0];
+        int outSize = (layer == LAYER_C1) ? D::C1_MAPS * D::C1_LEN * D::C1_LEN : D::C3_MAPS * D::C3_LEN * D::C3_LEN;
+        std::vector<float> direct(outSize * numImages), out(outSize * numImages);
+        lenet5.convolution(layer, layerIn, numImages, &direct[0], false, context);
+
+        for (int a = 0; a < CONV_ALGORITHM_COUNT; ++a) {
+            lenet5.set_conv_algorithm(layer, (ConvAlgorithm)a);
+
+            // pre-activation outputs against the direct ones
+            lenet5.convolution(layer, layerIn, numImages, &out[0], false, context);
+            float maxError = 0.f, maxValue = 0.f;
+            for (size_t i = 0; i < out.size(); ++i) {
+                float error = fabsf(out[i] - direct[i]);
+                maxError = (error > maxError) ? error : maxError;
+                maxValue = (fabsf(direct[i]) > maxValue) ? fabsf(direct[i]) : maxValue;
+            }
+
+            // whole network with this layer changed
+            lenet5.run_inference_batch(&images[0], numImages, &digits[0], context);
+            int agree = 0, correct = 0;
+            for (int b = 0; b < numImages; ++b) {
+                agree += (digits[b] == reference[b]);
+                correct += (digits[b] == images[b]->get_label() - '0');
+            }
+
+            // the layer alone
+            const int passes = 50;
+            std::vector<float> tileOut(outSize * tile.size());
+            const float* tileLayerIn = (layer == LAYER_C1) ? &tileIn[0] : &tileS2[0];
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int p = 0; p < passes; ++p)
+                lenet5.convolution(layer, tileLayerIn, (int)tile.size(), &tileOut[0], true, context);
+            auto stop = std::chrono::high_resolution_clock::now();
+            double time = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() * 1e-3 / (passes * tile.size());
+
+            printf("  %-5s %-10s %12.3g %12.3g %4d / %-3d %4d / %-3d %8.2f\n", layer_name(layer), conv_algorithm_name(a),
+                maxError, maxError / maxValue, agree, numImages, correct, numImages, time);
+        }
+        lenet5.set_conv_algorithm(layer, CONV_DIRECT);
+    }
+    return true;
+}
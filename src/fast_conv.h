@@ -0,0 +1,124 @@
+#ifndef FAST_CONV_H
+#define FAST_CONV_H
+
+#include <vector>
+#include "tensor.h"
+
+// Alternative algorithms for the 5x5 convolution layers (C1 and C3)
+//
+// direct:      25 multiply-adds per output and input map (the fused kernels / im2col + GEMM)
+// winograd2:   Winograd F(2x2, 5x5): 6x6 input tiles -> 2x2 outputs, 36 products per 4 outputs (9 per output)
+// winograd4:   Winograd F(4x4, 5x5): 8x8 input tiles -> 4x4 outputs, 64 products per 16 outputs (4 per output)
+// fft:         2-D FFT of each input map (padded to a power of 2), products in the frequency domain,
+//              one inverse FFT per output map
+//
+// The kernels are transformed once, when the algorithm is selected; every algorithm computes
+// out = bias + sum over the input maps of the 5x5 correlation, exactly like the direct one
+// up to float rounding (the transforms are not exact; see "lenet5 conv" for the errors).
+
+enum ConvAlgorithm {
+    CONV_DIRECT = 0,
+    CONV_WINOGRAD_2X2,
+    CONV_WINOGRAD_4X4,
+    CONV_FFT,
+    CONV_ALGORITHM_COUNT
+};
+
+const char* conv_algorithm_name(int algorithm);
+// "direct", "winograd2", "winograd4" or "fft"
+bool parse_conv_algorithm(const char* name, ConvAlgorithm& algorithm);
+
+// scratch buffers of one thread (kept in its InferenceContext so they are only allocated once)
+struct FastConvScratch {
+    Tensor<float> input;    // transformed input tiles / spectra
+    Tensor<float> product;  // products before the output transform
+    Tensor<float> work;     // tiles / rows being transformed
+};
+
+// one convolution layer with pre-transformed kernels, immutable once constructed
+// maps are stored as in the batched network: (maps) x (images) x length x length
+class FastConv {
+public:
+    virtual ~FastConv() {}
+
+    // out[k][b] = bias[k] + sum over c of in[c][b] (*) kernels[k][c], for numImages images b
+    // relu: clamp the outputs at 0
+    virtual void run(const float* in, int numImages, float* out, bool relu, FastConvScratch& scratch) const = 0;
+};
+
+// kernels: numOutputs x numInputs x 5 x 5 (dense: zero kernels for input maps an output is not connected to)
+// returns nullptr for CONV_DIRECT
+FastConv* create_fast_conv(ConvAlgorithm algorithm, const float* kernels, const float* bias,
+    int numOutputs, int numInputs, int inLength);
+
+// Winograd F(TileSize x TileSize, 5x5)
+// the input transform of every tile is done once per input map, then each of the (TileSize + 4)^2
+// transformed elements is a (outputs x inputs) * (inputs x tiles) GEMM, then the output transform
+template<int TileSize>
+class WinogradConv : public FastConv {
+public:
+    static const int ALPHA = TileSize + 4;  // input tile length
+    static const int TILE_BLOCK = 16;       // tiles transformed and multiplied together (keeps the products in cache)
+
+private:
+    int numOutputs, numInputs, inLength, outLength;
+    int tilesPerRow;        // tiles along each side of an output map (the last ones are cropped)
+    float AT[TileSize * ALPHA];     // output transform
+    float BT[ALPHA * ALPHA];        // input transform
+    Tensor<float> U;        // transformed kernels: ALPHA^2 x numOutputs x numInputs
+    std::vector<float> bias;
+
+public:
+    WinogradConv(const float* kernels, const float* bias, int numOutputs, int numInputs, int inLength);
+
+    void run(const float* in, int numImages, float* out, bool relu, FastConvScratch& scratch) const;
+};
+
+// correlation through real 2-D FFTs of size N x N (N = inLength rounded up to a power of 2)
+// only the N x (N / 2 + 1) non-redundant half of each spectrum is stored and multiplied;
+// the spectra of all maps of a block of images are interleaved, so every FFT and product runs over all of them at once
+class FftConv : public FastConv {
+public:
+    static const int IMAGE_BLOCK = 16;  // images transformed together (at most)
+
+private:
+    int numOutputs, numInputs, inLength, outLength;
+    int size, half;     // N, N / 2 + 1
+    std::vector<float> twiddle_re, twiddle_im;  // exp(-2 pi i j / N), j < N / 2
+    std::vector<int> bit_reverse;
+    Tensor<float> kernels_re, kernels_im;   // conjugated kernel spectra: N x half x numOutputs x numInputs
+    std::vector<char> connected;    // false for all-zero kernels, which are skipped
+    std::vector<float> bias;
+
+    // in-place complex FFTs of length N (unscaled) along a dimension of the given stride, for lanes contiguous vectors
+    void fft(float* re, float* im, int stride, int lanes, bool inverse) const;
+    // half spectra of images [b0, b0 + nb) of numMaps length x length real maps (numMaps x numImages x length x length),
+    // zero padded to N x N and to blockImages images: re / im are N x half x numMaps x blockImages;
+    // work: 2 * N * numMaps * blockImages floats
+    void forward(const float* in, int numMaps, int numImages, int b0, int nb, int blockImages, int length,
+        float* re, float* im, float* work) const;
+    // inverse of N x half x numOutputs x blockImages half spectra (overwritten), scaled by 1 / N^2, plus bias:
+    // the first outLength x outLength values of each map are written for images [b0, b0 + nb) of out
+    void inverse(float* re, float* im, int numImages, int b0, int nb, int blockImages, bool relu, float* out, float* work) const;
+
+public:
+    FftConv(const float* kernels, const float* bias, int numOutputs, int numInputs, int inLength);
+
+    void run(const float* in, int numImages, float* out, bool relu, FastConvScratch& scratch) const;
+};
+
+struct ConvReportOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;   // nullptr: the two CSV files
+
+    ConvReportOptions() : model_path(nullptr), dataset_path(nullptr) {}
+};
+
+// parses the arguments of "lenet5 conv" (argv[0] is the first one after the command)
+bool parse_conv_args(int argc, char* argv[], ConvReportOptions& options);
+void print_conv_usage();
+
+// accuracy of each algorithm against the direct convolution, per layer and for the whole network, and its time
+bool run_conv_report(const ConvReportOptions& options);
+
+#endif
@@ -58,7 +58,7 @@ public:
         return ss.str();
     }
 
-    friend class Lenet5;
+    friend class Lenet5Model;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,190 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fixed-point formats and the integer operations of the fixed-point engine (see lenet5_fixed.h)
+//
+// Qm.n:       a two's complement word of 1 + m + n bits whose integer value v stands for v * 2^-n
+//             (m integer bits besides the sign, n fraction bits); either may be negative, e.g. Q-2.17 for weights
+//             below 0.25 or Q20.-4 for activations kept in steps of 16, as long as the word has 2 to 32 bits
+// rounding:   when fraction bits are dropped (an arithmetic right shift by s)
+//             trunc       floor, i.e. the bits are just dropped
+//             half_up     + 2^(s-1), then floor: nearest, ties towards +infinity
+//             half_even   nearest, ties to the even value (convergent rounding)
+// overflow:   when a value does not fit its word
+//             saturate    the largest / smallest value of the word
+//             wrap        the low bits (two's complement wrap-around, like a Verilog assignment to a narrower reg)
+//
+// Everything here is exact integer arithmetic: the results do not depend on the compiler, the CPU or the SIMD level.
+
+enum FixedRounding {
+    ROUND_TRUNC = 0,
+    ROUND_HALF_UP,
+    ROUND_HALF_EVEN,
+    ROUNDING_COUNT
+};
+
+enum FixedOverflow {
+    OVERFLOW_SATURATE = 0,
+    OVERFLOW_WRAP,
+    OVERFLOW_COUNT
+};
+
+inline const char* fixed_rounding_name(int rounding) {
+    switch (rounding) {
+    case ROUND_TRUNC: return "trunc";
+    case ROUND_HALF_UP: return "half_up";
+    case ROUND_HALF_EVEN: return "half_even";
+    default: return "?";
+    }
+}
+
+inline const char* fixed_overflow_name(int overflow) {
+    switch (overflow) {
+    case OVERFLOW_SATURATE: return "saturate";
+    case OVERFLOW_WRAP: return "wrap";
+    default: return "?";
+    }
+}
+
+// "trunc", "half_up" or "half_even"
+inline bool parse_fixed_rounding(const char* name, FixedRounding& rounding) {
+    for (int r = 0; r < ROUNDING_COUNT; ++r) {
+        if (strcmp(name, fixed_rounding_name(r)) == 0) {
+            rounding = (FixedRounding)r;
+            return true;
+        }
+    }
+    return false;
+}
+
+// "saturate" or "wrap"
+inline bool parse_fixed_overflow(const char* name, FixedOverflow& overflow) {
+    for (int o = 0; o < OVERFLOW_COUNT; ++o) {
+        if (strcmp(name, fixed_overflow_name(o)) == 0) {
+            overflow = (FixedOverflow)o;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct QFormat {
+    int int_bits;
+    int frac_bits;
+
+    QFormat() : int_bits(0), frac_bits(0) {}
+    QFormat(int intBits, int fracBits) : int_bits(intBits), frac_bits(fracBits) {}
+
+    int width() const { return 1 + int_bits + frac_bits; }
+    // fraction bits are limited so that the shifts between formats stay within 64 bits
+    bool valid() const { return width() >= 2 && width() <= 32 && frac_bits >= -31 && frac_bits <= 31; }
+    int64_t max_value() const { return ((int64_t)1 << (width() - 1)) - 1; }
+    int64_t min_value() const { return -((int64_t)1 << (width() - 1)); }
+    // the real value of the word v
+    double to_real(int64_t v) const { return ldexp((double)v, -frac_bits); }
+};
+
+// "Qm.n", e.g. "Q7.8" or "Q-2.17"
+inline bool parse_qformat(const char* text, QFormat& format) {
+    if (text[0] != 'Q' && text[0] != 'q')
+        return false;
+    char* end;
+    long m = strtol(text + 1, &end, 10);
+    if (end == text + 1 || *end != '.')
+        return false;
+    const char* fraction = end + 1;
+    long n = strtol(fraction, &end, 10);
+    if (end == fraction || *end != '\0')
+        return false;
+    QFormat parsed((int)m, (int)n);
+    if (!parsed.valid())
+        return false;
+    format = parsed;
+    return true;
+}
+
+// v narrowed to a width-bit word (width <= 64)
+inline int64_t fixed_narrow(int64_t v, int width, FixedOverflow overflow) {
+    if (width >= 64)
+        return v;
+    if (overflow == OVERFLOW_WRAP) {
+        // keep the low bits, then sign-extend from bit width - 1
+        uint64_t low = (uint64_t)v & (((uint64_t)1 << width) - 1);
+        uint64_t sign = (uint64_t)1 << (width - 1);
+        return (int64_t)(low ^ sign) - (int64_t)sign;
+    }
+    int64_t max = ((int64_t)1 << (width - 1)) - 1;
+    return (v > max) ? max : ((v < -max - 1) ? -max - 1 : v);
+}
+
+// a + b narrowed to a width-bit word (a and b fit in it)
+inline int64_t fixed_add(int64_t a, int64_t b, int width, FixedOverflow overflow) {
+    uint64_t sum = (uint64_t)a + (uint64_t)b;
+    if (overflow == OVERFLOW_WRAP)
+        return fixed_narrow((int64_t)sum, width, overflow);
+    if (width >= 64 && (a < 0) == (b < 0) && ((int64_t)sum < 0) != (a < 0))    // int64 overflow
+        return (a < 0) ? INT64_MIN : INT64_MAX;
+    return fixed_narrow((int64_t)sum, width, overflow);
+}
+
+// v * 2^-shift: a right shift rounded with the rounding mode, or a left shift that saturates to int64 or wraps
+// (the result is narrowed to its word afterwards, so both give what the infinitely wide shift would)
+inline int64_t fixed_shift(int64_t v, int shift, FixedRounding rounding, FixedOverflow overflow) {
+
+    if (shift > 0) {
+        if (shift >= 64)    // |v * 2^-shift| < 1/2
+            return (rounding == ROUND_TRUNC && v < 0) ? -1 : 0;
+        int64_t q = v >> shift;     // floor
+        if (rounding == ROUND_TRUNC)
+            return q;
+        uint64_t rest = (uint64_t)v & (((uint64_t)1 << shift) - 1);
+        uint64_t half = (uint64_t)1 << (shift - 1);
+        // without branches: the rest is random, so a branch would be mispredicted half the time
+        bool tieUp = (rounding == ROUND_HALF_UP) | ((q & 1) != 0);
+        return q + (int64_t)((rest > half) | ((rest == half) & tieUp));
+    }
+    if (shift < 0) {
+        int s = -shift;
+        if (overflow == OVERFLOW_WRAP)
+            return (s >= 64) ? 0 : (int64_t)((uint64_t)v << s);
+        if (v == 0)
+            return 0;
+        if (s >= 63)
+            return (v > 0) ? INT64_MAX : INT64_MIN;
+        int64_t limit = INT64_MAX >> s;
+        if (v > limit)
+            return INT64_MAX;
+        if (v < -limit - 1)
+            return INT64_MIN;
+        return (int64_t)((uint64_t)v << s);
+    }
+    return v;
+}
+
+// the real number x in a word of width bits (<= 64) with fracBits fraction bits, rounded with the rounding mode
+// and always saturated (for converting the float weights, which is done once, outside the RTL)
+inline int64_t fixed_from_real(double x, int fracBits, int width, FixedRounding rounding) {
+
+    double scaled = ldexp(x, fracBits);
+    double q = floor(scaled);
+    if (rounding != ROUND_TRUNC) {
+        double rest = scaled - q;
+        if (rest > 0.5 || (rest == 0.5 && (rounding == ROUND_HALF_UP || fmod(q, 2.0) != 0.0)))
+            q += 1.0;
+    }
+    if (q != q)     // NaN
+        return 0;
+    double max = ldexp(1.0, width - 1);
+    if (q >= max)
+        return (width >= 64) ? INT64_MAX : (int64_t)max - 1;
+    if (q <= -max)
+        return (width >= 64) ? INT64_MIN : -(int64_t)max;
+    return (int64_t)q;
+}
+
+#endif
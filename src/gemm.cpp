@@ -0,0 +1,308 @@
+#include <string.h>
+#include "gemm.h"
+#include "simd.h"
+#include "tensor.h"
+
+// cache blocking sizes
+#define GEMM_KC 256     // depth of the packed panels (a KC x NR panel of B stays in L1)
+#define GEMM_MC 120     // rows of A packed at once (20 panels, C5 in one block; stays in L2)
+#define GEMM_NC 512     // columns of B packed at once, a multiple of every sgemm_nr
+
+// the packed blocks of the calling thread, allocated by its first sgemm and reused by every later one,
+// so that inference does not allocate after its warm-up
+struct GemmScratch {
+    float* a;   // GEMM_MC x GEMM_KC
+    float* b;   // GEMM_KC x GEMM_NC
+
+    GemmScratch() : a(nullptr), b(nullptr) {}
+    ~GemmScratch() {
+        if (a != nullptr)
+            aligned_free(a);
+        if (b != nullptr)
+            aligned_free(b);
+    }
+};
+static thread_local GemmScratch gemm_scratch;
+
+static GemmScratch& get_gemm_scratch() {
+
+    GemmScratch& scratch = gemm_scratch;
+    if (scratch.a == nullptr) {
+        scratch.a = (float*)aligned_malloc(GEMM_MC * GEMM_KC * sizeof(float));
+        scratch.b = (float*)aligned_malloc(GEMM_KC * GEMM_NC * sizeof(float));
+    }
+    return scratch;
+}
+
+// packs the mc x kc block A into panels of GEMM_MR rows, a[p * GEMM_MR + r] = A[r][p],
+// padding the rows of the last panel with zeros so that every tile runs the full micro-kernel
+static void pack_a(int mc, int kc, const float* A, int lda, float* packed) {
+
+    for (int i = 0; i < mc; i += GEMM_MR, packed += kc * GEMM_MR) {
+        int mr = (mc - i < GEMM_MR) ? mc - i : GEMM_MR;
+        for (int r = 0; r < GEMM_MR; ++r) {
+            const float* row = A + (i + r) * lda;
+            float* dst = packed + r;
+            if (r < mr) {
+                for (int p = 0; p < kc; ++p)
+                    dst[p * GEMM_MR] = row[p];
+            }
+            else {
+                for (int p = 0; p < kc; ++p)
+                    dst[p * GEMM_MR] = 0.f;
+            }
+        }
+    }
+}
+
+// n consecutive floats of a row of B into a packed row of nr, the rest of which is zeroed
+static inline void pack_row(const float* src, int n, int nr, float* dst) {
+
+    memcpy(dst, src, n * sizeof(float));
+    for (int c = n; c < nr; ++c)
+        dst[c] = 0.f;
+}
+
+// the row of ones of B the bias column of a PackedMatrix is multiplied by
+static inline void pack_ones(int n, int nr, float* dst) {
+
+    for (int c = 0; c < nr; ++c)
+        dst[c] = (c < n) ? 1.f : 0.f;
+}
+
+// packs the kc x nc block B into panels of nr columns, b[p * nr + j] = B[p][j], zero-padding the last one
+static void pack_b(int kc, int nc, int nr, const float* B, int ldb, float* packed) {
+
+    for (int j = 0; j < nc; j += nr, packed += kc * nr) {
+        int n = (nc - j < nr) ? nc - j : nr;
+        for (int p = 0; p < kc; ++p)
+            pack_row(B + p * ldb + j, n, nr, packed + p * nr);
+    }
+}
+
+// the n <= nr columns of C of one packed panel b (kc x nr) times the mc packed rows of a (panels of kc x GEMM_MR)
+// load_c: add onto C; relu: clamp the finished sums at 0
+static void multiply_panel(const SimdKernels* simd, int mc, int n, int kc, const float* a, const float* b,
+    float* C, int ldc, bool load_c, bool relu)
+{
+    const int nr = simd->sgemm_nr;
+    for (int i = 0; i < mc; i += GEMM_MR, a += kc * GEMM_MR, C += GEMM_MR * ldc) {
+        int m = (mc - i < GEMM_MR) ? mc - i : GEMM_MR;
+        if (m == GEMM_MR && n == nr) {
+            simd->sgemm_kernel(kc, a, b, C, ldc, load_c, relu);
+            continue;
+        }
+        // edge tile: the padded panels give a full tile, of which m x n is stored
+        float tile[GEMM_MR * GEMM_NR_MAX];
+        if (load_c) {
+            for (int r = 0; r < GEMM_MR; ++r)
+                for (int q = 0; q < nr; ++q)
+                    tile[r * nr + q] = (r < m && q < n) ? C[r * ldc + q] : 0.f;
+        }
+        simd->sgemm_kernel(kc, a, b, tile, nr, load_c, relu);
+        for (int r = 0; r < m; ++r)
+            for (int q = 0; q < n; ++q)
+                C[r * ldc + q] = tile[r * nr + q];
+    }
+}
+
+void sgemm(int M, int N, int K,
+    const float* A, int lda,
+    const float* B, int ldb,
+    float* C, int ldc,
+    bool accumulate)
+{
+    if (K == 0) {
+        if (!accumulate) {
+            for (int i = 0; i < M; ++i)
+                for (int j = 0; j < N; ++j)
+                    C[i * ldc + j] = 0.f;
+        }
+        return;
+    }
+
+    const SimdKernels* simd = &simd_kernels();
+    const int nr = simd->sgemm_nr;
+    GemmScratch& scratch = get_gemm_scratch();
+
+    for (int jc = 0; jc < N; jc += GEMM_NC) {
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+
+        for (int pc = 0; pc < K; pc += GEMM_KC) {
+            int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            bool load_c = accumulate || pc > 0;   // later depth blocks add onto the partial sums
+            pack_b(kc, nc, nr, B + pc * ldb + jc, ldb, scratch.b);
+
+            for (int ic = 0; ic < M; ic += GEMM_MC) {
+                int mc = (M - ic < GEMM_MC) ? M - ic : GEMM_MC;
+                pack_a(mc, kc, A + ic * lda + pc, lda, scratch.a);
+
+                for (int j = 0; j < nc; j += nr) {
+                    int n = (nc - j < nr) ? nc - j : nr;
+                    multiply_panel(simd, mc, n, kc, scratch.a, scratch.b + j * kc, C + ic * ldc + jc + j, ldc,
+                        load_c, false);
+                }
+            }
+        }
+    }
+}
+
+void PackedMatrix::build(const float* A, int rows, int cols, int lda, const float* bias) {
+
+    this->rows = rows;
+    this->cols = cols;
+    int K = cols + 1;
+    int paddedRows = (rows + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+    values.assign((size_t)paddedRows * K, 0.f);
+
+    float* packed = values.data();
+    for (int pc = 0; pc < K; pc += GEMM_KC) {
+        int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+        for (int r = 0; r < rows; ++r) {
+            float* dst = packed + (r / GEMM_MR) * kc * GEMM_MR + r % GEMM_MR;
+            for (int p = 0; p < kc; ++p)
+                dst[p * GEMM_MR] = (pc + p < cols) ? A[r * lda + pc + p] : bias[r];
+        }
+        packed += paddedRows * kc;
+    }
+}
+
+// B of sgemm_packed: a row-major K x N matrix with row stride ldb, every panel one run of each row
+struct MatrixPanels {
+    int ldb;
+    int rowOffset[GEMM_KC];     // start of each row of the current depth block
+
+    explicit MatrixPanels(int ldb) : ldb(ldb) {}
+
+    void block(int pc, int rows) {
+        for (int p = 0; p < rows; ++p)
+            rowOffset[p] = (pc + p) * ldb;
+    }
+    void columns(int j, int cols, PanelRuns& runs) const {
+        runs.count = 1;
+        runs.offset[0] = j;
+        runs.column[0] = 0;
+        runs.length[0] = cols;
+    }
+};
+
+// B of sgemm_conv: the im2col matrix of n images, whose row k is element (ki, kj) of the kernels of input map m
+// and whose columns are the output pixels; the columns of a panel split into runs along the rows of the output
+// maps, each of which reads a contiguous run of the input maps for every row
+struct ConvPanels {
+    int n, inLength, convLength, outLength;
+    int rowOffset[GEMM_KC];
+    int image, i, j;    // output pixel of the next panel: the panels of a depth block come in order
+
+    ConvPanels(int n, int inLength, int convLength) :
+        n(n), inLength(inLength), convLength(convLength), outLength(inLength - convLength + 1), image(0), i(0), j(0) {}
+
+    void block(int pc, int rows) {
+        int ksize = convLength * convLength;
+        int m = pc / ksize, ki = pc % ksize / convLength, kj = pc % convLength;
+        for (int p = 0; p < rows; ++p) {
+            rowOffset[p] = (m * n * inLength + ki) * inLength + kj;
+            if (++kj == convLength) {
+                kj = 0;
+                if (++ki == convLength) {
+                    ki = 0;
+                    ++m;
+                }
+            }
+        }
+        image = i = j = 0;
+    }
+    void columns(int, int cols, PanelRuns& runs) {
+        runs.count = 0;
+        for (int c = 0; c < cols; ) {
+            int length = (outLength - j < cols - c) ? outLength - j : cols - c;
+            runs.offset[runs.count] = (image * inLength + i) * inLength + j;
+            runs.column[runs.count] = c;
+            runs.length[runs.count] = length;
+            ++runs.count;
+            c += length;
+            j += length;
+            if (j == outLength) {
+                j = 0;
+                if (++i == outLength) {
+                    i = 0;
+                    ++image;
+                }
+            }
+        }
+    }
+};
+
+// C[A.rows x N] = A * B + bias for A packed once: B is packed from src one panel of nr columns at a time
+// (see MatrixPanels and ConvPanels), right before the panel is multiplied by all of A while it is in L1
+template<class Panels>
+static void multiply_packed_a(const PackedMatrix& A, int N, Panels& panels, const float* src, float* C, int ldc, bool relu) {
+
+    const SimdKernels* simd = &simd_kernels();
+    const int nr = simd->sgemm_nr;
+    float* b = get_gemm_scratch().b;
+    int K = A.cols + 1;
+    int paddedRows = (A.rows + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+
+    const float* a = A.values.data();
+    for (int pc = 0; pc < K; pc += GEMM_KC, a += paddedRows * GEMM_KC) {
+        int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+        int rows = (pc + kc == K) ? kc - 1 : kc;    // the last row is the one of the bias
+        panels.block(pc, rows);
+
+        for (int j = 0; j < N; j += nr) {
+            int n = (N - j < nr) ? N - j : nr;
+            PanelRuns runs;
+            panels.columns(j, n, runs);
+            simd->pack_panel(src, panels.rowOffset, rows, runs, n, nr, b);
+            if (rows < kc)
+                pack_ones(n, nr, b + rows * nr);
+            multiply_panel(simd, A.rows, n, kc, a, b, C + j, ldc, pc > 0, relu && pc + kc == K);
+        }
+    }
+}
+
+void sgemm_packed(const PackedMatrix& A, int N, const float* B, int ldb, float* C, int ldc, bool relu) {
+
+    MatrixPanels panels(ldb);
+    multiply_packed_a(A, N, panels, B, C, ldc, relu);
+}
+
+void sgemm_conv(const PackedMatrix& A, const float* in, int n, int inLength, int convLength, float* C, bool relu)
+{
+    int outLength = inLength - convLength + 1;
+    ConvPanels panels(n, inLength, convLength);
+    multiply_packed_a(A, n * outLength * outLength, panels, in, C, n * outLength * outLength, relu);
+}
+
+void sgemm_half_panels(int M, int N, int K,
+    const uint16_t* A, StoragePrecision precision,
+    const float* B, int ldb,
+    float* C, int ldc)
+{
+    float block[GEMV_PANEL * GEMM_KC];
+    for (int r0 = 0; r0 < M; r0 += GEMV_PANEL) {
+        int rows = (M - r0 < GEMV_PANEL) ? M - r0 : GEMV_PANEL;
+        for (int pc = 0; pc < K; pc += GEMM_KC) {
+            int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            for (int r = 0; r < rows; ++r) {
+                for (int p = 0; p < kc; ++p) {
+                    block[r * kc + p] = half_to_float(A[gemv_half_panel_index(r0 + r, pc + p, K, precision)], precision);
+                }
+            }
+            sgemm(rows, N, kc, block, kc, B + pc * ldb, ldb, C + r0 * ldc, ldc, pc > 0);
+        }
+    }
+}
+
+void bias_activation(int M, int N, float* C, int ldc, const float* bias, bool relu) {
+
+    for (int i = 0; i < M; ++i) {
+        float b = bias[i];
+        float* row = C + i * ldc;
+        for (int j = 0; j < N; ++j) {
+            float v = row[j] + b;
+            row[j] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
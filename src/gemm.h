@@ -0,0 +1,51 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stdint.h>
+#include <vector>
+#include "half_precision.h"
+
+// single-precision matrix multiply, all matrices row-major:
+//  C[M x N] = A[M x K] * B[K x N]          (accumulate == false)
+//  C[M x N] += A[M x K] * B[K x N]         (accumulate == true)
+// lda/ldb/ldc are the row strides (in elements) of A, B and C
+void sgemm(int M, int N, int K,
+    const float* A, int lda,
+    const float* B, int ldb,
+    float* C, int ldc,
+    bool accumulate);
+
+// A[rows x cols] packed once (the weights of a layer, at load time) for sgemm_packed and sgemm_conv:
+// for every depth block of GEMM_KC columns, the panels of GEMM_MR rows the micro-kernel reads (see simd.h),
+// the last one zero-padded; the bias is packed as column cols and multiplied by a row of ones of B
+struct PackedMatrix {
+    int rows, cols;
+    std::vector<float> values;
+
+    PackedMatrix() : rows(0), cols(0) {}
+
+    // lda: row stride of A; bias: rows elements
+    void build(const float* A, int rows, int cols, int lda, const float* bias);
+    size_t bytes() const { return values.size() * sizeof(float); }
+};
+
+// C[M x N] = A * B[K x N] + bias, clamped at 0 if relu, for M x K weights A packed into a PackedMatrix
+void sgemm_packed(const PackedMatrix& A, int N, const float* B, int ldb, float* C, int ldc, bool relu);
+
+// the convolutions of n images as one GEMM, with the im2col matrix packed straight from the maps instead of
+// being stored: C[M x (n * outLength * outLength)] = A * im2col(in) + bias, clamped at 0 if relu
+// in: the input maps of the n images, map m of image b at (m * n + b) * inLength * inLength;
+// A: M x (maps * convLength * convLength) kernels; outLength = inLength - convLength + 1
+void sgemm_conv(const PackedMatrix& A, const float* in, int n, int inLength, int convLength, float* C, bool relu);
+
+// C[M x N] = A[M x K] * B[K x N] for fp16 / bf16 weights A packed by pack_gemv_panels_half (see simd.h):
+// every block of 16 rows x GEMM_KC columns of A is converted to float once and multiplied by sgemm
+void sgemm_half_panels(int M, int N, int K,
+    const uint16_t* A, StoragePrecision precision,
+    const float* B, int ldb,
+    float* C, int ldc);
+
+// adds bias[m] to every element of row m of C[M x N], then optionally applies ReLU
+void bias_activation(int M, int N, float* C, int ldc, const float* bias, bool relu);
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef HALF_PRECISION_H
+#define HALF_PRECISION_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Reduced-precision storage of the fully-connected weights (see Lenet5Model::set_precision)
+//
+// fp16: IEEE half, 1 sign, 5 exponent, 10 mantissa bits (range +-65504, ~3 decimal digits)
+// bf16: the upper half of a float, 1 sign, 8 exponent, 7 mantissa bits (float range, ~2 decimal digits)
+//
+// Values are converted with round to nearest even, like the F16C / AVX-512 BF16 instructions
+// (except that vcvtneps2bf16 flushes float denormals to 0), and products are always accumulated in fp32.
+
+enum StoragePrecision {
+    PRECISION_FP32 = 0,
+    PRECISION_FP16,
+    PRECISION_BF16,
+    PRECISION_COUNT
+};
+
+inline const char* precision_name(int precision) {
+    switch (precision) {
+    case PRECISION_FP32: return "fp32";
+    case PRECISION_FP16: return "fp16";
+    case PRECISION_BF16: return "bf16";
+    default: return "?";
+    }
+}
+
+// "fp32", "fp16" or "bf16"
+inline bool parse_precision(const char* name, StoragePrecision& precision) {
+    for (int p = 0; p < PRECISION_COUNT; ++p) {
+        if (strcmp(name, precision_name(p)) == 0) {
+            precision = (StoragePrecision)p;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline uint32_t float_bits(float f) {
+    uint32_t u;
+    memcpy(&u, &f, 4);
+    return u;
+}
+
+inline float bits_float(uint32_t u) {
+    float f;
+    memcpy(&f, &u, 4);
+    return f;
+}
+
+inline uint16_t float_to_bf16(float f) {
+    uint32_t u = float_bits(f);
+    if ((u & 0x7fffffff) > 0x7f800000)
+        return (uint16_t)((u >> 16) | 0x40);    // quiet NaN
+    u += 0x7fff + ((u >> 16) & 1);
+    return (uint16_t)(u >> 16);
+}
+
+inline float bf16_to_float(uint16_t h) {
+    return bits_float((uint32_t)h << 16);
+}
+
+inline uint16_t float_to_fp16(float f) {
+
+    uint32_t u = float_bits(f);
+    uint16_t sign = (uint16_t)((u >> 16) & 0x8000);
+    uint32_t abs = u & 0x7fffffff;
+
+    if (abs >= 0x7f800000)      // inf / NaN
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    if (abs >= 0x477ff000)      // rounds to more than 65504
+        return sign | 0x7c00;
+    if (abs < 0x38800000) {     // subnormal half (or 0)
+        // the last mantissa bit of a float in [0.5, 1) weighs 2^-24, like the last bit of a subnormal half,
+        // so the float addition rounds abs to the half's mantissa (to nearest even)
+        float scaled = bits_float(abs) + 0.5f;
+        return sign | (uint16_t)(float_bits(scaled) - 0x3f000000);
+    }
+    // normal: rebias the exponent (127 -> 15) and round the mantissa from 23 to 10 bits
+    uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1);
+    return sign | (uint16_t)((rounded - 0x38000000) >> 13);
+}
+
+inline float fp16_to_float(uint16_t h) {
+
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    if (exponent == 0x1f)       // inf / NaN
+        return bits_float(sign | 0x7f800000 | (mantissa << 13));
+    if (exponent == 0) {        // subnormal (or 0): mantissa * 2^-24
+        float f = bits_float(0x3f000000 | mantissa) - 0.5f;
+        return bits_float(sign | float_bits(f));
+    }
+    return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+inline uint16_t float_to_half(float f, StoragePrecision precision) {
+    return (precision == PRECISION_BF16) ? float_to_bf16(f) : float_to_fp16(f);
+}
+
+inline float half_to_float(uint16_t h, StoragePrecision precision) {
+    return (precision == PRECISION_BF16) ? bf16_to_float(h) : fp16_to_float(h);
+}
+
+// f as stored in the given precision
+inline float round_to_precision(float f, StoragePrecision precision) {
+    return (precision == PRECISION_FP32) ? f : half_to_float(float_to_half(f, precision), precision);
+}
+
+// out[i] = in[i] as stored in the given precision, for a vector of activations:
+// fp16 values are scaled by a power of two first, so that the largest one is just below 65504, and scaled back
+// (the activations of this network reach 1e5 with raw 0-255 pixels); the scaling is exact, so only the
+// 11-bit mantissa of fp16 is kept, with the exponent range of the vector
+inline void round_to_precision(const float* in, int n, StoragePrecision precision, float* out) {
+
+    float scale = 1.f;
+    if (precision == PRECISION_FP16) {
+        float max = 0.f;
+        for (int i = 0; i < n; ++i)
+            max = (fabsf(in[i]) > max) ? fabsf(in[i]) : max;
+        int exponent;
+        frexpf(max, &exponent);     // max < 2^exponent
+        if (max > 0.f && max <= 3.4e38f)
+            scale = ldexpf(1.f, 15 - exponent);     // max * scale < 2^15
+    }
+    for (int i = 0; i < n; ++i)
+        out[i] = round_to_precision(in[i] * scale, precision) / scale;
+}
+
+struct PrecisionReportOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;   // nullptr: the two CSV files
+
+    PrecisionReportOptions() : model_path(nullptr), dataset_path(nullptr) {}
+};
+
+// parses the arguments of "lenet5 half" (argv[0] is the first one after the command)
+bool parse_precision_args(int argc, char* argv[], PrecisionReportOptions& options);
+void print_precision_usage();
+
+// accuracy and time of each precision (and of rounding the activations too) against fp32, defined in lenet5_precision.cpp
+bool run_precision_report(const PrecisionReportOptions& options);
+
+#endif
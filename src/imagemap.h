@@ -3,13 +3,16 @@
 
 #include "map.h"
 
-class ImageMap : public Map<char> {
+// 8-bit (0-255) pixels
+class ImageMap : public Map<unsigned char> {
 private:
     char _label;
 
 public:
     ImageMap(int length) : Map(length), _label(NULL) {}
     ImageMap(int length, char label) : Map(length), _label(label) {}
+    // view over length x length pixels owned by someone else (e.g. carved from an Arena by read_dataset)
+    ImageMap(unsigned char* data, int length, char label) : Map(data, length), _label(label) {}
 
     virtual ~ImageMap() {}
 
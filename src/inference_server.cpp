@@ -0,0 +1,546 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "inference_server.h"
+#include "lenet5.h"
+#include "dataset_reader.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static_assert(SERVER_IMAGE_BYTES == DATASET_IMAGE_LEN * DATASET_IMAGE_LEN, "requests carry unpadded dataset images");
+static_assert(SERVER_RESPONSE_BYTES == 8 + Lenet5Dims::OUT_LEN * sizeof(float), "responses carry every output");
+
+#define SERVER_POLL_MS 100      // the accept loop checks for a stop signal this often
+
+typedef std::chrono::steady_clock Clock;
+
+// one client: requests are read from in_fd and responses written to out_fd
+// (the same socket, or stdin / stdout), closed when the last request holding it is answered
+struct ServerConnection {
+    int in_fd;
+    int out_fd;
+    bool owns_fds;
+    std::mutex write_mutex;     // responses of concurrent batches are written whole
+    bool broken;                // a write failed, the remaining responses are dropped
+
+    ServerConnection(int in, int out, bool owns) : in_fd(in), out_fd(out), owns_fds(owns), broken(false) {}
+    ~ServerConnection();
+};
+
+struct ServerRequest {
+    std::shared_ptr<ServerConnection> connection;
+    uint32_t id;
+    int priority;
+    Clock::time_point arrival;
+    ImageMap image;     // 32x32, padding included
+
+    ServerRequest() : id(0), priority(SERVER_LATENCY), image(Lenet5Dims::IN_LEN) {}
+};
+
+// requests answered by one worker, per priority
+struct ServerStats {
+    long long requests[SERVER_PRIORITY_COUNT];
+    long long batches[SERVER_PRIORITY_COUNT];
+    double latency_us[SERVER_PRIORITY_COUNT];       // sum, from arrival to response
+    double max_latency_us[SERVER_PRIORITY_COUNT];
+
+    ServerStats() {
+        for (int p = 0; p < SERVER_PRIORITY_COUNT; ++p) {
+            requests[p] = 0;
+            batches[p] = 0;
+            latency_us[p] = 0.0;
+            max_latency_us[p] = 0.0;
+        }
+    }
+
+    void add(const ServerStats& other) {
+        for (int p = 0; p < SERVER_PRIORITY_COUNT; ++p) {
+            requests[p] += other.requests[p];
+            batches[p] += other.batches[p];
+            latency_us[p] += other.latency_us[p];
+            if (other.max_latency_us[p] > max_latency_us[p])
+                max_latency_us[p] = other.max_latency_us[p];
+        }
+    }
+};
+
+// the two queues and the batching policy described in inference_server.h
+class RequestScheduler {
+private:
+    ServerQueueOptions limits[SERVER_PRIORITY_COUNT];
+    std::deque<std::unique_ptr<ServerRequest>> queues[SERVER_PRIORITY_COUNT];
+    std::mutex mutex;
+    std::condition_variable wake;   // signalled when a request is queued or on stop
+    bool stopping;
+
+    Clock::time_point deadline(int priority) const {
+        return queues[priority].front()->arrival + std::chrono::microseconds(limits[priority].max_wait);
+    }
+
+    // queue a batch can be taken from now, -1 if none
+    int ready_queue(Clock::time_point now) const {
+        const std::deque<std::unique_ptr<ServerRequest>>& latency = queues[SERVER_LATENCY];
+        const std::deque<std::unique_ptr<ServerRequest>>& bulk = queues[SERVER_BULK];
+        if (!latency.empty() && (stopping || (int)latency.size() >= limits[SERVER_LATENCY].max_batch
+            || now >= deadline(SERVER_LATENCY)))
+            return SERVER_LATENCY;
+        if (!bulk.empty() && (stopping || now >= deadline(SERVER_BULK)
+            || ((int)bulk.size() >= limits[SERVER_BULK].max_batch && latency.empty())))
+            return SERVER_BULK;
+        return -1;
+    }
+
+public:
+    explicit RequestScheduler(const ServerQueueOptions* queueOptions) : stopping(false) {
+        for (int p = 0; p < SERVER_PRIORITY_COUNT; ++p)
+            limits[p] = queueOptions[p];
+    }
+
+    // false if the request's queue is full (the request is left untouched)
+    bool submit(std::unique_ptr<ServerRequest>& request) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::deque<std::unique_ptr<ServerRequest>>& queue = queues[request->priority];
+            if ((int)queue.size() >= limits[request->priority].max_queued)
+                return false;
+            queue.push_back(std::move(request));
+        }
+        wake.notify_all();
+        return true;
+    }
+
+    // waits for the next batch and moves it into batch
+    // returns false once stopped and both queues are empty
+    bool next_batch(std::vector<std::unique_ptr<ServerRequest>>& batch, int& priority) {
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            int ready = ready_queue(Clock::now());
+            if (ready >= 0) {
+                std::deque<std::unique_ptr<ServerRequest>>& queue = queues[ready];
+                int n = (int)queue.size() < limits[ready].max_batch ? (int)queue.size() : limits[ready].max_batch;
+                batch.clear();
+                for (int i = 0; i < n; ++i) {
+                    batch.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+                priority = ready;
+                // more requests may be ready for another worker
+                if (!queues[SERVER_LATENCY].empty() || !queues[SERVER_BULK].empty())
+                    wake.notify_one();
+                return true;
+            }
+            if (stopping)
+                return false;
+
+            // sleep until the earliest deadline of a non-empty queue, or until woken
+            if (queues[SERVER_LATENCY].empty() && queues[SERVER_BULK].empty()) {
+                wake.wait(lock);
+            }
+            else {
+                Clock::time_point until = Clock::time_point::max();
+                for (int p = 0; p < SERVER_PRIORITY_COUNT; ++p) {
+                    if (!queues[p].empty() && deadline(p) < until)
+                        until = deadline(p);
+                }
+                wake.wait_until(lock, until);
+            }
+        }
+    }
+
+    // the workers answer the requests still queued, then next_batch returns false
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+    }
+};
+
+#ifdef _WIN32
+static int read_fd(int fd, void* buffer, size_t bytes) { return _read(fd, buffer, (unsigned int)bytes); }
+static int write_fd(int fd, const void* buffer, size_t bytes) { return _write(fd, buffer, (unsigned int)bytes); }
+static void close_fd(int fd) { _close(fd); }
+#else
+static int read_fd(int fd, void* buffer, size_t bytes) { return (int)read(fd, buffer, bytes); }
+static int write_fd(int fd, const void* buffer, size_t bytes) { return (int)write(fd, buffer, bytes); }
+static void close_fd(int fd) { close(fd); }
+#endif
+
+ServerConnection::~ServerConnection() {
+    if (owns_fds) {
+        close_fd(in_fd);
+        if (out_fd != in_fd)
+            close_fd(out_fd);
+    }
+}
+
+// reads exactly bytes bytes, false at the end of the stream (or on an error / a truncated frame)
+static bool read_full(int fd, unsigned char* buffer, size_t bytes) {
+
+    size_t done = 0;
+    while (done < bytes) {
+        int n = read_fd(fd, buffer + done, bytes - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n < 0 || done > 0)
+                fprintf(stderr, "serve: %s while reading a request\n", n < 0 ? strerror(errno) : "truncated frame");
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const unsigned char* buffer, size_t bytes) {
+
+    size_t done = 0;
+    while (done < bytes) {
+        int n = write_fd(fd, buffer + done, bytes - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// digit < 0: rejected, logits ignored
+static void send_response(ServerConnection& connection, uint32_t id, int digit, const float* logits) {
+
+    unsigned char frame[SERVER_RESPONSE_BYTES];
+    int32_t value = digit;
+    float outputs[Lenet5Dims::OUT_LEN];
+    for (int i = 0; i < Lenet5Dims::OUT_LEN; ++i)
+        outputs[i] = (digit >= 0) ? logits[i] : 0.f;
+    memcpy(frame, &id, 4);
+    memcpy(frame + 4, &value, 4);
+    memcpy(frame + 8, outputs, sizeof(outputs));
+
+    std::lock_guard<std::mutex> lock(connection.write_mutex);
+    if (connection.broken)
+        return;
+    if (!write_full(connection.out_fd, frame, sizeof(frame))) {
+        fprintf(stderr, "serve: client went away, dropping its responses\n");
+        connection.broken = true;
+    }
+}
+
+const char* server_priority_name(int priority) {
+    switch (priority) {
+    case SERVER_LATENCY: return "latency";
+    case SERVER_BULK: return "bulk";
+    default: return "?";
+    }
+}
+
+ServerOptions::ServerOptions() : model_path(nullptr), socket_path(nullptr), conv_algorithms(nullptr), threads(0) {
+    queues[SERVER_LATENCY].max_batch = 8;
+    queues[SERVER_LATENCY].max_wait = 200;
+    queues[SERVER_LATENCY].max_queued = 1024;
+    queues[SERVER_BULK].max_batch = Lenet5Model::BATCH_TILE;
+    queues[SERVER_BULK].max_wait = 5000;
+    queues[SERVER_BULK].max_queued = 16384;
+}
+
+void print_server_usage() {
+
+    const ServerOptions defaults;
+    printf("usage: lenet5 serve [options]\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -s socket          Unix domain socket to listen on (default: one client on stdin / stdout)\n");
+    printf("  -t threads         workers, 0 = one per hardware thread (default 0)\n");
+    printf("  -c algorithms      C1 / C3 convolution, e.g. winograd4 or c1=direct,c3=fft (default direct)\n");
+    printf("  -b images          max batch of latency requests, run together (default %d)\n", defaults.queues[SERVER_LATENCY].max_batch);
+    printf("  -w us              max wait of latency requests (default %d)\n", defaults.queues[SERVER_LATENCY].max_wait);
+    printf("  -B images          max batch of bulk requests, run together (default %d)\n", defaults.queues[SERVER_BULK].max_batch);
+    printf("  -W us              max wait of bulk requests (default %d)\n", defaults.queues[SERVER_BULK].max_wait);
+    printf("  -q requests        max queued requests of each priority (default %d latency, %d bulk)\n",
+        defaults.queues[SERVER_LATENCY].max_queued, defaults.queues[SERVER_BULK].max_queued);
+    printf("frames: request = uint32 id, uint8 priority (0 latency, 1 bulk), 3 reserved, 784 pixels\n");
+    printf("        response = uint32 id, int32 digit (-1 rejected), 10 float logits\n");
+}
+
+bool parse_server_args(int argc, char* argv[], ServerOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        int number = atoi(value);
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-s") == 0) {
+            options.socket_path = value;
+        }
+        else if (strcmp(arg, "-c") == 0) {
+            options.conv_algorithms = value;
+        }
+        else if (strcmp(arg, "-t") == 0 && number >= 0) {
+            options.threads = number;
+        }
+        else if (strcmp(arg, "-b") == 0 && number > 0) {
+            options.queues[SERVER_LATENCY].max_batch = number;
+        }
+        else if (strcmp(arg, "-w") == 0 && number >= 0) {
+            options.queues[SERVER_LATENCY].max_wait = number;
+        }
+        else if (strcmp(arg, "-B") == 0 && number > 0) {
+            options.queues[SERVER_BULK].max_batch = number;
+        }
+        else if (strcmp(arg, "-W") == 0 && number >= 0) {
+            options.queues[SERVER_BULK].max_wait = number;
+        }
+        else if (strcmp(arg, "-q") == 0 && number > 0) {
+            for (int p = 0; p < SERVER_PRIORITY_COUNT; ++p)
+                options.queues[p].max_queued = number;
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// takes batches until the scheduler stops and runs each one through run_inference_batch, whose fully-connected
+// layers are one GEMM over the batch instead of one matrix-vector product per image
+static void worker_loop(const Lenet5Model* model, RequestScheduler* scheduler, ServerStats* stats) {
+
+    InferenceContext context;
+    std::vector<std::unique_ptr<ServerRequest>> batch;
+    std::vector<const ImageMap*> images;
+    std::vector<int> digits;
+    std::vector<float> logits;
+    int priority;
+
+    while (scheduler->next_batch(batch, priority)) {
+        int n = (int)batch.size();
+        images.resize(n);
+        digits.resize(n);
+        logits.resize(n * Lenet5Dims::OUT_LEN);
+        for (int b = 0; b < n; ++b)
+            images[b] = &batch[b]->image;
+        model->run_inference_batch(images.data(), n, digits.data(), context, logits.data());
+
+        for (int b = 0; b < n; ++b) {
+            send_response(*batch[b]->connection, batch[b]->id, digits[b], &logits[b * Lenet5Dims::OUT_LEN]);
+            double us = std::chrono::duration<double, std::micro>(Clock::now() - batch[b]->arrival).count();
+            stats->latency_us[priority] += us;
+            if (us > stats->max_latency_us[priority])
+                stats->max_latency_us[priority] = us;
+        }
+        stats->requests[priority] += n;
+        stats->batches[priority] += 1;
+        batch.clear();  // releases the connections
+    }
+}
+
+// reads the requests of one connection until it is closed
+static void read_requests(std::shared_ptr<ServerConnection> connection, RequestScheduler* scheduler) {
+
+    const int len = Lenet5Dims::IN_LEN;
+    unsigned char frame[SERVER_REQUEST_BYTES];
+    while (read_full(connection->in_fd, frame, sizeof(frame))) {
+        std::unique_ptr<ServerRequest> request(new ServerRequest());
+        memcpy(&request->id, frame, 4);
+        request->priority = frame[4];
+        request->connection = connection;
+        request->arrival = Clock::now();
+        if (request->priority >= SERVER_PRIORITY_COUNT) {
+            send_response(*connection, request->id, -1, nullptr);
+            continue;
+        }
+
+        // zero padding around the 28x28 pixels (the image buffer is not initialized)
+        unsigned char* data = request->image.data();
+        memset(data, 0, len * len);
+        const unsigned char* pixels = frame + 8;
+        for (int i = 0; i < DATASET_IMAGE_LEN; ++i)
+            memcpy(data + (i + DATASET_PADDING) * len + DATASET_PADDING, pixels + i * DATASET_IMAGE_LEN, DATASET_IMAGE_LEN);
+
+        uint32_t id = request->id;
+        if (!scheduler->submit(request))
+            send_response(*connection, id, -1, nullptr);
+    }
+}
+
+#ifndef _WIN32
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_stop_signal(int) {
+    stop_requested = 1;
+}
+
+// thread reading the requests of one socket client
+struct ClientReader {
+    std::thread thread;
+    std::weak_ptr<ServerConnection> connection;
+    std::shared_ptr<std::atomic<bool>> done;
+};
+
+static void read_client(std::shared_ptr<ServerConnection> connection, RequestScheduler* scheduler,
+    std::shared_ptr<std::atomic<bool>> done) {
+    read_requests(connection, scheduler);
+    *done = true;
+}
+
+// accepts clients until SIGINT / SIGTERM, one reader thread per client
+static bool serve_socket(const char* path, RequestScheduler& scheduler) {
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "serve: socket path '%s' is too long\n", path);
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fprintf(stderr, "serve: socket: %s\n", strerror(errno));
+        return false;
+    }
+    unlink(path);   // left over from a previous run
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        fprintf(stderr, "serve: cannot listen on '%s': %s\n", path, strerror(errno));
+        close(listener);
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);   // a client closing early is reported by write()
+    fprintf(stderr, "serve: listening on %s\n", path);
+
+    std::vector<ClientReader> readers;
+    while (!stop_requested) {
+        // join the readers of clients that have disconnected
+        for (size_t i = 0; i < readers.size();) {
+            if (*readers[i].done) {
+                readers[i].thread.join();
+                readers[i] = std::move(readers.back());
+                readers.pop_back();
+            }
+            else {
+                ++i;
+            }
+        }
+
+        struct pollfd pfd;
+        pfd.fd = listener;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, SERVER_POLL_MS) <= 0)
+            continue;
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+        ClientReader reader;
+        std::shared_ptr<ServerConnection> connection(new ServerConnection(fd, fd, true));
+        reader.connection = connection;
+        reader.done = std::make_shared<std::atomic<bool>>(false);
+        reader.thread = std::thread(read_client, connection, &scheduler, reader.done);
+        readers.push_back(std::move(reader));
+    }
+
+    // wake the readers up; the connections stay open until their queued requests are answered
+    for (size_t i = 0; i < readers.size(); ++i) {
+        std::shared_ptr<ServerConnection> connection = readers[i].connection.lock();
+        if (connection)
+            shutdown(connection->in_fd, SHUT_RD);
+    }
+    for (size_t i = 0; i < readers.size(); ++i)
+        readers[i].thread.join();
+    close(listener);
+    unlink(path);
+    return true;
+}
+#endif
+
+bool run_server(const ServerOptions& options) {
+
+#ifdef _WIN32
+    if (options.socket_path) {
+        fprintf(stderr, "serve: Unix domain sockets are not supported on this platform, use stdin / stdout\n");
+        return false;
+    }
+#endif
+
+    Lenet5Model model(options.model_path);
+    if (!model.is_loaded())
+        fprintf(stderr, "serve: some parameter files are missing, serving random weights\n");
+    if (options.conv_algorithms && !model.set_conv_algorithms(options.conv_algorithms))
+        return false;
+
+    int numThreads = options.threads;
+    if (numThreads <= 0)
+        numThreads = (int)std::thread::hardware_concurrency();
+    if (numThreads <= 0)
+        numThreads = 1;
+
+    RequestScheduler scheduler(options.queues);
+    std::vector<ServerStats> stats(numThreads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < numThreads; ++t)
+        workers.push_back(std::thread(worker_loop, &model, &scheduler, &stats[t]));
+
+    bool ok = true;
+    if (options.socket_path) {
+#ifndef _WIN32
+        ok = serve_socket(options.socket_path, scheduler);
+#endif
+    }
+    else {
+        // one client: requests on stdin, responses on stdout, until stdin is closed
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        read_requests(std::make_shared<ServerConnection>(0, 1, false), &scheduler);
+    }
+
+    scheduler.stop();
+    for (int t = 0; t < numThreads; ++t)
+        workers[t].join();
+
+    ServerStats total;
+    for (int t = 0; t < numThreads; ++t)
+        total.add(stats[t]);
+    for (int p = 0; p < SERVER_PRIORITY_COUNT; ++p) {
+        if (total.requests[p] == 0)
+            continue;
+        fprintf(stderr, "serve: %s: %lld requests in %lld batches (%.1f per batch), latency mean %.0f us, max %.0f us\n",
+            server_priority_name(p), total.requests[p], total.batches[p], (double)total.requests[p] / total.batches[p],
+            total.latency_us[p] / total.requests[p], total.max_latency_us[p]);
+    }
+
+    return ok;
+}
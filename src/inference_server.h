@@ -0,0 +1,62 @@
+#ifndef INFERENCE_SERVER_H
+#define INFERENCE_SERVER_H
+
+#include <stdint.h>
+
+// Resident inference server ("lenet5 serve")
+//
+// The model is loaded once; clients then send images over a Unix domain socket, or over stdin / stdout.
+// Every message is a fixed-size binary frame in the byte order of the host:
+//
+//   request:  uint32 id, uint8 priority (SERVER_LATENCY or SERVER_BULK), 3 reserved bytes,
+//             28 x 28 pixels (0-255, row-major, unpadded)
+//   response: uint32 id (of the request), int32 digit (-1: rejected), 10 float logits (the OUTPUT layer)
+//
+// Responses are sent when their batch completes, so a client with several requests in flight
+// must match them by id. A request is rejected (digit -1, zero logits) if its priority is unknown
+// or if its queue is full.
+//
+// Requests wait in one queue per priority and are run in batches (Lenet5Model::run_inference_batch) through
+// the same model by the workers, each with its own InferenceContext. A worker takes a batch from a queue:
+//   latency:  as soon as max_batch requests are waiting, or the oldest one has waited max_wait
+//   bulk:     when the oldest one has waited max_wait, or when max_batch requests are waiting
+//             and no latency request is
+// so latency-sensitive traffic goes first and bulk traffic is delayed by at most its own deadline.
+
+#define SERVER_IMAGE_BYTES (28 * 28)
+#define SERVER_REQUEST_BYTES (8 + SERVER_IMAGE_BYTES)
+#define SERVER_RESPONSE_BYTES (8 + 10 * 4)
+
+enum ServerPriority {
+    SERVER_LATENCY = 0,
+    SERVER_BULK,
+    SERVER_PRIORITY_COUNT
+};
+
+const char* server_priority_name(int priority);
+
+// batching limits of one queue
+struct ServerQueueOptions {
+    int max_batch;      // requests a worker takes at once
+    int max_wait;       // microseconds the oldest request may wait for its batch to fill
+    int max_queued;     // requests waiting before new ones are rejected
+};
+
+struct ServerOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* socket_path;    // nullptr: stdin / stdout
+    const char* conv_algorithms;    // C1 / C3 convolution algorithms (see Lenet5Model::set_conv_algorithms)
+    int threads;                // workers, 0: one per hardware thread
+    ServerQueueOptions queues[SERVER_PRIORITY_COUNT];
+
+    ServerOptions();
+};
+
+// parses the arguments of "lenet5 serve" (argv[0] is the first one after "serve")
+bool parse_server_args(int argc, char* argv[], ServerOptions& options);
+void print_server_usage();
+
+// serves until SIGINT / SIGTERM (socket) or the end of stdin, then answers the queued requests and returns
+bool run_server(const ServerOptions& options);
+
+#endif
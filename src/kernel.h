@@ -14,12 +14,16 @@ public:
     Kernel() : Map(), _bias(0.f) {}
 
     Kernel(int len) : Map(len), _bias(0.f) {}
+    // view over len x len weights owned by a kernel bank Tensor
+    Kernel(float* weights, int len) : Map(weights, len), _bias(0.f) {}
     virtual ~Kernel() {}
 
     void set_bias(float bias) {
         _bias = bias;
     }
 
+    float get_bias() const { return _bias; }
+
     std::string to_string() {
 
         std::ostringstream ss;
@@ -30,7 +34,7 @@ public:
         return ss.str();
     }
 
-    friend class Lenet5;
+    friend class Lenet5Model;
 };
 
 #endif
\ No newline at end of file
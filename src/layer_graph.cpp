@@ -0,0 +1,727 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include "layer_graph.h"
+#include "lenet5.h"
+#include "gemm.h"
+#include "model_file.h"
+#include "dataset_reader.h"
+
+#define GRAPH_LINE_LEN 1024
+#define GRAPH_ALIGNMENT (TENSOR_ALIGNMENT / sizeof(float))     // buffers start on a cache line
+
+static const char* op_names[] = { "input", "conv", "fc", "relu", "maxpool", "avgpool" };
+
+static bool parse_op(const std::string& name, GraphOp& op) {
+    for (size_t o = 0; o < sizeof(op_names) / sizeof(op_names[0]); ++o) {
+        if (name == op_names[o]) {
+            op = (GraphOp)o;
+            return true;
+        }
+    }
+    return false;
+}
+
+// "0,1,2/1,2,3/..." (the input maps of each output map) or "lenet5"
+static bool parse_table(const std::string& spec, int numMaps, int inMaps, std::vector<std::vector<int>>& table) {
+
+    table.clear();
+    if (spec == "lenet5") {
+        if (numMaps != Lenet5Dims::C3_MAPS || inMaps != Lenet5Dims::C1_MAPS)
+            return false;
+        for (int n = 0; n < Lenet5Dims::C3_MAPS; ++n)
+            table.push_back(std::vector<int>(C3_TABLE.inputs[n], C3_TABLE.inputs[n] + C3_TABLE.num_inputs[n]));
+        return true;
+    }
+
+    table.push_back(std::vector<int>());
+    for (const char* p = spec.c_str(); *p != '\0'; ) {
+        char* end;
+        long id = strtol(p, &end, 10);
+        if (end == p || id < 0 || id >= inMaps)
+            return false;
+        table.back().push_back((int)id);
+        p = end;
+        if (*p == '/')
+            table.push_back(std::vector<int>());
+        if (*p == ',' || *p == '/')
+            ++p;
+        else if (*p != '\0')
+            return false;
+    }
+    return (int)table.size() == numMaps;
+}
+
+static void im2col(const float* in, int inMaps, int inLength, int kernel, float* cols) {
+
+    // cols: (inMaps * kernel * kernel) x (outLength * outLength), row c * kernel * kernel + ki * kernel + kj
+    int outLength = inLength - kernel + 1;
+    for (int c = 0; c < inMaps; ++c) {
+        const float* map = in + c * inLength * inLength;
+        for (int ki = 0; ki < kernel; ++ki) {
+            for (int kj = 0; kj < kernel; ++kj) {
+                float* row = cols + ((c * kernel + ki) * kernel + kj) * outLength * outLength;
+                for (int i = 0; i < outLength; ++i)
+                    memcpy(row + i * outLength, map + (i + ki) * inLength + kj, outLength * sizeof(float));
+            }
+        }
+    }
+}
+
+static void pool_maps(const SimdKernels* simd, const float* in, float* out, int maps, int inLength, int size, bool max) {
+
+    int outLength = inLength / size;
+    for (int m = 0; m < maps; ++m) {
+        const float* inMap = in + m * inLength * inLength;
+        float* outMap = out + m * outLength * outLength;
+        if (max && size == 2) {
+            simd->max_pool_2x2(inMap, outMap, outLength);
+            continue;
+        }
+        for (int i = 0; i < outLength; ++i) {
+            for (int j = 0; j < outLength; ++j) {
+                const float* window = inMap + i * size * inLength + j * size;
+                float value = max ? window[0] : 0.f;
+                for (int wi = 0; wi < size; ++wi) {
+                    for (int wj = 0; wj < size; ++wj) {
+                        float x = window[wi * inLength + wj];
+                        value = max ? ((x > value) ? x : value) : value + x;
+                    }
+                }
+                outMap[i * outLength + j] = max ? value : value / (size * size);
+            }
+        }
+    }
+}
+
+// rows of the largest group of a sparse connection conv (0 for a dense one)
+static size_t largest_group(const GraphNode& node) {
+    int largest = 0;
+    for (size_t g = 0; g + 1 < node.group_start.size(); ++g)
+        largest = std::max(largest, node.group_start[g + 1] - node.group_start[g]);
+    return (size_t)largest;
+}
+
+GraphContext::GraphContext() : arena(ARENA_BLOCK_SIZE, arena_huge_pages()), outputs(nullptr)
+{
+    workspace.set_arena(&arena);
+}
+
+LayerGraph::LayerGraph(const char* graph_path, const char* model_path, bool fuse) :
+    simd(&simd_kernels()), workspace_size(0), loaded(false)
+{
+    if (!parse(graph_path) || !load_weights(model_path))
+        return;
+    if (fuse)
+        this->fuse();
+    pack();
+    plan();
+    loaded = true;
+}
+
+bool LayerGraph::parse(const char* graph_path) {
+
+    FILE* fp;
+    errno_t err;
+    if ((err = fopen_s(&fp, graph_path, "r")) != 0) {
+        fprintf(stderr, "cannot open graph '%s'\n", graph_path);
+        return false;
+    }
+
+    char line[GRAPH_LINE_LEN];
+    int lineNo = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp) != NULL) {
+        ++lineNo;
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+        std::vector<std::string> tokens;
+        for (char* p = line; *p != '\0'; ) {
+            while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+                ++p;
+            char* start = p;
+            while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                ++p;
+            if (p > start)
+                tokens.push_back(std::string(start, p - start));
+        }
+        if (tokens.empty())
+            continue;
+
+        GraphNode node;
+        node.name = node.label = node.weights = tokens[0];
+        node.input = (int)nodes.size() - 1;
+        if (tokens.size() < 2 || !parse_op(tokens[1], node.op)) {
+            fprintf(stderr, "%s:%d: expected \"name op [input] key=value ...\"\n", graph_path, lineNo);
+            ok = false;
+            break;
+        }
+        std::string table;
+        for (size_t t = 2; ok && t < tokens.size(); ++t) {
+            size_t eq = tokens[t].find('=');
+            if (eq == std::string::npos) {
+                node.input = -1;
+                for (int n = 0; n < (int)nodes.size(); ++n)
+                    node.input = (nodes[n].name == tokens[t]) ? n : node.input;
+                if (node.input < 0) {
+                    fprintf(stderr, "%s:%d: no node '%s' before this one\n", graph_path, lineNo, tokens[t].c_str());
+                    ok = false;
+                }
+                continue;
+            }
+            std::string key = tokens[t].substr(0, eq), value = tokens[t].substr(eq + 1);
+            int number = atoi(value.c_str());
+            if (key == "maps" || key == "outputs")
+                node.maps = number;
+            else if (key == "length")
+                node.length = number;
+            else if (key == "kernel" || key == "size")
+                node.kernel = number;
+            else if (key == "table")
+                table = value;
+            else if (key == "weights")
+                node.weights = value;
+            else {
+                fprintf(stderr, "%s:%d: unknown option '%s'\n", graph_path, lineNo, key.c_str());
+                ok = false;
+            }
+        }
+        if (!ok)
+            break;
+
+        // output shape
+        const char* error = nullptr;
+        if (node.op == GRAPH_INPUT) {
+            node.input = -1;
+            if (!nodes.empty())
+                error = "the input must be the first node";
+            else if (node.maps != 1 || node.length <= 0)
+                error = "the input is one 8-bit image: maps=1 and length=";
+        }
+        else if (node.input < 0) {
+            error = "the first node must be the input";
+        }
+        else {
+            const GraphNode& in = nodes[node.input];
+            switch (node.op) {
+            case GRAPH_CONV:
+                node.length = in.length - node.kernel + 1;
+                node.conv_length = node.length;
+                if (node.maps <= 0 || node.kernel <= 0 || node.length <= 0)
+                    error = "conv needs maps= and a kernel= no larger than its input";
+                else if (!table.empty() && !parse_table(table, node.maps, in.maps, node.table))
+                    error = "table= needs one list of input maps per output map";
+                break;
+            case GRAPH_FC:
+                node.length = 1;
+                if (node.maps <= 0)
+                    error = "fc needs outputs=";
+                break;
+            case GRAPH_RELU:
+                node.maps = in.maps;
+                node.length = in.length;
+                break;
+            default:    // pooling
+                node.maps = in.maps;
+                node.length = (node.kernel > 0) ? in.length / node.kernel : 0;
+                if (node.kernel <= 0 || in.length % node.kernel != 0)
+                    error = "pooling needs a size= that divides its input";
+                break;
+            }
+        }
+        if (error != nullptr) {
+            fprintf(stderr, "%s:%d: %s\n", graph_path, lineNo, error);
+            ok = false;
+            break;
+        }
+        nodes.push_back(node);
+    }
+    fclose(fp);
+
+    if (ok && nodes.size() < 2) {
+        fprintf(stderr, "%s: no layers\n", graph_path);
+        ok = false;
+    }
+    return ok;
+}
+
+const Tensor<float>* LayerGraph::lenet5_tensor(const Lenet5Model& model, const std::string& name) {
+
+    const struct {
+        const char* name;
+        const Tensor<float>* tensor;
+    } tensors[] = {
+        { "c1.kernels", &model.C1_kernels }, { "c1.bias", &model.C1_bias },
+        { "c3.kernels", &model.C3_kernels }, { "c3.bias", &model.C3_bias },
+        { "c5.kernels", &model.C5_kernels }, { "c5.bias", &model.C5_bias },
+        { "f6.weights", &model.F6_weights }, { "f6.bias", &model.F6_bias },
+        { "out.weights", &model.OUT_weights }, { "out.bias", &model.OUT_bias },
+    };
+    for (size_t t = 0; t < sizeof(tensors) / sizeof(tensors[0]); ++t) {
+        if (name == tensors[t].name)
+            return tensors[t].tensor;
+    }
+    return nullptr;
+}
+
+bool LayerGraph::load_weights(const char* model_path) {
+
+    ModelFile file;
+    std::unique_ptr<Lenet5Model> params;
+    if (model_path != nullptr) {
+        if (!file.open(model_path)) {
+            fprintf(stderr, "cannot use model file '%s'\n", model_path);
+            return false;
+        }
+    }
+    else {
+        params.reset(new Lenet5Model());
+    }
+
+    // copies count floats of the named tensor into tensor (n x c x h x w)
+    auto copy = [&](const std::string& name, Tensor<float>& tensor, int n, int c, int h, int w) {
+        size_t count = (size_t)n * c * h * w;
+        const float* data = nullptr;
+        if (params) {
+            const Tensor<float>* source = lenet5_tensor(*params, name);
+            if (source == nullptr || source->size() != count)
+                fprintf(stderr, "params/ has no tensor '%s' of %u floats\n", name.c_str(), (unsigned)count);
+            else
+                data = source->data();
+        }
+        else {
+            data = file.tensor(name.c_str(), count);
+        }
+        if (data == nullptr)
+            return false;
+        tensor.init(n, c, h, w);
+        memcpy(tensor.data(), data, count * sizeof(float));
+        return true;
+    };
+
+    for (GraphNode& node : nodes) {
+        const GraphNode* in = (node.input >= 0) ? &nodes[node.input] : nullptr;
+        bool ok = true;
+        if (node.op == GRAPH_CONV) {
+            ok = copy(node.weights + ".kernels", node.kernels, node.maps, in->maps, node.kernel, node.kernel)
+                && copy(node.weights + ".bias", node.bias, 1, 1, 1, node.maps);
+        }
+        else if (node.op == GRAPH_FC) {
+            ok = copy(node.weights + ".weights", node.kernels, 1, 1, node.maps, in->maps * in->length * in->length)
+                && copy(node.weights + ".bias", node.bias, 1, 1, 1, node.maps);
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+void LayerGraph::fuse() {
+
+    // a convolution whose kernels cover its whole input is a matrix-vector product
+    for (GraphNode& node : nodes) {
+        if (node.op == GRAPH_CONV && node.table.empty() && node.length == 1) {
+            Tensor<float> matrix(1, 1, node.maps, node.kernels.c() * node.kernel * node.kernel);
+            memcpy(matrix.data(), node.kernels.data(), matrix.size() * sizeof(float));
+            node.kernels = matrix;
+            node.op = GRAPH_FC;
+        }
+    }
+
+    // ReLU into the conv / fc node before it, max pooling into the conv node before it,
+    // when that node feeds nothing else
+    std::vector<int> consumers(nodes.size(), 0);
+    for (const GraphNode& node : nodes) {
+        if (node.input >= 0)
+            ++consumers[node.input];
+    }
+    std::vector<int> index(nodes.size());     // node that replaces each node
+    std::vector<bool> removed(nodes.size(), false);
+    for (int n = 0; n < (int)nodes.size(); ++n) {
+        index[n] = n;
+        GraphNode& node = nodes[n];
+        if (node.input < 0)
+            continue;
+        node.input = index[node.input];
+        GraphNode& prev = nodes[node.input];
+        if (consumers[node.input] != 1)
+            continue;
+        bool fused = false;
+        if (node.op == GRAPH_RELU && (prev.op == GRAPH_CONV || prev.op == GRAPH_FC)) {
+            prev.relu = true;   // after max pooling too: ReLU and max commute
+            fused = true;
+        }
+        else if (node.op == GRAPH_MAXPOOL && prev.op == GRAPH_CONV && prev.pool == 0) {
+            prev.pool = node.kernel;
+            prev.length = node.length;
+            fused = true;
+        }
+        if (fused) {
+            prev.label += "+" + node.name;
+            consumers[node.input] = consumers[n];
+            index[n] = node.input;
+            removed[n] = true;
+        }
+    }
+
+    std::vector<GraphNode> kept;
+    std::vector<int> position(nodes.size(), -1);
+    for (int n = 0; n < (int)nodes.size(); ++n) {
+        if (removed[n])
+            continue;
+        position[n] = (int)kept.size();
+        kept.push_back(nodes[n]);
+        if (kept.back().input >= 0)
+            kept.back().input = position[kept.back().input];
+    }
+    nodes.swap(kept);
+}
+
+bool LayerGraph::has_fused_kernel(const GraphNode& node) const {
+
+    // the SimdKernels instantiations: C1 (one 32x32 input) and C3 (1 to 6 14x14 inputs), 5x5 kernels, 2x2 pooling
+    if (node.op != GRAPH_CONV || !node.relu || node.pool != Lenet5Dims::POOL || node.kernel != Lenet5Dims::CONV)
+        return false;
+    const GraphNode& in = nodes[node.input];
+    int maxInputs = (in.length == Lenet5Dims::IN_LEN) ? 1 : (in.length == Lenet5Dims::S2_LEN) ? Lenet5Dims::C1_MAPS : 0;
+    for (int m = 0; m < node.maps; ++m) {
+        int numInputs = node.table.empty() ? in.maps : (int)node.table[m].size();
+        if (numInputs < 1 || numInputs > maxInputs)
+            return false;
+    }
+    return true;
+}
+
+void LayerGraph::pack() {
+
+    for (GraphNode& node : nodes) {
+        if (node.op == GRAPH_FC) {
+            // GEMV panels, as Lenet5Model::pack_panels
+            int n = node.kernels.size() / node.maps;
+            node.matrix.init(gemv_num_panels(node.maps), 1, n, GEMV_PANEL);
+            pack_gemv_panels(node.kernels.data(), node.maps, n, node.matrix.data());
+        }
+        else if (node.op == GRAPH_CONV && !node.table.empty() && !has_fused_kernel(node)) {
+            // a sparse connection table: per input map, the kernels of the output maps it feeds (as C3_weights)
+            int inMaps = nodes[node.input].maps;
+            int kk = node.kernel * node.kernel;
+            std::vector<float> rows;
+            node.group_start.assign(1, 0);
+            node.group_rows.clear();
+            for (int c = 0; c < inMaps; ++c) {
+                for (int m = 0; m < node.maps; ++m) {
+                    for (int j = 0; j < (int)node.table[m].size(); ++j) {
+                        if (node.table[m][j] != c)
+                            continue;
+                        const float* kernel = node.kernels.data() + ((size_t)m * inMaps + j) * kk;
+                        rows.insert(rows.end(), kernel, kernel + kk);
+                        node.group_rows.push_back(m);
+                    }
+                }
+                node.group_start.push_back((int)node.group_rows.size());
+            }
+            node.matrix.init(1, 1, (int)node.group_rows.size(), kk);
+            memcpy(node.matrix.data(), rows.data(), rows.size() * sizeof(float));
+        }
+    }
+}
+
+void LayerGraph::plan() {
+
+    // sizes and lifetimes
+    for (int n = 0; n < (int)nodes.size(); ++n) {
+        GraphNode& node = nodes[n];
+        node.size = (size_t)node.maps * node.length * node.length;
+        node.scratch = 0;
+        node.last_use = n;
+        if (node.op == GRAPH_CONV && !has_fused_kernel(node)) {
+            size_t convSize = (size_t)node.conv_length * node.conv_length;
+            node.scratch = (size_t)nodes[node.input].maps * node.kernel * node.kernel * convSize;     // im2col
+            node.scratch += largest_group(node) * convSize;     // partial sums of one input map
+            if (node.pool > 0)
+                node.scratch += node.maps * convSize;           // maps before pooling
+        }
+    }
+    for (int n = 0; n < (int)nodes.size(); ++n) {
+        if (nodes[n].input >= 0)
+            nodes[nodes[n].input].last_use = n;
+    }
+    nodes.back().last_use = (int)nodes.size();     // read by the caller after the last node
+
+    // buffers: outputs live from their node to their last reader, scratch only during its node
+    struct Buffer {
+        size_t size;
+        int first, last;
+        size_t* offset;
+    };
+    std::vector<Buffer> buffers;
+    for (int n = 0; n < (int)nodes.size(); ++n) {
+        Buffer output = { nodes[n].size, n, nodes[n].last_use, &nodes[n].offset };
+        buffers.push_back(output);
+        if (nodes[n].scratch > 0) {
+            Buffer scratch = { nodes[n].scratch, n, n, &nodes[n].scratch_offset };
+            buffers.push_back(scratch);
+        }
+    }
+    for (Buffer& buffer : buffers)
+        buffer.size = (buffer.size + GRAPH_ALIGNMENT - 1) / GRAPH_ALIGNMENT * GRAPH_ALIGNMENT;
+
+    // largest first, each at the lowest offset clear of the placed buffers that are alive at the same time
+    std::stable_sort(buffers.begin(), buffers.end(), [](const Buffer& a, const Buffer& b) { return a.size > b.size; });
+    workspace_size = 0;
+    for (size_t b = 0; b < buffers.size(); ++b) {
+        std::vector<std::pair<size_t, size_t>> taken;
+        for (size_t p = 0; p < b; ++p) {
+            if (buffers[p].first <= buffers[b].last && buffers[b].first <= buffers[p].last)
+                taken.push_back(std::make_pair(*buffers[p].offset, *buffers[p].offset + buffers[p].size));
+        }
+        std::sort(taken.begin(), taken.end());
+        size_t offset = 0;
+        for (const std::pair<size_t, size_t>& range : taken) {
+            if (offset + buffers[b].size <= range.first)
+                break;
+            offset = std::max(offset, range.second);
+        }
+        *buffers[b].offset = offset;
+        workspace_size = std::max(workspace_size, offset + buffers[b].size);
+    }
+}
+
+size_t LayerGraph::unplanned_bytes() const {
+    size_t floats = 0;
+    for (const GraphNode& node : nodes)
+        floats += node.size + node.scratch;
+    return floats * sizeof(float);
+}
+
+std::string LayerGraph::plan_to_string() const {
+
+    std::string text;
+    char line[200];
+    snprintf(line, sizeof(line), "  %-16s %-8s %-12s %9s %9s %9s %9s  %s\n", "node", "op", "shape", "output", "offset",
+        "scratch", "offset", "live");
+    text += line;
+    for (int n = 0; n < (int)nodes.size(); ++n) {
+        const GraphNode& node = nodes[n];
+        char shape[32];
+        snprintf(shape, sizeof(shape), "%dx%dx%d", node.maps, node.length, node.length);
+        const char* op = (node.op == GRAPH_CONV && has_fused_kernel(node)) ? "conv*" : op_names[node.op];
+        snprintf(line, sizeof(line), "  %-16s %-8s %-12s %9u %9u %9u %9u  %d-%d\n", node.label.c_str(), op, shape,
+            (unsigned)node.size, (unsigned)node.offset, (unsigned)node.scratch, (unsigned)node.scratch_offset,
+            n, node.last_use);
+        text += line;
+    }
+    snprintf(line, sizeof(line), "  (sizes and offsets in floats, conv*: fused SimdKernels convolution + ReLU + pooling)\n"
+        "workspace: %.1f KB per context, one buffer per node: %.1f KB\n",
+        workspace_bytes() / 1024.0, unplanned_bytes() / 1024.0);
+    text += line;
+    return text;
+}
+
+void LayerGraph::run_fused_conv(const GraphNode& node, const float* in, float* out) const {
+
+    const GraphNode& input = nodes[node.input];
+    const int kk = node.kernel * node.kernel;
+    const float* inMaps[Lenet5Dims::C1_MAPS];
+    const float* kernels[Lenet5Dims::C1_MAPS];
+    for (int m = 0; m < node.maps; ++m) {
+        int numInputs = node.table.empty() ? input.maps : (int)node.table[m].size();
+        for (int j = 0; j < numInputs; ++j) {
+            int c = node.table.empty() ? j : node.table[m][j];
+            inMaps[j] = in + c * input.length * input.length;
+            kernels[j] = node.kernels.data() + ((size_t)m * input.maps + j) * kk;
+        }
+        float* outMap = out + m * node.length * node.length;
+        if (input.length == Lenet5Dims::IN_LEN)
+            simd->conv_relu_pool_c1(inMaps, kernels, node.bias[m], outMap);
+        else
+            simd->conv_relu_pool_c3[numInputs](inMaps, kernels, node.bias[m], outMap);
+    }
+}
+
+void LayerGraph::run_conv(const GraphNode& node, const float* in, float* out, float* scratch) const {
+
+    // im2col + GEMM
+    const GraphNode& input = nodes[node.input];
+    const int kk = node.kernel * node.kernel;
+    const int convSize = node.conv_length * node.conv_length;
+    float* cols = scratch;
+    float* partial = cols + (size_t)input.maps * kk * convSize;
+    float* conv = (node.pool > 0) ? partial + largest_group(node) * convSize : out;
+
+    im2col(in, input.maps, input.length, node.kernel, cols);
+    if (node.table.empty()) {
+        sgemm(node.maps, convSize, input.maps * kk, node.kernels.data(), input.maps * kk, cols, convSize,
+            conv, convSize, false);
+    }
+    else {
+        // each input map's kernels times its im2col rows, added to the output maps they feed
+        memset(conv, 0, (size_t)node.maps * convSize * sizeof(float));
+        for (int c = 0; c < input.maps; ++c) {
+            int first = node.group_start[c], rows = node.group_start[c + 1] - first;
+            if (rows == 0)
+                continue;
+            sgemm(rows, convSize, kk, node.matrix.data() + (size_t)first * kk, kk, cols + (size_t)c * kk * convSize, convSize,
+                partial, convSize, false);
+            for (int r = 0; r < rows; ++r) {
+                float* dst = conv + (size_t)node.group_rows[first + r] * convSize;
+                const float* src = partial + (size_t)r * convSize;
+                for (int i = 0; i < convSize; ++i)
+                    dst[i] += src[i];
+            }
+        }
+    }
+    bias_activation(node.maps, convSize, conv, convSize, node.bias.data(), node.relu);
+    if (node.pool > 0)
+        pool_maps(simd, conv, out, node.maps, node.conv_length, node.pool, true);
+}
+
+int LayerGraph::run_inference(const ImageMap* image, GraphContext& ctx) const {
+
+    if (image->length() != nodes[0].length)
+        return -1;
+
+    // the workspace only grows on the first image
+    ctx.workspace.init(1, 1, 1, (int)workspace_size);
+    float* base = ctx.workspace.data();
+
+    for (const GraphNode& node : nodes) {
+        float* out = base + node.offset;
+        const float* in = (node.input >= 0) ? base + nodes[node.input].offset : nullptr;
+        switch (node.op) {
+        case GRAPH_INPUT: {
+            const unsigned char* pixels = image->data();
+            for (size_t i = 0; i < node.size; ++i)
+                out[i] = (float)pixels[i];
+            break;
+        }
+        case GRAPH_CONV:
+            if (has_fused_kernel(node))
+                run_fused_conv(node, in, out);
+            else
+                run_conv(node, in, out, base + node.scratch_offset);
+            break;
+        case GRAPH_FC:
+            simd->gemv(node.matrix.data(), in, node.matrix.h(), node.bias.data(), out, node.maps, node.relu);
+            break;
+        case GRAPH_RELU:
+            memcpy(out, in, node.size * sizeof(float));
+            simd->relu(out, (int)node.size);
+            break;
+        case GRAPH_MAXPOOL:
+        case GRAPH_AVGPOOL:
+            pool_maps(simd, in, out, node.maps, nodes[node.input].length, node.kernel, node.op == GRAPH_MAXPOOL);
+            break;
+        }
+    }
+
+    // treat the largest output as the prediction (the later one on a tie, as Lenet5Model)
+    const float* outputs = base + nodes.back().offset;
+    ctx.outputs = outputs;
+    int maxIdx = 0;
+    for (int i = 1; i < (int)nodes.back().size; ++i) {
+        if (outputs[i] >= outputs[maxIdx])
+            maxIdx = i;
+    }
+    return maxIdx;
+}
+
+void print_graph_usage() {
+    printf("usage: lenet5 graph [options]               run a network described as a layer graph and compare it with lenet-5\n");
+    printf("  -g file.graph      layer graph (default params/lenet5.graph)\n");
+    printf("  -m model.bin       binary model with the weights of its conv / fc nodes (default params/*.txt)\n");
+    printf("  -d dataset         CSV or MNIST IDX images file (default ./dataset/*.csv)\n");
+    printf("  -f 0|1             fold ReLU and pooling into the layers before them (default 1)\n");
+}
+
+bool parse_graph_args(int argc, char* argv[], GraphOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        if (strcmp(arg, "-g") == 0) {
+            options.graph_path = value;
+        }
+        else if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else if (strcmp(arg, "-f") == 0 && (strcmp(value, "0") == 0 || strcmp(value, "1") == 0)) {
+            options.fuse = strcmp(value, "1") == 0;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_graph_report(const GraphOptions& options) {
+
+    const LayerGraph graph(options.graph_path, options.model_path, options.fuse);
+    if (!graph.is_loaded())
+        return false;
+    printf("%s (%s)\n%s", options.graph_path, options.fuse ? "fused" : "not fused", graph.plan_to_string().c_str());
+
+    const Lenet5Model lenet5(options.model_path);
+    GraphContext graphContext;
+    InferenceContext context;
+    ImageMap image(Lenet5Dims::IN_LEN);
+
+    std::vector<const char*> datasets;
+    if (options.dataset_path != nullptr) {
+        datasets.push_back(options.dataset_path);
+    }
+    else {
+        datasets.push_back("./dataset/test_dataset.csv");
+        datasets.push_back("./dataset/test_dataset_2.csv");
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    double graphSeconds = 0.0, modelSeconds = 0.0;
+    size_t numImages = 0, correct = 0, agree = 0;
+    float maxDiff = 0.f;
+    for (const char* path : datasets) {
+        DatasetReader reader;
+        if (!reader.open(path))
+            return false;
+        while (reader.next(&image)) {
+            Clock::time_point t0 = Clock::now();
+            int digit = graph.run_inference(&image, graphContext);
+            Clock::time_point t1 = Clock::now();
+            int expected = lenet5.run_inference(&image, context);
+            Clock::time_point t2 = Clock::now();
+            graphSeconds += std::chrono::duration<double>(t1 - t0).count();
+            modelSeconds += std::chrono::duration<double>(t2 - t1).count();
+
+            ++numImages;
+            correct += (digit == image.get_label() - '0') ? 1 : 0;
+            agree += (digit == expected) ? 1 : 0;
+            if (graph.num_outputs() == Lenet5Dims::OUT_LEN) {
+                for (int i = 0; i < Lenet5Dims::OUT_LEN; ++i) {
+                    float diff = fabsf(graphContext.get_outputs()[i] - context.get_outputs()[i]);
+                    maxDiff = (diff > maxDiff) ? diff : maxDiff;
+                }
+            }
+        }
+    }
+    if (numImages == 0) {
+        fprintf(stderr, "no images to run\n");
+        return false;
+    }
+
+    printf("%zu images: accuracy %.2f%%, same digit as Lenet5Model on %zu", numImages, 100.0 * correct / numImages, agree);
+    if (graph.num_outputs() == Lenet5Dims::OUT_LEN)
+        printf(", outputs within %g", maxDiff);
+    printf("\n%.2f us per image (Lenet5Model: %.2f us)\n", 1e6 * graphSeconds / numImages, 1e6 * modelSeconds / numImages);
+    return true;
+}
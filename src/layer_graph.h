@@ -0,0 +1,167 @@
+#ifndef LAYER_GRAPH_H
+#define LAYER_GRAPH_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "tensor.h"
+#include "arena.h"
+#include "imagemap.h"
+#include "simd.h"
+
+// Network described as a graph of layers in a text file ("lenet5 graph", "lenet5 -g file"), so variants of
+// LeNet-5 run without rebuilding
+//
+// description:  one node per line, "name op [input] key=value ...", '#' starts a comment; the input is the
+//               name of an earlier node (default: the node before), e.g. params/lenet5.graph:
+//                   in    input          maps=1 length=32
+//                   c1    conv     in    maps=6 kernel=5
+//                   r1    relu     c1
+//                   s2    maxpool  r1    size=2
+//                   c3    conv     s2    maps=16 kernel=5 table=lenet5
+//                   ...
+// ops:          input    maps= length=                  the 8-bit image, as floats
+//               conv     maps= kernel= [table=]         valid convolution, weights "<name>.kernels" (maps x in maps
+//                                                       x kernel x kernel) and "<name>.bias" of the model file;
+//                                                       table: the input maps of each output map, "0,1,2/1,2,3/..."
+//                                                       or "lenet5" (C3_TABLE), kernel (m, j) belongs to the j-th
+//                                                       input of map m
+//               fc       outputs=                       "<name>.weights" (outputs x inputs) and "<name>.bias"
+//               relu
+//               maxpool  size=    avgpool  size=        size x size windows, stride size
+//               weights=prefix takes the tensors of a conv / fc node from another name
+// fusion:       ReLU and pooling are folded into the conv / fc node before them, and a convolution whose kernel
+//               covers its whole input becomes an fc node (C5); conv + ReLU + 2x2 max pooling with the LeNet-5
+//               shapes runs on the fused SimdKernels of Lenet5Model, without storing the convolution maps
+// memory:       every node's output (and its scratch, e.g. the im2col matrix) gets an offset in one workspace per
+//               GraphContext: buffers whose lifetimes (from the node that writes them to the last node that reads
+//               them) overlap never share memory, the others do, placed largest first at the lowest free offset.
+//               For a chain this is a ping-pong between two buffers, so the workspace is about the largest two
+//               adjacent activations instead of the sum of all of them.
+
+enum GraphOp {
+    GRAPH_INPUT,
+    GRAPH_CONV,
+    GRAPH_FC,
+    GRAPH_RELU,
+    GRAPH_MAXPOOL,
+    GRAPH_AVGPOOL
+};
+
+struct GraphNode {
+    std::string name;
+    std::string label;      // name with the nodes fused into it, e.g. "c1+r1+s2"
+    GraphOp op;
+    int input;              // node index, -1 for GRAPH_INPUT
+    int maps, length;       // output shape: maps x length x length (fc: outputs x 1 x 1)
+
+    // conv / pooling
+    int kernel;             // conv kernel, pooling window
+    std::vector<std::vector<int>> table;    // conv: input maps of each output map (empty: all of them)
+    // fused into conv / fc
+    bool relu;
+    int pool;               // max pooling window after the convolution (0: none)
+    int conv_length;        // conv: length of the maps before pooling
+
+    // parameters, copied out of the model
+    std::string weights;    // tensor name prefix
+    Tensor<float> kernels;  // conv: maps x in maps x kernel x kernel, fc: outputs x inputs
+    Tensor<float> matrix;   // conv: per input map, rows of the output maps it feeds (im2col GEMM); fc: GEMV panels
+    std::vector<int> group_start;   // conv: first row of each input map in matrix
+    std::vector<int> group_rows;    // conv: output map of each row
+    Tensor<float> bias;
+
+    // memory plan, in floats
+    size_t size;            // output
+    size_t scratch;         // used while the node runs
+    size_t offset, scratch_offset;
+    int last_use;           // last node reading the output
+
+    GraphNode() : op(GRAPH_INPUT), input(-1), maps(0), length(0), kernel(0), relu(false), pool(0), conv_length(0),
+        size(0), scratch(0), offset(0), scratch_offset(0), last_use(0) {}
+};
+
+class LayerGraph;
+class Lenet5Model;
+
+// per-thread workspace of a LayerGraph; any number of contexts can share one graph
+class GraphContext {
+private:
+    Arena arena;
+    Tensor<float> workspace;
+    const float* outputs;
+
+    GraphContext(const GraphContext&);
+    GraphContext& operator=(const GraphContext&);
+
+public:
+    GraphContext();
+
+    // outputs of the last node for the last image run through LayerGraph::run_inference
+    const float* get_outputs() const { return outputs; }
+    const Arena& get_arena() const { return arena; }
+
+    friend class LayerGraph;
+};
+
+// immutable once loaded, safe to share between threads
+class LayerGraph {
+private:
+    const SimdKernels* simd;
+    std::vector<GraphNode> nodes;   // in execution order, the last one is the output
+    size_t workspace_size;          // floats
+    bool loaded;
+
+    bool parse(const char* graph_path);
+    bool load_weights(const char* model_path);
+    // the params/*.txt parameters under the tensor names of the model file
+    static const Tensor<float>* lenet5_tensor(const Lenet5Model& model, const std::string& name);
+    void fuse();
+    void plan();
+    void pack();
+
+    void run_conv(const GraphNode& node, const float* in, float* out, float* scratch) const;
+    void run_fused_conv(const GraphNode& node, const float* in, float* out) const;
+    bool has_fused_kernel(const GraphNode& node) const;
+
+    LayerGraph(const LayerGraph&);
+    LayerGraph& operator=(const LayerGraph&);
+
+public:
+    // reads the description and the weights of its conv / fc nodes from the binary model (nullptr: params/*.txt,
+    // for the tensor names of LeNet-5); fuse: fold ReLU / pooling into the layers before them
+    LayerGraph(const char* graph_path, const char* model_path, bool fuse = true);
+
+    bool is_loaded() const { return loaded; }
+    const std::vector<GraphNode>& get_nodes() const { return nodes; }
+    // bytes of the workspace of a context
+    size_t workspace_bytes() const { return workspace_size * sizeof(float); }
+    // bytes if every node had a buffer of its own
+    size_t unplanned_bytes() const;
+    int num_outputs() const { return nodes.empty() ? 0 : nodes.back().maps * nodes.back().length * nodes.back().length; }
+
+    // the nodes with their shapes, buffers and lifetimes, and the workspace against one buffer per node
+    std::string plan_to_string() const;
+
+    // predicted digit: the largest output (the later one on a tie, as Lenet5Model); -1 if the image is not
+    // the length of the input node
+    int run_inference(const ImageMap* image, GraphContext& ctx) const;
+};
+
+struct GraphOptions {
+    const char* graph_path;
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;   // nullptr: the two CSV files
+    bool fuse;
+
+    GraphOptions() : graph_path("params/lenet5.graph"), model_path(nullptr), dataset_path(nullptr), fuse(true) {}
+};
+
+// parses the arguments of "lenet5 graph" (argv[0] is the first one after the command)
+bool parse_graph_args(int argc, char* argv[], GraphOptions& options);
+void print_graph_usage();
+
+// prints the memory plan, then runs the dataset through the graph and Lenet5Model and compares them
+bool run_graph_report(const GraphOptions& options);
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef LAYER_PROFILE_H
+#define LAYER_PROFILE_H
+
+#include <chrono>
+
+// build with LENET5_PERF_COUNTERS defined to also count hardware events (cycles, cache and branch misses)
+// in every layer; without it the counters are compiled out entirely
+#ifdef LENET5_PERF_COUNTERS
+#include "perf_counters.h"
+#endif
+
+// layers of LeNet-5, in execution order
+enum Lenet5Layer {
+    LAYER_C1 = 0,
+    LAYER_S2,
+    LAYER_C3,
+    LAYER_S4,
+    LAYER_C5,
+    LAYER_F6,
+    LAYER_OUTPUT,
+    LAYER_COUNT
+};
+
+inline const char* layer_name(int layer) {
+    static const char* names[LAYER_COUNT] = { "C1", "S2", "C3", "S4", "C5", "F6", "OUTPUT" };
+    return (layer >= 0 && layer < LAYER_COUNT) ? names[layer] : "?";
+}
+
+// time (and hardware events) spent in each layer, summed over any number of inferences
+// one profile per thread; add() merges the profiles of several threads
+struct LayerProfile {
+    double seconds[LAYER_COUNT];
+    bool fused[LAYER_COUNT];    // pooling layer computed inside its convolution, its time is counted there
+    long long images;
+#ifdef LENET5_PERF_COUNTERS
+    uint64_t counters[LAYER_COUNT][PERF_EVENT_COUNT];
+    bool counters_valid;        // false if the counters could not be read for some inference
+#endif
+
+    LayerProfile() { reset(); }
+
+    void reset() {
+        for (int l = 0; l < LAYER_COUNT; ++l) {
+            seconds[l] = 0.0;
+            fused[l] = false;
+        }
+        images = 0;
+#ifdef LENET5_PERF_COUNTERS
+        for (int l = 0; l < LAYER_COUNT; ++l)
+            for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+                counters[l][e] = 0;
+        counters_valid = true;
+#endif
+    }
+
+    void add(const LayerProfile& other) {
+        for (int l = 0; l < LAYER_COUNT; ++l) {
+            seconds[l] += other.seconds[l];
+            fused[l] = fused[l] || other.fused[l];
+        }
+        images += other.images;
+#ifdef LENET5_PERF_COUNTERS
+        for (int l = 0; l < LAYER_COUNT; ++l)
+            for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+                counters[l][e] += other.counters[l][e];
+        counters_valid = counters_valid && other.counters_valid;
+#endif
+    }
+};
+
+// stamps the end of every layer of one inference into a LayerProfile
+// without a profile (the default for inference contexts) it does not read the clock at all
+// (with LENET5_PERF_COUNTERS, the counters are read with one system call per layer, which is part of the layer's time)
+class LayerTimer {
+private:
+    LayerProfile* profile;
+    std::chrono::high_resolution_clock::time_point last;
+#ifdef LENET5_PERF_COUNTERS
+    uint64_t last_counters[PERF_EVENT_COUNT];
+#endif
+
+public:
+    explicit LayerTimer(LayerProfile* profile) : profile(profile) {
+        if (profile == nullptr)
+            return;
+#ifdef LENET5_PERF_COUNTERS
+        if (!perf_counters_read(last_counters))
+            profile->counters_valid = false;
+#endif
+        last = std::chrono::high_resolution_clock::now();
+    }
+
+    void end_layer(Lenet5Layer layer) {
+        if (profile == nullptr)
+            return;
+        std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+        profile->seconds[layer] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count() * 1e-9;
+#ifdef LENET5_PERF_COUNTERS
+        uint64_t counters[PERF_EVENT_COUNT];
+        if (profile->counters_valid && perf_counters_read(counters)) {
+            for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+                profile->counters[layer][e] += counters[e] - last_counters[e];
+                last_counters[e] = counters[e];
+            }
+        }
+        else {
+            profile->counters_valid = false;
+        }
+#endif
+        last = std::chrono::high_resolution_clock::now();
+    }
+
+    // end of a convolution with its pooling layer fused into it
+    void end_fused(Lenet5Layer conv, Lenet5Layer pool) {
+        end_layer(conv);
+        if (profile != nullptr)
+            profile->fused[pool] = true;
+    }
+
+    void end_images(int n) {
+        if (profile != nullptr)
+            profile->images += n;
+    }
+};
+
+#endif
@@ -1,87 +1,105 @@
 #include <fstream>
+#include <string>
 #include "lenet5.h"
+#include "gemm.h"
 
-#define MAXCHAR 1000
+#define MAXCHAR 4000    // longest parameter line: 120 F6 weights of up to 13 characters + separators
 
-void Lenet5::init() {
-
-    // initialize C1 maps and kernels
-    for (int n = 0; n < C1_maps.size(); ++n) {
-
-        // initialize feature map
-        C1_maps[n].init(C1_LEN);
+InferenceContext::InferenceContext(bool hugePages) : arena(ARENA_BLOCK_SIZE, hugePages), profile(nullptr)
+{
+    Tensor<float>* tensors[] = {
+        &IN_map, &S2_maps, &S4_maps, &C5_maps, &F6_outputs, &OUT_outputs,
+        &B_cols, &B_column, &B_IN, &B_C1, &B_S2, &B_C3, &B_S4, &B_C5, &B_F6, &B_OUT,
+        &conv_scratch.input, &conv_scratch.product, &conv_scratch.work, &H_inputs, &H_column,
+    };
+    for (size_t t = 0; t < sizeof(tensors) / sizeof(tensors[0]); ++t)
+        tensors[t]->set_arena(&arena);
+    H_pairs.set_arena(&arena);
+
+    // the single-image activations; the batch buffers take their size from the first batch
+    IN_map.init(1, 1, Lenet5Model::IN_LEN, Lenet5Model::IN_LEN);
+    S2_maps.init(1, Lenet5Model::C1_MAPS, Lenet5Model::S2_LEN, Lenet5Model::S2_LEN);
+    S4_maps.init(1, Lenet5Model::C3_MAPS, Lenet5Model::S4_LEN, Lenet5Model::S4_LEN);
+    C5_maps.init(1, Lenet5Model::C5_MAPS, Lenet5Model::C5_LEN, Lenet5Model::C5_LEN);
+    F6_outputs.init(1, 1, 1, Lenet5Model::F6_LEN);
+    OUT_outputs.init(1, 1, 1, Lenet5Model::OUT_LEN);
+}
 
-        // initialize kernel
-        C1_kernels[n].init(CONV);
-        // load parameters
-        char c1_kernel_file[50];
-        sprintf_s(c1_kernel_file, "params/kernel_c1_m%d.txt", n);
-        load_weights(&(C1_kernels[n]), CONV, c1_kernel_file);
+Lenet5Model::Lenet5Model(const char* model_path) : simd(&simd_kernels()),
+    C1_kernels(C1_MAPS, 1, CONV, CONV), C1_bias(1, 1, 1, C1_MAPS),
+    C3_kernels(C3_MAPS, C1_MAPS, CONV, CONV), C3_bias(1, 1, 1, C3_MAPS),
+    C5_kernels(C5_MAPS, C3_MAPS, CONV, CONV), C5_bias(1, 1, 1, C5_MAPS),
+    F6_weights(1, 1, F6_LEN, C5_MAPS), F6_bias(1, 1, 1, F6_LEN),
+    OUT_weights(1, 1, OUT_LEN, F6_LEN), OUT_bias(1, 1, 1, OUT_LEN),
+    precision(PRECISION_FP32), half_activations(false), sparse_format(SPARSE_NONE),
+    C1_algorithm(CONV_DIRECT), C3_algorithm(CONV_DIRECT)
+{
+    weights_loaded = true;
+    bool embedded = false;
+    if (model_path == nullptr || !load_model(model_path)) {
+        // the built-in weights come with their GEMV panels, nothing is read or packed
+        embedded = load_embedded();
+        if (model_path != nullptr)
+            fprintf(stderr, "cannot use model file '%s', loading %s instead\n", model_path,
+                embedded ? "the built-in weights" : "params/");
+        if (!embedded)
+            weights_loaded = init();
     }
+    pack_weights();
+    if (!embedded)
+        pack_panels();
+
+    const char* env = getenv("LENET5_CONV");
+    if (env != NULL)
+        set_conv_algorithms(env);
+    env = getenv("LENET5_PRECISION");
+    if (env != NULL)
+        set_precision(env);
+    env = getenv("LENET5_SPARSE");
+    if (env != NULL)
+        set_sparse(env);
+}
 
-    // initialize S2 maps
-    for (int n = 0; n < S2_maps.size(); ++n) {
-        // initialize feature map
-        S2_maps[n].init(S2_LEN);
-    }
+bool Lenet5Model::init() {
 
+    bool loaded = true;
 
-    // initialize C3 maps
-    for (int n = 0; n < C3_maps.size(); ++n) {
-        // initialize feature map
-        C3_maps[n].init(C3_LEN);
+    // initialize C1 kernels
+    for (int n = 0; n < C1_MAPS; ++n) {
+        // load parameters into the kernel bank
+        Kernel kernel(C1_kernels.plane(n, 0), CONV);
+        char c1_kernel_file[50];
+        sprintf_s(c1_kernel_file, "params/kernel_c1_m%d.txt", n);
+        loaded &= load_weights(&kernel, CONV, c1_kernel_file);
+        C1_bias[n] = kernel.get_bias();
     }
 
     // initialize C3 kernels
-    // 6 maps 3rd dimension = 3
-    for (int n = 0; n <= 5; ++n) {
-        for (int k = 0; k < 3; ++k) {  // 1 kernel for each 3rd dimension of convolution
-            C3_kernels[n][k].init(CONV);
+    // 6 maps 3rd dimension = 3, 9 maps 3rd dimension = 4, 1 map 3rd dimension = 6
+    C3_kernels.zero();
+    for (int n = 0; n < C3_MAPS; ++n) {
+        C3_bias[n] = 0.f;
+        for (int k = 0; k < C3_TABLE.num_inputs[n]; ++k) {  // 1 kernel for each 3rd dimension of convolution
             // load parameters
+            Kernel kernel(C3_kernels.plane(n, k), CONV);
             char c3_kernel_file[50];
             sprintf_s(c3_kernel_file, "params/kernel_c3_m%d_%d.txt", n, k);
-            load_weights(&(C3_kernels[n][k]), CONV, c3_kernel_file);
+            loaded &= load_weights(&kernel, CONV, c3_kernel_file);
+            C3_bias[n] += kernel.get_bias();
         }
     }
-    // 9 maps 3rd dimension = 4
-    for (int n = 6; n <= 14; ++n) {
-        for (int k = 0; k < 4; ++k) {  // 1 kernel for each 3rd dimension of convolution
-            C3_kernels[n][k].init(CONV);
-            // load parameters
-            char c3_kernel_file[50];
-            sprintf_s(c3_kernel_file, "params/kernel_c3_m%d_%d.txt", n, k);
-            load_weights(&(C3_kernels[n][k]), CONV, c3_kernel_file);
-        }
-    }
-    // 1 map 3rd dimension = 6
-    for (int k = 0; k < 6; ++k) {  // 1 kernel for each 3rd dimension of convolution
-        C3_kernels[15][k].init(CONV);
-        // load parameters
-        char c3_kernel_file[50];
-        sprintf_s(c3_kernel_file, "params/kernel_c3_m%d_%d.txt", 15, k);
-        load_weights(&(C3_kernels[15][k]), CONV, c3_kernel_file);
-    }
-
 
-    // initialize S4 maps
-    for (int n = 0; n < S4_maps.size(); ++n) {
-        // initialize feature map
-        S4_maps[n].init(S4_LEN);
-    }
-
-    // initialize C5 maps and kernels
+    // initialize C5 kernels
     for (int n = 0; n < C5_MAPS; ++n) {
-
-        // initialize feature map
-        C5_maps[n].init(C5_LEN);
-
+        C5_bias[n] = 0.f;
         // initialize kernels (convolution kernel for each feature map)
         for (int k = 0; k < C3_MAPS; ++k) {  // 1 kernel for each 3rd dimension of convolution
-            C5_kernels[n][k].init(CONV);
             // load parameters
+            Kernel kernel(C5_kernels.plane(n, k), CONV);
             char c5_kernel_file[50];
             sprintf_s(c5_kernel_file, "params/kernel_c5_m%d_%d.txt", n, k);
-            load_weights(&(C5_kernels[n][k]), CONV, c5_kernel_file);
+            loaded &= load_weights(&kernel, CONV, c5_kernel_file);
+            C5_bias[n] += kernel.get_bias();
         }
     }
 
@@ -89,217 +107,356 @@ void Lenet5::init() {
     // initialize F6 parameters
     for (int n = 0; n < F6_LEN; ++n) {
         // initialize parameters
-        F6_params[n].init(C5_MAPS);
+        FCParams params(C5_MAPS);
 
         // read parameters
         char f6_kernel_file[25];
         sprintf_s(f6_kernel_file, "params/fc_f6_out%d.txt", n);
-        load_weights(&(F6_params[n]), C5_MAPS, f6_kernel_file);
+        loaded &= load_weights(&params, C5_MAPS, f6_kernel_file);
+        memcpy(F6_weights.data() + n * C5_MAPS, params._weights, C5_MAPS * sizeof(float));
+        F6_bias[n] = params._bias;
     }
 
     // initialize OUTPUT parameters
     for (int n = 0; n < OUT_LEN; ++n) {
         // initialize parameters
-        OUT_params[n].init(F6_LEN);
+        FCParams params(F6_LEN);
 
         // read parameters
         char last_kernel_file[30];
         sprintf_s(last_kernel_file, "params/fc_last_out%d.txt", n);
-        load_weights(&(OUT_params[n]), F6_LEN, last_kernel_file);
+        loaded &= load_weights(&params, F6_LEN, last_kernel_file);
+        memcpy(OUT_weights.data() + n * F6_LEN, params._weights, F6_LEN * sizeof(float));
+        OUT_bias[n] = params._bias;
     }
+
+    return loaded;
 }
 
+bool Lenet5Model::load_model(const char* filename) {
 
-void Lenet5::convolution_3d(std::vector<FeatureMap>& in, std::vector<FeatureMap>& out, std::vector<std::vector<Kernel>>& kernels,
-    int numKernels, int mapIds[], int n_start, int n_end, int CONV_LENGTH, int LAYER_LENGTH)
-{
-    // perform convolution
-    for (int n = n_start; n <= n_end; ++n) {
-        //printf("Convolution: Map %d\n", n);
-        for (int i = 0; i < LAYER_LENGTH; ++i) {  // stride = 1
-            for (int j = 0; j < LAYER_LENGTH; ++j) {  // stride = 1
-                float convOut = 0;
-                // 3-dimensional convolution
-                for (int k = 0; k < numKernels; ++k) {
-                    convOut += convolution(in[mapIds[k]], i, j, CONV_LENGTH, kernels[n][k]);
-                }
-                convOut = relu(convOut);
-                out[n].set_cell(convOut, i, j);
-                //printf("%.2f ", convOut);
-            }
-            //printf("\n");
-        }
+    if (!model_file.open(filename))
+        return false;
 
-        // update map indexes
-        for (int k = 0; k < numKernels; ++k) {
-            mapIds[k] = (mapIds[k] + 1) % 6;
+    // every weight tensor becomes a view into the read-only mapping
+    struct {
+        Tensor<float>* tensor;
+        const char* name;
+    } weights[] = {
+        { &C1_kernels, "c1.kernels" }, { &C1_bias, "c1.bias" },
+        { &C3_kernels, "c3.kernels" }, { &C3_bias, "c3.bias" },
+        { &C5_kernels, "c5.kernels" }, { &C5_bias, "c5.bias" },
+        { &F6_weights, "f6.weights" }, { &F6_bias, "f6.bias" },
+        { &OUT_weights, "out.weights" }, { &OUT_bias, "out.bias" },
+    };
+
+    const size_t numWeights = sizeof(weights) / sizeof(weights[0]);
+
+    // look every tensor up before wrapping any: on a failure the tensors must still own their memory,
+    // as the constructor falls back to init(), which writes into them
+    const float* data[numWeights];
+    for (size_t t = 0; t < numWeights; ++t) {
+        const Tensor<float>& tensor = *weights[t].tensor;
+        data[t] = model_file.tensor(weights[t].name, tensor.n(), tensor.c(), tensor.h(), tensor.w());
+        if (data[t] == nullptr) {
+            model_file.close();
+            return false;
         }
     }
+    for (size_t t = 0; t < numWeights; ++t) {
+        Tensor<float>& tensor = *weights[t].tensor;
+        tensor.wrap(const_cast<float*>(data[t]), tensor.n(), tensor.c(), tensor.h(), tensor.w());
+    }
+
+    return true;
 }
 
-void Lenet5::max_pooling_layer(std::vector<FeatureMap>& in, std::vector<FeatureMap>& out, int OUT_LENGTH) {
+bool Lenet5Model::save_model(const char* filename) const {
 
-    // perform max pooling
-    for (int n = 0; n < out.size(); ++n) {
-        //printf("Pooling: Map %d\n", n);
-        for (int i = 0; i < OUT_LENGTH; ++i) {
-            for (int j = 0; j < OUT_LENGTH; ++j) {
-                float max = max_pool(&(in[n]), i * 2, j * 2, 2); // stride = 2
-                out[n].set_cell(max, i, j);
-                //printf("%.2f ", max);
-            }
-            //printf("\n");
-        }
+    const Tensor<float>* weights[] = { &C1_kernels, &C1_bias, &C3_kernels, &C3_bias, &C5_kernels, &C5_bias,
+        &F6_weights, &F6_bias, &OUT_weights, &OUT_bias };
+    const char* names[] = { "c1.kernels", "c1.bias", "c3.kernels", "c3.bias", "c5.kernels", "c5.bias",
+        "f6.weights", "f6.bias", "out.weights", "out.bias" };
+
+    std::vector<ModelTensorData> tensors;
+    for (size_t t = 0; t < sizeof(weights) / sizeof(weights[0]); ++t) {
+        ModelTensorData tensor = { names[t], { weights[t]->n(), weights[t]->c(), weights[t]->h(), weights[t]->w() }, weights[t]->data() };
+        tensors.push_back(tensor);
     }
-}
 
-int Lenet5::run_inference(ImageMap* image) {
+    return ModelFile::write(filename, tensors);
+}
 
-    //image->print();
+void Lenet5Model::copy_weights() {
 
-    // layer C1 convolution
-    for (int n = 0; n < C1_maps.size(); ++n) {
+    // the GEMV panels too: with the built-in weights they are views of the executable's read-only data
+    Tensor<float>* weights[] = { &C1_kernels, &C1_bias, &C3_kernels, &C3_bias, &C5_kernels, &C5_bias,
+        &F6_weights, &F6_bias, &OUT_weights, &OUT_bias, &C5_panels, &F6_panels, &OUT_panels };
 
-        //printf("Convolution: Map %d\n", n);
-        for (int i = 0; i < C1_LEN; ++i) {  // stride = 1
-            for (int j = 0; j < C1_LEN; ++j) {  // stride = 1
-                float convOut = convolution(*image, i, j, CONV, C1_kernels[n]);
-                C1_maps[n].set_cell(relu(convOut), i, j);
-                //printf("%.2f ", convOut);
-            }
-            //printf("\n");
-        }
+    // a copy always owns its data, so assigning it back also turns a view of the mapping into an owner
+    for (size_t t = 0; t < sizeof(weights) / sizeof(weights[0]); ++t) {
+        Tensor<float> copy(*weights[t]);
+        *weights[t] = copy;
     }
+    model_file.close();
+}
 
-    // layer S2 max pooling
-    max_pooling_layer(C1_maps, S2_maps, S2_LEN);
+uint64_t Lenet5Model::fingerprint() const {
 
-    // layer C3 convolution
-    // 1st 6 C3 feature maps (#0 to #5): take inputs from every contiguous subset of 3 feature maps
-    int initial_ids_0[] = { 0, 1, 2 };
-    convolution_3d(S2_maps, C3_maps, C3_kernels, 3, initial_ids_0, 0, 5, CONV, C3_LEN);
-    // next 6 C3 feature maps (#6 to #11): take inputs from every contiguous subset of 4 feature maps
-    int initial_ids_1[] = { 0, 1, 2, 3 };
-    convolution_3d(S2_maps, C3_maps, C3_kernels, 4, initial_ids_1, 6, 11, CONV, C3_LEN);
-    // next 3 C3 feature maps (#12 to #14): take inputs from some discontinous subsets of 4 feature maps
-    int initial_ids_2[] = { 0, 1, 3, 4 };
-    convolution_3d(S2_maps, C3_maps, C3_kernels, 4, initial_ids_2, 12, 14, CONV, C3_LEN);
-    // last 1 C3 feature map (#15): takes input from all 6 S2 feature maps
-    int initial_ids_3[] = { 0, 1, 2, 3, 4, 5 };
-    convolution_3d(S2_maps, C3_maps, C3_kernels, 6, initial_ids_3, 15, 15, CONV, C3_LEN);
+    const Tensor<float>* weights[] = { &C1_kernels, &C1_bias, &C3_kernels, &C3_bias, &C5_kernels, &C5_bias,
+        &F6_weights, &F6_bias, &OUT_weights, &OUT_bias };
 
+    uint64_t hash = MODEL_CHECKSUM_SEED;
+    for (size_t t = 0; t < sizeof(weights) / sizeof(weights[0]); ++t)
+        hash = ModelFile::checksum(weights[t]->data(), weights[t]->size() * sizeof(float), hash);
+    return hash;
+}
 
-    // layer S4 max pooling
-    max_pooling_layer(C3_maps, S4_maps, S4_LEN);
 
-    // layer C5 convolution
-    // each feature map takes input from all 16 feature maps
-    int c5_map_ids[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };    // hardcoded bc lazy to change the method
-    convolution_3d(S4_maps, C5_maps, C5_kernels, 16, c5_map_ids, 0, 119, CONV, C5_LEN);
+void Lenet5Model::pack_panels() {
 
-    // layer F6 fully-connected
-    //printf("FC LAYER F6:\n");
-    for (int n = 0; n < F6_LEN; ++n) {
-        //fully_connected_output + ReLU
-        F6_outputs[n] = relu(fully_connected_output(C5_maps, F6_params[n]));
-        //printf("%.2f ", F6_outputs[n]);
-    }
+    // the weight tensors are row-major (outputs x inputs) matrices; each panel is (inputs x GEMV_PANEL outputs)
+    struct {
+        Tensor<float>* panels;
+        const Tensor<float>* weights;
+        int numRows;
+        int n;
+    } layers[] = {
+        { &C5_panels, &C5_kernels, C5_MAPS, C3_MAPS * CONV * CONV },
+        { &F6_panels, &F6_weights, F6_LEN, C5_MAPS },
+        { &OUT_panels, &OUT_weights, OUT_LEN, F6_LEN },
+    };
 
-    // OUTPUT layer: fully-connected (skip softmax function), 10 outputs
-    //printf("OUTPUT LAYER:\n");
-    for (int n = 0; n < OUT_LEN; ++n) {
-        // fully connected
-        OUT_outputs[n] = fully_connected_output(F6_outputs, OUT_params[n]);
-        //printf("%.2f ", OUT_outputs[n]);
+    for (size_t l = 0; l < sizeof(layers) / sizeof(layers[0]); ++l) {
+        layers[l].panels->init(gemv_num_panels(layers[l].numRows), 1, layers[l].n, GEMV_PANEL);
+        pack_gemv_panels(layers[l].weights->data(), layers[l].numRows, layers[l].n, layers[l].panels->data());
     }
+}
 
-    // treat the largest output as the NN's prediction
-    int maxIdx = 0;
-    //printf("OUTPUTS:");
-    //printf("%.4f ", OUT_outputs[0]);
-    for (int i = 1; i < OUT_LEN; ++i) {
-        //printf("%.4f ", OUT_outputs[i]);
-        if (OUT_outputs[i] >= OUT_outputs[maxIdx])  // take the "later" one; as this is the implementation for Verilog for now
-        {
-            //printf("New max! ");
-            maxIdx = i;
+size_t Lenet5Model::weight_bytes() const {
+
+    size_t bytes = (C1_kernels.size() + C1_bias.size() + C3_kernels.size() + C3_bias.size()) * sizeof(float);
+    bytes += (C5_bias.size() + F6_bias.size() + OUT_bias.size()) * sizeof(float);
+    if (sparse_format == SPARSE_CSR)
+        return bytes + C5_csr.bytes() + F6_csr.bytes() + OUT_csr.bytes();
+    if (sparse_format == SPARSE_BLOCK)
+        return bytes + C5_blocks.bytes() + F6_blocks.bytes() + OUT_blocks.bytes();
+    size_t weights = C5_kernels.size() + F6_weights.size() + OUT_weights.size();
+    bytes += weights * ((precision == PRECISION_FP32) ? sizeof(float) : sizeof(uint16_t));
+    return bytes;
+}
+
+bool Lenet5Model::set_conv_algorithm(Lenet5Layer layer, ConvAlgorithm algorithm) {
+
+    if (layer == LAYER_C1) {
+        C1_fast.reset(create_fast_conv(algorithm, C1_kernels.data(), C1_bias.data(), C1_MAPS, 1, IN_LEN));
+        C1_algorithm = algorithm;
+        return true;
+    }
+    if (layer == LAYER_C3) {
+        // dense 16 x 6 kernel bank indexed by S2 map, zero where a C3 map is not connected
+        Tensor<float> kernels(C3_MAPS, C1_MAPS, CONV, CONV);
+        kernels.zero();
+        for (int n = 0; n < C3_MAPS; ++n) {
+            for (int k = 0; k < C3_TABLE.num_inputs[n]; ++k)
+                memcpy(kernels.plane(n, C3_TABLE.inputs[n][k]), C3_kernels.plane(n, k), CONV * CONV * sizeof(float));
         }
+        C3_fast.reset(create_fast_conv(algorithm, kernels.data(), C3_bias.data(), C3_MAPS, C1_MAPS, S2_LEN));
+        C3_algorithm = algorithm;
+        return true;
     }
-    //printf("\n");
 
-    return maxIdx;
+    fprintf(stderr, "layer %s is not a 5x5 convolution layer\n", layer_name(layer));
+    return false;
 }
 
-float Lenet5::convolution(const ImageMap& inputMap, int i_start, int j_start, int convLength, const Kernel& weights) {
-
-    float convResult = 0;
-    for (int i = 0; i < convLength; ++i) {
-        for (int j = 0; j < convLength; ++j) {
-            convResult += (float)(inputMap._values[i + i_start][j + j_start]) * weights._values[i][j];
-
-            //printf("input:%.2f, weight:%.2f, Conv:%.2f ", (float)(inputMap._values[i + i_start][j + j_start]), weights._values[i][j], convResult);
+bool Lenet5Model::set_conv_algorithms(const char* spec) {
+
+    // comma-separated "algorithm" (C1 and C3) or "layer=algorithm" entries
+    std::string list(spec);
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string entry = list.substr(begin, end - begin);
+        begin = end + 1;
+
+        size_t eq = entry.find('=');
+        std::string layerName = (eq == std::string::npos) ? "" : entry.substr(0, eq);
+        std::string name = (eq == std::string::npos) ? entry : entry.substr(eq + 1);
+        ConvAlgorithm algorithm;
+        if (!parse_conv_algorithm(name.c_str(), algorithm)) {
+            fprintf(stderr, "unknown convolution algorithm '%s' (direct, winograd2, winograd4, fft)\n", name.c_str());
+            return false;
+        }
+        if (layerName == "" || layerName == "c1" || layerName == "C1")
+            set_conv_algorithm(LAYER_C1, algorithm);
+        if (layerName == "" || layerName == "c3" || layerName == "C3")
+            set_conv_algorithm(LAYER_C3, algorithm);
+        if (layerName != "" && layerName != "c1" && layerName != "C1" && layerName != "c3" && layerName != "C3") {
+            fprintf(stderr, "unknown convolution layer '%s' (c1, c3)\n", layerName.c_str());
+            return false;
         }
     }
+    return true;
+}
+
+void Lenet5Model::convolution_pooling_c1(const Tensor<float>& in, Tensor<float>& out) const {
 
-    return convResult + weights._bias;
+    // each C1 feature map convolves the input image, and is pooled 2x2 into the S2 map right away
+    const float* inMap = in.data();
+    for (int n = 0; n < C1_MAPS; ++n) {
+        //printf("Convolution + pooling: Map %d\n", n);
+        const float* kernel = C1_kernels.data() + n * CONV * CONV;
+        simd->conv_relu_pool_c1(&inMap, &kernel, C1_bias[n], out.data() + n * S2_LEN * S2_LEN);
+    }
 }
 
-float Lenet5::convolution(const FeatureMap& inputMap, int i_start, int j_start, int convLength, const Kernel& weights) {
+template<int N>
+void Lenet5Model::convolution_pooling_c3_map(const float* in, float* out) const {
 
-    float convResult = 0;
-    for (int i = 0; i < convLength; ++i) {
-        for (int j = 0; j < convLength; ++j) {
-            convResult += inputMap._values[i + i_start][j + j_start] * weights._values[i][j];
-        }
+    // the number of inputs picks the kernel instantiation, and the input offsets are constants
+    constexpr int numInputs = C3_TABLE.num_inputs[N];
+    const float* inMaps[numInputs];
+    const float* kernels[numInputs];
+    for (int k = 0; k < numInputs; ++k) {
+        inMaps[k] = in + C3_TABLE.inputs[N][k] * S2_LEN * S2_LEN;
+        kernels[k] = C3_kernels.data() + (N * C1_MAPS + k) * CONV * CONV;
     }
+    simd->conv_relu_pool_c3[numInputs](inMaps, kernels, C3_bias[N], out + N * S4_LEN * S4_LEN);
+}
 
-    return convResult + weights._bias;
+// calls convolution_pooling_c3_map<N> for every C3 map N
+template<int... N>
+void Lenet5Model::convolution_pooling_c3_maps(const float* in, float* out, std::integer_sequence<int, N...>) const {
+    int expand[] = { (convolution_pooling_c3_map<N>(in, out), 0)... };
+    (void)expand;
 }
 
-float Lenet5::relu(float in) {
-    return (in < 0.f) ? 0.f : in;
+void Lenet5Model::convolution_pooling_c3(const Tensor<float>& in, Tensor<float>& out) const {
+
+    // 3-dimensional convolution of each C3 feature map over its S2 inputs (see C3_TABLE), pooled into S4
+    convolution_pooling_c3_maps(in.data(), out.data(), std::make_integer_sequence<int, C3_MAPS>());
 }
 
-float Lenet5::max_pool(FeatureMap* inputMap, int i_start, int j_start, int poolSize) {
+void Lenet5Model::fully_connected(Lenet5Layer layer, const float* in, float* out, InferenceContext& ctx) const {
 
-    int max = inputMap->_values[i_start][j_start];
-    for (int i = 0; i < poolSize; i++) {
-        for (int j = 0; j < poolSize; j++) {
-            float thisVal = inputMap->_values[i + i_start][j + j_start];
-            if (thisVal > max)
-                max = thisVal;
-        }
+    int numRows = (layer == LAYER_C5) ? C5_MAPS : (layer == LAYER_F6) ? F6_LEN : OUT_LEN;
+    int n = (layer == LAYER_C5) ? C3_MAPS * CONV * CONV : (layer == LAYER_F6) ? C5_MAPS : F6_LEN;
+    const float* bias = (layer == LAYER_C5) ? C5_bias.data() : (layer == LAYER_F6) ? F6_bias.data() : OUT_bias.data();
+    bool relu = (layer != LAYER_OUTPUT);
+
+    if (sparse_format == SPARSE_CSR) {
+        const CsrMatrix& csr = (layer == LAYER_C5) ? C5_csr : (layer == LAYER_F6) ? F6_csr : OUT_csr;
+        simd->gemv_csr(csr.values.data(), csr.columns.data(), csr.row_start.data(), in, bias, out, numRows, relu);
+        return;
+    }
+    if (sparse_format == SPARSE_BLOCK) {
+        const BlockSparsePanels& blocks = (layer == LAYER_C5) ? C5_blocks : (layer == LAYER_F6) ? F6_blocks : OUT_blocks;
+        simd->gemv_block_sparse(blocks.values.data(), blocks.columns.data(), blocks.panel_start.data(), in, bias, out, numRows, relu);
+        return;
+    }
+    if (precision == PRECISION_FP32) {
+        const Tensor<float>& panels = (layer == LAYER_C5) ? C5_panels : (layer == LAYER_F6) ? F6_panels : OUT_panels;
+        simd->gemv(panels.data(), in, n, bias, out, numRows, relu);
+        return;
     }
 
-    return max;
+    const Tensor<uint16_t>& panels = (layer == LAYER_C5) ? C5_half : (layer == LAYER_F6) ? F6_half : OUT_half;
+    if (half_activations && precision == PRECISION_BF16 && simd->gemv_bf16_pairs != nullptr) {
+        // bf16 x bf16 products in hardware
+        int n2 = (n + 1) / 2;
+        ctx.H_pairs.init(1, 1, 1, n2);
+        for (int j = 0; j < n2; ++j) {
+            uint32_t hi = (j * 2 + 1 < n) ? float_to_bf16(in[j * 2 + 1]) : 0;
+            ctx.H_pairs[j] = float_to_bf16(in[j * 2]) | (hi << 16);
+        }
+        simd->gemv_bf16_pairs(panels.data(), ctx.H_pairs.data(), n, bias, out, numRows, relu);
+        return;
+    }
+    if (half_activations) {
+        ctx.H_inputs.init(1, 1, 1, n);
+        round_to_precision(in, n, precision, ctx.H_inputs.data());
+        in = ctx.H_inputs.data();
+    }
+    if (precision == PRECISION_BF16)
+        simd->gemv_bf16(panels.data(), in, n, bias, out, numRows, relu);
+    else
+        simd->gemv_fp16(panels.data(), in, n, bias, out, numRows, relu);
 }
 
-float Lenet5::fully_connected_output(std::vector<FeatureMap>& inputMaps, const FCParams& params) {
+int Lenet5Model::run_inference(const ImageMap* image, InferenceContext& ctx) const {
 
-    float output = 0;
-    int length = inputMaps[0]._length;
-    for (int n = 0; n < inputMaps.size(); ++n) {    // loop through all input maps
-        for (int i = 0; i < length; ++i) {      // 1st-Dimension of map
-            for (int j = 0; j < length; ++j) {  // 2nd-Dimension of map
-                output += inputMaps[n]._values[i][j] * params._weights[i * length + j];
-            }
-        }
+    //image->print();
+    LayerTimer timer(ctx.profile);
+
+    // layer C1 convolution + layer S2 max pooling
+    const unsigned char* pixels = image->data();
+    for (int i = 0; i < IN_LEN * IN_LEN; ++i)
+        ctx.IN_map[i] = (float)(pixels[i]);
+    if (C1_algorithm == CONV_DIRECT) {
+        convolution_pooling_c1(ctx.IN_map, ctx.S2_maps);
+        timer.end_fused(LAYER_C1, LAYER_S2);
+    }
+    else {
+        ctx.B_C1.init(C1_MAPS, 1, C1_LEN, C1_LEN);
+        C1_fast->run(ctx.IN_map.data(), 1, ctx.B_C1.data(), true, ctx.conv_scratch);
+        timer.end_layer(LAYER_C1);
+        max_pooling_batch(ctx.B_C1.data(), ctx.S2_maps.data(), C1_MAPS, 1, S2_LEN);
+        timer.end_layer(LAYER_S2);
     }
 
-    return output + params._bias;
-}
+    // layer C3 convolution + layer S4 max pooling
+    // 1st 6 C3 feature maps (#0 to #5): take inputs from every contiguous subset of 3 feature maps
+    // next 6 C3 feature maps (#6 to #11): take inputs from every contiguous subset of 4 feature maps
+    // next 3 C3 feature maps (#12 to #14): take inputs from some discontinous subsets of 4 feature maps
+    // last 1 C3 feature map (#15): takes input from all 6 S2 feature maps
+    if (C3_algorithm == CONV_DIRECT) {
+        convolution_pooling_c3(ctx.S2_maps, ctx.S4_maps);
+        timer.end_fused(LAYER_C3, LAYER_S4);
+    }
+    else {
+        ctx.B_C3.init(C3_MAPS, 1, C3_LEN, C3_LEN);
+        C3_fast->run(ctx.S2_maps.data(), 1, ctx.B_C3.data(), true, ctx.conv_scratch);
+        timer.end_layer(LAYER_C3);
+        max_pooling_batch(ctx.B_C3.data(), ctx.S4_maps.data(), C3_MAPS, 1, S4_LEN);
+        timer.end_layer(LAYER_S4);
+    }
+
+    // layer C5 convolution
+    // each feature map takes input from all 16 feature maps, and its 5x5 kernels cover the whole 5x5 S4 maps,
+    // so the layer is a 400 -> 120 matrix-vector product over the contiguous S4 maps (+ ReLU)
+    fully_connected(LAYER_C5, ctx.S4_maps.data(), ctx.C5_maps.data(), ctx);
+    timer.end_layer(LAYER_C5);
 
-float Lenet5::fully_connected_output(std::vector<float>& input, const FCParams& params) {
+    // layer F6 fully-connected + ReLU
+    fully_connected(LAYER_F6, ctx.C5_maps.data(), ctx.F6_outputs.data(), ctx);
+    timer.end_layer(LAYER_F6);
 
-    float output = 0;
-    for (int i = 0; i < input.size(); ++i) {
-        output += input[i] * params._weights[i];
+    // OUTPUT layer: fully-connected (skip softmax function), 10 outputs
+    fully_connected(LAYER_OUTPUT, ctx.F6_outputs.data(), ctx.OUT_outputs.data(), ctx);
+
+    // treat the largest output as the NN's prediction
+    int maxIdx = 0;
+    //printf("OUTPUTS:");
+    //printf("%.4f ", ctx.OUT_outputs[0]);
+    for (int i = 1; i < OUT_LEN; ++i) {
+        //printf("%.4f ", ctx.OUT_outputs[i]);
+        if (ctx.OUT_outputs[i] >= ctx.OUT_outputs[maxIdx])  // take the "later" one; as this is the implementation for Verilog for now
+        {
+            //printf("New max! ");
+            maxIdx = i;
+        }
     }
+    //printf("\n");
+    timer.end_layer(LAYER_OUTPUT);
+    timer.end_images(1);
 
-    return output + params._bias;
+    return maxIdx;
 }
 
-bool Lenet5::load_weights(FCParams* params, int length, const char* filename) {
+bool Lenet5Model::load_weights(FCParams* params, int length, const char* filename) {
 
     FILE* fp;
     errno_t err;
@@ -357,11 +514,11 @@ bool Lenet5::load_weights(FCParams* params, int length, const char* filename) {
     return true;
 }
 
-bool Lenet5::load_weights(Kernel* kernel, int length, const char* filename) {
+bool Lenet5Model::load_weights(Kernel* kernel, int length, const char* filename) {
 
     FILE* fp;
     errno_t err;
-    char str[1600];
+    char str[MAXCHAR];
 
     // open file
     if ((err = fopen_s(&fp, filename, "r")) != 0) { // file opened unsuccessfully
@@ -1,98 +1,281 @@
 #ifndef LENET_5_H
 #define LENET_5_H
 
+#include <memory>
+#include <utility>
 #include <vector>
 #include "map.h"
+#include "tensor.h"
 #include "imagemap.h"
 #include "kernel.h"
 #include "fcparams.h"
+#include "simd.h"
+#include "model_file.h"
+#include "lenet5_dims.h"
+#include "layer_profile.h"
+#include "fast_conv.h"
+#include "sparse.h"
+#include "gemm.h"
 
-class Lenet5 {
+class Lenet5Model;
+class IncrementalContext;    // lenet5_incremental.h
+
+// mutable per-inference state: activations of every layer and batch scratch buffers
+// one context per thread; any number of contexts can share one Lenet5Model
+class InferenceContext {
 private:
-    // variables
-    const int IN_LEN = 32;  // (28x28 with padding)
-    const int C1_LEN = 28;
-    const int S2_LEN = 14;
-    const int C3_LEN = 10;
-    const int S4_LEN = 5;
-    const int C5_LEN = 1;
-    const int F6_LEN = 84;
-    const int OUT_LEN = 10;
-
-    const int C1_MAPS = 6;
-    const int C3_MAPS = 16;
-    const int C5_MAPS = 120;
-
-    const int CONV = 5;
+    // every buffer below is carved from this arena (declared first: it must outlive them), so once the
+    // buffers have grown to the largest batch run through the context, inference allocates nothing
+    Arena arena;
+
+    // input image converted to float
+    Tensor<float> IN_map;
+    // feature maps are (1 x maps x length x length) NCHW tensors
+    // C1 and C3 are pooled as they are computed, only their S2 / S4 outputs are stored
+    Tensor<float> S2_maps;      // 6 feature maps
+    Tensor<float> S4_maps;      // 16 feature maps
+    Tensor<float> C5_maps;      // 120 feature maps
+    Tensor<float> F6_outputs;   // fully-connected layer with 84 outputs
+    Tensor<float> OUT_outputs;  // fully-connected layer with 10 outputs
+
+    // scratch buffers for batched execution, each is (channels x images x length x length)
+    Tensor<float> B_cols;       // S4 maps as the (16 * 25) x images input matrix of C5
+    Tensor<float> B_column;     // one image's outputs of a fully-connected layer (small batches, with H_column)
+    Tensor<float> B_IN, B_C1, B_S2, B_C3, B_S4, B_C5, B_F6, B_OUT;
+    FastConvScratch conv_scratch;   // Winograd / FFT convolution buffers
+
+    // inputs of a fully-connected layer rounded to fp16 / bf16 (Lenet5Model::set_precision with activations),
+    // as floats or as the bf16 pairs of SimdKernels::gemv_bf16_pairs
+    Tensor<float> H_inputs;
+    Tensor<float> H_column;     // one image's inputs in the batched path
+    Tensor<uint32_t> H_pairs;
+
+    LayerProfile* profile;      // time per layer is added here when set
+
+    // not copyable (the buffers point into the arena)
+    InferenceContext(const InferenceContext&);
+    InferenceContext& operator=(const InferenceContext&);
+
+public:
+    // hugePages: back the arena with transparent huge pages (see Arena), by default LENET5_HUGE_PAGES
+    explicit InferenceContext(bool hugePages = arena_huge_pages());
+
+    // adds the time spent in every layer of each following inference to profile (nullptr: stop profiling)
+    void set_profile(LayerProfile* profile) { this->profile = profile; }
+
+    // outputs of the OUTPUT layer for the last image run through run_inference
+    const Tensor<float>& get_outputs() const { return OUT_outputs; }
+
+    const Arena& get_arena() const { return arena; }
 
+    friend class Lenet5Model;
+    friend class Lenet5Int8Model;   // reads the activations for calibration
+    friend class Lenet5FixedModel;  // the same for the fixed-point formats
+};
+
+// immutable network parameters, safe to share between threads once constructed
+// dimensions are the compile-time constants of Lenet5Dims (IN_LEN, C1_MAPS, CONV, ...)
+class Lenet5Model : public Lenet5Dims {
+public:
+    static const int BATCH_TILE = 32;   // max images per pass through the layers in run_inference_batch
+
+private:
+    const SimdKernels* simd;    // convolution, ReLU, pooling and dot product kernels for this CPU
+
+    // kernel banks are (out maps x in maps x 5 x 5) tensors, biases of each output map are summed
     // layer C1
-    std::vector<FeatureMap> C1_maps;    // 6 feature maps
-    std::vector<Kernel> C1_kernels; // convolution kernel for each feature map
-    // layer S2
-    std::vector<FeatureMap> S2_maps;    // 6 feature maps
+    Tensor<float> C1_kernels;   // convolution kernel for each feature map
+    Tensor<float> C1_bias;
     // layer C3
-    std::vector<FeatureMap> C3_maps;    // 16 feature maps
-    std::vector<std::vector<Kernel>> C3_kernels;    // 3d convolution kernel for each output feature map
-    // layer S4
-    std::vector<FeatureMap> S4_maps;    // 16 feature maps
+    Tensor<float> C3_kernels;   // 3d convolution kernel for each output feature map (only the first C3_TABLE.num_inputs[n] are used)
+    Tensor<float> C3_bias;
     // layer C5
-    std::vector<FeatureMap> C5_maps;    // 120 feature maps
-    std::vector<std::vector<Kernel>> C5_kernels;    // 3d convolution kernel for each output feature map
+    Tensor<float> C5_kernels;   // 3d convolution kernel for each output feature map
+    Tensor<float> C5_bias;
     // layer F6
-    std::vector<FCParams> F6_params;    // weights and bias
-    std::vector<float> F6_outputs;  // fully-connected layer with 84 outputs
+    Tensor<float> F6_weights;   // 84 x 120
+    Tensor<float> F6_bias;
     // OUTPUT layer
-    std::vector<FCParams> OUT_params;   // weights and bias
-    std::vector<float> OUT_outputs; // fully-connected layer with 10 outputs
+    Tensor<float> OUT_weights;  // 10 x 84
+    Tensor<float> OUT_bias;
+
+    // binary model the weight tensors above point into (when loaded from one)
+    ModelFile model_file;
+    bool weights_loaded;    // false if any parameter file was missing and randomly initialized
+
+    // C5, F6 and OUTPUT weights packed into GEMV panels (see pack_gemv_panels) for run_inference
+    // C5 is a 400 -> 120 fully-connected layer: its 5x5 kernels cover the whole 5x5 S4 maps
+    Tensor<float> C5_panels;    // 120 x 400 -> 8 panels of 400 x 16
+    Tensor<float> F6_panels;    // 84 x 120 -> 6 panels of 120 x 16
+    Tensor<float> OUT_panels;   // 10 x 84 -> 1 panel of 84 x 16
+
+    // storage precision of the C5, F6 and OUTPUT weights (see set_precision); for fp16 / bf16 both
+    // run_inference and run_inference_batch read these panels (pack_gemv_panels_half) instead of the float weights,
+    // which stay as the masters for save_model, the int8 quantization and switching back to fp32
+    StoragePrecision precision;
+    bool half_activations;      // the inputs of C5, F6 and OUTPUT are rounded to the precision as well
+    Tensor<uint16_t> C5_half, F6_half, OUT_half;
+
+    // sparse copies of the C5, F6 and OUTPUT weights (see set_sparse); the batched path uses the CSR ones
+    // for both formats, as a CSR row times the input matrix already skips the zeros at full vector width
+    SparseFormat sparse_format;
+    CsrMatrix C5_csr, F6_csr, OUT_csr;
+    BlockSparsePanels C5_blocks, F6_blocks, OUT_blocks;
+
+    // convolution algorithm of C1 and C3 (see fast_conv.h), with the kernels transformed for it
+    // (nullptr for CONV_DIRECT: the fused kernels, per image in run_inference_batch too)
+    ConvAlgorithm C1_algorithm, C3_algorithm;
+    std::unique_ptr<FastConv> C1_fast, C3_fast;
 
-    void init();
+    // weights and biases packed for the GEMMs of run_inference_batch (see PackedMatrix)
+    PackedMatrix C1_gemm;   // 6 x 25
+    PackedMatrix C3_gemm;   // 16 x (6 * 25), zero kernels where C3_TABLE has no connection
+    PackedMatrix C5_gemm;   // 120 x 400
+    PackedMatrix F6_gemm;   // 84 x 120
+    PackedMatrix OUT_gemm;  // 10 x 84
+
+    bool init();
+    bool load_model(const char* filename);
+    // points the weights and GEMV panels at the arrays compiled in from lenet5_weights.h (see save_embedded);
+    // false if the executable was built without LENET5_EMBEDDED_WEIGHTS
+    bool load_embedded();
+    void pack_weights();
+    void pack_panels();
+    void pack_half_panels();
+    void build_sparse();
+    // after the C5, F6 or OUTPUT weights changed: repacks every copy of them in use
+    void repack_fully_connected();
 
     // load parameters
     static bool load_weights(Kernel* kernel, int length, const char* filename);
     static bool load_weights(FCParams* params, int length, const char* filename);
 
     // layer operations
-    static void max_pooling_layer(std::vector<FeatureMap>& in, std::vector<FeatureMap>& out, int OUT_LENGTH);
-    static void convolution_3d(std::vector<FeatureMap>& in, std::vector<FeatureMap>& out, std::vector<std::vector<Kernel>>& kernels,
-        int numKernels, int mapIds[], int n_start, int n_end, int CONV_LENGTH, int LAYER_LENGTH);
-
-    // operations
-    static float relu(float in);
-    static float convolution(const ImageMap& inputMap, int i_start, int j_start, int convLength, const Kernel& weights);
-    static float convolution(const FeatureMap& inputMap, int i_start, int j_start, int convLength, const Kernel& weights);
-    static float max_pool(FeatureMap* inputMap, int i_start, int j_start, int poolSize);
-    static float fully_connected_output(std::vector<FeatureMap>& inputMaps, const FCParams& params);
-    static float fully_connected_output(std::vector<float>& input, const FCParams& params);
+    // convolution + ReLU + max pooling of C1 -> S2 and C3 -> S4, without storing the C1 / C3 maps
+    void convolution_pooling_c1(const Tensor<float>& in, Tensor<float>& out) const;
+    void convolution_pooling_c3(const Tensor<float>& in, Tensor<float>& out) const;
+    // one C3 map, with its S2 inputs taken from C3_TABLE at compile time
+    template<int N> void convolution_pooling_c3_map(const float* in, float* out) const;
+    template<int... N> void convolution_pooling_c3_maps(const float* in, float* out, std::integer_sequence<int, N...>) const;
+
+    // batched layer operations, maps are stored as (channels) x (images * length * length)
+    static void im2col(const float* in, int numImages, int inLength, int convLength, float* cols);
+    void max_pooling_batch(const float* in, float* out, int numMaps, int numImages, int outLength) const;
+    // C5, F6 or OUTPUT layer in the selected precision: out = bias + W * in (clamped at 0 for C5 and F6),
+    // for one image (vectors) or n images ((inputs) x n and (outputs) x n matrices)
+    void fully_connected(Lenet5Layer layer, const float* in, float* out, InferenceContext& ctx) const;
+    void fully_connected_batch(Lenet5Layer layer, const float* in, int n, float* out, InferenceContext& ctx) const;
+    void run_batch_tile(const ImageMap* const* images, int n, int* out, float* logits, InferenceContext& ctx) const;
+
+    friend class Lenet5Int8Model;   // quantizes the weights
+    friend class Lenet5FixedModel;  // converts the weights to fixed point
+    friend class Lenet5Trainer;     // starts training from the weights, shares im2col
+    friend class Lenet5NumaReplicas;    // reports the node of the weights
+    friend class LayerGraph;    // takes the params/*.txt weights
+
+    // not copyable (may own a file mapping)
+    Lenet5Model(const Lenet5Model&);
+    Lenet5Model& operator=(const Lenet5Model&);
 
 public:
-    Lenet5() : C1_maps(C1_MAPS), C1_kernels(C1_MAPS), S2_maps(C1_MAPS),
-        C3_maps(C3_MAPS), C3_kernels(C3_MAPS), S4_maps(C3_MAPS),
-        C5_maps(C5_MAPS), C5_kernels(C5_MAPS),
-        F6_params(F6_LEN), F6_outputs(F6_LEN),
-        OUT_params(OUT_LEN), OUT_outputs(OUT_LEN)
-    {
-        // initialize C3 Kernel vectors
-        for (int i = 0; i <= 5; ++i) {
-            for (int n = 0; n < 3; ++n)
-                C3_kernels[i].push_back(Kernel());
-        }
-        for (int i = 6; i <= 14; ++i) {
-            for (int n = 0; n < 4; ++n)
-                C3_kernels[i].push_back(Kernel());
-        }
-        for (int n = 0; n < 6; ++n)
-            C3_kernels[15].push_back(Kernel());
-
-        // initalize C5 Kernel vectors
-        for (int i = 0; i < C5_MAPS; ++i) { // 120
-            for (int n = 0; n < C3_MAPS; ++n)   // 16
-                C5_kernels[i].push_back(Kernel());
-        }
-
-        init();
-    }
+    // loads the parameters from params/*.txt, or uses the ones compiled into the executable
+    // (built with LENET5_EMBEDDED_WEIGHTS) without reading any file
+    Lenet5Model() : Lenet5Model(nullptr) {}
+    // maps the parameters from a binary model file (see model_file.h) and uses them in place,
+    // falls back to params/*.txt (or the compiled-in ones) if the file cannot be used
+    // the convolution algorithms are taken from the LENET5_CONV environment variable (see set_conv_algorithms)
+    // the precision from LENET5_PRECISION (see set_precision) and the sparse format from LENET5_SPARSE (see set_sparse)
+    explicit Lenet5Model(const char* model_path);
+
+    // selects the algorithm of a convolution layer (LAYER_C1 or LAYER_C3) and transforms its kernels for it
+    // not thread-safe: call before sharing the model between threads
+    bool set_conv_algorithm(Lenet5Layer layer, ConvAlgorithm algorithm);
+    // "winograd4" (both layers) or per layer, e.g. "c1=fft,c3=winograd4"
+    bool set_conv_algorithms(const char* spec);
+    ConvAlgorithm get_conv_algorithm(Lenet5Layer layer) const { return (layer == LAYER_C1) ? C1_algorithm : C3_algorithm; }
+
+    // stores the C5, F6 and OUTPUT weights (96% of the parameters) as fp16 or bf16, converted to float inside
+    // the kernels and accumulated in fp32; activations: also round their inputs to the precision (bf16 inputs
+    // use the vdpbf16ps dot products on AVX-512 BF16 CPUs). C1 and C3 always stay fp32.
+    // not thread-safe: call before sharing the model between threads
+    void set_precision(StoragePrecision precision, bool activations = false);
+    // "fp32", "fp16", "bf16", optionally followed by "+act" for the activations (e.g. "bf16+act")
+    bool set_precision(const char* spec);
+    StoragePrecision get_precision() const { return precision; }
+    bool get_half_activations() const { return half_activations; }
+    // bytes of weights and biases read by one inference in the selected precision
+    size_t weight_bytes() const;
+
+    // runs C5, F6 and OUTPUT with kernels that skip their zero weights (see sparse.h), in fp32
+    // whatever set_precision selected; SPARSE_NONE: the dense kernels
+    // not thread-safe: call before sharing the model between threads
+    void set_sparse(SparseFormat format);
+    // "dense", "csr" or "block"
+    bool set_sparse(const char* name);
+    SparseFormat get_sparse() const { return sparse_format; }
+
+    // magnitude pruning of C5, F6 and OUTPUT: zeroes the fraction sparsity of the weights of each layer with
+    // the smallest magnitude, one by one or in the 16 x 1 blocks of the GEMV panels (see prune_magnitude,
+    // prune_blocks); the weights are copied out of a mapped model file first
+    // returns the fraction of zero weights in the three layers
+    float prune(float sparsity, bool blocks = false);
+    // zeroes the C5, F6 and OUTPUT weights with |w| < threshold
+    float prune_threshold(float threshold);
+    // fraction of the C5, F6 and OUTPUT weights that are 0
+    float sparsity() const;
+
+    // convolution layer C1 (from n 32x32 input maps) or C3 (from the 6 x n 14x14 S2 maps) with the selected algorithm,
+    // before pooling: out = bias + convolution, clamped at 0 if relu; maps are (channels) x (n) x length x length
+    void convolution(Lenet5Layer layer, const float* in, int n, float* out, bool relu, InferenceContext& ctx) const;
+
+    // true if every parameter was read from a file
+    bool is_loaded() const { return weights_loaded; }
+
+    // writes the current parameters as a binary model file
+    bool save_model(const char* filename) const;
+    // writes the current parameters and their GEMV panels as constexpr arrays in a C++ header, to be compiled
+    // into the executable (src/lenet5_weights.h, built with LENET5_EMBEDDED_WEIGHTS defined)
+    bool save_embedded(const char* filename) const;
+    // checksum of the current float parameters, to tell whether results came from the same weights
+    uint64_t fingerprint() const;
+    // copies the weights out of a mapped model file (or the executable) into memory of this model, written by the calling thread
+    // (with the default first-touch policy, that places them on the calling thread's NUMA node)
+    // not thread-safe: call before sharing the model between threads
+    void copy_weights();
 
-    int run_inference(ImageMap* image);
+    int run_inference(const ImageMap* image, InferenceContext& ctx) const;
+    // the same prediction and outputs (bit for bit) for the next frame of a stream, recomputing only what the pixels
+    // that changed since the previous frame reach (see lenet5_incremental.cpp)
+    int run_inference_incremental(const ImageMap* image, IncrementalContext& ctx) const;
+    // runs n images through the network with C5, F6 and OUTPUT as packed GEMMs over the batch, writes each predicted digit into out[]
+    // and, if logits is not nullptr, the OUTPUT layer of each image into logits[b * OUT_LEN ...]
+    // returns the number of images processed
+    int run_inference_batch(const ImageMap* const* images, int n, int* out, InferenceContext& ctx,
+        float* logits = nullptr) const;
+};
+
+// a model together with one inference context, for single-threaded use
+class Lenet5 {
+private:
+    Lenet5Model model;
+    InferenceContext context;
+
+public:
+    Lenet5() {}
+    explicit Lenet5(const char* model_path) : model(model_path) {}
+
+    const Lenet5Model& get_model() const { return model; }
+    const InferenceContext& get_context() const { return context; }
+
+    bool is_loaded() const { return model.is_loaded(); }
+    bool save_model(const char* filename) const { return model.save_model(filename); }
+
+    int run_inference(ImageMap* image) {
+        return model.run_inference(image, context);
+    }
+    int run_inference_batch(const ImageMap* const* images, int n, int* out) {
+        return model.run_inference_batch(images, n, out, context);
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,239 @@
+#include "lenet5.h"
+#include "gemm.h"
+
+// Batched execution of the network.
+// Every layer's activations are stored as a (channels) x (images * length * length) matrix,
+// so each layer becomes one GEMM of its packed weights against its input: the convolutions pack their
+// im2col matrix straight from the maps (sgemm_conv), the bias is added and ReLU applied in the same pass,
+// and the weights are read once per panel of output pixels instead of once per output pixel.
+
+void Lenet5Model::pack_weights() {
+
+    const int KSIZE = CONV * CONV;
+
+    C1_gemm.build(C1_kernels.data(), C1_MAPS, KSIZE, KSIZE, C1_bias.data());
+
+    // C3 as one 16 x (6 * 25) matrix over all S2 maps: the zero kernels of the missing connections cost
+    // 3/8 of the multiplications, but every S2 map is packed once and no partial sums are scattered
+    std::vector<float> c3Dense(C3_MAPS * C1_MAPS * KSIZE, 0.f);
+    for (int n = 0; n < C3_MAPS; ++n) {
+        for (int k = 0; k < C3_TABLE.num_inputs[n]; ++k) {
+            memcpy(&c3Dense[(n * C1_MAPS + C3_TABLE.inputs[n][k]) * KSIZE], C3_kernels.plane(n, k), KSIZE * sizeof(float));
+        }
+    }
+    C3_gemm.build(&c3Dense[0], C3_MAPS, C1_MAPS * KSIZE, C1_MAPS * KSIZE, C3_bias.data());
+
+    C5_gemm.build(C5_kernels.data(), C5_MAPS, C3_MAPS * KSIZE, C3_MAPS * KSIZE, C5_bias.data());
+    F6_gemm.build(F6_weights.data(), F6_LEN, C5_MAPS, C5_MAPS, F6_bias.data());
+    OUT_gemm.build(OUT_weights.data(), OUT_LEN, F6_LEN, F6_LEN, OUT_bias.data());
+}
+
+void Lenet5Model::im2col(const float* in, int numImages, int inLength, int convLength, float* cols) {
+
+    // in: numImages maps of inLength x inLength
+    // cols: (convLength * convLength) x (numImages * outLength * outLength)
+    int outLength = inLength - convLength + 1;
+    int outSize = outLength * outLength;
+    int numCols = numImages * outSize;
+
+    for (int ki = 0; ki < convLength; ++ki) {
+        for (int kj = 0; kj < convLength; ++kj) {
+            float* row = cols + (ki * convLength + kj) * numCols;
+            for (int b = 0; b < numImages; ++b) {
+                const float* map = in + b * inLength * inLength;
+                for (int i = 0; i < outLength; ++i) {
+                    const float* src = map + (i + ki) * inLength + kj;
+                    float* dst = row + b * outSize + i * outLength;
+                    for (int j = 0; j < outLength; ++j)
+                        dst[j] = src[j];
+                }
+            }
+        }
+    }
+}
+
+void Lenet5Model::max_pooling_batch(const float* in, float* out, int numMaps, int numImages, int outLength) const {
+
+    // 2x2 pooling, stride = 2
+    int inLength = outLength * 2;
+    for (int m = 0; m < numMaps * numImages; ++m) {
+        simd->max_pool_2x2(in + m * inLength * inLength, out + m * outLength * outLength, outLength);
+    }
+}
+
+void Lenet5Model::convolution(Lenet5Layer layer, const float* in, int n, float* out, bool relu, InferenceContext& ctx) const {
+
+    if (layer == LAYER_C1) {
+        if (C1_fast) {
+            C1_fast->run(in, n, out, relu, ctx.conv_scratch);
+            return;
+        }
+        // (6 x 25) * (25 x n*784)
+        sgemm_conv(C1_gemm, in, n, IN_LEN, CONV, out, relu);
+        return;
+    }
+
+    if (C3_fast) {
+        C3_fast->run(in, n, out, relu, ctx.conv_scratch);
+        return;
+    }
+    // (16 x 150) * (150 x n*100)
+    sgemm_conv(C3_gemm, in, n, S2_LEN, CONV, out, relu);
+}
+
+void Lenet5Model::fully_connected_batch(Lenet5Layer layer, const float* in, int n, float* out, InferenceContext& ctx) const {
+
+    int numRows = (layer == LAYER_C5) ? C5_MAPS : (layer == LAYER_F6) ? F6_LEN : OUT_LEN;
+    int k = (layer == LAYER_C5) ? C3_MAPS * CONV * CONV : (layer == LAYER_F6) ? C5_MAPS : F6_LEN;
+    const float* bias = (layer == LAYER_C5) ? C5_bias.data() : (layer == LAYER_F6) ? F6_bias.data() : OUT_bias.data();
+
+    if (sparse_format != SPARSE_NONE) {
+        csr_gemm((layer == LAYER_C5) ? C5_csr : (layer == LAYER_F6) ? F6_csr : OUT_csr, in, n, out);
+    }
+    else if (precision == PRECISION_FP32 && 2 * n < simd->sgemm_nr) {
+        // below half a tile of the GEMM, its padding columns cost more than reading the GEMV panels once per image
+        ctx.H_column.init(1, 1, 1, k);
+        ctx.B_column.init(1, 1, 1, numRows);
+        for (int b = 0; b < n; ++b) {
+            for (int i = 0; i < k; ++i)
+                ctx.H_column[i] = in[i * n + b];
+            fully_connected(layer, ctx.H_column.data(), ctx.B_column.data(), ctx);
+            for (int i = 0; i < numRows; ++i)
+                out[i * n + b] = ctx.B_column[i];
+        }
+        return;
+    }
+    else if (precision == PRECISION_FP32) {
+        // the packed weights carry the bias
+        const PackedMatrix& weights = (layer == LAYER_C5) ? C5_gemm : (layer == LAYER_F6) ? F6_gemm : OUT_gemm;
+        sgemm_packed(weights, n, in, n, out, n, layer != LAYER_OUTPUT);
+        return;
+    }
+    else {
+        if (half_activations) {
+            // one scale per image (column) like the single-image path
+            ctx.H_inputs.init(1, 1, k, n);
+            ctx.H_column.init(1, 1, 1, k);
+            float* column = ctx.H_column.data();
+            for (int b = 0; b < n; ++b) {
+                for (int i = 0; i < k; ++i)
+                    column[i] = in[i * n + b];
+                round_to_precision(column, k, precision, column);
+                for (int i = 0; i < k; ++i)
+                    ctx.H_inputs[i * n + b] = column[i];
+            }
+            in = ctx.H_inputs.data();
+        }
+        const Tensor<uint16_t>& panels = (layer == LAYER_C5) ? C5_half : (layer == LAYER_F6) ? F6_half : OUT_half;
+        sgemm_half_panels(numRows, n, k, panels.data(), precision, in, n, out, n);
+    }
+    bias_activation(numRows, n, out, n, bias, layer != LAYER_OUTPUT);
+}
+
+int Lenet5Model::run_inference_batch(const ImageMap* const* images, int n, int* out, InferenceContext& ctx,
+    float* logits) const {
+
+    for (int b = 0; b < n; b += BATCH_TILE) {
+        int numImages = (n - b < BATCH_TILE) ? n - b : BATCH_TILE;
+        run_batch_tile(images + b, numImages, out + b, logits ? logits + b * OUT_LEN : nullptr, ctx);
+    }
+
+    return n;
+}
+
+void Lenet5Model::run_batch_tile(const ImageMap* const* images, int n, int* out, float* logits, InferenceContext& ctx) const {
+
+    const int S4_SIZE = S4_LEN * S4_LEN;
+
+    ctx.B_cols.init(1, 1, C3_MAPS * S4_SIZE, n);
+    ctx.B_C5.init(C5_MAPS, n, 1, 1);
+    ctx.B_F6.init(F6_LEN, n, 1, 1);
+    ctx.B_OUT.init(OUT_LEN, n, 1, 1);
+
+    LayerTimer timer(ctx.profile);
+
+    if (C1_algorithm == CONV_DIRECT && C3_algorithm == CONV_DIRECT) {
+        // direct convolutions run image by image through the fused kernels of run_inference: the C1 and C3
+        // weights (150 and 1500 floats) stay in L1 without batching, and fused with the pooling they skip the
+        // C1 and C3 maps, which makes them faster than the im2col + GEMM of convolution() over the tile
+        for (int b = 0; b < n; ++b) {
+            const unsigned char* pixels = images[b]->data();
+            for (int i = 0; i < IN_LEN * IN_LEN; ++i)
+                ctx.IN_map[i] = (float)(pixels[i]);
+            convolution_pooling_c1(ctx.IN_map, ctx.S2_maps);
+            timer.end_fused(LAYER_C1, LAYER_S2);
+            convolution_pooling_c3(ctx.S2_maps, ctx.S4_maps);
+            // the S4 maps are the input column of C5 for this image
+            for (int i = 0; i < C3_MAPS * S4_SIZE; ++i)
+                ctx.B_cols[i * n + b] = ctx.S4_maps[i];
+            timer.end_fused(LAYER_C3, LAYER_S4);
+        }
+    }
+    else {
+        ctx.B_IN.init(1, n, IN_LEN, IN_LEN);
+        ctx.B_C1.init(C1_MAPS, n, C1_LEN, C1_LEN);
+        ctx.B_S2.init(C1_MAPS, n, S2_LEN, S2_LEN);
+        ctx.B_C3.init(C3_MAPS, n, C3_LEN, C3_LEN);
+        ctx.B_S4.init(C3_MAPS, n, S4_LEN, S4_LEN);
+
+        // layer C1 (Winograd / FFT, or direct: (6 x 25) * (25 x n*784) over the im2col matrix of the input images)
+        for (int b = 0; b < n; ++b) {
+            const unsigned char* pixels = images[b]->data();
+            float* map = &ctx.B_IN[b * IN_LEN * IN_LEN];
+            for (int i = 0; i < IN_LEN * IN_LEN; ++i)
+                map[i] = (float)(pixels[i]);
+        }
+        convolution(LAYER_C1, ctx.B_IN.data(), n, ctx.B_C1.data(), true, ctx);
+        timer.end_layer(LAYER_C1);
+
+        // layer S2 max pooling
+        max_pooling_batch(ctx.B_C1.data(), ctx.B_S2.data(), C1_MAPS, n, S2_LEN);
+        timer.end_layer(LAYER_S2);
+
+        // layer C3 (Winograd / FFT, or direct: (16 x 150) * (150 x n*100) over the im2col matrix of the 6 S2 maps)
+        convolution(LAYER_C3, ctx.B_S2.data(), n, ctx.B_C3.data(), true, ctx);
+        timer.end_layer(LAYER_C3);
+
+        // layer S4 max pooling
+        max_pooling_batch(ctx.B_C3.data(), ctx.B_S4.data(), C3_MAPS, n, S4_LEN);
+        timer.end_layer(LAYER_S4);
+
+        // the 5x5 C5 kernels cover the whole 5x5 S4 maps, so the im2col matrix of C5 is a transpose into (16 * 25) x n
+        for (int m = 0; m < C3_MAPS; ++m) {
+            for (int p = 0; p < S4_SIZE; ++p) {
+                for (int b = 0; b < n; ++b) {
+                    ctx.B_cols[(m * S4_SIZE + p) * n + b] = ctx.B_S4[(m * n + b) * S4_SIZE + p];
+                }
+            }
+        }
+    }
+
+    // layer C5: (120 x 400) * (400 x n) + ReLU
+    fully_connected_batch(LAYER_C5, ctx.B_cols.data(), n, ctx.B_C5.data(), ctx);
+    timer.end_layer(LAYER_C5);
+
+    // layer F6 fully-connected: (84 x 120) * (120 x n) + ReLU
+    fully_connected_batch(LAYER_F6, ctx.B_C5.data(), n, ctx.B_F6.data(), ctx);
+    timer.end_layer(LAYER_F6);
+
+    // OUTPUT layer fully-connected (skip softmax function): (10 x 84) * (84 x n)
+    fully_connected_batch(LAYER_OUTPUT, ctx.B_F6.data(), n, ctx.B_OUT.data(), ctx);
+
+    // treat the largest output as the NN's prediction, "later" one wins ties as in run_inference
+    for (int b = 0; b < n; ++b) {
+        int maxIdx = 0;
+        for (int i = 1; i < OUT_LEN; ++i) {
+            if (ctx.B_OUT[i * n + b] >= ctx.B_OUT[maxIdx * n + b])
+                maxIdx = i;
+        }
+        out[b] = maxIdx;
+    }
+    if (logits) {
+        for (int b = 0; b < n; ++b) {
+            for (int i = 0; i < OUT_LEN; ++i)
+                logits[b * OUT_LEN + i] = ctx.B_OUT[i * n + b];
+        }
+    }
+    timer.end_layer(LAYER_OUTPUT);
+    timer.end_images(n);
+}
@@ -0,0 +1,65 @@
+#ifndef LENET_5_DIMS_H
+#define LENET_5_DIMS_H
+
+// Layer dimensions and S2 -> C3 connection table of LeNet-5, fixed at compile time.
+// The convolution + pooling kernels are instantiated for these exact shapes (see SimdKernels),
+// so every loop over rows, columns, kernel taps and input maps has a constant trip count.
+struct Lenet5Dims {
+    static constexpr int IN_LEN = 32;  // (28x28 with padding)
+    static constexpr int C1_LEN = 28;
+    static constexpr int S2_LEN = 14;
+    static constexpr int C3_LEN = 10;
+    static constexpr int S4_LEN = 5;
+    static constexpr int C5_LEN = 1;
+    static constexpr int F6_LEN = 84;
+    static constexpr int OUT_LEN = 10;
+
+    static constexpr int C1_MAPS = 6;
+    static constexpr int C3_MAPS = 16;
+    static constexpr int C5_MAPS = 120;
+
+    static constexpr int CONV = 5;
+    static constexpr int POOL = 2;
+};
+
+static_assert(Lenet5Dims::C1_LEN == Lenet5Dims::IN_LEN - Lenet5Dims::CONV + 1, "C1 is a valid 5x5 convolution of the input");
+static_assert(Lenet5Dims::S2_LEN * Lenet5Dims::POOL == Lenet5Dims::C1_LEN, "S2 pools C1 2x2");
+static_assert(Lenet5Dims::C3_LEN == Lenet5Dims::S2_LEN - Lenet5Dims::CONV + 1, "C3 is a valid 5x5 convolution of S2");
+static_assert(Lenet5Dims::S4_LEN * Lenet5Dims::POOL == Lenet5Dims::C3_LEN, "S4 pools C3 2x2");
+static_assert(Lenet5Dims::S4_LEN == Lenet5Dims::CONV && Lenet5Dims::C5_LEN == 1, "C5 kernels cover the whole S4 maps");
+
+// S2 -> C3 connection table: input S2 map ids of each C3 map (same order as the C3 kernels of the map)
+struct C3ConnectionTable {
+    int inputs[Lenet5Dims::C3_MAPS][Lenet5Dims::C1_MAPS];
+    int num_inputs[Lenet5Dims::C3_MAPS];
+};
+
+constexpr C3ConnectionTable make_c3_table() {
+
+    // 1st 6 C3 feature maps (#0 to #5): every contiguous subset of 3 feature maps
+    // next 6 C3 feature maps (#6 to #11): every contiguous subset of 4 feature maps
+    // next 3 C3 feature maps (#12 to #14): some discontinous subsets of 4 feature maps
+    // last 1 C3 feature map (#15): all 6 S2 feature maps
+    const int numKernels[] = { 3, 4, 4, 6 };
+    const int initialIds[][6] = { { 0, 1, 2 }, { 0, 1, 2, 3 }, { 0, 1, 3, 4 }, { 0, 1, 2, 3, 4, 5 } };
+    const int n_start[] = { 0, 6, 12, 15 };
+    const int n_end[] = { 5, 11, 14, 15 };
+
+    C3ConnectionTable table = {};
+    for (int g = 0; g < 4; ++g) {
+        for (int n = n_start[g]; n <= n_end[g]; ++n) {
+            table.num_inputs[n] = numKernels[g];
+            for (int k = 0; k < numKernels[g]; ++k) {
+                table.inputs[n][k] = (initialIds[g][k] + n - n_start[g]) % Lenet5Dims::C1_MAPS;
+            }
+        }
+    }
+    return table;
+}
+
+constexpr C3ConnectionTable C3_TABLE = make_c3_table();
+
+static_assert(C3_TABLE.num_inputs[0] == 3 && C3_TABLE.num_inputs[6] == 4 && C3_TABLE.num_inputs[15] == 6, "C3 connection groups");
+static_assert(C3_TABLE.inputs[5][2] == 1 && C3_TABLE.inputs[14][3] == 0, "C3 connections wrap around the S2 maps");
+
+#endif
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <math.h>
+#include "lenet5.h"
+
+// Weights compiled into the executable
+//
+// "lenet5 embed" writes the current parameters (params/*.txt or -m model.bin) as constexpr arrays into
+// src/lenet5_weights.h, with the GEMV panels of C5, F6 and OUTPUT already packed; an executable built with
+// LENET5_EMBEDDED_WEIGHTS defined includes them, and Lenet5Model() uses them in place from its read-only data:
+// no file is opened, parsed or mapped and nothing is packed before the first inference. The floats are written
+// as hexadecimal literals, so the embedded network is bit-exact with the one it was generated from.
+//
+// Nothing regenerates the header when the weights change; after retraining or converting a model, run
+//
+//   lenet5 embed [-m model.bin] [-o src/lenet5_weights.h]
+//
+// then rebuild with LENET5_EMBEDDED_WEIGHTS defined (e.g. -DLENET5_EMBEDDED_WEIGHTS, or in the project's
+// preprocessor definitions). Without the define the header is not included and the weights are read at startup
+// as before. LENET5_WEIGHTS_FINGERPRINT in the header identifies the model it was generated from.
+#ifdef LENET5_EMBEDDED_WEIGHTS
+#include "lenet5_weights.h"
+
+static_assert(sizeof(lenet5_weights::c1_kernels) == sizeof(float) * Lenet5Dims::C1_MAPS * Lenet5Dims::CONV * Lenet5Dims::CONV,
+    "lenet5_weights.h was generated for other dimensions, run lenet5 embed again");
+static_assert(sizeof(lenet5_weights::c5_panels) == sizeof(float) * ((Lenet5Dims::C5_MAPS + GEMV_PANEL - 1) / GEMV_PANEL)
+    * Lenet5Dims::C3_MAPS * Lenet5Dims::CONV * Lenet5Dims::CONV * GEMV_PANEL,
+    "lenet5_weights.h was generated for another GEMV_PANEL, run lenet5 embed again");
+#endif
+
+#define EMBED_VALUES_PER_LINE 6
+
+bool Lenet5Model::load_embedded() {
+
+#ifdef LENET5_EMBEDDED_WEIGHTS
+    // views, as for a mapped model file: anything that changes the weights (prune, ...) copies them first
+    struct {
+        Tensor<float>* tensor;
+        const float* data;
+    } weights[] = {
+        { &C1_kernels, lenet5_weights::c1_kernels }, { &C1_bias, lenet5_weights::c1_bias },
+        { &C3_kernels, lenet5_weights::c3_kernels }, { &C3_bias, lenet5_weights::c3_bias },
+        { &C5_kernels, lenet5_weights::c5_kernels }, { &C5_bias, lenet5_weights::c5_bias },
+        { &F6_weights, lenet5_weights::f6_weights }, { &F6_bias, lenet5_weights::f6_bias },
+        { &OUT_weights, lenet5_weights::out_weights }, { &OUT_bias, lenet5_weights::out_bias },
+    };
+    for (size_t t = 0; t < sizeof(weights) / sizeof(weights[0]); ++t) {
+        Tensor<float>& tensor = *weights[t].tensor;
+        tensor.wrap(const_cast<float*>(weights[t].data), tensor.n(), tensor.c(), tensor.h(), tensor.w());
+    }
+
+    C5_panels.wrap(const_cast<float*>(lenet5_weights::c5_panels), gemv_num_panels(C5_MAPS), 1, C3_MAPS * CONV * CONV, GEMV_PANEL);
+    F6_panels.wrap(const_cast<float*>(lenet5_weights::f6_panels), gemv_num_panels(F6_LEN), 1, C5_MAPS, GEMV_PANEL);
+    OUT_panels.wrap(const_cast<float*>(lenet5_weights::out_panels), gemv_num_panels(OUT_LEN), 1, F6_LEN, GEMV_PANEL);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Lenet5Model::save_embedded(const char* filename) const {
+
+    const Tensor<float>* tensors[] = { &C1_kernels, &C1_bias, &C3_kernels, &C3_bias, &C5_kernels, &C5_bias,
+        &F6_weights, &F6_bias, &OUT_weights, &OUT_bias, &C5_panels, &F6_panels, &OUT_panels };
+    const char* names[] = { "c1_kernels", "c1_bias", "c3_kernels", "c3_bias", "c5_kernels", "c5_bias",
+        "f6_weights", "f6_bias", "out_weights", "out_bias", "c5_panels", "f6_panels", "out_panels" };
+
+    // a NaN or infinity would not even compile as a literal, and would be a broken model anyway
+    for (size_t t = 0; t < sizeof(tensors) / sizeof(tensors[0]); ++t) {
+        for (size_t i = 0; i < tensors[t]->size(); ++i) {
+            if (!isfinite((*tensors[t])[i])) {
+                fprintf(stderr, "%s[%u] is %g, not writing '%s'\n", names[t], (unsigned)i, (*tensors[t])[i], filename);
+                return false;
+            }
+        }
+    }
+
+    FILE* fp;
+    errno_t err;
+    if ((err = fopen_s(&fp, filename, "w")) != 0) {
+        fprintf(stderr, "cannot create '%s'\n", filename);
+        return false;
+    }
+
+    fprintf(fp, "// LeNet-5 parameters compiled into the executable (see lenet5_embedded.cpp)\n");
+    fprintf(fp, "// generated by \"lenet5 embed\", do not edit\n");
+    fprintf(fp, "#ifndef LENET_5_WEIGHTS_H\n#define LENET_5_WEIGHTS_H\n\n");
+    fprintf(fp, "#define LENET5_WEIGHTS_FINGERPRINT 0x%016llxULL    // Lenet5Model::fingerprint\n\n",
+        (unsigned long long)fingerprint());
+    fprintf(fp, "namespace lenet5_weights {\n");
+    for (size_t t = 0; t < sizeof(tensors) / sizeof(tensors[0]); ++t) {
+        const Tensor<float>& tensor = *tensors[t];
+        fprintf(fp, "\n// %d x %d x %d x %d\nalignas(64) constexpr float %s[%u] = {\n", tensor.n(), tensor.c(), tensor.h(),
+            tensor.w(), names[t], (unsigned)tensor.size());
+        for (size_t i = 0; i < tensor.size(); ++i) {
+            // hexadecimal: exact, and shorter than the 9 significant digits a float needs in decimal
+            fprintf(fp, "%s%af,", (i % EMBED_VALUES_PER_LINE == 0) ? "    " : " ", tensor[i]);
+            if (i % EMBED_VALUES_PER_LINE == EMBED_VALUES_PER_LINE - 1 || i + 1 == tensor.size())
+                fprintf(fp, "\n");
+        }
+        fprintf(fp, "};\n");
+    }
+    fprintf(fp, "\n}\n\n#endif\n");
+
+    bool ok = ferror(fp) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok)
+        fprintf(stderr, "cannot write '%s'\n", filename);
+    return ok;
+}
@@ -0,0 +1,687 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "lenet5_fixed.h"
+#include "dataset_reader.h"
+#include "thread_pool.h"
+
+// the layers with weights, in execution order, and their names in a spec
+static const Lenet5Layer FIXED_LAYERS[] = { LAYER_C1, LAYER_C3, LAYER_C5, LAYER_F6, LAYER_OUTPUT };
+static const int NUM_FIXED_LAYERS = sizeof(FIXED_LAYERS) / sizeof(FIXED_LAYERS[0]);
+
+static const char* layer_key(int layer) {
+    switch (layer) {
+    case LAYER_C1: return "c1";
+    case LAYER_C3: return "c3";
+    case LAYER_C5: return "c5";
+    case LAYER_F6: return "f6";
+    case LAYER_OUTPUT: return "out";
+    default: return "?";
+    }
+}
+
+// format of the words a layer reads: the input image, or the outputs of the previous layer with weights
+static QFormat layer_input(const FixedPointConfig& config, int index) {
+    return (index == 0) ? config.input : config.layers[FIXED_LAYERS[index - 1]].out;
+}
+
+// products summed into one output of each layer (C3: all 6 S2 maps, the unconnected weights are 0)
+static int layer_products(int layer) {
+    switch (layer) {
+    case LAYER_C1: return Lenet5Dims::CONV * Lenet5Dims::CONV;
+    case LAYER_C3: return Lenet5Dims::C1_MAPS * Lenet5Dims::CONV * Lenet5Dims::CONV;
+    case LAYER_C5: return Lenet5Dims::C3_MAPS * Lenet5Dims::CONV * Lenet5Dims::CONV;
+    case LAYER_F6: return Lenet5Dims::C5_MAPS;
+    case LAYER_OUTPUT: return Lenet5Dims::F6_LEN;
+    default: return 0;
+    }
+}
+
+static std::string qformat_string(QFormat format) {
+    char text[32];
+    snprintf(text, sizeof(text), "Q%d.%d", format.int_bits, format.frac_bits);
+    return text;
+}
+
+bool FixedPointConfig::valid() const {
+
+    if (!input.valid()) {
+        fprintf(stderr, "invalid input format %s (2 to 32 bits, at most 31 fraction bits)\n", qformat_string(input).c_str());
+        return false;
+    }
+    for (int l = 0; l < NUM_FIXED_LAYERS; ++l) {
+        const FixedLayerFormat& f = layers[FIXED_LAYERS[l]];
+        if (!f.weights.valid() || !f.out.valid()) {
+            fprintf(stderr, "invalid %s format %s / %s (2 to 32 bits, at most 31 fraction bits)\n", layer_name(FIXED_LAYERS[l]),
+                qformat_string(f.weights).c_str(), qformat_string(f.out).c_str());
+            return false;
+        }
+        if (f.acc_bits < 2 || f.acc_bits > 64) {
+            fprintf(stderr, "invalid %s accumulator width %d (2 to 64 bits)\n", layer_name(FIXED_LAYERS[l]), f.acc_bits);
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string FixedPointConfig::to_string() const {
+
+    std::string spec = "in=" + qformat_string(input);
+    for (int l = 0; l < NUM_FIXED_LAYERS; ++l) {
+        const FixedLayerFormat& f = layers[FIXED_LAYERS[l]];
+        std::string key = layer_key(FIXED_LAYERS[l]);
+        spec += "," + key + ".w=" + qformat_string(f.weights) + "," + key + ".act=" + qformat_string(f.out) +
+            "," + key + ".acc=" + std::to_string(f.acc_bits);
+    }
+    spec += std::string(",round=") + fixed_rounding_name(rounding) + ",overflow=" + fixed_overflow_name(overflow);
+    return spec;
+}
+
+FixedRanges::FixedRanges() : numImages(0) {
+    for (int l = 0; l < LAYER_COUNT; ++l)
+        weight_max[l] = bias_max[l] = out_max[l] = 0.f;
+}
+
+// width-bit format whose integer bits just cover max (max < 2^int_bits)
+static QFormat auto_format(float max, int width) {
+
+    int intBits = 0;
+    if (max > 0.f)
+        frexpf(max, &intBits);
+    int fracBits = width - 1 - intBits;
+    fracBits = (fracBits < -31) ? -31 : ((fracBits > 31) ? 31 : fracBits);
+    return QFormat(width - 1 - fracBits, fracBits);
+}
+
+FixedPointConfig auto_fixed_config(const FixedRanges& ranges, int width) {
+
+    FixedPointConfig config;
+    config.input = auto_format(255.f, width);   // 8-bit pixels
+    for (int l = 0; l < NUM_FIXED_LAYERS; ++l) {
+        int layer = FIXED_LAYERS[l];
+        FixedLayerFormat& f = config.layers[layer];
+        f.weights = auto_format(ranges.weight_max[layer], width);
+        f.out = auto_format(ranges.out_max[layer], width);
+
+        // the sum of k products of the input and weight words, and the bias in the accumulator format, plus a carry;
+        // wide words can need more than 64 bits, then the weights lose fraction bits until the accumulator fits
+        QFormat in = layer_input(config, l);
+        int kBits = 0;
+        while ((1 << kBits) < layer_products(layer))
+            ++kBits;
+        int accBits;
+        for (;;) {
+            int sumBits = in.width() + f.weights.width() - 1 + kBits;
+            int biasBits = 0;
+            if (ranges.bias_max[layer] > 0.f) {
+                frexpf(ranges.bias_max[layer], &biasBits);
+                biasBits += in.frac_bits + f.weights.frac_bits + 1;
+            }
+            accBits = ((sumBits > biasBits) ? sumBits : biasBits) + 1;
+            if (accBits <= 64 || f.weights.width() <= 2)
+                break;
+            --f.weights.frac_bits;
+        }
+        f.acc_bits = (accBits < 2) ? 2 : ((accBits > 64) ? 64 : accBits);
+    }
+    return config;
+}
+
+bool parse_fixed_config(const char* spec, const FixedRanges& ranges, FixedPointConfig& config) {
+
+    FixedPointConfig parsed = auto_fixed_config(ranges, 16);
+    std::string list(spec);
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string entry = list.substr(begin, end - begin);
+        begin = end + 1;
+        if (entry.empty())
+            continue;
+
+        if (entry.compare(0, 4, "auto") == 0) {
+            int width = atoi(entry.c_str() + 4);
+            if (width < 2 || width > 32) {
+                fprintf(stderr, "invalid fixed-point entry '%s' (auto2 to auto32)\n", entry.c_str());
+                return false;
+            }
+            FixedRounding rounding = parsed.rounding;
+            FixedOverflow overflow = parsed.overflow;
+            parsed = auto_fixed_config(ranges, width);
+            parsed.rounding = rounding;
+            parsed.overflow = overflow;
+            continue;
+        }
+
+        size_t eq = entry.find('=');
+        if (eq == std::string::npos) {
+            fprintf(stderr, "invalid fixed-point entry '%s' (key=value or autoN)\n", entry.c_str());
+            return false;
+        }
+        std::string key = entry.substr(0, eq);
+        std::string value = entry.substr(eq + 1);
+
+        if (key == "round") {
+            if (!parse_fixed_rounding(value.c_str(), parsed.rounding)) {
+                fprintf(stderr, "unknown rounding '%s' (trunc, half_up, half_even)\n", value.c_str());
+                return false;
+            }
+            continue;
+        }
+        if (key == "overflow") {
+            if (!parse_fixed_overflow(value.c_str(), parsed.overflow)) {
+                fprintf(stderr, "unknown overflow mode '%s' (saturate, wrap)\n", value.c_str());
+                return false;
+            }
+            continue;
+        }
+        if (key == "in") {
+            if (!parse_qformat(value.c_str(), parsed.input)) {
+                fprintf(stderr, "invalid Q format '%s' (Qm.n of 2 to 32 bits)\n", value.c_str());
+                return false;
+            }
+            continue;
+        }
+
+        // [layer.]w / act / acc
+        size_t dot = key.find('.');
+        std::string layerKey = (dot == std::string::npos) ? "" : key.substr(0, dot);
+        std::string field = (dot == std::string::npos) ? key : key.substr(dot + 1);
+        bool matched = false;
+        for (int l = 0; l < NUM_FIXED_LAYERS; ++l) {
+            if (layerKey != "" && layerKey != layer_key(FIXED_LAYERS[l]))
+                continue;
+            matched = true;
+            FixedLayerFormat& f = parsed.layers[FIXED_LAYERS[l]];
+            bool ok;
+            if (field == "w")
+                ok = parse_qformat(value.c_str(), f.weights);
+            else if (field == "act")
+                ok = parse_qformat(value.c_str(), f.out);
+            else if (field == "acc") {
+                f.acc_bits = atoi(value.c_str());
+                ok = f.acc_bits >= 2 && f.acc_bits <= 64;
+            }
+            else {
+                fprintf(stderr, "unknown fixed-point key '%s' (in, w, act, acc, round, overflow)\n", key.c_str());
+                return false;
+            }
+            if (!ok) {
+                fprintf(stderr, "invalid value in '%s' (Qm.n of 2 to 32 bits, acc of 2 to 64 bits)\n", entry.c_str());
+                return false;
+            }
+        }
+        if (!matched) {
+            fprintf(stderr, "unknown layer '%s' (c1, c3, c5, f6, out)\n", layerKey.c_str());
+            return false;
+        }
+    }
+
+    if (!parsed.valid())
+        return false;
+    config = parsed;
+    return true;
+}
+
+FixedInferenceContext::FixedInferenceContext(bool hugePages) : arena(ARENA_BLOCK_SIZE, hugePages), profile(nullptr)
+{
+    const int CONV = Lenet5Model::CONV;
+    Tensor<int32_t>* tensors[] = { &IN_map, &C1_cols, &C1_maps, &S2_maps, &C3_cols, &C3_maps, &S4_maps, &C5_maps,
+        &F6_outputs, &OUT_outputs };
+    for (size_t t = 0; t < sizeof(tensors) / sizeof(tensors[0]); ++t)
+        tensors[t]->set_arena(&arena);
+    acc.set_arena(&arena);
+
+    IN_map.init(1, 1, Lenet5Model::IN_LEN, Lenet5Model::IN_LEN);
+    C1_cols.init(1, 1, CONV * CONV, Lenet5Model::C1_LEN * Lenet5Model::C1_LEN);
+    C1_maps.init(1, Lenet5Model::C1_MAPS, Lenet5Model::C1_LEN, Lenet5Model::C1_LEN);
+    S2_maps.init(1, Lenet5Model::C1_MAPS, Lenet5Model::S2_LEN, Lenet5Model::S2_LEN);
+    C3_cols.init(1, 1, Lenet5Model::C1_MAPS * CONV * CONV, Lenet5Model::C3_LEN * Lenet5Model::C3_LEN);
+    C3_maps.init(1, Lenet5Model::C3_MAPS, Lenet5Model::C3_LEN, Lenet5Model::C3_LEN);
+    S4_maps.init(1, Lenet5Model::C3_MAPS, Lenet5Model::S4_LEN, Lenet5Model::S4_LEN);
+    C5_maps.init(1, 1, 1, Lenet5Model::C5_MAPS);
+    F6_outputs.init(1, 1, 1, Lenet5Model::F6_LEN);
+    OUT_outputs.init(1, 1, 1, Lenet5Model::OUT_LEN);
+    acc.init(1, 1, 1, Lenet5Model::C1_MAPS * Lenet5Model::C1_LEN * Lenet5Model::C1_LEN);
+}
+
+static float max_abs(const float* values, size_t n, float max) {
+    for (size_t i = 0; i < n; ++i)
+        max = (fabsf(values[i]) > max) ? fabsf(values[i]) : max;
+    return max;
+}
+
+FixedRanges Lenet5FixedModel::measure_ranges(const Lenet5Model& model, const std::vector<ImageMap*>& images) {
+
+    FixedRanges ranges;
+    ranges.weight_max[LAYER_C1] = max_abs(model.C1_kernels.data(), model.C1_kernels.size(), 0.f);
+    ranges.weight_max[LAYER_C3] = max_abs(model.C3_kernels.data(), model.C3_kernels.size(), 0.f);
+    ranges.weight_max[LAYER_C5] = max_abs(model.C5_kernels.data(), model.C5_kernels.size(), 0.f);
+    ranges.weight_max[LAYER_F6] = max_abs(model.F6_weights.data(), model.F6_weights.size(), 0.f);
+    ranges.weight_max[LAYER_OUTPUT] = max_abs(model.OUT_weights.data(), model.OUT_weights.size(), 0.f);
+    ranges.bias_max[LAYER_C1] = max_abs(model.C1_bias.data(), model.C1_bias.size(), 0.f);
+    ranges.bias_max[LAYER_C3] = max_abs(model.C3_bias.data(), model.C3_bias.size(), 0.f);
+    ranges.bias_max[LAYER_C5] = max_abs(model.C5_bias.data(), model.C5_bias.size(), 0.f);
+    ranges.bias_max[LAYER_F6] = max_abs(model.F6_bias.data(), model.F6_bias.size(), 0.f);
+    ranges.bias_max[LAYER_OUTPUT] = max_abs(model.OUT_bias.data(), model.OUT_bias.size(), 0.f);
+
+    // the pooling windows cover the whole C1 / C3 maps, so their maxima are those of S2 / S4
+    InferenceContext ctx;
+    for (size_t i = 0; i < images.size(); ++i) {
+        model.run_inference(images[i], ctx);
+        ranges.out_max[LAYER_C1] = max_abs(ctx.S2_maps.data(), ctx.S2_maps.size(), ranges.out_max[LAYER_C1]);
+        ranges.out_max[LAYER_C3] = max_abs(ctx.S4_maps.data(), ctx.S4_maps.size(), ranges.out_max[LAYER_C3]);
+        ranges.out_max[LAYER_C5] = max_abs(ctx.C5_maps.data(), ctx.C5_maps.size(), ranges.out_max[LAYER_C5]);
+        ranges.out_max[LAYER_F6] = max_abs(ctx.F6_outputs.data(), ctx.F6_outputs.size(), ranges.out_max[LAYER_F6]);
+        ranges.out_max[LAYER_OUTPUT] = max_abs(ctx.OUT_outputs.data(), ctx.OUT_outputs.size(), ranges.out_max[LAYER_OUTPUT]);
+    }
+    ranges.numImages = (int)images.size();
+
+    return ranges;
+}
+
+void Lenet5FixedModel::quantize_layer(FixedLayer& layer, Lenet5Layer id, const float* weights, const float* bias, int rows, int k,
+    QFormat in)
+{
+    const FixedLayerFormat& f = config.layers[id];
+    layer.rows = rows;
+    layer.k = k;
+    layer.weights.init(1, 1, rows, k);
+    for (int i = 0; i < rows * k; ++i)
+        layer.weights[i] = (int32_t)fixed_from_real(weights[i], f.weights.frac_bits, f.weights.width(), config.rounding);
+
+    layer.acc_frac = in.frac_bits + f.weights.frac_bits;
+    layer.bias.resize(rows);
+    for (int r = 0; r < rows; ++r)
+        layer.bias[r] = fixed_from_real(bias[r], layer.acc_frac, f.acc_bits, config.rounding);
+}
+
+Lenet5FixedModel::Lenet5FixedModel(const Lenet5Model& model, const FixedPointConfig& config, const SimdKernels* kernels) :
+    simd(kernels != nullptr ? kernels : &simd_kernels()), config(config)
+{
+    const int CONV = Lenet5Model::CONV;
+    const int C1_MAPS = Lenet5Model::C1_MAPS;
+    const int C3_MAPS = Lenet5Model::C3_MAPS;
+    const int C5_MAPS = Lenet5Model::C5_MAPS;
+
+    for (int p = 0; p < 256; ++p) {
+        int64_t word = fixed_shift(p, -config.input.frac_bits, config.rounding, config.overflow);
+        input_words[p] = (int32_t)fixed_narrow(word, config.input.width(), config.overflow);
+    }
+
+    quantize_layer(C1, LAYER_C1, model.C1_kernels.data(), model.C1_bias.data(), C1_MAPS, CONV * CONV, layer_input(config, 0));
+
+    // C3: spread the kernels of each map over the 6 S2 maps they read, in S2 map order (the order of the patches)
+    std::vector<float> c3Dense(C3_MAPS * C1_MAPS * CONV * CONV, 0.f);
+    for (int n = 0; n < C3_MAPS; ++n) {
+        for (int k = 0; k < C3_TABLE.num_inputs[n]; ++k) {
+            memcpy(&c3Dense[(n * C1_MAPS + C3_TABLE.inputs[n][k]) * CONV * CONV], model.C3_kernels.plane(n, k),
+                CONV * CONV * sizeof(float));
+        }
+    }
+    quantize_layer(C3, LAYER_C3, c3Dense.data(), model.C3_bias.data(), C3_MAPS, C1_MAPS * CONV * CONV, layer_input(config, 1));
+
+    quantize_layer(C5, LAYER_C5, model.C5_kernels.data(), model.C5_bias.data(), C5_MAPS, C3_MAPS * CONV * CONV, layer_input(config, 2));
+    quantize_layer(F6, LAYER_F6, model.F6_weights.data(), model.F6_bias.data(), Lenet5Model::F6_LEN, C5_MAPS, layer_input(config, 3));
+    quantize_layer(OUT, LAYER_OUTPUT, model.OUT_weights.data(), model.OUT_bias.data(), Lenet5Model::OUT_LEN, Lenet5Model::F6_LEN,
+        layer_input(config, 4));
+}
+
+size_t Lenet5FixedModel::weight_bits() const {
+    const FixedLayer* layers[] = { &C1, &C3, &C5, &F6, &OUT };
+    size_t bits = 0;
+    for (int l = 0; l < NUM_FIXED_LAYERS; ++l) {
+        const FixedLayerFormat& f = config.layers[FIXED_LAYERS[l]];
+        bits += (size_t)layers[l]->rows * layers[l]->k * f.weights.width() + (size_t)layers[l]->rows * f.acc_bits;
+    }
+    return bits;
+}
+
+double Lenet5FixedModel::output_real(const FixedInferenceContext& ctx, int n) const {
+    return config.layers[LAYER_OUTPUT].out.to_real(ctx.OUT_outputs[n]);
+}
+
+// the rounding and overflow modes are template arguments, so that the per-word loop has no mode branches left
+template<FixedRounding Rounding, FixedOverflow Overflow>
+static void requantize_words(const int64_t* acc, const int64_t* bias, int numRows, int rowLength, int accBits, int shift,
+    int width, bool relu, int32_t* out)
+{
+    for (int r = 0; r < numRows; ++r) {
+        int64_t b = bias[r];
+        for (int p = 0; p < rowLength; ++p) {
+            int64_t v = fixed_narrow(acc[r * rowLength + p], accBits, OVERFLOW_WRAP);   // the accumulator wraps
+            v = fixed_add(v, b, accBits, Overflow);
+            v = fixed_shift(v, shift, Rounding, Overflow);
+            v = (relu && v < 0) ? 0 : v;
+            out[r * rowLength + p] = (int32_t)fixed_narrow(v, width, Overflow);
+        }
+    }
+}
+
+void Lenet5FixedModel::requantize(const FixedLayer& layer, Lenet5Layer id, const int64_t* acc, int numRows, int rowLength,
+    int32_t* out) const
+{
+    typedef void (*RequantizeWordsFn)(const int64_t*, const int64_t*, int, int, int, int, int, bool, int32_t*);
+    static const RequantizeWordsFn fns[ROUNDING_COUNT][OVERFLOW_COUNT] = {
+        { requantize_words<ROUND_TRUNC, OVERFLOW_SATURATE>, requantize_words<ROUND_TRUNC, OVERFLOW_WRAP> },
+        { requantize_words<ROUND_HALF_UP, OVERFLOW_SATURATE>, requantize_words<ROUND_HALF_UP, OVERFLOW_WRAP> },
+        { requantize_words<ROUND_HALF_EVEN, OVERFLOW_SATURATE>, requantize_words<ROUND_HALF_EVEN, OVERFLOW_WRAP> },
+    };
+    const FixedLayerFormat& f = config.layers[id];
+    fns[config.rounding][config.overflow](acc, layer.bias.data(), numRows, rowLength, f.acc_bits,
+        layer.acc_frac - f.out.frac_bits, f.out.width(), id != LAYER_OUTPUT, out);
+}
+
+// 5x5 patches of an inLength x inLength map (numMaps maps, NCHW) as a GemmI32Fn cols matrix:
+// row (m, ki, kj) holds that input word for every output position
+static void im2col_i32(const int32_t* in, int numMaps, int inLength, int32_t* cols) {
+
+    int outLength = inLength - 4;
+    for (int m = 0; m < numMaps; ++m) {
+        const int32_t* map = in + m * inLength * inLength;
+        for (int ki = 0; ki < 5; ++ki) {
+            for (int kj = 0; kj < 5; ++kj) {
+                int32_t* row = cols + ((m * 5 + ki) * 5 + kj) * outLength * outLength;
+                for (int i = 0; i < outLength; ++i)
+                    memcpy(row + i * outLength, map + (i + ki) * inLength + kj, outLength * sizeof(int32_t));
+            }
+        }
+    }
+}
+
+void Lenet5FixedModel::max_pooling(const int32_t* in, int32_t* out, int numMaps, int outLength) {
+
+    int inLength = outLength * 2;
+    for (int m = 0; m < numMaps; ++m) {
+        const int32_t* map = in + m * inLength * inLength;
+        int32_t* o = out + m * outLength * outLength;
+        for (int i = 0; i < outLength; ++i) {
+            const int32_t* r0 = map + (i * 2) * inLength;
+            const int32_t* r1 = r0 + inLength;
+            for (int j = 0; j < outLength; ++j) {
+                int32_t a = (r0[j * 2] > r0[j * 2 + 1]) ? r0[j * 2] : r0[j * 2 + 1];
+                int32_t b = (r1[j * 2] > r1[j * 2 + 1]) ? r1[j * 2] : r1[j * 2 + 1];
+                o[i * outLength + j] = (a > b) ? a : b;
+            }
+        }
+    }
+}
+
+int Lenet5FixedModel::run_inference(const ImageMap* image, FixedInferenceContext& ctx) const {
+
+    const int IN_LEN = Lenet5Model::IN_LEN;
+    const int C1_LEN = Lenet5Model::C1_LEN;
+    const int C3_LEN = Lenet5Model::C3_LEN;
+    int64_t* acc = ctx.acc.data();
+    LayerTimer timer(ctx.profile);
+
+    // layer C1 convolution
+    const unsigned char* pixels = image->data();
+    for (int i = 0; i < IN_LEN * IN_LEN; ++i)
+        ctx.IN_map[i] = input_words[pixels[i]];
+    im2col_i32(ctx.IN_map.data(), 1, IN_LEN, ctx.C1_cols.data());
+    simd->gemm_i32(ctx.C1_cols.data(), C1.weights.data(), C1.k, C1.rows, C1_LEN * C1_LEN, acc);
+    requantize(C1, LAYER_C1, acc, C1.rows, C1_LEN * C1_LEN, ctx.C1_maps.data());
+    timer.end_layer(LAYER_C1);
+
+    // layer S2 max pooling
+    max_pooling(ctx.C1_maps.data(), ctx.S2_maps.data(), Lenet5Model::C1_MAPS, Lenet5Model::S2_LEN);
+    timer.end_layer(LAYER_S2);
+
+    // layer C3 convolution, every map against all 6 S2 maps (unconnected ones have zero weights)
+    im2col_i32(ctx.S2_maps.data(), Lenet5Model::C1_MAPS, Lenet5Model::S2_LEN, ctx.C3_cols.data());
+    simd->gemm_i32(ctx.C3_cols.data(), C3.weights.data(), C3.k, C3.rows, C3_LEN * C3_LEN, acc);
+    requantize(C3, LAYER_C3, acc, C3.rows, C3_LEN * C3_LEN, ctx.C3_maps.data());
+    timer.end_layer(LAYER_C3);
+
+    // layer S4 max pooling
+    max_pooling(ctx.C3_maps.data(), ctx.S4_maps.data(), Lenet5Model::C3_MAPS, Lenet5Model::S4_LEN);
+    timer.end_layer(LAYER_S4);
+
+    // layer C5 convolution (one dot product of the whole S4 output per map)
+    simd->dot_i32(ctx.S4_maps.data(), C5.weights.data(), C5.k, C5.rows, acc);
+    requantize(C5, LAYER_C5, acc, C5.rows, 1, ctx.C5_maps.data());
+    timer.end_layer(LAYER_C5);
+
+    // layer F6 fully-connected
+    simd->dot_i32(ctx.C5_maps.data(), F6.weights.data(), F6.k, F6.rows, acc);
+    requantize(F6, LAYER_F6, acc, F6.rows, 1, ctx.F6_outputs.data());
+    timer.end_layer(LAYER_F6);
+
+    // OUTPUT layer, no ReLU
+    simd->dot_i32(ctx.F6_outputs.data(), OUT.weights.data(), OUT.k, OUT.rows, acc);
+    requantize(OUT, LAYER_OUTPUT, acc, OUT.rows, 1, ctx.OUT_outputs.data());
+
+    // treat the largest output as the NN's prediction (ties go to the later one, as in the float path)
+    int maxIdx = 0;
+    for (int i = 1; i < OUT.rows; ++i) {
+        if (ctx.OUT_outputs[i] >= ctx.OUT_outputs[maxIdx])
+            maxIdx = i;
+    }
+
+    timer.end_layer(LAYER_OUTPUT);
+    timer.end_images(1);
+
+    return maxIdx;
+}
+
+// one word per line, as width-bit two's complement hex
+template<class T>
+static void write_words(FILE* fp, const T* words, size_t n, int width) {
+    uint64_t mask = (width >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << width) - 1);
+    for (size_t i = 0; i < n; ++i)
+        fprintf(fp, "%0*llx\n", (width + 3) / 4, (unsigned long long)((uint64_t)(int64_t)words[i] & mask));
+}
+
+bool Lenet5FixedModel::write_vectors(const FixedInferenceContext& ctx, const char* filename) const {
+
+    FILE* fp;
+    errno_t err;
+    if ((err = fopen_s(&fp, filename, "w")) != 0) {
+        fprintf(stderr, "cannot open file '%s'\n", filename);
+        return false;
+    }
+
+    fprintf(fp, "// LeNet-5 fixed-point vectors: %s\n", config.to_string().c_str());
+    const FixedLayer* layers[] = { &C1, &C3, &C5, &F6, &OUT };
+    for (int l = 0; l < NUM_FIXED_LAYERS; ++l) {
+        const FixedLayerFormat& f = config.layers[FIXED_LAYERS[l]];
+        const FixedLayer& layer = *layers[l];
+        fprintf(fp, "// %s weights: %d x %d, %s, row-major\n", layer_name(FIXED_LAYERS[l]), layer.rows, layer.k,
+            qformat_string(f.weights).c_str());
+        write_words(fp, layer.weights.data(), layer.weights.size(), f.weights.width());
+        fprintf(fp, "// %s bias: %d, %d-bit accumulator with %d fraction bits\n", layer_name(FIXED_LAYERS[l]), layer.rows,
+            f.acc_bits, layer.acc_frac);
+        write_words(fp, layer.bias.data(), layer.bias.size(), f.acc_bits);
+    }
+
+    struct Section {
+        const char* name;
+        const Tensor<int32_t>* words;
+        QFormat format;
+    };
+    const Section sections[] = {
+        { "input", &ctx.IN_map, config.input },
+        { "C1", &ctx.C1_maps, config.layers[LAYER_C1].out },
+        { "S2", &ctx.S2_maps, config.layers[LAYER_C1].out },
+        { "C3", &ctx.C3_maps, config.layers[LAYER_C3].out },
+        { "S4", &ctx.S4_maps, config.layers[LAYER_C3].out },
+        { "C5", &ctx.C5_maps, config.layers[LAYER_C5].out },
+        { "F6", &ctx.F6_outputs, config.layers[LAYER_F6].out },
+        { "OUTPUT", &ctx.OUT_outputs, config.layers[LAYER_OUTPUT].out },
+    };
+    for (size_t s = 0; s < sizeof(sections) / sizeof(sections[0]); ++s) {
+        const Tensor<int32_t>& t = *sections[s].words;
+        fprintf(fp, "// %s: %d x %d x %d, %s\n", sections[s].name, t.c(), t.h(), t.w(),
+            qformat_string(sections[s].format).c_str());
+        write_words(fp, t.data(), t.size(), sections[s].format.width());
+    }
+
+    int maxIdx = 0;
+    for (int i = 1; i < OUT.rows; ++i) {
+        if (ctx.OUT_outputs[i] >= ctx.OUT_outputs[maxIdx])
+            maxIdx = i;
+    }
+    fprintf(fp, "// prediction: %d\n", maxIdx);
+
+    bool ok = !ferror(fp);
+    fclose(fp);
+    if (!ok)
+        fprintf(stderr, "cannot write file '%s'\n", filename);
+    return ok;
+}
+
+void print_fixed_usage() {
+    printf("usage: lenet5 fixed [options]               bit-exact fixed-point engine with each Q-format spec against float\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -d dataset         CSV or MNIST IDX images file (default ./dataset/*.csv)\n");
+    printf("  -t threads         threads, 0 = one per hardware thread (default 0)\n");
+    printf("  -q spec            Q-format spec, e.g. auto12,round=trunc; repeatable (default auto8 to auto32)\n");
+    printf("  -x vectors.hex     write the RTL vectors of the first image with the first spec\n");
+}
+
+bool parse_fixed_args(int argc, char* argv[], FixedReportOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else if (strcmp(arg, "-t") == 0) {
+            options.threads = atoi(value);
+        }
+        else if (strcmp(arg, "-q") == 0) {
+            options.specs.push_back(value);
+        }
+        else if (strcmp(arg, "-x") == 0) {
+            options.vectors_path = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_fixed_report(const FixedReportOptions& options) {
+
+    // a whole dataset (e.g. the MNIST test set), or the two CSV files
+    Arena imageArena;
+    std::vector<ImageMap*> images;
+    if (!read_report_images(images, imageArena, options.dataset_path))
+        return false;
+    int numImages = (int)images.size();
+
+    // the auto formats are sized on the first images
+    const Lenet5Model lenet5(options.model_path);
+    std::vector<ImageMap*> calibrationImages(images.begin(), images.begin() + ((numImages < 1000) ? numImages : 1000));
+    FixedRanges ranges = Lenet5FixedModel::measure_ranges(lenet5, calibrationImages);
+
+    std::vector<std::string> names;
+    std::vector<FixedPointConfig> configs;
+    const char* defaults[] = { "auto8", "auto10", "auto12", "auto14", "auto16", "auto20", "auto24", "auto32" };
+    for (int s = 0; s < (options.specs.empty() ? (int)(sizeof(defaults) / sizeof(defaults[0])) : (int)options.specs.size()); ++s) {
+        const char* spec = options.specs.empty() ? defaults[s] : options.specs[s];
+        FixedPointConfig config;
+        if (!parse_fixed_config(spec, ranges, config))
+            return false;
+        names.push_back(spec);
+        configs.push_back(config);
+    }
+
+    ThreadPool pool(options.threads);
+    const int grain = 64;
+
+    // float reference
+    std::vector<int> floatDigits(numImages);
+    std::vector<float> floatOutputs((size_t)numImages * Lenet5Dims::OUT_LEN);
+    {
+        std::vector<InferenceContext> contexts(pool.size());
+        pool.parallel_for(numImages, grain, [&](int begin, int end, int worker) {
+            for (int i = begin; i < end; ++i) {
+                floatDigits[i] = lenet5.run_inference(images[i], contexts[worker]);
+                for (int n = 0; n < Lenet5Dims::OUT_LEN; ++n)
+                    floatOutputs[(size_t)i * Lenet5Dims::OUT_LEN + n] = contexts[worker].get_outputs()[n];
+            }
+        });
+    }
+    int floatCorrect = 0;
+    for (int i = 0; i < numImages; ++i)
+        floatCorrect += (floatDigits[i] == images[i]->get_label() - '0');
+
+    printf("fixed-point report (%s kernels, %d threads, %d images, formats sized on %d images)\n",
+        simd_level_name(simd_kernels().level), pool.size(), numImages, ranges.numImages);
+    printf("  float: %d / %d correct\n", floatCorrect, numImages);
+    printf("  %-24s %9s %13s %13s %12s %10s %12s\n", "config", "ROM bits", "correct", "agree", "rel. error",
+        "images/s", "vs scalar");
+
+    std::vector<FixedInferenceContext> contexts(pool.size());
+    std::vector<int> digits(numImages);
+    std::vector<double> outputs((size_t)numImages * Lenet5Dims::OUT_LEN);
+    for (size_t c = 0; c < configs.size(); ++c) {
+        const Lenet5FixedModel fixed(lenet5, configs[c]);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        pool.parallel_for(numImages, grain, [&](int begin, int end, int worker) {
+            for (int i = begin; i < end; ++i) {
+                digits[i] = fixed.run_inference(images[i], contexts[worker]);
+                for (int n = 0; n < Lenet5Dims::OUT_LEN; ++n)
+                    outputs[(size_t)i * Lenet5Dims::OUT_LEN + n] = fixed.output_real(contexts[worker], n);
+            }
+        });
+        auto stop = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() * 1e-9;
+
+        int correct = 0, agree = 0;
+        double maxError = 0.0, maxValue = 0.0;
+        for (int i = 0; i < numImages; ++i) {
+            correct += (digits[i] == images[i]->get_label() - '0');
+            agree += (digits[i] == floatDigits[i]);
+            for (int n = 0; n < Lenet5Dims::OUT_LEN; ++n) {
+                double ref = floatOutputs[(size_t)i * Lenet5Dims::OUT_LEN + n];
+                double error = fabs(outputs[(size_t)i * Lenet5Dims::OUT_LEN + n] - ref);
+                maxError = (error > maxError) ? error : maxError;
+                maxValue = (fabs(ref) > maxValue) ? fabs(ref) : maxValue;
+            }
+        }
+
+        // the same words from the scalar kernels on the first images
+        const Lenet5FixedModel scalar(lenet5, configs[c], &simd_kernels(SIMD_SCALAR));
+        int checked = (numImages < 100) ? numImages : 100;
+        int mismatches = 0;
+        for (int i = 0; i < checked; ++i) {
+            fixed.run_inference(images[i], contexts[0]);
+            scalar.run_inference(images[i], contexts[1 % contexts.size()]);
+            for (int n = 0; n < Lenet5Dims::OUT_LEN; ++n)
+                mismatches += (contexts[0].get_outputs()[n] != contexts[1 % contexts.size()].get_outputs()[n]);
+        }
+        char exact[32];
+        snprintf(exact, sizeof(exact), mismatches == 0 ? "exact" : "%d differ", mismatches);
+
+        printf("  %-24s %9d %6d / %-6d %6d / %-6d %12.3g %10.0f %12s\n", names[c].c_str(), (int)fixed.weight_bits(),
+            correct, numImages, agree, numImages, maxError / maxValue, numImages / seconds, exact);
+    }
+
+    printf("formats:\n");
+    for (size_t c = 0; c < configs.size(); ++c)
+        printf("  %s: %s\n", names[c].c_str(), configs[c].to_string().c_str());
+
+    if (options.vectors_path != nullptr) {
+        const Lenet5FixedModel fixed(lenet5, configs[0]);
+        fixed.run_inference(images[0], contexts[0]);
+        if (!fixed.write_vectors(contexts[0], options.vectors_path))
+            return false;
+        printf("vectors of the first image with %s written to %s\n", names[0].c_str(), options.vectors_path);
+    }
+    return true;
+}
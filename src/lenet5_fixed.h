@@ -0,0 +1,180 @@
+#ifndef LENET_5_FIXED_H
+#define LENET_5_FIXED_H
+
+#include <string>
+#include <vector>
+#include "tensor.h"
+#include "imagemap.h"
+#include "simd.h"
+#include "lenet5.h"
+#include "fixed_point.h"
+
+// Bit-exact fixed-point emulation of a Lenet5Model: the golden model of the Verilog implementation ("lenet5 fixed")
+//
+// Every value is a word of the Q format of its layer (see fixed_point.h) and every step is integer arithmetic
+// that a straightforward RTL datapath computes bit for bit:
+// input:      the 8-bit pixel p becomes the word p * 2^n of the input format (rounded and overflowed like any value)
+// weights:    the float weights rounded with the rounding mode and saturated to the layer's weight format;
+//             biases go to the accumulator format (input + weight fraction bits), saturated to its width
+// MAC:        exact products summed in an acc-bit two's complement accumulator that wraps around, like a plain
+//             Verilog adder (the sum modulo 2^acc does not depend on the order, so every SIMD level gives the same bits)
+// outputs:    acc + bias (overflow mode at acc bits), shifted to the output format with the rounding mode,
+//             ReLU (except after OUTPUT), then narrowed to the output word with the overflow mode
+// pooling:    max of the 2x2 words, in the format of the convolution
+// argmax:     ties go to the later digit (>=), like run_inference
+//
+// The formats come from a spec (see parse_fixed_config), usually "autoN": N-bit words whose integer bits
+// just cover the largest weights and activations of the float model on calibration images.
+
+// formats of a layer with weights (the pooling layers keep the format of their input)
+struct FixedLayerFormat {
+    QFormat weights;
+    QFormat out;        // activations, or the logits of OUTPUT
+    int acc_bits;       // accumulator width, up to 64
+
+    FixedLayerFormat() : weights(0, 15), out(15, 16), acc_bits(64) {}
+};
+
+struct FixedPointConfig {
+    QFormat input;
+    FixedLayerFormat layers[LAYER_COUNT];   // C1, C3, C5, F6 and OUTPUT (the S2 / S4 entries are not used)
+    FixedRounding rounding;
+    FixedOverflow overflow;
+
+    FixedPointConfig() : input(8, 0), rounding(ROUND_HALF_EVEN), overflow(OVERFLOW_SATURATE) {}
+
+    // prints the first invalid format to stderr
+    bool valid() const;
+    // every format, in the syntax of parse_fixed_config
+    std::string to_string() const;
+};
+
+// largest magnitudes of the float model the auto formats are sized for
+struct FixedRanges {
+    float weight_max[LAYER_COUNT];  // |weight|
+    float bias_max[LAYER_COUNT];    // |bias|
+    float out_max[LAYER_COUNT];     // |activation| on the calibration images (OUTPUT: |logit|)
+    int numImages;
+
+    FixedRanges();
+};
+
+// width-bit words everywhere, with the integer bits of each format just covering its range (input: 8-bit pixels)
+// and accumulators wide enough never to wrap (at most 64 bits: wider words drop weight fraction bits to fit)
+FixedPointConfig auto_fixed_config(const FixedRanges& ranges, int width);
+
+// comma-separated entries applied in order to auto16:
+//   autoN                          auto_fixed_config of N-bit words (keeps round / overflow)
+//   in=Qm.n                        input format
+//   w=Qm.n, act=Qm.n, acc=bits     weight, output and accumulator formats of every layer
+//   c1.w=Qm.n, f6.act=..., out.acc=...     of one layer (c1, c3, c5, f6, out)
+//   round=trunc|half_up|half_even, overflow=saturate|wrap
+// e.g. "auto12,round=trunc", "auto16,out.act=Q20.11,acc=32"
+bool parse_fixed_config(const char* spec, const FixedRanges& ranges, FixedPointConfig& config);
+
+class Lenet5FixedModel;
+
+// per-thread state of the fixed-point network, like InferenceContext for the float one
+class FixedInferenceContext {
+private:
+    Arena arena;                    // holds every buffer below (see InferenceContext)
+
+    Tensor<int32_t> IN_map;         // 32 x 32 input words
+    Tensor<int32_t> C1_cols;        // 25 x 784 im2col matrix
+    Tensor<int32_t> C1_maps;        // 6 x 28 x 28
+    Tensor<int32_t> S2_maps;        // 6 x 14 x 14
+    Tensor<int32_t> C3_cols;        // (6 * 25) x 100 im2col matrix over all 6 S2 maps
+    Tensor<int32_t> C3_maps;        // 16 x 10 x 10
+    Tensor<int32_t> S4_maps;        // 16 x 5 x 5
+    Tensor<int32_t> C5_maps;        // 120
+    Tensor<int32_t> F6_outputs;     // 84
+    Tensor<int32_t> OUT_outputs;    // 10
+    Tensor<int64_t> acc;            // sums of one layer
+
+    LayerProfile* profile;          // time per layer is added here when set
+
+    FixedInferenceContext(const FixedInferenceContext&);
+    FixedInferenceContext& operator=(const FixedInferenceContext&);
+
+public:
+    explicit FixedInferenceContext(bool hugePages = arena_huge_pages());
+
+    // adds the time spent in every layer of each following inference to profile (nullptr: stop profiling)
+    void set_profile(LayerProfile* profile) { this->profile = profile; }
+
+    // OUTPUT words of the last image run through run_inference (see Lenet5FixedModel::output_real)
+    const Tensor<int32_t>& get_outputs() const { return OUT_outputs; }
+
+    friend class Lenet5FixedModel;
+};
+
+// one layer: rows output channels x k weight words
+struct FixedLayer {
+    int rows;
+    int k;
+    Tensor<int32_t> weights;
+    std::vector<int64_t> bias;      // in the accumulator format
+    int acc_frac;                   // fraction bits of the accumulator
+};
+
+// immutable fixed-point copy of a float model, safe to share between threads
+class Lenet5FixedModel {
+private:
+    const SimdKernels* simd;
+    FixedPointConfig config;
+    int32_t input_words[256];   // input word of every pixel value
+
+    FixedLayer C1;  // 6 x 25
+    FixedLayer C3;  // 16 x (6 * 25), zero weights for S2 maps a C3 map is not connected to
+    FixedLayer C5;  // 120 x 400
+    FixedLayer F6;  // 84 x 120
+    FixedLayer OUT; // 10 x 84
+
+    void quantize_layer(FixedLayer& layer, Lenet5Layer id, const float* weights, const float* bias, int rows, int k, QFormat in);
+    // acc + bias of numRows x rowLength sums -> output words of layer id
+    void requantize(const FixedLayer& layer, Lenet5Layer id, const int64_t* acc, int numRows, int rowLength, int32_t* out) const;
+    static void max_pooling(const int32_t* in, int32_t* out, int numMaps, int outLength);
+
+    // not copyable
+    Lenet5FixedModel(const Lenet5FixedModel&);
+    Lenet5FixedModel& operator=(const Lenet5FixedModel&);
+
+public:
+    // converts the weights of model to the formats of config (which must be valid);
+    // kernels: the MAC kernels (any level gives the same bits), by default the ones of this CPU
+    Lenet5FixedModel(const Lenet5Model& model, const FixedPointConfig& config, const SimdKernels* kernels = nullptr);
+
+    // runs the float model over the images and records the ranges of every layer
+    static FixedRanges measure_ranges(const Lenet5Model& model, const std::vector<ImageMap*>& images);
+
+    const FixedPointConfig& get_config() const { return config; }
+    // bits of all weight and bias words (the ROM of the RTL)
+    size_t weight_bits() const;
+    // real value of OUTPUT word n of the last image run through ctx
+    double output_real(const FixedInferenceContext& ctx, int n) const;
+
+    int run_inference(const ImageMap* image, FixedInferenceContext& ctx) const;
+
+    // writes the weight and bias words and the words of every layer of the last image run through ctx
+    // as $readmemh hex (one word per line, two's complement, // comments between the sections)
+    bool write_vectors(const FixedInferenceContext& ctx, const char* filename) const;
+};
+
+struct FixedReportOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;   // nullptr: the two CSV files
+    int threads;                // 0: one per hardware thread
+    std::vector<const char*> specs;     // Q-format specs (see parse_fixed_config), empty: auto8 to auto32
+    const char* vectors_path;   // nullptr: no RTL vectors
+
+    FixedReportOptions() : model_path(nullptr), dataset_path(nullptr), threads(0), vectors_path(nullptr) {}
+};
+
+// parses the arguments of "lenet5 fixed" (argv[0] is the first one after the command)
+bool parse_fixed_args(int argc, char* argv[], FixedReportOptions& options);
+void print_fixed_usage();
+
+// runs the dataset through the fixed-point engine with each spec and compares it with the float network
+bool run_fixed_report(const FixedReportOptions& options);
+
+#endif
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include "lenet5_incremental.h"
+#include "dataset_reader.h"
+
+// Incremental inference on a stream of near-identical frames (a camera held over a digit, a stroke being drawn)
+//
+// run_inference_incremental compares each frame with the previous one row by row, and recomputes only the pooled
+// rows whose receptive fields contain a changed pixel: S2 row i reads the input rows 2i to 2i + CONV (two
+// convolution rows of CONV rows each), and S4 row i the same rows of the S2 maps its C3 map is connected to.
+// The rows are recomputed by the row-range entries of the fused kernels (SimdKernels::conv_relu_pool_rows_*),
+// which compute every output exactly as the whole-map entries of run_inference do, and the other rows keep the
+// activations of the previous frame. An S2 row whose values came out unchanged (ReLU and max pooling absorb many
+// small changes) does not dirty C3, and if no S4 value changed, C5, F6 and OUTPUT are not run at all; otherwise
+// they run in full, as every C5 output reads all of S4. The outputs are bit-identical to run_inference.
+
+IncrementalContext::IncrementalContext(bool hugePages) : context(hugePages),
+    last_image(1, 1, Lenet5Dims::IN_LEN, Lenet5Dims::IN_LEN), valid(false), digit(0)
+{
+}
+
+static_assert(Lenet5Dims::IN_LEN <= 32, "the rows of a map are a 32-bit mask");
+
+// rows of a pooled map that read any of the input rows set in inRows
+static uint32_t pooled_rows(uint32_t inRows, int outLength) {
+
+    const uint32_t window = (1u << (Lenet5Dims::CONV + 1)) - 1;  // input rows 2i to 2i + CONV
+    uint32_t rows = 0;
+    for (int i = 0; i < outLength; ++i) {
+        if (inRows & (window << (i * 2)))
+            rows |= 1u << i;
+    }
+    return rows;
+}
+
+static int count_rows(uint32_t rows) {
+    int count = 0;
+    for (; rows != 0; rows &= rows - 1)
+        ++count;
+    return count;
+}
+
+// recomputes the rows of the outLength x outLength map out set in rows, one kernel call per run of adjacent rows;
+// returns the rows whose values changed
+static uint32_t update_rows(ConvReluPoolRowsFn kernel, const float* const* in, const float* const* weights, float bias,
+    float* out, int outLength, uint32_t rows)
+{
+    float previous[Lenet5Dims::S2_LEN * Lenet5Dims::S2_LEN];
+    memcpy(previous, out, outLength * outLength * sizeof(float));
+
+    for (int i = 0; i < outLength; ) {
+        if (!(rows & (1u << i))) {
+            ++i;
+            continue;
+        }
+        int end = i + 1;
+        while (end < outLength && (rows & (1u << end)))
+            ++end;
+        kernel(in, weights, bias, out, i, end);
+        i = end;
+    }
+
+    uint32_t changed = 0;
+    for (int i = 0; i < outLength; ++i) {
+        int row = i * outLength;
+        if ((rows & (1u << i)) && memcmp(previous + row, out + row, outLength * sizeof(float)) != 0)
+            changed |= 1u << i;
+    }
+    return changed;
+}
+
+int Lenet5Model::run_inference_incremental(const ImageMap* image, IncrementalContext& inc) const {
+
+    InferenceContext& ctx = inc.context;
+    IncrementalStats& stats = inc.stats;
+    ++stats.frames;
+
+    // the Winograd / FFT convolutions transform whole maps
+    if (C1_algorithm != CONV_DIRECT || C3_algorithm != CONV_DIRECT) {
+        ++stats.full_frames;
+        inc.valid = false;
+        return run_inference(image, ctx);
+    }
+
+    // changed input rows, all of them for the first frame
+    bool full = !inc.valid;
+    const unsigned char* pixels = image->data();
+    unsigned char* last = inc.last_image.data();
+    uint32_t inRows = 0;
+    for (int r = 0; r < IN_LEN; ++r) {
+        const unsigned char* row = pixels + r * IN_LEN;
+        if (!full && memcmp(row, last + r * IN_LEN, IN_LEN) == 0)
+            continue;
+        inRows |= 1u << r;
+        memcpy(last + r * IN_LEN, row, IN_LEN);
+        for (int c = 0; c < IN_LEN; ++c)
+            ctx.IN_map[r * IN_LEN + c] = (float)row[c];
+    }
+    if (full)
+        ++stats.full_frames;
+    else if (inRows == 0) {
+        ++stats.unchanged_frames;
+        return inc.digit;
+    }
+
+    // layer C1 convolution + layer S2 max pooling: every C1 map reads the image
+    uint32_t s2Rows = pooled_rows(inRows, S2_LEN);
+    uint32_t s2Changed[C1_MAPS];
+    const float* inMap = ctx.IN_map.data();
+    for (int n = 0; n < C1_MAPS; ++n) {
+        const float* kernel = C1_kernels.data() + n * CONV * CONV;
+        s2Changed[n] = update_rows(simd->conv_relu_pool_rows_c1, &inMap, &kernel, C1_bias[n],
+            ctx.S2_maps.data() + n * S2_LEN * S2_LEN, S2_LEN, s2Rows);
+        if (full)
+            s2Changed[n] = s2Rows;  // the previous values were not those of another frame
+        stats.s2_rows += count_rows(s2Rows);
+    }
+
+    // layer C3 convolution + layer S4 max pooling: a C3 map only reads its S2 inputs (see C3_TABLE)
+    bool s4Changed = full;
+    for (int N = 0; N < C3_MAPS; ++N) {
+        int numInputs = C3_TABLE.num_inputs[N];
+        const float* inMaps[C1_MAPS];
+        const float* kernels[C1_MAPS];
+        uint32_t inChanged = 0;
+        for (int k = 0; k < numInputs; ++k) {
+            inMaps[k] = ctx.S2_maps.data() + C3_TABLE.inputs[N][k] * S2_LEN * S2_LEN;
+            kernels[k] = C3_kernels.data() + (N * C1_MAPS + k) * CONV * CONV;
+            inChanged |= s2Changed[C3_TABLE.inputs[N][k]];
+        }
+        uint32_t rows = pooled_rows(inChanged, S4_LEN);
+        if (rows == 0)
+            continue;
+        stats.s4_rows += count_rows(rows);
+        if (update_rows(simd->conv_relu_pool_rows_c3[numInputs], inMaps, kernels, C3_bias[N],
+                ctx.S4_maps.data() + N * S4_LEN * S4_LEN, S4_LEN, rows) != 0)
+            s4Changed = true;
+    }
+    inc.valid = true;
+    if (!s4Changed) {
+        ++stats.cached_frames;
+        return inc.digit;
+    }
+
+    // layers C5, F6 and OUTPUT, as in run_inference
+    fully_connected(LAYER_C5, ctx.S4_maps.data(), ctx.C5_maps.data(), ctx);
+    fully_connected(LAYER_F6, ctx.C5_maps.data(), ctx.F6_outputs.data(), ctx);
+    fully_connected(LAYER_OUTPUT, ctx.F6_outputs.data(), ctx.OUT_outputs.data(), ctx);
+
+    // the largest output, the later one on a tie
+    int maxIdx = 0;
+    for (int i = 1; i < OUT_LEN; ++i) {
+        if (ctx.OUT_outputs[i] >= ctx.OUT_outputs[maxIdx])
+            maxIdx = i;
+    }
+    inc.digit = maxIdx;
+    return maxIdx;
+}
+
+void print_incremental_usage() {
+    printf("usage: lenet5 incremental [options]         incremental inference on streams of near-identical frames\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -d dataset         CSV or MNIST IDX images file (default ./dataset/*.csv)\n");
+}
+
+bool parse_incremental_args(int argc, char* argv[], IncrementalReportOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_incremental_report(const IncrementalReportOptions& options) {
+
+    Arena imageArena;
+    std::vector<ImageMap*> images;
+    if (!read_report_images(images, imageArena, options.dataset_path))
+        return false;
+
+    typedef Lenet5Dims D;
+    const int length = D::IN_LEN;
+    const int framesPerImage = 32;
+    int numImages = (int)images.size();
+    int numFrames = numImages * framesPerImage;
+
+    Lenet5Model lenet5(options.model_path);
+    lenet5.set_conv_algorithm(LAYER_C1, CONV_DIRECT);
+    lenet5.set_conv_algorithm(LAYER_C3, CONV_DIRECT);
+    InferenceContext context;
+
+    // each image is followed by frames that differ from the one before in a patch x patch square of random pixels
+    // (0: no pixel changes, -1: every frame is the next image)
+    struct Scenario {
+        const char* name;
+        int patch;
+    };
+    const Scenario scenarios[] = {
+        { "static", 0 }, { "1 pixel", 1 }, { "3x3 patch", 3 }, { "8x8 patch", 8 }, { "new image", -1 },
+    };
+
+    printf("incremental inference report (%s kernels, %d images x %d frames)\n", simd_level_name(simd_kernels().level),
+        numImages, framesPerImage);
+    printf("  %-10s %8s %8s %9s %9s %11s %10s %12s\n", "frames", "S2 rows", "S4 rows", "FC runs", "no work",
+        "identical", "us/frame", "incremental");
+
+    std::mt19937 random(1);
+    std::vector<unsigned char> pixels((size_t)numFrames * length * length);
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); ++s) {
+        const Scenario& scenario = scenarios[s];
+        std::vector<ImageMap> frames;
+        frames.reserve(numFrames);
+        for (int f = 0; f < numFrames; ++f) {
+            unsigned char* frame = &pixels[(size_t)f * length * length];
+            int b = (scenario.patch < 0) ? f % numImages : f / framesPerImage;
+            if (f % framesPerImage == 0 || scenario.patch < 0)
+                memcpy(frame, images[b]->data(), length * length);
+            else {
+                memcpy(frame, frame - length * length, length * length);
+                int top = (int)(random() % (length - scenario.patch + 1));
+                int left = (int)(random() % (length - scenario.patch + 1));
+                for (int i = 0; i < scenario.patch; ++i)
+                    for (int j = 0; j < scenario.patch; ++j)
+                        frame[(top + i) * length + left + j] = (unsigned char)(random() % 256);
+            }
+            frames.push_back(ImageMap(frame, length, images[b]->get_label()));
+        }
+
+        // outputs against a full pass over every frame
+        IncrementalContext stream;
+        int identical = 0;
+        for (int f = 0; f < numFrames; ++f) {
+            int digit = lenet5.run_inference(&frames[f], context);
+            int incremental = lenet5.run_inference_incremental(&frames[f], stream);
+            identical += (digit == incremental &&
+                memcmp(context.get_outputs().data(), stream.get_outputs().data(), D::OUT_LEN * sizeof(float)) == 0);
+        }
+        IncrementalStats stats = stream.get_stats();
+        double s2Rows = 100.0 * stats.s2_rows / ((double)stats.frames * D::C1_MAPS * D::S2_LEN);
+        double s4Rows = 100.0 * stats.s4_rows / ((double)stats.frames * D::C3_MAPS * D::S4_LEN);
+        size_t fcRuns = stats.frames - stats.unchanged_frames - stats.cached_frames;
+
+        const int passes = 20;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int p = 0; p < passes; ++p)
+            for (int f = 0; f < numFrames; ++f)
+                lenet5.run_inference(&frames[f], context);
+        auto middle = std::chrono::high_resolution_clock::now();
+        for (int p = 0; p < passes; ++p)
+            for (int f = 0; f < numFrames; ++f)
+                lenet5.run_inference_incremental(&frames[f], stream);
+        auto stop = std::chrono::high_resolution_clock::now();
+        double full = std::chrono::duration_cast<std::chrono::nanoseconds>(middle - start).count() * 1e-3 / (passes * numFrames);
+        double incremental = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - middle).count() * 1e-3 / (passes * numFrames);
+
+        printf("  %-10s %7.1f%% %7.1f%% %8.1f%% %8.1f%% %5d / %-5d %8.2f %10.2f\n", scenario.name, s2Rows, s4Rows,
+            100.0 * fcRuns / stats.frames, 100.0 * stats.unchanged_frames / stats.frames, identical, numFrames, full, incremental);
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef LENET_5_INCREMENTAL_H
+#define LENET_5_INCREMENTAL_H
+
+#include "lenet5.h"
+
+// Incremental inference on streams of near-identical frames (see lenet5_incremental.cpp)
+
+// counters of Lenet5Model::run_inference_incremental
+struct IncrementalStats {
+    size_t frames;
+    size_t full_frames;         // run in full: the first frame of a stream, or Winograd / FFT convolutions selected
+    size_t unchanged_frames;    // no pixel changed, nothing was run
+    size_t cached_frames;       // no S4 value changed, C5, F6 and OUTPUT were not run
+    size_t s2_rows, s4_rows;    // pooled rows recomputed, out of C1_MAPS x S2_LEN and C3_MAPS x S4_LEN per frame
+
+    IncrementalStats() : frames(0), full_frames(0), unchanged_frames(0), cached_frames(0), s2_rows(0), s4_rows(0) {}
+};
+
+// state of one stream of frames for Lenet5Model::run_inference_incremental: the previous frame and its activations
+// one context per stream (and thread), used with one model
+class IncrementalContext {
+private:
+    InferenceContext context;   // activations of last_image
+    Tensor<unsigned char> last_image;
+    bool valid;                 // false: the next frame is run in full
+    int digit;                  // prediction for last_image
+    IncrementalStats stats;
+
+    IncrementalContext(const IncrementalContext&);
+    IncrementalContext& operator=(const IncrementalContext&);
+
+public:
+    explicit IncrementalContext(bool hugePages = arena_huge_pages());
+
+    // forgets the previous frame: call before another stream, or after the model (precision, sparse format, ...) changed
+    void reset() { valid = false; }
+
+    const IncrementalStats& get_stats() const { return stats; }
+    void clear_stats() { stats = IncrementalStats(); }
+    // outputs of the OUTPUT layer for the last frame
+    const Tensor<float>& get_outputs() const { return context.get_outputs(); }
+    const Arena& get_arena() const { return context.get_arena(); }
+
+    friend class Lenet5Model;
+};
+
+struct IncrementalReportOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;   // nullptr: the two CSV files
+
+    IncrementalReportOptions() : model_path(nullptr), dataset_path(nullptr) {}
+};
+
+// parses the arguments of "lenet5 incremental" (argv[0] is the first one after the command)
+bool parse_incremental_args(int argc, char* argv[], IncrementalReportOptions& options);
+void print_incremental_usage();
+
+// streams of frames that change a few pixels at a time, run incrementally and in full and compared
+bool run_incremental_report(const IncrementalReportOptions& options);
+
+#endif
@@ -0,0 +1,323 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "lenet5_int8.h"
+#include "dataset_reader.h"
+
+// padded dot product length
+static int pad_k(int length, int align = INT8_K_ALIGN) {
+    return (length + align - 1) / align * align;
+}
+
+// column stride of an im2col matrix (see GemmU8S8Fn)
+static int pad_cols(int numCols) {
+    return (numCols + 15) & ~15;
+}
+
+// activation scale that maps [0, max] onto [0, 255]
+static float activation_scale(float max) {
+    return (max > 0.f) ? max / 255.f : 1.f;
+}
+
+// 5x5 patches of an inLength x inLength map (numMaps maps, NCHW) as the cols matrix of GemmU8S8Fn:
+// row (m, ki, kj) holds that input value for every output position; the padding is left untouched
+static void im2col_u8(const unsigned char* in, int numMaps, int inLength, unsigned char* cols) {
+
+    int outLength = inLength - 4;
+    int stride = pad_cols(outLength * outLength);
+    for (int m = 0; m < numMaps; ++m) {
+        const unsigned char* map = in + m * inLength * inLength;
+        for (int ki = 0; ki < 5; ++ki) {
+            for (int kj = 0; kj < 5; ++kj) {
+                unsigned char* row = cols + ((m * 5 + ki) * 5 + kj) * stride;
+                for (int i = 0; i < outLength; ++i)
+                    memcpy(row + i * outLength, map + (i + ki) * inLength + kj, outLength);
+            }
+        }
+    }
+}
+
+Int8InferenceContext::Int8InferenceContext(bool hugePages) : arena(ARENA_BLOCK_SIZE, hugePages), profile(nullptr)
+{
+    Tensor<unsigned char>* tensors[] = { &C1_cols, &C1_maps, &S2_maps, &C3_cols, &C3_maps, &S4_maps, &C5_maps, &F6_outputs };
+    for (size_t t = 0; t < sizeof(tensors) / sizeof(tensors[0]); ++t)
+        tensors[t]->set_arena(&arena);
+    acc.set_arena(&arena);
+    OUT_outputs.set_arena(&arena);
+
+    C1_cols.init(1, 1, pad_k(Lenet5Model::CONV * Lenet5Model::CONV, INT8_CONV_K_ALIGN), pad_cols(Lenet5Model::C1_LEN * Lenet5Model::C1_LEN));
+    C1_maps.init(1, Lenet5Model::C1_MAPS, Lenet5Model::C1_LEN, Lenet5Model::C1_LEN);
+    S2_maps.init(1, Lenet5Model::C1_MAPS, Lenet5Model::S2_LEN, Lenet5Model::S2_LEN);
+    C3_cols.init(1, 1, pad_k(Lenet5Model::C1_MAPS * Lenet5Model::CONV * Lenet5Model::CONV, INT8_CONV_K_ALIGN), pad_cols(Lenet5Model::C3_LEN * Lenet5Model::C3_LEN));
+    C3_maps.init(1, Lenet5Model::C3_MAPS, Lenet5Model::C3_LEN, Lenet5Model::C3_LEN);
+    S4_maps.init(1, 1, 1, pad_k(Lenet5Model::C3_MAPS * Lenet5Model::S4_LEN * Lenet5Model::S4_LEN));
+    C5_maps.init(1, 1, 1, pad_k(Lenet5Model::C5_MAPS));
+    F6_outputs.init(1, 1, 1, pad_k(Lenet5Model::F6_LEN));
+    acc.init(1, 1, 1, Lenet5Model::C1_MAPS * Lenet5Model::C1_LEN * Lenet5Model::C1_LEN);
+    OUT_outputs.init(1, 1, 1, Lenet5Model::OUT_LEN);
+
+    // the padding at the end of every dot product operand must stay 0
+    C1_cols.zero();
+    C3_cols.zero();
+    S4_maps.zero();
+    C5_maps.zero();
+    F6_outputs.zero();
+}
+
+Int8Calibration Lenet5Int8Model::calibrate(const Lenet5Model& model, const std::vector<ImageMap*>& images) {
+
+    Int8Calibration calib;
+    InferenceContext ctx;
+
+    for (size_t i = 0; i < images.size(); ++i) {
+        model.run_inference(images[i], ctx);
+
+        // the pooling windows cover the whole C1 / C3 maps, so their maxima are those of S2 / S4
+        for (size_t j = 0; j < ctx.S2_maps.size(); ++j)
+            calib.C1_max = (ctx.S2_maps[j] > calib.C1_max) ? ctx.S2_maps[j] : calib.C1_max;
+        for (size_t j = 0; j < ctx.S4_maps.size(); ++j)
+            calib.C3_max = (ctx.S4_maps[j] > calib.C3_max) ? ctx.S4_maps[j] : calib.C3_max;
+        for (size_t j = 0; j < ctx.C5_maps.size(); ++j)
+            calib.C5_max = (ctx.C5_maps[j] > calib.C5_max) ? ctx.C5_maps[j] : calib.C5_max;
+        for (size_t j = 0; j < ctx.F6_outputs.size(); ++j)
+            calib.F6_max = (ctx.F6_outputs[j] > calib.F6_max) ? ctx.F6_outputs[j] : calib.F6_max;
+    }
+    calib.numImages = (int)images.size();
+
+    return calib;
+}
+
+void Lenet5Int8Model::quantize_layer(Int8Layer& layer, const float* weights, const float* bias, int rows, int length, int k,
+    float inScale, float outScale)
+{
+    layer.rows = rows;
+    layer.k = k;
+    layer.weights.init(1, 1, rows, k);
+    layer.weights.zero();
+    layer.bias.resize(rows);
+    layer.multiplier.resize(rows);
+
+    for (int r = 0; r < rows; ++r) {
+        const float* w = weights + r * length;
+
+        // symmetric per-channel scale
+        float maxAbs = 0.f;
+        for (int i = 0; i < length; ++i)
+            maxAbs = (fabsf(w[i]) > maxAbs) ? fabsf(w[i]) : maxAbs;
+        float scale = (maxAbs > 0.f) ? maxAbs / 127.f : 1.f;
+
+        signed char* q = layer.weights.data() + r * k;
+        for (int i = 0; i < length; ++i)
+            q[i] = (signed char)lrintf(w[i] / scale);
+
+        float accScale = inScale * scale;   // value of 1 in the accumulator
+        layer.bias[r] = (int)lrintf(bias[r] / accScale);
+        layer.multiplier[r] = accScale / outScale;
+    }
+}
+
+Lenet5Int8Model::Lenet5Int8Model(const Lenet5Model& model, const std::vector<ImageMap*>& calibrationImages) :
+    simd(&simd_kernels())
+{
+    const int CONV = Lenet5Model::CONV;
+    const int C1_MAPS = Lenet5Model::C1_MAPS;
+    const int C3_MAPS = Lenet5Model::C3_MAPS;
+    const int C5_MAPS = Lenet5Model::C5_MAPS;
+
+    calibration = calibrate(model, calibrationImages);
+
+    float inScale = 1.f;    // raw pixels
+    float c1Scale = activation_scale(calibration.C1_max);
+    float c3Scale = activation_scale(calibration.C3_max);
+    float c5Scale = activation_scale(calibration.C5_max);
+    float f6Scale = activation_scale(calibration.F6_max);
+
+    // C1: 6 x 25
+    quantize_layer(C1, model.C1_kernels.data(), model.C1_bias.data(), C1_MAPS, CONV * CONV, pad_k(CONV * CONV, INT8_CONV_K_ALIGN),
+        inScale, c1Scale);
+
+    // C3: spread the kernels of each map over the 6 S2 maps they read, in S2 map order (the order of the patches)
+    std::vector<float> c3Dense(C3_MAPS * C1_MAPS * CONV * CONV, 0.f);
+    for (int n = 0; n < C3_MAPS; ++n) {
+        for (int k = 0; k < C3_TABLE.num_inputs[n]; ++k) {
+            memcpy(&c3Dense[(n * C1_MAPS + C3_TABLE.inputs[n][k]) * CONV * CONV], model.C3_kernels.plane(n, k),
+                CONV * CONV * sizeof(float));
+        }
+    }
+    quantize_layer(C3, c3Dense.data(), model.C3_bias.data(), C3_MAPS, C1_MAPS * CONV * CONV, pad_k(C1_MAPS * CONV * CONV, INT8_CONV_K_ALIGN),
+        c1Scale, c3Scale);
+
+    // C5: 120 x 400, F6: 84 x 120, OUTPUT: 10 x 84 (dequantized to float, so the output scale is 1)
+    quantize_layer(C5, model.C5_kernels.data(), model.C5_bias.data(), C5_MAPS, C3_MAPS * CONV * CONV, pad_k(C3_MAPS * CONV * CONV),
+        c3Scale, c5Scale);
+    quantize_layer(F6, model.F6_weights.data(), model.F6_bias.data(), Lenet5Model::F6_LEN, C5_MAPS, pad_k(C5_MAPS),
+        c5Scale, f6Scale);
+    quantize_layer(OUT, model.OUT_weights.data(), model.OUT_bias.data(), Lenet5Model::OUT_LEN, Lenet5Model::F6_LEN, pad_k(Lenet5Model::F6_LEN),
+        f6Scale, 1.f);
+}
+
+void Lenet5Int8Model::max_pooling(const unsigned char* in, unsigned char* out, int numMaps, int outLength) {
+
+    // the quantization is monotonic, so pooling the uint8 values picks the same element as the float path
+    int inLength = outLength * 2;
+    for (int m = 0; m < numMaps; ++m) {
+        const unsigned char* map = in + m * inLength * inLength;
+        unsigned char* o = out + m * outLength * outLength;
+        for (int i = 0; i < outLength; ++i) {
+            const unsigned char* r0 = map + (i * 2) * inLength;
+            const unsigned char* r1 = r0 + inLength;
+            for (int j = 0; j < outLength; ++j) {
+                unsigned char a = (r0[j * 2] > r0[j * 2 + 1]) ? r0[j * 2] : r0[j * 2 + 1];
+                unsigned char b = (r1[j * 2] > r1[j * 2 + 1]) ? r1[j * 2] : r1[j * 2 + 1];
+                o[i * outLength + j] = (a > b) ? a : b;
+            }
+        }
+    }
+}
+
+int Lenet5Int8Model::run_inference(const ImageMap* image, Int8InferenceContext& ctx) const {
+
+    const int C1_LEN = Lenet5Model::C1_LEN;
+    const int C3_LEN = Lenet5Model::C3_LEN;
+    int* acc = ctx.acc.data();
+    LayerTimer timer(ctx.profile);
+
+    // layer C1 convolution: the 8-bit pixels are the uint8 input
+    im2col_u8(image->data(), 1, Lenet5Model::IN_LEN, ctx.C1_cols.data());
+    simd->gemm_u8s8(ctx.C1_cols.data(), C1.weights.data(), C1.k, C1.rows, C1_LEN * C1_LEN, acc);
+    for (int n = 0; n < C1.rows; ++n)
+        simd->requantize(acc + n * C1_LEN * C1_LEN, C1.bias[n], C1.multiplier[n], ctx.C1_maps.plane(0, n), C1_LEN * C1_LEN);
+    timer.end_layer(LAYER_C1);
+
+    // layer S2 max pooling
+    max_pooling(ctx.C1_maps.data(), ctx.S2_maps.data(), Lenet5Model::C1_MAPS, Lenet5Model::S2_LEN);
+    timer.end_layer(LAYER_S2);
+
+    // layer C3 convolution, every map against all 6 S2 maps (unconnected ones have zero weights)
+    im2col_u8(ctx.S2_maps.data(), Lenet5Model::C1_MAPS, Lenet5Model::S2_LEN, ctx.C3_cols.data());
+    simd->gemm_u8s8(ctx.C3_cols.data(), C3.weights.data(), C3.k, C3.rows, C3_LEN * C3_LEN, acc);
+    for (int n = 0; n < C3.rows; ++n)
+        simd->requantize(acc + n * C3_LEN * C3_LEN, C3.bias[n], C3.multiplier[n], ctx.C3_maps.plane(0, n), C3_LEN * C3_LEN);
+    timer.end_layer(LAYER_C3);
+
+    // layer S4 max pooling
+    max_pooling(ctx.C3_maps.data(), ctx.S4_maps.data(), Lenet5Model::C3_MAPS, Lenet5Model::S4_LEN);
+    timer.end_layer(LAYER_S4);
+
+    // layer C5 convolution (one dot product of the whole S4 output per map)
+    simd->dot_u8s8(ctx.S4_maps.data(), C5.weights.data(), C5.k, C5.rows, acc);
+    for (int n = 0; n < C5.rows; ++n)
+        simd->requantize(acc + n, C5.bias[n], C5.multiplier[n], ctx.C5_maps.data() + n, 1);
+    timer.end_layer(LAYER_C5);
+
+    // layer F6 fully-connected
+    simd->dot_u8s8(ctx.C5_maps.data(), F6.weights.data(), F6.k, F6.rows, acc);
+    for (int n = 0; n < F6.rows; ++n)
+        simd->requantize(acc + n, F6.bias[n], F6.multiplier[n], ctx.F6_outputs.data() + n, 1);
+    timer.end_layer(LAYER_F6);
+
+    // OUTPUT layer: dequantize, no ReLU
+    simd->dot_u8s8(ctx.F6_outputs.data(), OUT.weights.data(), OUT.k, OUT.rows, acc);
+    for (int n = 0; n < OUT.rows; ++n)
+        ctx.OUT_outputs[n] = (float)(acc[n] + OUT.bias[n]) * OUT.multiplier[n];
+
+    // treat the largest output as the NN's prediction (ties go to the later one, as in the float path)
+    int maxIdx = 0;
+    for (int i = 1; i < OUT.rows; ++i) {
+        if (ctx.OUT_outputs[i] >= ctx.OUT_outputs[maxIdx])
+            maxIdx = i;
+    }
+
+    timer.end_layer(LAYER_OUTPUT);
+    timer.end_images(1);
+
+    return maxIdx;
+}
+
+void print_int8_usage() {
+    printf("usage: lenet5 int8 [options]                quantize to int8, calibrated on the images, and compare with float\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -d dataset         CSV or MNIST IDX images file (default ./dataset/*.csv)\n");
+}
+
+bool parse_int8_args(int argc, char* argv[], Int8ReportOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_int8_report(const Int8ReportOptions& options) {
+
+    // calibration and evaluation images
+    Arena imageArena;
+    std::vector<ImageMap*> images;
+    if (!read_report_images(images, imageArena, options.dataset_path))
+        return false;
+
+    const Lenet5Model lenet5(options.model_path);
+    const Lenet5Int8Model lenet5Int8(lenet5, images);
+    InferenceContext context;
+    Int8InferenceContext contextInt8;
+
+    int numImages = (int)images.size();
+    int agree = 0, correct = 0, correctInt8 = 0;
+    float maxError = 0.f, maxLogit = 0.f;
+    for (int i = 0; i < numImages; ++i) {
+        int digit = lenet5.run_inference(images[i], context);
+        int digitInt8 = lenet5Int8.run_inference(images[i], contextInt8);
+        agree += (digit == digitInt8);
+        correct += (digit == images[i]->get_label() - '0');
+        correctInt8 += (digitInt8 == images[i]->get_label() - '0');
+        for (int n = 0; n < Lenet5Dims::OUT_LEN; ++n) {
+            float error = fabsf(context.get_outputs()[n] - contextInt8.get_outputs()[n]);
+            maxError = (error > maxError) ? error : maxError;
+            maxLogit = (fabsf(context.get_outputs()[n]) > maxLogit) ? fabsf(context.get_outputs()[n]) : maxLogit;
+        }
+    }
+
+    // time both paths over repeated passes of the images
+    const int passes = 200;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int p = 0; p < passes; ++p)
+        for (int i = 0; i < numImages; ++i)
+            lenet5.run_inference(images[i], context);
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (int p = 0; p < passes; ++p)
+        for (int i = 0; i < numImages; ++i)
+            lenet5Int8.run_inference(images[i], contextInt8);
+    auto stop = std::chrono::high_resolution_clock::now();
+    double timeFloat = std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count() * 1e-3 / (passes * numImages);
+    double timeInt8 = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - mid).count() * 1e-3 / (passes * numImages);
+
+    // float weights: every kernel and fully-connected weight, plus one bias per output map
+    typedef Lenet5Dims D;
+    size_t floatBytes = (D::C1_MAPS * D::CONV * D::CONV + D::C3_MAPS * D::C1_MAPS * D::CONV * D::CONV + D::C5_MAPS * D::C3_MAPS * D::CONV * D::CONV
+        + D::F6_LEN * D::C5_MAPS + D::OUT_LEN * D::F6_LEN + D::C1_MAPS + D::C3_MAPS + D::C5_MAPS + D::F6_LEN + D::OUT_LEN) * sizeof(float);
+
+    const Int8Calibration& calib = lenet5Int8.get_calibration();
+    printf("int8 quantization report (%s kernels)\n", simd_level_name(simd_kernels().level));
+    printf("  calibration:        %d images, max activation C1 %.3f, C3 %.3f, C5 %.3f, F6 %.3f\n",
+        calib.numImages, calib.C1_max, calib.C3_max, calib.C5_max, calib.F6_max);
+    printf("  weights:            float32 %d bytes, int8 %d bytes (%.2fx smaller)\n",
+        (int)floatBytes, (int)lenet5Int8.weight_bytes(), (double)floatBytes / lenet5Int8.weight_bytes());
+    printf("  agreement:          %d / %d predictions match the float network\n", agree, numImages);
+    printf("  accuracy (labels):  float %d / %d, int8 %d / %d\n", correct, numImages, correctInt8, numImages);
+    printf("  max output error:   %.4f (largest float output %.4f)\n", maxError, maxLogit);
+    printf("  time per image:     float %.2f us, int8 %.2f us (%.2fx)\n", timeFloat, timeInt8, timeFloat / timeInt8);
+    return true;
+}
@@ -0,0 +1,134 @@
+#ifndef LENET_5_INT8_H
+#define LENET_5_INT8_H
+
+#include <vector>
+#include "tensor.h"
+#include "imagemap.h"
+#include "simd.h"
+#include "lenet5.h"
+
+// Post-training int8 quantization of a Lenet5Model
+//
+// weights:     symmetric int8, one scale per output channel (w = scale[c] * q)
+// activations: uint8 with zero point 0 (every hidden layer ends in ReLU), one scale per layer,
+//              calibrated from the largest float activation seen on the calibration images;
+//              the input image is used as is (scale 1, like the float path)
+// each layer:  int32 accumulation of uint8 x int8 products, then requantize + ReLU:
+//              out = clamp(round((acc + bias[c]) * multiplier[c]), 0, 255)
+//              the OUTPUT layer is dequantized to float instead
+
+#define INT8_K_ALIGN 32     // fully-connected lengths are zero padded to a multiple of this (see DotU8S8Fn)
+#define INT8_CONV_K_ALIGN 4 // convolution patch lengths are zero padded to a multiple of this (see GemmU8S8Fn)
+
+class Lenet5Int8Model;
+
+// largest float activation of each layer over the calibration images (after ReLU)
+struct Int8Calibration {
+    float C1_max;
+    float C3_max;
+    float C5_max;
+    float F6_max;
+    int numImages;
+
+    Int8Calibration() : C1_max(0.f), C3_max(0.f), C5_max(0.f), F6_max(0.f), numImages(0) {}
+};
+
+// per-thread state of the int8 network, like InferenceContext for the float one
+class Int8InferenceContext {
+private:
+    Arena arena;                    // holds every buffer below (see InferenceContext)
+
+    Tensor<unsigned char> C1_cols;  // (25 -> 28) x 784 im2col matrix
+    Tensor<unsigned char> C1_maps;  // 6 x 28 x 28
+    Tensor<unsigned char> S2_maps;  // 6 x 14 x 14
+    Tensor<unsigned char> C3_cols;  // (6 * 25 -> 152) x (100 -> 112) im2col matrix over all 6 S2 maps
+    Tensor<unsigned char> C3_maps;  // 16 x 10 x 10
+    Tensor<unsigned char> S4_maps;  // 16 x 5 x 5, padded to 416
+    Tensor<unsigned char> C5_maps;  // 120, padded to 128
+    Tensor<unsigned char> F6_outputs;   // 84, padded to 96
+    Tensor<int> acc;                // int32 sums of one layer
+    Tensor<float> OUT_outputs;      // dequantized outputs
+
+    LayerProfile* profile;          // time per layer is added here when set
+
+    Int8InferenceContext(const Int8InferenceContext&);
+    Int8InferenceContext& operator=(const Int8InferenceContext&);
+
+public:
+    explicit Int8InferenceContext(bool hugePages = arena_huge_pages());
+
+    // adds the time spent in every layer of each following inference to profile (nullptr: stop profiling)
+    void set_profile(LayerProfile* profile) { this->profile = profile; }
+
+    // outputs of the OUTPUT layer for the last image run through run_inference
+    const Tensor<float>& get_outputs() const { return OUT_outputs; }
+
+    const Arena& get_arena() const { return arena; }
+
+    friend class Lenet5Int8Model;
+};
+
+// one quantized layer: rows output channels x k (padded) int8 weights
+struct Int8Layer {
+    int rows;
+    int k;
+    Tensor<signed char> weights;
+    std::vector<int> bias;          // in units of the accumulator (input scale x weight scale)
+    std::vector<float> multiplier;  // accumulator -> output scale (or -> float for the OUTPUT layer)
+
+    // weights / bias bytes of the packed layer
+    size_t bytes() const { return weights.size() + bias.size() * sizeof(int); }
+};
+
+// immutable int8 copy of a float model, safe to share between threads
+class Lenet5Int8Model {
+private:
+    const SimdKernels* simd;
+
+    Int8Layer C1;   // 6 x (25 -> 28)
+    Int8Layer C3;   // 16 x (6 * 25 -> 152), zero weights for S2 maps a C3 map is not connected to
+    Int8Layer C5;   // 120 x (400 -> 416)
+    Int8Layer F6;   // 84 x (120 -> 128)
+    Int8Layer OUT;  // 10 x (84 -> 96)
+
+    Int8Calibration calibration;
+
+    // quantizes rows x length float weights (row stride = length) into layer, with padded length k
+    static void quantize_layer(Int8Layer& layer, const float* weights, const float* bias, int rows, int length, int k,
+        float inScale, float outScale);
+
+    static void max_pooling(const unsigned char* in, unsigned char* out, int numMaps, int outLength);
+
+    // not copyable
+    Lenet5Int8Model(const Lenet5Int8Model&);
+    Lenet5Int8Model& operator=(const Lenet5Int8Model&);
+
+public:
+    // quantizes the model, with activation scales calibrated on the given images
+    Lenet5Int8Model(const Lenet5Model& model, const std::vector<ImageMap*>& calibrationImages);
+
+    // runs the float model over the images and records the range of every layer
+    static Int8Calibration calibrate(const Lenet5Model& model, const std::vector<ImageMap*>& images);
+
+    const Int8Calibration& get_calibration() const { return calibration; }
+    // bytes of all packed weights and biases
+    size_t weight_bytes() const { return C1.bytes() + C3.bytes() + C5.bytes() + F6.bytes() + OUT.bytes(); }
+
+    int run_inference(const ImageMap* image, Int8InferenceContext& ctx) const;
+};
+
+struct Int8ReportOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;   // nullptr: the two CSV files
+
+    Int8ReportOptions() : model_path(nullptr), dataset_path(nullptr) {}
+};
+
+// parses the arguments of "lenet5 int8" (argv[0] is the first one after the command)
+bool parse_int8_args(int argc, char* argv[], Int8ReportOptions& options);
+void print_int8_usage();
+
+// quantizes the model, calibrated on the images, and compares predictions, outputs and time with the float network
+bool run_int8_report(const Int8ReportOptions& options);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <thread>
+#include "lenet5_numa.h"
+
+Lenet5NumaReplicas::Lenet5NumaReplicas(const char* model_path, const char* conv_algorithms) :
+    topology(NumaTopology::detect()), replicas(topology.nodes.size()), loaded(true)
+{
+    // worker CPUs: the nodes in turn
+    size_t largest = 0;
+    for (const NumaNode& node : topology.nodes)
+        largest = (node.cpus.size() > largest) ? node.cpus.size() : largest;
+    for (size_t i = 0; i < largest; ++i) {
+        for (int n = 0; n < (int)topology.nodes.size(); ++n) {
+            if (i < topology.nodes[n].cpus.size()) {
+                cpus.push_back(topology.nodes[n].cpus[i]);
+                cpu_nodes.push_back(n);
+            }
+        }
+    }
+
+    // every replica is built and copied by a thread pinned to its node, so its pages are first touched there;
+    // the nodes build theirs at the same time
+    std::vector<char> ok(replicas.size(), 1);
+    std::vector<std::thread> builders;
+    for (int n = 0; n < (int)replicas.size(); ++n) {
+        builders.push_back(std::thread([&, n]() {
+            pin_thread(topology.nodes[n].cpus[0]);
+            Lenet5Model* model = new Lenet5Model(model_path);
+            if (conv_algorithms != nullptr && !model->set_conv_algorithms(conv_algorithms))
+                ok[n] = 0;
+            model->copy_weights();
+            ok[n] &= model->is_loaded() ? 1 : 0;
+            replicas[n].reset(model);
+        }));
+    }
+    for (size_t b = 0; b < builders.size(); ++b)
+        builders[b].join();
+    for (size_t n = 0; n < ok.size(); ++n)
+        loaded = loaded && ok[n] != 0;
+}
+
+void Lenet5NumaReplicas::pin_worker(int worker) const {
+    if (!pin_thread(worker_cpu(worker)))
+        fprintf(stderr, "cannot pin worker %d to cpu %d\n", worker, worker_cpu(worker));
+}
+
+std::string Lenet5NumaReplicas::placement() const {
+
+    std::string text;
+    for (int n = 0; n < (int)topology.nodes.size(); ++n) {
+        const Lenet5Model& model = *replicas[n];
+        int weightsNode = numa_node_of(model.C5_kernels.data());
+        int panelsNode = numa_node_of(model.C5_panels.data());
+        char line[160];
+        snprintf(line, sizeof(line), "node %d: cpus %s, replica weights on node %s, packed C5 panels on node %s\n",
+            topology.nodes[n].id, format_cpu_list(topology.nodes[n].cpus).c_str(),
+            (weightsNode >= 0) ? std::to_string(weightsNode).c_str() : "?",
+            (panelsNode >= 0) ? std::to_string(panelsNode).c_str() : "?");
+        text += line;
+    }
+    return text;
+}
@@ -0,0 +1,53 @@
+#ifndef LENET_5_NUMA_H
+#define LENET_5_NUMA_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "lenet5.h"
+#include "numa.h"
+
+// Lenet5Model on a NUMA machine ("lenet5 -N", "lenet5 bench -e numa")
+//
+// weights:    one replica of the model per node, built by a thread pinned to the node, with its weights copied
+//             out of the model file (Lenet5Model::copy_weights), so C5 / F6 / OUTPUT (96% of the parameters)
+//             and every packed copy of them sit in that node's memory; a worker only reads its node's replica
+// workers:    pool worker w is pinned to the w-th CPU taken from the nodes in turn (node 0 CPU 0, node 1 CPU 0,
+//             node 0 CPU 1, ...), so any number of workers is spread evenly; pin_worker is meant for the
+//             ThreadPool start hook, which then allocates the worker's InferenceContext on its node as well
+// Without NUMA (one node) this is one model copied into the heap and workers pinned to the CPUs.
+
+class Lenet5NumaReplicas {
+private:
+    NumaTopology topology;
+    std::vector<std::unique_ptr<Lenet5Model>> replicas;    // one per entry of topology.nodes
+    std::vector<int> cpus;          // CPU of each worker (cycled)
+    std::vector<int> cpu_nodes;     // node index (into topology.nodes) of each of them
+    bool loaded;
+
+    Lenet5NumaReplicas(const Lenet5NumaReplicas&);
+    Lenet5NumaReplicas& operator=(const Lenet5NumaReplicas&);
+
+public:
+    // builds the replicas on the detected topology (see NumaTopology::detect), each with the convolution
+    // algorithms conv_algorithms (nullptr: LENET5_CONV or direct)
+    explicit Lenet5NumaReplicas(const char* model_path, const char* conv_algorithms = nullptr);
+
+    // every replica has all its parameters and accepted the convolution algorithms
+    bool is_loaded() const { return loaded; }
+    const NumaTopology& get_topology() const { return topology; }
+    // one worker per usable CPU
+    int num_cpus() const { return (int)cpus.size(); }
+
+    int worker_cpu(int worker) const { return cpus[worker % cpus.size()]; }
+    int worker_node(int worker) const { return cpu_nodes[worker % cpus.size()]; }
+    // pins the calling thread to the CPU of worker
+    void pin_worker(int worker) const;
+    // replica of the worker's node
+    const Lenet5Model& model(int worker) const { return *replicas[worker_node(worker)]; }
+
+    // one line per node: its CPUs and the node the replica's weights actually landed on
+    std::string placement() const;
+};
+
+#endif
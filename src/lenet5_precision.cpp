@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include "lenet5.h"
+#include "dataset_reader.h"
+
+// fp16 / bf16 storage of the C5, F6 and OUTPUT weights (see half_precision.h)
+
+void Lenet5Model::pack_half_panels() {
+
+    struct {
+        Tensor<uint16_t>* panels;
+        const Tensor<float>* weights;
+        int numRows;
+        int n;
+    } layers[] = {
+        { &C5_half, &C5_kernels, C5_MAPS, C3_MAPS * CONV * CONV },
+        { &F6_half, &F6_weights, F6_LEN, C5_MAPS },
+        { &OUT_half, &OUT_weights, OUT_LEN, F6_LEN },
+    };
+
+    for (size_t l = 0; l < sizeof(layers) / sizeof(layers[0]); ++l) {
+        layers[l].panels->init(1, 1, 1, (int)gemv_half_panels_size(layers[l].numRows, layers[l].n, precision));
+        pack_gemv_panels_half(layers[l].weights->data(), layers[l].numRows, layers[l].n, precision, layers[l].panels->data());
+    }
+}
+
+void Lenet5Model::set_precision(StoragePrecision precision, bool activations) {
+
+    this->precision = precision;
+    half_activations = activations && precision != PRECISION_FP32;
+    if (precision != PRECISION_FP32)
+        pack_half_panels();
+}
+
+bool Lenet5Model::set_precision(const char* spec) {
+
+    std::string name(spec);
+    bool activations = false;
+    size_t plus = name.find('+');
+    if (plus != std::string::npos) {
+        if (name.substr(plus + 1) != "act") {
+            fprintf(stderr, "unknown precision option '%s' (act)\n", name.substr(plus + 1).c_str());
+            return false;
+        }
+        activations = true;
+        name = name.substr(0, plus);
+    }
+    StoragePrecision p;
+    if (!parse_precision(name.c_str(), p)) {
+        fprintf(stderr, "unknown precision '%s' (fp32, fp16, bf16)\n", name.c_str());
+        return false;
+    }
+    set_precision(p, activations);
+    return true;
+}
+
+void print_precision_usage() {
+    printf("usage: lenet5 half [options]                compare fp16 / bf16 fully-connected weights with fp32\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -d dataset         CSV or MNIST IDX images file (default ./dataset/*.csv)\n");
+}
+
+bool parse_precision_args(int argc, char* argv[], PrecisionReportOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_precision_report(const PrecisionReportOptions& options) {
+
+    Arena imageArena;
+    std::vector<ImageMap*> images;
+    if (!read_report_images(images, imageArena, options.dataset_path))
+        return false;
+
+    typedef Lenet5Dims D;
+    Lenet5Model lenet5(options.model_path);
+    InferenceContext context;
+    int numImages = (int)images.size();
+
+    // fp32 outputs of every image
+    lenet5.set_precision(PRECISION_FP32);
+    std::vector<float> reference(numImages * D::OUT_LEN);
+    std::vector<int> referenceDigits(numImages);
+    lenet5.run_inference_batch(&images[0], numImages, &referenceDigits[0], context, &reference[0]);
+
+    // the batch times are measured on batches of BATCH_TILE images (the dataset cycled)
+    std::vector<ImageMap*> tile = cycle_images(images, Lenet5Model::BATCH_TILE);
+    std::vector<int> tileDigits(tile.size());
+
+    printf("storage precision report (%s kernels, %d images, batch times on batches of %d)\n",
+        simd_level_name(simd_kernels().level), numImages, (int)tile.size());
+    printf("  %-10s %8s %12s %12s %9s %9s %9s %10s %10s\n", "precision", "bytes", "max error", "rel. error", "agree", "batch",
+        "correct", "us/image", "batched");
+
+    const char* specs[] = { "fp32", "fp16", "bf16", "fp16+act", "bf16+act" };
+    for (size_t c = 0; c < sizeof(specs) / sizeof(specs[0]); ++c) {
+        lenet5.set_precision(specs[c]);
+
+        // single-image path: outputs against fp32
+        float maxError = 0.f, maxValue = 0.f;
+        int agree = 0, correct = 0;
+        for (int b = 0; b < numImages; ++b) {
+            int digit = lenet5.run_inference(images[b], context);
+            agree += (digit == referenceDigits[b]);
+            correct += (digit == images[b]->get_label() - '0');
+            for (int n = 0; n < D::OUT_LEN; ++n) {
+                float ref = reference[b * D::OUT_LEN + n];
+                float error = fabsf(context.get_outputs()[n] - ref);
+                maxError = (error > maxError) ? error : maxError;
+                maxValue = (fabsf(ref) > maxValue) ? fabsf(ref) : maxValue;
+            }
+        }
+
+        // same predictions from the batched path
+        std::vector<int> digits(numImages);
+        lenet5.run_inference_batch(&images[0], numImages, &digits[0], context);
+        int batchAgree = 0;
+        for (int b = 0; b < numImages; ++b)
+            batchAgree += (digits[b] == referenceDigits[b]);
+
+        const int passes = 200;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int p = 0; p < passes; ++p)
+            for (int b = 0; b < numImages; ++b)
+                lenet5.run_inference(images[b], context);
+        auto mid = std::chrono::high_resolution_clock::now();
+        for (int p = 0; p < passes; ++p)
+            lenet5.run_inference_batch(&tile[0], (int)tile.size(), &tileDigits[0], context);
+        auto stop = std::chrono::high_resolution_clock::now();
+        double timeSingle = std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count() * 1e-3 / (passes * numImages);
+        double timeBatch = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - mid).count() * 1e-3 / (passes * tile.size());
+
+        printf("  %-10s %8d %12.3g %12.3g %4d / %-3d %4d / %-3d %4d / %-3d %8.2f %10.2f\n", specs[c], (int)lenet5.weight_bytes(),
+            maxError, maxError / maxValue, agree, numImages, batchAgree, numImages, correct, numImages, timeSingle, timeBatch);
+    }
+    return true;
+}
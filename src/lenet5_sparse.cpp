@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include "lenet5.h"
+#include "dataset_reader.h"
+
+// Pruning and sparse execution of the C5, F6 and OUTPUT layers (see sparse.h)
+
+void Lenet5Model::build_sparse() {
+
+    C5_csr.build(C5_kernels.data(), C5_MAPS, C3_MAPS * CONV * CONV);
+    F6_csr.build(F6_weights.data(), F6_LEN, C5_MAPS);
+    OUT_csr.build(OUT_weights.data(), OUT_LEN, F6_LEN);
+    if (sparse_format == SPARSE_BLOCK) {
+        C5_blocks.build(C5_kernels.data(), C5_MAPS, C3_MAPS * CONV * CONV);
+        F6_blocks.build(F6_weights.data(), F6_LEN, C5_MAPS);
+        OUT_blocks.build(OUT_weights.data(), OUT_LEN, F6_LEN);
+    }
+}
+
+void Lenet5Model::repack_fully_connected() {
+
+    pack_weights();
+    pack_panels();
+    if (precision != PRECISION_FP32)
+        pack_half_panels();
+    if (sparse_format != SPARSE_NONE)
+        build_sparse();
+}
+
+void Lenet5Model::set_sparse(SparseFormat format) {
+
+    sparse_format = format;
+    if (format != SPARSE_NONE)
+        build_sparse();
+}
+
+bool Lenet5Model::set_sparse(const char* name) {
+
+    SparseFormat format;
+    if (!parse_sparse_format(name, format)) {
+        fprintf(stderr, "unknown sparse format '%s' (dense, csr, block)\n", name);
+        return false;
+    }
+    set_sparse(format);
+    return true;
+}
+
+float Lenet5Model::prune(float sparsity, bool blocks) {
+
+    struct {
+        Tensor<float>* weights;
+        int rows;
+        int cols;
+    } layers[] = {
+        { &C5_kernels, C5_MAPS, C3_MAPS * CONV * CONV },
+        { &F6_weights, F6_LEN, C5_MAPS },
+        { &OUT_weights, OUT_LEN, F6_LEN },
+    };
+
+    for (size_t l = 0; l < sizeof(layers) / sizeof(layers[0]); ++l) {
+        // a copy always owns its data, so this also moves the weights out of a read-only mapping
+        Tensor<float> weights(*layers[l].weights);
+        *layers[l].weights = weights;
+        if (blocks)
+            prune_blocks(layers[l].weights->data(), layers[l].rows, layers[l].cols, sparsity);
+        else
+            prune_magnitude(layers[l].weights->data(), layers[l].rows, layers[l].cols, sparsity);
+    }
+    repack_fully_connected();
+    return this->sparsity();
+}
+
+float Lenet5Model::prune_threshold(float threshold) {
+
+    Tensor<float>* layers[] = { &C5_kernels, &F6_weights, &OUT_weights };
+    for (size_t l = 0; l < sizeof(layers) / sizeof(layers[0]); ++l) {
+        Tensor<float> weights(*layers[l]);
+        *layers[l] = weights;
+        ::prune_threshold(layers[l]->data(), 1, (int)layers[l]->size(), threshold);
+    }
+    repack_fully_connected();
+    return sparsity();
+}
+
+float Lenet5Model::sparsity() const {
+
+    const Tensor<float>* layers[] = { &C5_kernels, &F6_weights, &OUT_weights };
+    size_t zeros = 0, total = 0;
+    for (size_t l = 0; l < sizeof(layers) / sizeof(layers[0]); ++l) {
+        for (size_t i = 0; i < layers[l]->size(); ++i)
+            zeros += ((*layers[l])[i] == 0.f);
+        total += layers[l]->size();
+    }
+    return (float)zeros / total;
+}
+
+void print_prune_usage() {
+    printf("usage: lenet5 prune (-s sparsity | -T threshold) [options]\n");
+    printf("                                            zero the smallest C5 / F6 / OUTPUT weights and write the model\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -s sparsity        fraction of the weights of each layer to zero, 0 to 1\n");
+    printf("  -T threshold       zero the weights with a magnitude below threshold (also --threshold)\n");
+    printf("  -b                 zero whole 16x1 blocks of the GEMV panels (with -s)\n");
+    printf("  -o pruned.bin      output model (default params/lenet5_pruned.bin)\n");
+}
+
+bool parse_prune_args(int argc, char* argv[], PruneOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-b") == 0) {
+            options.blocks = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        const char* value = argv[++i];
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-o") == 0) {
+            options.out_path = value;
+        }
+        else if (strcmp(arg, "-s") == 0) {
+            options.sparsity = (float)atof(value);
+        }
+        else if (strcmp(arg, "-T") == 0 || strcmp(arg, "--threshold") == 0) {
+            options.threshold = (float)atof(value);
+        }
+        else {
+            return false;
+        }
+    }
+    // exactly one of a sparsity in [0, 1] and a threshold
+    return (options.sparsity < 0.f) != (options.threshold < 0.f) && options.sparsity <= 1.f
+        && !(options.blocks && options.sparsity < 0.f);
+}
+
+bool prune_model(const PruneOptions& options) {
+
+    Lenet5Model lenet5(options.model_path);
+    float before = lenet5.sparsity();
+    float after = (options.sparsity >= 0.f) ? lenet5.prune(options.sparsity, options.blocks)
+        : lenet5.prune_threshold(options.threshold);
+    if (!lenet5.save_model(options.out_path))
+        return false;
+
+    printf("C5 / F6 / OUTPUT weights: %.1f%% zero before, %.1f%% after\n", before * 100.f, after * 100.f);
+    printf("wrote %s\n", options.out_path);
+    return true;
+}
+
+void print_sparse_usage() {
+    printf("usage: lenet5 sparse [options]              accuracy and speed of the sparse kernels at several sparsity levels\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -d dataset         CSV or MNIST IDX images file (default ./dataset/*.csv)\n");
+}
+
+bool parse_sparse_args(int argc, char* argv[], SparseReportOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_sparse_report(const SparseReportOptions& options) {
+
+    Arena imageArena;
+    std::vector<ImageMap*> images;
+    if (!read_report_images(images, imageArena, options.dataset_path))
+        return false;
+
+    typedef Lenet5Dims D;
+    int numImages = (int)images.size();
+    InferenceContext context;
+
+    // outputs of the unpruned model
+    std::vector<float> reference(numImages * D::OUT_LEN);
+    std::vector<int> referenceDigits(numImages);
+    {
+        Lenet5Model lenet5(options.model_path);
+        lenet5.set_sparse(SPARSE_NONE);
+        for (int b = 0; b < numImages; ++b) {
+            referenceDigits[b] = lenet5.run_inference(images[b], context);
+            for (int n = 0; n < D::OUT_LEN; ++n)
+                reference[b * D::OUT_LEN + n] = context.get_outputs()[n];
+        }
+    }
+
+    std::vector<ImageMap*> tile = cycle_images(images, Lenet5Model::BATCH_TILE);
+    std::vector<int> tileDigits(tile.size());
+
+    printf("sparse C5 / F6 / OUTPUT report (%s kernels, %d images; us/image of the three layers, batched on batches of %d)\n",
+        simd_level_name(simd_kernels().level), numImages, (int)tile.size());
+    printf("  %-9s %8s %-6s %8s %12s %9s %9s %10s %10s\n", "pruning", "zeros", "format", "bytes", "rel. error", "agree",
+        "correct", "us/image", "batched");
+
+    const float levels[] = { 0.f, 0.5f, 0.7f, 0.8f, 0.9f, 0.95f };
+    for (int blocks = 0; blocks < 2; ++blocks) {
+        for (size_t s = 0; s < sizeof(levels) / sizeof(levels[0]); ++s) {
+            Lenet5Model lenet5(options.model_path);
+            float zeros = lenet5.prune(levels[s], blocks != 0);
+
+            for (int f = 0; f < SPARSE_FORMAT_COUNT; ++f) {
+                lenet5.set_sparse((SparseFormat)f);
+
+                float maxError = 0.f, maxValue = 0.f;
+                int agree = 0, correct = 0;
+                for (int b = 0; b < numImages; ++b) {
+                    int digit = lenet5.run_inference(images[b], context);
+                    agree += (digit == referenceDigits[b]);
+                    correct += (digit == images[b]->get_label() - '0');
+                    for (int n = 0; n < D::OUT_LEN; ++n) {
+                        float ref = reference[b * D::OUT_LEN + n];
+                        float error = fabsf(context.get_outputs()[n] - ref);
+                        maxError = (error > maxError) ? error : maxError;
+                        maxValue = (fabsf(ref) > maxValue) ? fabsf(ref) : maxValue;
+                    }
+                }
+
+                // time of the three layers alone, from the layer profile
+                const int passes = 100;
+                LayerProfile single, batched;
+                context.set_profile(&single);
+                for (int p = 0; p < passes; ++p)
+                    for (int b = 0; b < numImages; ++b)
+                        lenet5.run_inference(images[b], context);
+                context.set_profile(&batched);
+                for (int p = 0; p < passes; ++p)
+                    lenet5.run_inference_batch(&tile[0], (int)tile.size(), &tileDigits[0], context);
+                context.set_profile(nullptr);
+                double timeSingle = (single.seconds[LAYER_C5] + single.seconds[LAYER_F6] + single.seconds[LAYER_OUTPUT]) * 1e6 / single.images;
+                double timeBatch = (batched.seconds[LAYER_C5] + batched.seconds[LAYER_F6] + batched.seconds[LAYER_OUTPUT]) * 1e6 / batched.images;
+
+                printf("  %-9s %7.1f%% %-6s %8d %12.3g %4d / %-3d %4d / %-3d %8.2f %10.2f\n", blocks ? "blocks" : "magnitude",
+                    zeros * 100.f, sparse_format_name(f), (int)lenet5.weight_bytes(), maxError / maxValue,
+                    agree, numImages, correct, numImages, timeSingle, timeBatch);
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,740 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include "lenet5_train.h"
+#include "dataset_reader.h"
+#include "gemm.h"
+
+#define TRAIN_INPUT_SCALE (1.f / 255.f)    // default pixels -> [0, 1]
+
+struct TrainShard {
+    std::vector<float> grads;   // same layout as the parameters
+    double loss;
+    int correct;
+
+    // activations of one tile (see Lenet5Trainer::run_tile)
+    std::vector<float> in, cols1, a1, s2, cols3, a3, s4, x5, a5, a6, out;
+    std::vector<unsigned char> s2_arg, s4_arg;  // position of the max of each 2x2 pooling window
+    // gradients of the activations
+    std::vector<float> d_out, d_a6, d_a5, d_x5, d_a3, d_cols3, d_s2, d_a1;
+
+    TrainShard(size_t numParams) : grads(numParams, 0.f), loss(0.0), correct(0) {
+        const int n = Lenet5Model::BATCH_TILE;
+        const int N1 = n * Lenet5Dims::C1_LEN * Lenet5Dims::C1_LEN;
+        const int N2 = n * Lenet5Dims::S2_LEN * Lenet5Dims::S2_LEN;
+        const int N3 = n * Lenet5Dims::C3_LEN * Lenet5Dims::C3_LEN;
+        const int N4 = n * Lenet5Dims::S4_LEN * Lenet5Dims::S4_LEN;
+        in.resize(n * Lenet5Dims::IN_LEN * Lenet5Dims::IN_LEN);
+        cols1.resize(Lenet5Trainer::C1_K * N1);
+        a1.resize(Lenet5Dims::C1_MAPS * N1);
+        s2.resize(Lenet5Dims::C1_MAPS * N2);
+        s2_arg.resize(Lenet5Dims::C1_MAPS * N2);
+        cols3.resize(Lenet5Trainer::C3_K * N3);
+        a3.resize(Lenet5Dims::C3_MAPS * N3);
+        s4.resize(Lenet5Dims::C3_MAPS * N4);
+        s4_arg.resize(Lenet5Dims::C3_MAPS * N4);
+        x5.resize(Lenet5Trainer::C5_K * n);
+        a5.resize(Lenet5Dims::C5_MAPS * n);
+        a6.resize(Lenet5Dims::F6_LEN * n);
+        out.resize(Lenet5Dims::OUT_LEN * n);
+        d_out.resize(out.size());
+        d_a6.resize(a6.size());
+        d_a5.resize(a5.size());
+        d_x5.resize(x5.size());
+        d_a3.resize(a3.size());
+        d_cols3.resize(cols3.size());
+        d_s2.resize(s2.size());
+        d_a1.resize(a1.size());
+    }
+};
+
+// out[c * rows + r] = in[r * cols + c]
+static void transpose(const float* in, int rows, int cols, float* out) {
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c)
+            out[c * rows + r] = in[r * cols + c];
+    }
+}
+
+// 2x2 max pooling of numMaps (outLength * 2)^2 maps, arg records which of the 4 inputs is the max
+static void max_pool_forward(const float* in, int numMaps, int outLength, float* out, unsigned char* arg) {
+
+    const int inLength = outLength * 2;
+    for (int m = 0; m < numMaps; ++m) {
+        const float* map = in + m * inLength * inLength;
+        for (int i = 0; i < outLength; ++i) {
+            for (int j = 0; j < outLength; ++j) {
+                const float* p = map + 2 * i * inLength + 2 * j;
+                float values[4] = { p[0], p[1], p[inLength], p[inLength + 1] };
+                int best = 0;
+                for (int k = 1; k < 4; ++k) {
+                    if (values[k] > values[best])
+                        best = k;
+                }
+                *out++ = values[best];
+                *arg++ = (unsigned char)best;
+            }
+        }
+    }
+}
+
+// gradient of max_pool_forward(relu(z)) with respect to z: each output gradient goes to the max of its window,
+// or nowhere if that max was clamped by the ReLU
+static void max_pool_backward(const float* dOut, const unsigned char* arg, const float* pooled, int numMaps, int outLength, float* dIn) {
+
+    const int inLength = outLength * 2;
+    memset(dIn, 0, (size_t)numMaps * inLength * inLength * sizeof(float));
+    for (int m = 0; m < numMaps; ++m) {
+        float* map = dIn + m * inLength * inLength;
+        for (int i = 0; i < outLength; ++i) {
+            for (int j = 0; j < outLength; ++j) {
+                int o = (m * outLength + i) * outLength + j;
+                if (pooled[o] > 0.f)
+                    map[(2 * i + (arg[o] >> 1)) * inLength + 2 * j + (arg[o] & 1)] = dOut[o];
+            }
+        }
+    }
+}
+
+// inverse of im2col: adds every column entry back to the input pixel it was copied from
+static void col2im(const float* cols, int numImages, int inLength, int convLength, float* in) {
+
+    int outLength = inLength - convLength + 1;
+    int outSize = outLength * outLength;
+    int numCols = numImages * outSize;
+
+    memset(in, 0, (size_t)numImages * inLength * inLength * sizeof(float));
+    for (int ki = 0; ki < convLength; ++ki) {
+        for (int kj = 0; kj < convLength; ++kj) {
+            const float* row = cols + (ki * convLength + kj) * numCols;
+            for (int b = 0; b < numImages; ++b) {
+                float* map = in + b * inLength * inLength;
+                for (int i = 0; i < outLength; ++i) {
+                    float* dst = map + (i + ki) * inLength + kj;
+                    const float* src = row + b * outSize + i * outLength;
+                    for (int j = 0; j < outLength; ++j)
+                        dst[j] += src[j];
+                }
+            }
+        }
+    }
+}
+
+// dx[i] = (x[i] > 0) ? dx[i] : 0, the gradient through a ReLU whose output is x
+static void relu_backward(const float* x, float* dx, int n) {
+    for (int i = 0; i < n; ++i) {
+        if (x[i] <= 0.f)
+            dx[i] = 0.f;
+    }
+}
+
+bool TrainingSet::load(const char* filename, int maxImages) {
+
+    DatasetReader reader;
+    if (!reader.open(filename))
+        return false;
+
+    const int imageSize = Lenet5Dims::IN_LEN * Lenet5Dims::IN_LEN;
+    ImageMap image(Lenet5Dims::IN_LEN);
+    pixels.clear();
+    labels.clear();
+    max_pixel = 0;
+    while ((maxImages <= 0 || size() < maxImages) && reader.next(&image)) {
+        int label = image.get_label() - '0';
+        if (label < 0 || label >= Lenet5Dims::OUT_LEN) {
+            fprintf(stderr, "%s: image %d has no digit label\n", filename, size());
+            return false;
+        }
+        pixels.insert(pixels.end(), image.data(), image.data() + imageSize);
+        labels.push_back(label);
+        for (int i = 0; i < imageSize; ++i)
+            max_pixel = std::max(max_pixel, (int)image.data()[i]);
+    }
+    if (labels.empty()) {
+        fprintf(stderr, "%s: no images\n", filename);
+        return false;
+    }
+    return true;
+}
+
+Lenet5Trainer::Lenet5Trainer(int numThreads) : simd(&simd_kernels()), pool(numThreads), input_scale(TRAIN_INPUT_SCALE) {
+
+    const size_t sizes[PARAM_TENSOR_COUNT] = {
+        C1_MAPS * C1_K, C1_MAPS,
+        C3_MAPS * C3_K, C3_MAPS,
+        C5_MAPS * C5_K, C5_MAPS,
+        F6_LEN * C5_MAPS, F6_LEN,
+        OUT_LEN * F6_LEN, OUT_LEN,
+    };
+    offsets[0] = 0;
+    for (int t = 0; t < PARAM_TENSOR_COUNT; ++t)
+        offsets[t + 1] = offsets[t] + sizes[t];
+    params.assign(offsets[PARAM_TENSOR_COUNT], 0.f);
+    velocity.assign(params.size(), 0.f);
+
+    C3_connected.assign(C3_MAPS * C3_K, 0);
+    for (int n = 0; n < C3_MAPS; ++n) {
+        for (int k = 0; k < C3_TABLE.num_inputs[n]; ++k)
+            memset(&C3_connected[n * C3_K + C3_TABLE.inputs[n][k] * C1_K], 1, C1_K);
+    }
+
+    C3_T.resize(C3_K * C3_MAPS);
+    C5_T.resize(C5_K * C5_MAPS);
+    F6_T.resize(C5_MAPS * F6_LEN);
+    OUT_T.resize(F6_LEN * OUT_LEN);
+    for (int s = 0; s < pool.size(); ++s)
+        shards.push_back(std::unique_ptr<TrainShard>(new TrainShard(params.size())));
+}
+
+Lenet5Trainer::~Lenet5Trainer() {}
+
+void Lenet5Trainer::init_random(unsigned int seed) {
+
+    std::mt19937 rng(seed);
+    struct {
+        int weights;
+        int rows;
+        int fanIn;
+        float gain;     // 2 for the layers followed by a ReLU
+    } layers[] = {
+        { PARAM_C1_W, C1_MAPS, C1_K, 2.f },
+        { PARAM_C3_W, C3_MAPS, 0, 2.f },    // fan-in of each C3 map from C3_TABLE
+        { PARAM_C5_W, C5_MAPS, C5_K, 2.f },
+        { PARAM_F6_W, F6_LEN, C5_MAPS, 2.f },
+        { PARAM_OUT_W, OUT_LEN, F6_LEN, 1.f },
+    };
+
+    std::fill(params.begin(), params.end(), 0.f);
+    std::fill(velocity.begin(), velocity.end(), 0.f);
+    for (size_t l = 0; l < sizeof(layers) / sizeof(layers[0]); ++l) {
+        float* w = param(layers[l].weights);
+        int cols = (int)(offsets[layers[l].weights + 1] - offsets[layers[l].weights]) / layers[l].rows;
+        for (int r = 0; r < layers[l].rows; ++r) {
+            int fanIn = (layers[l].weights == PARAM_C3_W) ? C3_TABLE.num_inputs[r] * C1_K : layers[l].fanIn;
+            std::normal_distribution<float> normal(0.f, sqrtf(layers[l].gain / fanIn));
+            for (int c = 0; c < cols; ++c) {
+                bool used = (layers[l].weights != PARAM_C3_W) || C3_connected[r * cols + c];
+                w[r * cols + c] = used ? normal(rng) : 0.f;
+            }
+        }
+    }
+}
+
+void Lenet5Trainer::init_from(const Lenet5Model& model) {
+
+    // C1 sees pixels * input_scale here
+    for (int i = 0; i < C1_MAPS * C1_K; ++i)
+        param(PARAM_C1_W)[i] = model.C1_kernels[i] / input_scale;
+    memcpy(param(PARAM_C1_B), model.C1_bias.data(), C1_MAPS * sizeof(float));
+
+    // C3 kernels are stored in C3_TABLE order by the model, by S2 map here
+    memset(param(PARAM_C3_W), 0, C3_MAPS * C3_K * sizeof(float));
+    for (int n = 0; n < C3_MAPS; ++n) {
+        for (int k = 0; k < C3_TABLE.num_inputs[n]; ++k)
+            memcpy(param(PARAM_C3_W) + n * C3_K + C3_TABLE.inputs[n][k] * C1_K, model.C3_kernels.plane(n, k), C1_K * sizeof(float));
+    }
+    memcpy(param(PARAM_C3_B), model.C3_bias.data(), C3_MAPS * sizeof(float));
+
+    memcpy(param(PARAM_C5_W), model.C5_kernels.data(), C5_MAPS * C5_K * sizeof(float));
+    memcpy(param(PARAM_C5_B), model.C5_bias.data(), C5_MAPS * sizeof(float));
+    memcpy(param(PARAM_F6_W), model.F6_weights.data(), F6_LEN * C5_MAPS * sizeof(float));
+    memcpy(param(PARAM_F6_B), model.F6_bias.data(), F6_LEN * sizeof(float));
+    memcpy(param(PARAM_OUT_W), model.OUT_weights.data(), OUT_LEN * F6_LEN * sizeof(float));
+    memcpy(param(PARAM_OUT_B), model.OUT_bias.data(), OUT_LEN * sizeof(float));
+    std::fill(velocity.begin(), velocity.end(), 0.f);
+}
+
+void Lenet5Trainer::transpose_weights() {
+    transpose(param(PARAM_C3_W), C3_MAPS, C3_K, C3_T.data());
+    transpose(param(PARAM_C5_W), C5_MAPS, C5_K, C5_T.data());
+    transpose(param(PARAM_F6_W), F6_LEN, C5_MAPS, F6_T.data());
+    transpose(param(PARAM_OUT_W), OUT_LEN, F6_LEN, OUT_T.data());
+}
+
+void Lenet5Trainer::run_tile(const TrainingSet& data, const int* indices, int n, bool gradients, float gradScale,
+    TrainShard& s) const {
+
+    const int IN_SIZE = IN_LEN * IN_LEN;
+    const int N1 = n * C1_LEN * C1_LEN;     // columns of the C1 maps
+    const int N2 = n * S2_LEN * S2_LEN;
+    const int N3 = n * C3_LEN * C3_LEN;
+    const int S4_SIZE = S4_LEN * S4_LEN;
+
+    // forward, like run_batch_tile
+    for (int b = 0; b < n; ++b) {
+        const unsigned char* pixels = data.image(indices[b]);
+        for (int i = 0; i < IN_SIZE; ++i)
+            s.in[b * IN_SIZE + i] = pixels[i] * input_scale;
+    }
+
+    // C1 + ReLU: (6 x 25) * (25 x n*784), then S2
+    Lenet5Model::im2col(s.in.data(), n, IN_LEN, CONV, s.cols1.data());
+    sgemm(C1_MAPS, N1, C1_K, param(PARAM_C1_W), C1_K, s.cols1.data(), N1, s.a1.data(), N1, false);
+    bias_activation(C1_MAPS, N1, s.a1.data(), N1, param(PARAM_C1_B), true);
+    max_pool_forward(s.a1.data(), C1_MAPS * n, S2_LEN, s.s2.data(), s.s2_arg.data());
+
+    // C3 + ReLU: (16 x 150) * (150 x n*100) over the im2col rows of all 6 S2 maps, then S4
+    for (int m = 0; m < C1_MAPS; ++m)
+        Lenet5Model::im2col(&s.s2[m * N2], n, S2_LEN, CONV, &s.cols3[m * C1_K * N3]);
+    sgemm(C3_MAPS, N3, C3_K, param(PARAM_C3_W), C3_K, s.cols3.data(), N3, s.a3.data(), N3, false);
+    bias_activation(C3_MAPS, N3, s.a3.data(), N3, param(PARAM_C3_B), true);
+    max_pool_forward(s.a3.data(), C3_MAPS * n, S4_LEN, s.s4.data(), s.s4_arg.data());
+
+    // C5 + ReLU: (120 x 400) * (400 x n)
+    for (int m = 0; m < C3_MAPS; ++m) {
+        for (int p = 0; p < S4_SIZE; ++p) {
+            for (int b = 0; b < n; ++b)
+                s.x5[(m * S4_SIZE + p) * n + b] = s.s4[(m * n + b) * S4_SIZE + p];
+        }
+    }
+    sgemm(C5_MAPS, n, C5_K, param(PARAM_C5_W), C5_K, s.x5.data(), n, s.a5.data(), n, false);
+    bias_activation(C5_MAPS, n, s.a5.data(), n, param(PARAM_C5_B), true);
+
+    // F6 + ReLU, OUTPUT
+    sgemm(F6_LEN, n, C5_MAPS, param(PARAM_F6_W), C5_MAPS, s.a5.data(), n, s.a6.data(), n, false);
+    bias_activation(F6_LEN, n, s.a6.data(), n, param(PARAM_F6_B), true);
+    sgemm(OUT_LEN, n, F6_LEN, param(PARAM_OUT_W), F6_LEN, s.a6.data(), n, s.out.data(), n, false);
+    bias_activation(OUT_LEN, n, s.out.data(), n, param(PARAM_OUT_B), false);
+
+    // softmax cross-entropy, d_out = (softmax - one hot) * gradScale
+    for (int b = 0; b < n; ++b) {
+        int label = data.labels[indices[b]];
+        int maxIdx = 0;
+        for (int i = 1; i < OUT_LEN; ++i) {
+            if (s.out[i * n + b] >= s.out[maxIdx * n + b])
+                maxIdx = i;
+        }
+        s.correct += (maxIdx == label);
+
+        float maxValue = s.out[maxIdx * n + b];
+        double sum = 0.0;
+        for (int i = 0; i < OUT_LEN; ++i)
+            sum += exp((double)(s.out[i * n + b] - maxValue));
+        s.loss += log(sum) - (s.out[label * n + b] - maxValue);
+        for (int i = 0; i < OUT_LEN; ++i) {
+            float p = (float)(exp((double)(s.out[i * n + b] - maxValue)) / sum);
+            s.d_out[i * n + b] = (p - (i == label ? 1.f : 0.f)) * gradScale;
+        }
+    }
+    if (!gradients)
+        return;
+
+    // backward: dW[o][k] += dot(dZ[o], X[k]) over the columns of the tile, dX = W^T * dZ
+    struct {
+        int weights;
+        int rows;
+        int k;
+        int numCols;
+        const float* dz;
+        const float* x;
+    } layers[] = {
+        { PARAM_OUT_W, OUT_LEN, F6_LEN, n, s.d_out.data(), s.a6.data() },
+        { PARAM_F6_W, F6_LEN, C5_MAPS, n, s.d_a6.data(), s.a5.data() },
+        { PARAM_C5_W, C5_MAPS, C5_K, n, s.d_a5.data(), s.x5.data() },
+        { PARAM_C3_W, C3_MAPS, C3_K, N3, s.d_a3.data(), s.cols3.data() },
+        { PARAM_C1_W, C1_MAPS, C1_K, N1, s.d_a1.data(), s.cols1.data() },
+    };
+    float* grads = s.grads.data();
+    for (size_t l = 0; l < sizeof(layers) / sizeof(layers[0]); ++l) {
+        const int w = layers[l].weights;
+        const int numCols = layers[l].numCols;
+
+        // input gradient first: the next layer's dZ is computed from this one's
+        switch (w) {
+        case PARAM_OUT_W:
+            sgemm(F6_LEN, n, OUT_LEN, OUT_T.data(), OUT_LEN, s.d_out.data(), n, s.d_a6.data(), n, false);
+            relu_backward(s.a6.data(), s.d_a6.data(), F6_LEN * n);
+            break;
+        case PARAM_F6_W:
+            sgemm(C5_MAPS, n, F6_LEN, F6_T.data(), F6_LEN, s.d_a6.data(), n, s.d_a5.data(), n, false);
+            relu_backward(s.a5.data(), s.d_a5.data(), C5_MAPS * n);
+            break;
+        case PARAM_C5_W:
+            sgemm(C5_K, n, C5_MAPS, C5_T.data(), C5_MAPS, s.d_a5.data(), n, s.d_x5.data(), n, false);
+            // back to (16 x n x 25) S4 maps (in d_s2, unused until C3), then through S4 and the C3 ReLU
+            for (int m = 0; m < C3_MAPS; ++m) {
+                for (int p = 0; p < S4_SIZE; ++p) {
+                    for (int b = 0; b < n; ++b)
+                        s.d_s2[(m * n + b) * S4_SIZE + p] = s.d_x5[(m * S4_SIZE + p) * n + b];
+                }
+            }
+            max_pool_backward(s.d_s2.data(), s.s4_arg.data(), s.s4.data(), C3_MAPS * n, S4_LEN, s.d_a3.data());
+            break;
+        case PARAM_C3_W:
+            sgemm(C3_K, N3, C3_MAPS, C3_T.data(), C3_MAPS, s.d_a3.data(), N3, s.d_cols3.data(), N3, false);
+            for (int m = 0; m < C1_MAPS; ++m)
+                col2im(&s.d_cols3[m * C1_K * N3], n, S2_LEN, CONV, &s.d_s2[m * N2]);
+            max_pool_backward(s.d_s2.data(), s.s2_arg.data(), s.s2.data(), C1_MAPS * n, S2_LEN, s.d_a1.data());
+            break;
+        default:
+            break;  // C1 needs no input gradient
+        }
+
+        float* dw = grads + offsets[w];
+        float* db = grads + offsets[w + 1];
+        for (int o = 0; o < layers[l].rows; ++o) {
+            const float* dz = layers[l].dz + (size_t)o * numCols;
+            for (int k = 0; k < layers[l].k; ++k) {
+                if (w == PARAM_C3_W && !C3_connected[o * C3_K + k])
+                    continue;
+                dw[o * layers[l].k + k] += simd->dot(dz, layers[l].x + (size_t)k * numCols, numCols);
+            }
+            float sum = 0.f;
+            for (int c = 0; c < numCols; ++c)
+                sum += dz[c];
+            db[o] += sum;
+        }
+    }
+}
+
+double Lenet5Trainer::train_batch(const TrainingSet& data, const int* indices, int n,
+    float learningRate, float momentum, float weightDecay, int& correct) {
+
+    transpose_weights();
+
+    // one shard per thread, in tiles of at most BATCH_TILE images
+    const int numShards = std::min((int)shards.size(), n);
+    const float gradScale = 1.f / n;
+    pool.parallel_for(numShards, 1, [&](int begin, int end, int /*worker*/) {
+        for (int sh = begin; sh < end; ++sh) {
+            TrainShard& shard = *shards[sh];
+            std::fill(shard.grads.begin(), shard.grads.end(), 0.f);
+            shard.loss = 0.0;
+            shard.correct = 0;
+            int first = (int)((long long)n * sh / numShards);
+            int last = (int)((long long)n * (sh + 1) / numShards);
+            for (int b = first; b < last; b += Lenet5Model::BATCH_TILE) {
+                int numImages = std::min(last - b, (int)Lenet5Model::BATCH_TILE);
+                run_tile(data, indices + b, numImages, true, gradScale, shard);
+            }
+        }
+    });
+
+    // all-reduce: each thread sums the shards' gradients of one slice and updates that slice
+    const int numSlices = pool.size();
+    const size_t numParams = params.size();
+    pool.parallel_for(numSlices, 1, [&](int begin, int end, int /*worker*/) {
+        for (int slice = begin; slice < end; ++slice) {
+            size_t first = numParams * slice / numSlices;
+            size_t last = numParams * (slice + 1) / numSlices;
+            for (int sh = 1; sh < numShards; ++sh) {
+                const float* src = shards[sh]->grads.data();
+                float* dst = shards[0]->grads.data();
+                for (size_t i = first; i < last; ++i)
+                    dst[i] += src[i];
+            }
+            update(first, last, learningRate, momentum, weightDecay);
+        }
+    });
+
+    double loss = 0.0;
+    for (int sh = 0; sh < numShards; ++sh) {
+        loss += shards[sh]->loss;
+        correct += shards[sh]->correct;
+    }
+    return loss;
+}
+
+void Lenet5Trainer::update(size_t begin, size_t end, float learningRate, float momentum, float weightDecay) {
+
+    const float* grads = shards[0]->grads.data();
+    for (int t = 0; t < PARAM_TENSOR_COUNT; ++t) {
+        size_t first = std::max(begin, offsets[t]);
+        size_t last = std::min(end, offsets[t + 1]);
+        // biases are the odd tensors, they are not decayed
+        float decay = (t % 2 == 0) ? weightDecay : 0.f;
+        for (size_t i = first; i < last; ++i) {
+            float g = grads[i] + decay * params[i];
+            velocity[i] = momentum * velocity[i] - learningRate * g;
+            params[i] += velocity[i];
+        }
+    }
+}
+
+double Lenet5Trainer::evaluate(const TrainingSet& data, int& correct) {
+
+    for (size_t sh = 0; sh < shards.size(); ++sh) {
+        shards[sh]->loss = 0.0;
+        shards[sh]->correct = 0;
+    }
+
+    const int n = data.size();
+    std::vector<int> indices(n);
+    for (int i = 0; i < n; ++i)
+        indices[i] = i;
+    const int tile = Lenet5Model::BATCH_TILE;
+    pool.parallel_for((n + tile - 1) / tile, 1, [&](int begin, int end, int worker) {
+        for (int t = begin; t < end; ++t) {
+            int numImages = std::min(n - t * tile, tile);
+            run_tile(data, &indices[t * tile], numImages, false, 0.f, *shards[worker]);
+        }
+    });
+
+    double loss = 0.0;
+    for (size_t sh = 0; sh < shards.size(); ++sh) {
+        loss += shards[sh]->loss;
+        correct += shards[sh]->correct;
+    }
+    return loss / n;
+}
+
+void Lenet5Trainer::model_tensors(std::vector<float> (&tensors)[PARAM_TENSOR_COUNT]) const {
+
+    for (int t = 0; t < PARAM_TENSOR_COUNT; ++t)
+        tensors[t].assign(param(t), param(t) + (offsets[t + 1] - offsets[t]));
+
+    // the written model takes raw pixels
+    for (size_t i = 0; i < tensors[PARAM_C1_W].size(); ++i)
+        tensors[PARAM_C1_W][i] *= input_scale;
+
+    // 16 x 6 x 5 x 5 with the kernels of each C3 map first, in C3_TABLE order
+    std::vector<float>& c3 = tensors[PARAM_C3_W];
+    std::fill(c3.begin(), c3.end(), 0.f);
+    for (int n = 0; n < C3_MAPS; ++n) {
+        for (int k = 0; k < C3_TABLE.num_inputs[n]; ++k)
+            memcpy(&c3[n * C3_K + k * C1_K], param(PARAM_C3_W) + n * C3_K + C3_TABLE.inputs[n][k] * C1_K, C1_K * sizeof(float));
+    }
+}
+
+bool Lenet5Trainer::save_params(const char* directory) const {
+
+    std::vector<float> tensors[PARAM_TENSOR_COUNT];
+    model_tensors(tensors);
+
+    char filename[512];
+    bool ok = true;
+    // one kernel file per map (C1) or per map and input (C3, C5): the model sums the biases
+    // of a map's kernels, so the whole bias goes into the first one
+    struct {
+        const char* name;
+        int weights;
+        int numMaps;
+    } convs[] = {
+        { "kernel_c1", PARAM_C1_W, C1_MAPS },
+        { "kernel_c3", PARAM_C3_W, C3_MAPS },
+        { "kernel_c5", PARAM_C5_W, C5_MAPS },
+    };
+    for (size_t l = 0; l < sizeof(convs) / sizeof(convs[0]) && ok; ++l) {
+        const int w = convs[l].weights;
+        int mapSize = (int)tensors[w].size() / convs[l].numMaps;
+        for (int n = 0; n < convs[l].numMaps && ok; ++n) {
+            int numInputs = (w == PARAM_C1_W) ? 1 : (w == PARAM_C3_W) ? C3_TABLE.num_inputs[n] : C3_MAPS;
+            for (int k = 0; k < numInputs && ok; ++k) {
+                Kernel kernel(&tensors[w][n * mapSize + k * C1_K], CONV);
+                kernel.set_bias(k == 0 ? tensors[w + 1][n] : 0.f);
+                if (w == PARAM_C1_W)
+                    sprintf_s(filename, "%s/%s_m%d.txt", directory, convs[l].name, n);
+                else
+                    sprintf_s(filename, "%s/%s_m%d_%d.txt", directory, convs[l].name, n, k);
+                std::ofstream write(filename);
+                write << kernel.to_string();
+                ok = write.good();
+            }
+        }
+    }
+
+    struct {
+        const char* name;
+        int weights;
+        int numOutputs;
+        int length;
+    } fcs[] = {
+        { "fc_f6_out", PARAM_F6_W, F6_LEN, C5_MAPS },
+        { "fc_last_out", PARAM_OUT_W, OUT_LEN, F6_LEN },
+    };
+    for (size_t l = 0; l < sizeof(fcs) / sizeof(fcs[0]) && ok; ++l) {
+        const int w = fcs[l].weights;
+        for (int n = 0; n < fcs[l].numOutputs && ok; ++n) {
+            FCParams fc(fcs[l].length);
+            for (int i = 0; i < fcs[l].length; ++i)
+                fc.set_weight(tensors[w][n * fcs[l].length + i], i);
+            fc.set_bias(tensors[w + 1][n]);
+            sprintf_s(filename, "%s/%s%d.txt", directory, fcs[l].name, n);
+            std::ofstream write(filename);
+            write << fc.to_string();
+            ok = write.good();
+        }
+    }
+
+    if (!ok)
+        fprintf(stderr, "cannot write '%s'\n", filename);
+    return ok;
+}
+
+bool Lenet5Trainer::save_model(const char* filename) const {
+
+    std::vector<float> tensors[PARAM_TENSOR_COUNT];
+    model_tensors(tensors);
+
+    // same names and shapes as Lenet5Model::save_model
+    const char* names[PARAM_TENSOR_COUNT] = { "c1.kernels", "c1.bias", "c3.kernels", "c3.bias", "c5.kernels", "c5.bias",
+        "f6.weights", "f6.bias", "out.weights", "out.bias" };
+    const int dims[PARAM_TENSOR_COUNT][4] = {
+        { C1_MAPS, 1, CONV, CONV }, { 1, 1, 1, C1_MAPS },
+        { C3_MAPS, C1_MAPS, CONV, CONV }, { 1, 1, 1, C3_MAPS },
+        { C5_MAPS, C3_MAPS, CONV, CONV }, { 1, 1, 1, C5_MAPS },
+        { 1, 1, F6_LEN, C5_MAPS }, { 1, 1, 1, F6_LEN },
+        { 1, 1, OUT_LEN, F6_LEN }, { 1, 1, 1, OUT_LEN },
+    };
+    std::vector<ModelTensorData> data;
+    for (int t = 0; t < PARAM_TENSOR_COUNT; ++t) {
+        ModelTensorData tensor = { names[t], { dims[t][0], dims[t][1], dims[t][2], dims[t][3] }, tensors[t].data() };
+        data.push_back(tensor);
+    }
+    return ModelFile::write(filename, data);
+}
+
+TrainOptions::TrainOptions() : dataset_path(nullptr), validation_path(nullptr), init_path(nullptr),
+    params_dir("params"), model_path(nullptr), max_images(0), epochs(10), batch_size(64), learning_rate(0.02f), lr_decay(0.9f),
+    momentum(0.9f), weight_decay(5e-4f), threads(0), seed(1)
+{
+}
+
+void print_train_usage() {
+    printf("usage: lenet5 train -d dataset [options]\n");
+    printf("  -d dataset         training images, CSV or MNIST IDX images file\n");
+    printf("  -v dataset         validation images, evaluated after every epoch\n");
+    printf("  -i init            start from 'params' (params/*.txt) or a binary model (default random weights)\n");
+    printf("  -o directory       write the params/*.txt files there (default params, 'none' to skip)\n");
+    printf("  -B model.bin       also write a binary model\n");
+    printf("  -n images          train on the first images of the dataset only (default all)\n");
+    printf("  -e epochs          (default 10)\n");
+    printf("  -b images          minibatch size (default 64)\n");
+    printf("  -l rate            learning rate (default 0.02)\n");
+    printf("  -g factor          learning rate decay per epoch (default 0.9)\n");
+    printf("  -p momentum        (default 0.9)\n");
+    printf("  -w decay           L2 weight decay (default 0.0005)\n");
+    printf("  -t threads         0 = one per hardware thread (default 0)\n");
+    printf("  -s seed            initial weights and shuffling (default 1)\n");
+    printf("sanity check: -n 10 -b 10 -e 30 -o none must reach 100%% training accuracy\n");
+}
+
+bool parse_train_args(int argc, char* argv[], TrainOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else if (strcmp(arg, "-v") == 0) {
+            options.validation_path = value;
+        }
+        else if (strcmp(arg, "-i") == 0) {
+            options.init_path = value;
+        }
+        else if (strcmp(arg, "-o") == 0) {
+            options.params_dir = (strcmp(value, "none") == 0) ? nullptr : value;
+        }
+        else if (strcmp(arg, "-B") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-n") == 0 && atoi(value) > 0) {
+            options.max_images = atoi(value);
+        }
+        else if (strcmp(arg, "-e") == 0 && atoi(value) > 0) {
+            options.epochs = atoi(value);
+        }
+        else if (strcmp(arg, "-b") == 0 && atoi(value) > 0) {
+            options.batch_size = atoi(value);
+        }
+        else if (strcmp(arg, "-l") == 0 && atof(value) > 0.0) {
+            options.learning_rate = (float)atof(value);
+        }
+        else if (strcmp(arg, "-g") == 0 && atof(value) > 0.0) {
+            options.lr_decay = (float)atof(value);
+        }
+        else if (strcmp(arg, "-p") == 0 && atof(value) >= 0.0) {
+            options.momentum = (float)atof(value);
+        }
+        else if (strcmp(arg, "-w") == 0 && atof(value) >= 0.0) {
+            options.weight_decay = (float)atof(value);
+        }
+        else if (strcmp(arg, "-t") == 0 && atoi(value) >= 0) {
+            options.threads = atoi(value);
+        }
+        else if (strcmp(arg, "-s") == 0) {
+            options.seed = (unsigned int)strtoul(value, nullptr, 10);
+        }
+        else {
+            return false;
+        }
+    }
+
+    return options.dataset_path != nullptr;
+}
+
+bool run_training(const TrainOptions& options) {
+
+    TrainingSet train, validation;
+    if (!train.load(options.dataset_path, options.max_images))
+        return false;
+    if (options.validation_path && !validation.load(options.validation_path))
+        return false;
+
+    Lenet5Trainer trainer(options.threads);
+    if (train.max_pixel > 0)
+        trainer.set_input_scale(1.f / train.max_pixel);
+    if (options.init_path == nullptr) {
+        trainer.init_random(options.seed);
+    }
+    else {
+        Lenet5Model model(strcmp(options.init_path, "params") == 0 ? nullptr : options.init_path);
+        if (!model.is_loaded()) {
+            fprintf(stderr, "cannot start from '%s': some parameters are missing\n", options.init_path);
+            return false;
+        }
+        trainer.init_from(model);
+    }
+    printf("training on %d images (%s, pixels 0-%d), batch %d, %d threads\n", train.size(), options.dataset_path,
+        train.max_pixel, options.batch_size, trainer.num_threads());
+
+    std::mt19937 rng(options.seed);
+    std::vector<int> order(train.size());
+    for (int i = 0; i < train.size(); ++i)
+        order[i] = i;
+
+    float learningRate = options.learning_rate;
+    for (int epoch = 1; epoch <= options.epochs; ++epoch) {
+        std::shuffle(order.begin(), order.end(), rng);
+
+        auto start = std::chrono::steady_clock::now();
+        double loss = 0.0;
+        int correct = 0;
+        for (int b = 0; b < train.size(); b += options.batch_size) {
+            int n = std::min(train.size() - b, options.batch_size);
+            loss += trainer.train_batch(train, &order[b], n, learningRate, options.momentum, options.weight_decay, correct);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("epoch %d/%d: loss %.4f, accuracy %.2f%%", epoch, options.epochs, loss / train.size(),
+            100.0 * correct / train.size());
+        if (validation.size() > 0) {
+            int validCorrect = 0;
+            double validLoss = trainer.evaluate(validation, validCorrect);
+            printf(", validation loss %.4f, accuracy %.2f%%", validLoss, 100.0 * validCorrect / validation.size());
+        }
+        printf(" (%.1f s, %.0f images/s, learning rate %g)\n", seconds, train.size() / seconds, learningRate);
+        learningRate *= options.lr_decay;
+    }
+
+    bool ok = true;
+    if (options.params_dir) {
+        ok &= trainer.save_params(options.params_dir);
+        if (ok)
+            printf("wrote %s/*.txt\n", options.params_dir);
+    }
+    if (options.model_path) {
+        ok &= trainer.save_model(options.model_path);
+        if (ok)
+            printf("wrote %s\n", options.model_path);
+    }
+    return ok;
+}
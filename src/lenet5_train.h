@@ -0,0 +1,138 @@
+#ifndef LENET_5_TRAIN_H
+#define LENET_5_TRAIN_H
+
+#include <memory>
+#include <vector>
+#include "lenet5.h"
+#include "thread_pool.h"
+
+// Minibatch SGD training of the Lenet5Model network ("lenet5 train")
+//
+// loss:       softmax cross-entropy of the OUTPUT layer (inference only takes the argmax, so it has no softmax)
+// layers:     the batched layout of run_inference_batch, activations are (channels) x (images * length * length)
+//             matrices and every layer is a GEMM forward and backward; C3 is a dense 16 x (6 * 25) matrix
+//             whose weights for the S2 maps a C3 map is not connected to (C3_TABLE) are kept at 0
+// inputs:     pixels / the largest pixel of the training set while training (255 for MNIST, 1 for binarized
+//             images, which would be nearly blank at / 255); the C1 weights are scaled back when the model is
+//             written, so the written model takes raw pixels like every inference engine
+// init:       He (normal, variance 2 / fan-in), so with the default learning rate a correct build fits a handful
+//             of images within a few dozen steps: "lenet5 train -d dataset -n 10 -b 10 -e 30 -o none" must end
+//             at 100% training accuracy
+// parallel:   each minibatch is split into one shard per thread and every shard's gradients go to its own buffer;
+//             the buffers are then summed one slice of the parameters per thread, and each thread updates its slice.
+//             The sums are always taken in shard order, so the result does not depend on the thread schedule.
+// optimizer:  SGD with momentum and L2 weight decay (weights only), the learning rate decays once per epoch
+
+struct TrainOptions {
+    const char* dataset_path;       // training images, CSV or MNIST IDX
+    const char* validation_path;    // images evaluated after every epoch, nullptr: none
+    const char* init_path;          // nullptr: random weights, "params": params/*.txt, otherwise a binary model
+    const char* params_dir;         // directory the params/*.txt files are written to, nullptr: none
+    const char* model_path;         // binary model written as well, nullptr: none
+    int max_images;             // trains on the first max_images images of the dataset, 0: all
+    int epochs;
+    int batch_size;
+    float learning_rate;
+    float lr_decay;             // learning rate multiplier after every epoch
+    float momentum;
+    float weight_decay;
+    int threads;                // 0: one per hardware thread
+    unsigned int seed;          // initial weights and shuffling
+
+    TrainOptions();
+};
+
+// parses the arguments of "lenet5 train" (argv[0] is the first one after "train")
+bool parse_train_args(int argc, char* argv[], TrainOptions& options);
+void print_train_usage();
+
+bool run_training(const TrainOptions& options);
+
+// a whole dataset in memory: 32x32 padded images and their digits
+struct TrainingSet {
+    std::vector<unsigned char> pixels;  // size() x IN_LEN x IN_LEN
+    std::vector<int> labels;
+    int max_pixel;      // largest pixel value of all images
+
+    TrainingSet() : max_pixel(0) {}
+
+    // maxImages > 0: only the first maxImages images
+    bool load(const char* filename, int maxImages = 0);
+    int size() const { return (int)labels.size(); }
+    const unsigned char* image(int i) const { return &pixels[(size_t)i * Lenet5Dims::IN_LEN * Lenet5Dims::IN_LEN]; }
+};
+
+// activations and gradients of one shard of a minibatch
+struct TrainShard;
+
+class Lenet5Trainer : public Lenet5Dims {
+public:
+    // the parameters are stored back to back in one vector, in this order
+    enum ParamTensor {
+        PARAM_C1_W, PARAM_C1_B,     // 6 x 25
+        PARAM_C3_W, PARAM_C3_B,     // 16 x (6 * 25), indexed by S2 map
+        PARAM_C5_W, PARAM_C5_B,     // 120 x 400
+        PARAM_F6_W, PARAM_F6_B,     // 84 x 120
+        PARAM_OUT_W, PARAM_OUT_B,   // 10 x 84
+        PARAM_TENSOR_COUNT
+    };
+
+    static const int C1_K = CONV * CONV;
+    static const int C3_K = C1_MAPS * CONV * CONV;
+    static const int C5_K = C3_MAPS * S4_LEN * S4_LEN;
+
+private:
+    const SimdKernels* simd;
+    ThreadPool pool;
+    std::vector<float> params;
+    std::vector<float> velocity;
+    size_t offsets[PARAM_TENSOR_COUNT + 1];
+    std::vector<char> C3_connected;     // 16 x 150, false for the weights that stay 0
+    float input_scale;                  // pixels -> [0, 1]
+
+    // weights transposed for the input gradients, refreshed before every minibatch
+    std::vector<float> C3_T, C5_T, F6_T, OUT_T;
+    std::vector<std::unique_ptr<TrainShard>> shards;    // one per thread
+
+    float* param(int tensor) { return &params[offsets[tensor]]; }
+    const float* param(int tensor) const { return &params[offsets[tensor]]; }
+
+    void transpose_weights();
+    // forward pass of n <= BATCH_TILE images; with gradients, adds the gradients of the loss times
+    // gradScale to the shard's buffer; adds the loss and the correct predictions to the shard's totals
+    void run_tile(const TrainingSet& data, const int* indices, int n, bool gradients, float gradScale, TrainShard& shard) const;
+    void update(size_t begin, size_t end, float learningRate, float momentum, float weightDecay);
+    // parameters in the layout of Lenet5Model (C1 scaled for raw pixels, C3 kernels in C3_TABLE order)
+    void model_tensors(std::vector<float> (&tensors)[PARAM_TENSOR_COUNT]) const;
+
+    Lenet5Trainer(const Lenet5Trainer&);
+    Lenet5Trainer& operator=(const Lenet5Trainer&);
+
+public:
+    // numThreads <= 0: one per hardware thread
+    explicit Lenet5Trainer(int numThreads = 0);
+    ~Lenet5Trainer();
+
+    int num_threads() const { return pool.size(); }
+
+    // inputs are pixels * scale (default 1 / 255); set before init_from, which rescales the C1 weights
+    void set_input_scale(float scale) { input_scale = scale; }
+
+    // He initialization (biases 0)
+    void init_random(unsigned int seed);
+    // starts from the weights of a model
+    void init_from(const Lenet5Model& model);
+
+    // one SGD step on the images indices[0..n); returns the summed loss, correct counts the right predictions
+    double train_batch(const TrainingSet& data, const int* indices, int n,
+        float learningRate, float momentum, float weightDecay, int& correct);
+    // mean loss over a dataset, correct counts the right predictions
+    double evaluate(const TrainingSet& data, int& correct);
+
+    // writes params/*.txt style files into directory (which must exist)
+    bool save_params(const char* directory) const;
+    // writes a binary model (see model_file.h)
+    bool save_model(const char* filename) const;
+};
+
+#endif
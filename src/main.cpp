@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <iostream>
 #include <fstream>
 #include <string.h>
@@ -7,100 +8,383 @@
 #include <vector>
 //#include <time.h>
 #include <chrono>
+#include <memory>
+#include <thread>
 
 #include "map.h"
 #include "imagemap.h"
 #include "kernel.h"
 #include "lenet5.h"
+#include "lenet5_incremental.h"
 #include "fcparams.h"
-
-#define IN_LEN  32  // (28x28 with padding)
-#define C1_LEN  28
-#define S2_LEN  14
-#define C3_LEN  10
-#define S4_LEN  5
-#define C5_LEN  1
-#define F6_LEN  84
-#define OUT_LEN 10
-
-#define C1_MAPS 6
-#define C3_MAPS 16
-#define C5_MAPS 120
-
-#define CONV 5
-#define POOL 2
-
-#define MAXCHAR 1600    // 1570 characters per row
+#include "thread_pool.h"
+#include "lenet5_int8.h"
+#include "lenet5_fixed.h"
+#include "dataset_reader.h"
+#include "benchmark.h"
+#include "inference_server.h"
+#include "lenet5_train.h"
+#include "shard_eval.h"
+#include "lenet5_numa.h"
+#include "pipeline.h"
+#include "layer_graph.h"
+#include "model_file.h"
+
+#define MAXCHAR 4000    // up to 28 * 28 * 4 + 2 characters per row (1570 in test_dataset.csv)
 
 // read files
 bool load_image(ImageMap* image, const char* filename);
 
 // run program
 void run_test_lenet5(); // testing
-void run_lenet5_dataset();  // read dataset and run lenet-5 on each data
-
-// read dataset
-bool read_dataset(std::vector<ImageMap*>& images, const char* filename);
+void run_lenet5_dataset(const char* model_path, const char* dataset_path, int numThreads,  // stream the dataset through lenet-5
+    const char* conv_algorithms, bool numa, int queueDepth, bool stageStats, const char* graph_path);
+bool convert_params(const char* model_path);    // write params/*.txt as one binary model file
+bool verify_model(const char* model_path);      // check the structure and checksum of a binary model file
+bool embed_params(const char* model_path, const char* header_path);    // write the weights as a C++ header
+
+void print_usage() {
+    printf("usage: lenet5 [-m model.bin] [-t threads] [-d dataset] [-c conv] [-N] [-q depth] [-v] [-g file.graph]\n");
+    printf("                                            run on a CSV or MNIST IDX images file (default ./dataset/test_dataset.csv)\n");
+    printf("                                            with the given C1 / C3 convolution algorithms (e.g. winograd4, c3=fft)\n");
+    printf("                                            -N: workers pinned to the CPUs, one copy of the weights per NUMA node\n");
+    printf("                                            -q: capacity of the queues between the pipeline stages (default 64)\n");
+    printf("                                            -v: print the time each pipeline stage was busy, starved and blocked\n");
+    printf("                                            -g: run the network described by a layer graph (e.g. params/lenet5.graph)\n");
+    printf("       lenet5 convert [model.bin]           convert params/*.txt to a binary model (default params/lenet5.bin)\n");
+    printf("       lenet5 verify [model.bin]            check the checksum of a binary model (default params/lenet5.bin),\n");
+    printf("                                            which loading skips unless LENET5_VERIFY_MODEL=1\n");
+    printf("       lenet5 embed [-m model.bin] [-o file.h]  write the weights as constexpr arrays (default src/lenet5_weights.h)\n");
+    printf("                                            that a build with -DLENET5_EMBEDDED_WEIGHTS runs without reading files\n");
+    printf("       lenet5 int8 [options]                quantize to int8 and compare with float (lenet5 int8 -h)\n");
+    printf("       lenet5 conv [options]                compare the Winograd and FFT convolutions with the direct one\n");
+    printf("       lenet5 half [options]                compare fp16 / bf16 fully-connected weights with fp32\n");
+    printf("       lenet5 prune (-s sparsity | -T threshold) [options]\n");
+    printf("                                            zero the smallest C5 / F6 / OUTPUT weights and write the model (lenet5 prune -h)\n");
+    printf("       lenet5 sparse [options]              accuracy and speed of the sparse kernels at several sparsity levels\n");
+    printf("       lenet5 fixed [options]               bit-exact fixed-point engine with each Q-format spec against float\n");
+    printf("                                            (lenet5 fixed -h)\n");
+    printf("       lenet5 allocs [options]              check that inference allocates no memory after warm-up\n");
+    printf("       lenet5 incremental [options]         rerun only what changed pixels reach on streams of near-identical frames,\n");
+    printf("                                            compared with full inference\n");
+    printf("       lenet5 graph [options]               memory plan of a layer graph, compared with lenet-5 (lenet5 graph -h)\n");
+    printf("       lenet5 bench [options]               benchmark the engines (lenet5 bench -h for the options)\n");
+    printf("       lenet5 train -d dataset [options]    train the network and write params/*.txt (lenet5 train -h for the options)\n");
+    printf("       lenet5 shard -n shards [options]     score a dataset in shards, one process each (lenet5 shard -h)\n");
+    printf("       lenet5 merge [options]               merge the shard results: accuracy, confusion matrix, throughput\n");
+    printf("       lenet5 serve [options]               keep the model loaded and answer requests in batches\n");
+    printf("                                            on a Unix socket or stdin / stdout (lenet5 serve -h for the options)\n");
+}
 
-int main() {
+int main(int argc, char* argv[]) {
 
     // seed RNG
     srand(time(NULL));
 
+    if (argc >= 2 && strcmp(argv[1], "convert") == 0) {
+        return convert_params(argc >= 3 ? argv[2] : "params/lenet5.bin") ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "verify") == 0) {
+        return verify_model(argc >= 3 ? argv[2] : "params/lenet5.bin") ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "embed") == 0) {
+        const char* model = nullptr;
+        const char* header = "src/lenet5_weights.h";
+        bool valid = true;
+        for (int i = 2; i < argc; ++i) {
+            if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+                model = argv[++i];
+            else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+                header = argv[++i];
+            else
+                valid = false;
+        }
+        if (!valid) {
+            print_usage();
+            return 1;
+        }
+        return embed_params(model, header) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        BenchmarkOptions options;
+        if (!parse_benchmark_args(argc - 2, argv + 2, options)) {
+            print_benchmark_usage();
+            return 1;
+        }
+        return run_benchmark(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "train") == 0) {
+        TrainOptions options;
+        if (!parse_train_args(argc - 2, argv + 2, options)) {
+            print_train_usage();
+            return 1;
+        }
+        return run_training(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+        ServerOptions options;
+        if (!parse_server_args(argc - 2, argv + 2, options)) {
+            print_server_usage();
+            return 1;
+        }
+        return run_server(options) ? 0 : 1;
+    }
+    if (argc >= 2 && (strcmp(argv[1], "shard") == 0 || strcmp(argv[1], "merge") == 0)) {
+        ShardOptions options;
+        options.program = argv[0];
+        if (!parse_shard_args(argc - 2, argv + 2, options)) {
+            print_shard_usage();
+            return 1;
+        }
+        if (strcmp(argv[1], "merge") == 0)
+            return merge_shards(options) ? 0 : 1;
+        return run_shards(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "graph") == 0) {
+        GraphOptions options;
+        if (!parse_graph_args(argc - 2, argv + 2, options)) {
+            print_graph_usage();
+            return 1;
+        }
+        return run_graph_report(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "int8") == 0) {
+        Int8ReportOptions options;
+        if (!parse_int8_args(argc - 2, argv + 2, options)) {
+            print_int8_usage();
+            return 1;
+        }
+        return run_int8_report(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "conv") == 0) {
+        ConvReportOptions options;
+        if (!parse_conv_args(argc - 2, argv + 2, options)) {
+            print_conv_usage();
+            return 1;
+        }
+        return run_conv_report(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "prune") == 0) {
+        PruneOptions options;
+        if (!parse_prune_args(argc - 2, argv + 2, options)) {
+            print_prune_usage();
+            return 1;
+        }
+        return prune_model(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "sparse") == 0) {
+        SparseReportOptions options;
+        if (!parse_sparse_args(argc - 2, argv + 2, options)) {
+            print_sparse_usage();
+            return 1;
+        }
+        return run_sparse_report(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "half") == 0) {
+        PrecisionReportOptions options;
+        if (!parse_precision_args(argc - 2, argv + 2, options)) {
+            print_precision_usage();
+            return 1;
+        }
+        return run_precision_report(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "fixed") == 0) {
+        FixedReportOptions options;
+        if (!parse_fixed_args(argc - 2, argv + 2, options)) {
+            print_fixed_usage();
+            return 1;
+        }
+        return run_fixed_report(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "allocs") == 0) {
+        AllocCheckOptions options;
+        if (!parse_alloc_check_args(argc - 2, argv + 2, options)) {
+            print_alloc_check_usage();
+            return 1;
+        }
+        return run_alloc_check(options) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "incremental") == 0) {
+        IncrementalReportOptions options;
+        if (!parse_incremental_args(argc - 2, argv + 2, options)) {
+            print_incremental_usage();
+            return 1;
+        }
+        return run_incremental_report(options) ? 0 : 1;
+    }
+
+    const char* model_path = nullptr;   // nullptr: params/*.txt
+    const char* dataset_path = "./dataset/test_dataset.csv";
+    int numThreads = 0;     // 0: one per hardware thread
+    const char* conv_algorithms = nullptr;  // nullptr: LENET5_CONV or direct
+    bool numa = false;
+    int queueDepth = 0;     // 0: PipelineOptions default
+    bool stageStats = false;
+    const char* graph_path = nullptr;   // nullptr: the built-in lenet-5
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            model_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            dataset_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            conv_algorithms = argv[++i];
+        }
+        else if (strcmp(argv[i], "-N") == 0) {
+            numa = true;
+        }
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            queueDepth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            stageStats = true;
+        }
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            graph_path = argv[++i];
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+
     // run
     //run_test_lenet5();
-    run_lenet5_dataset();
+    if (graph_path != nullptr && (numa || conv_algorithms != nullptr)) {
+        fprintf(stderr, "-g cannot be combined with -N or -c\n");
+        return 1;
+    }
+    run_lenet5_dataset(model_path, dataset_path, numThreads, conv_algorithms, numa, queueDepth, stageStats, graph_path);
 
     return 0;
 }
 
+bool convert_params(const char* model_path) {
 
-void run_lenet5_dataset() {
-
-    // instantiate images dataset
-    std::vector<ImageMap*> images;  // vector of 32x32 images
-    read_dataset(images, "./dataset/test_dataset.csv");   // read dataset
-
-    // instantiate Lenet-5 neural network
     Lenet5 lenet5;
+    if (!lenet5.is_loaded()) {
+        fprintf(stderr, "some parameter files are missing, not writing '%s'\n", model_path);
+        return false;
+    }
+    if (!lenet5.save_model(model_path))
+        return false;
 
-    // for each image
-    for (int i = 0; i < images.size(); ++i) {
+    printf("wrote %s\n", model_path);
+    return true;
+}
 
-        // print image
-        //printf("Image:\n");
-        //images[i]->print();
-        printf("\n");
+bool verify_model(const char* model_path) {
 
-        // START COUNTING TIME
-        //clock_t begin = clock();
-        auto start = std::chrono::high_resolution_clock::now();
-        std::ios_base::sync_with_stdio(false);
+    ModelFile file;
+    if (!file.open(model_path, true))
+        return false;
 
-        // run inference
-        int digit = lenet5.run_inference(images[i]);
+    printf("%s: checksum ok\n", model_path);
+    return true;
+}
 
-        // STOP COUNTING TIME
-        //clock_t end = clock();
-        //double time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
-        auto end = std::chrono::high_resolution_clock::now();
-        double time_taken = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-        time_taken *= 1e-9; // convert to seconds
+bool embed_params(const char* model_path, const char* header_path) {
 
-        // Print results
-        printf("Predicted Digit: %d\n\n", digit);
-        printf("time_spent: %.8f seconds\n", time_taken);
+    // the random parameters of a missing file must never end up in the executable
+    const Lenet5Model lenet5(model_path);
+    if (!lenet5.is_loaded()) {
+        fprintf(stderr, "some parameter files are missing, not writing '%s'\n", header_path);
+        return false;
     }
+    if (!lenet5.save_embedded(header_path))
+        return false;
+
+    printf("wrote %s (model %016llx), build with -DLENET5_EMBEDDED_WEIGHTS to use it\n", header_path,
+        (unsigned long long)lenet5.fingerprint());
+    return true;
+}
+
+void run_lenet5_dataset(const char* model_path, const char* dataset_path, int numThreads, const char* conv_algorithms,
+    bool numa, int queueDepth, bool stageStats, const char* graph_path) {
+
+    // images are streamed from the file through the stages of a pipeline (see pipeline.h), so inference starts
+    // on the first image and memory does not grow with the size of the dataset
+    DatasetReader reader;
+    if (!reader.open(dataset_path))
+        return;
 
-    // delete images after running
-    for (int i = 0; i < images.size(); ++i) {
-        delete images[i];
+    // instantiate Lenet-5 neural network: one copy of the weights shared by all threads (numa: one per node;
+    // graph: the network of a layer graph), and one inference context (activations) per thread, allocated by
+    // the thread itself
+    std::unique_ptr<Lenet5Model> shared;
+    std::unique_ptr<Lenet5NumaReplicas> replicas;
+    std::unique_ptr<LayerGraph> graph;
+    if (graph_path != nullptr) {
+        graph.reset(new LayerGraph(graph_path, model_path));
+        if (!graph->is_loaded())
+            return;
     }
+    else if (numa) {
+        replicas.reset(new Lenet5NumaReplicas(model_path, conv_algorithms));
+        if (!replicas->is_loaded())
+            return;
+        fprintf(stderr, "%s", replicas->placement().c_str());
+        if (numThreads <= 0)
+            numThreads = replicas->num_cpus();
+    }
+    else {
+        shared.reset(new Lenet5Model(model_path));
+        if (conv_algorithms != nullptr && !shared->set_conv_algorithms(conv_algorithms))
+            return;
+    }
+    if (numThreads <= 0)
+        numThreads = (std::thread::hardware_concurrency() > 0) ? (int)std::thread::hardware_concurrency() : 1;
+    std::vector<std::unique_ptr<InferenceContext>> contexts(numThreads);
+    std::vector<std::unique_ptr<GraphContext>> graphContexts(numThreads);
+
+    // results go out in dataset order through one large buffer, written when it fills and at the end
+    std::string output;
+    output.reserve(1 << 16);
+
+    PipelineOptions options;
+    options.workers = numThreads;
+    if (queueDepth > 0)
+        options.queue_depth = queueDepth;
+    PipelineStats stats;
+    run_pipeline(reader, options,
+        [&](int worker) {
+            if (numa)
+                replicas->pin_worker(worker);
+            if (graph)
+                graphContexts[worker].reset(new GraphContext());
+            else
+                contexts[worker].reset(new InferenceContext());
+        },
+        [&](const ImageMap* image, int worker) {
+            if (graph)
+                return graph->run_inference(image, *graphContexts[worker]);
+            const Lenet5Model& lenet5 = numa ? replicas->model(worker) : *shared;
+            return lenet5.run_inference(image, *contexts[worker]);
+        },
+        [&](const PipelineResult& result) {
+            char text[80];
+            snprintf(text, sizeof(text), "\nPredicted Digit: %d\n\ntime_spent: %.8f seconds\n", result.digit, result.seconds);
+            output += text;
+            if (output.size() + sizeof(text) > output.capacity()) {
+                fwrite(output.data(), 1, output.size(), stdout);
+                output.clear();
+            }
+        },
+        stats);
+    fwrite(output.data(), 1, output.size(), stdout);
+    fflush(stdout);
+
+    if (stageStats)
+        fprintf(stderr, "%s", stats.to_string().c_str());
 }
 
 void run_test_lenet5() {
 
-    ImageMap image(IN_LEN);
+    ImageMap image(Lenet5Dims::IN_LEN);
     char filename[] = "./dataset/test_img.txt";
     if (!load_image(&image, filename))
     {
@@ -132,70 +416,6 @@ void run_test_lenet5() {
     printf("time_spent: %.4f seconds\n", time_spent);
 }
 
-bool read_dataset(std::vector<ImageMap*>& images, const char* filename) {
-
-    FILE* fp;
-    errno_t err;
-    char str[MAXCHAR];
-
-    // open file
-    if ((err = fopen_s(&fp, filename, "r")) != 0) { // file opened unsuccessfully
-        fprintf(stderr, "cannot open file '%s'\n", filename);
-        return false;
-    }
-
-    // read file
-    while (fgets(str, MAXCHAR, fp) != NULL) {   // each row is a 28x28 image
-
-        //printf("%s\n", str);
-
-        // initialize new image first
-        ImageMap* newImage = new ImageMap(IN_LEN);
-        images.push_back(newImage);
-        // add zero padding first
-        for (int i = 0; i < 32; ++i) {
-            // rows
-            newImage->set_cell(0, 0, i);    // row 0
-            newImage->set_cell(0, 1, i);    // row 1
-            newImage->set_cell(0, 30, i);   // row 30
-            newImage->set_cell(0, 31, i);   // row 31
-
-            // columns
-            if (i > 1 && i < 30) {
-                newImage->set_cell(0, i, 0);    // column 0
-                newImage->set_cell(0, i, 1);    // column 1
-                newImage->set_cell(0, i, 30);   // column 30
-                newImage->set_cell(0, i, 31);   // column 31
-            }
-        }
-
-        char* token, * next_token;
-        // retrieve first token - label
-        token = strtok_s(str, ",", &next_token);
-        newImage->set_label(token[0]);
-        // retrieve next token - first cell
-        token = strtok_s(NULL, ",", &next_token);
-        // loop through the string to add and extract all other tokens
-        int row = 0, col = 0;
-        while (token != NULL) {
-            // convert string to int
-            int iVal = std::stoi(token);
-            // set respective cell in ImageMap
-            newImage->set_cell(iVal, row + 2, col + 2);
-            token = strtok_s(NULL, ",", &next_token);
-            // update count
-            col++;
-            if (col >= 28) {
-                row++;
-                col = 0;
-            }
-        }
-    }
-    fclose(fp);
-
-    return true;
-}
-
 bool load_image(ImageMap* image, const char* filename) {
 
     FILE* fp;
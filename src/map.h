@@ -4,46 +4,49 @@
 #include <stdio.h>
 #include <string>
 #include <sstream>
+#include "tensor.h"
 
 template<class T>
 class Map {
 private:
     int _length;
-    T** _values;
+    Tensor<T> _values;  // length x length cells, contiguous and row-major
 
 public:
     // default constructor for dynamic allocation
-    Map() : _length(0), _values(nullptr) {}
+    Map() : _length(0) {}
 
-    Map(int len) : _length(len), _values(nullptr) {
+    Map(int len) : _length(len) {
         init(len);
     }
-    virtual ~Map() {
-        if (_values != nullptr) {
-            for (int i = 0; i < _length; ++i) {
-                delete[] _values[i];
-            }
-            delete[] _values;
-        }
+    // view over len x len cells owned by someone else (e.g. one map of a layer's Tensor)
+    Map(T* data, int len) : _length(len) {
+        _values.wrap(data, 1, 1, len, len);
     }
+    virtual ~Map() {}
 
     void init(int len) {
         _length = len;
-        _values = new T * [len];
-        for (int i = 0; i < len; ++i) {
-            _values[i] = new T[len];
-        }
+        _values.init(1, 1, len, len);
     }
 
     void set_cell(T val, int i, int j) {
-        _values[i][j] = val;
+        _values[i * _length + j] = val;
     }
 
+    T get_cell(int i, int j) const {
+        return _values[i * _length + j];
+    }
+
+    int length() const { return _length; }
+    T* data() { return _values.data(); }
+    const T* data() const { return _values.data(); }
+
     void print() {
 
         for (int i = 0; i < _length; ++i) {
             for (int j = 0; j < _length; ++j) {
-                printf("%d ", _values[i][j]);
+                printf("%d ", _values[i * _length + j]);
             }
             printf("\n");
         }
@@ -55,7 +58,7 @@ public:
         for (int i = 0; i < _length; ++i) {
             for (int j = 0; j < _length; ++j) {
                 //printf("%.2f ", (float)_values[i][j]);
-                ss << _values[i][j];
+                ss << _values[i * _length + j];
                 if (j < _length - 1)
                     ss << " ";
             }
@@ -67,11 +70,11 @@ public:
         return ss.str();
     }
 
-    friend class Lenet5;
+    friend class Lenet5Model;
     //friend int max_pool(FeatureMap* inputMap, int i_start, int j_start);
 };
 
-//typedef Map<char> ImageMap; // 8-bit (0-255) for each image pixel
+//typedef Map<unsigned char> ImageMap; // 8-bit (0-255) for each image pixel
 typedef Map<float> FeatureMap;  // outputs of convolution and FC are floats
 
 #endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : _data(nullptr), _size(0)
+#ifdef _WIN32
+    , _file(nullptr), _mapping(nullptr)
+#endif
+{}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const char* filename, bool sequential) {
+
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "cannot open file '%s'\n", filename);
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        fprintf(stderr, "cannot read file '%s'\n", filename);
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void* base = (mapping != NULL) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (base == NULL) {
+        fprintf(stderr, "cannot map file '%s'\n", filename);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    _file = file;
+    _mapping = mapping;
+    _data = (const unsigned char*)base;
+    _size = (size_t)fileSize.QuadPart;
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open file '%s'\n", filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "cannot read file '%s'\n", filename);
+        ::close(fd);
+        return false;
+    }
+    // shared, read-only: every process using the file maps the same page cache pages
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);   // the mapping stays valid
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "cannot map file '%s'\n", filename);
+        return false;
+    }
+    if (sequential)
+        madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+    _data = (const unsigned char*)base;
+    _size = (size_t)st.st_size;
+#endif
+
+    return true;
+}
+
+void MappedFile::close() {
+
+    if (_data == nullptr)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+    CloseHandle((HANDLE)_mapping);
+    CloseHandle((HANDLE)_file);
+    _mapping = nullptr;
+    _file = nullptr;
+#else
+    munmap((void*)_data, _size);
+#endif
+    _data = nullptr;
+    _size = 0;
+}
+
+void MappedFile::release(size_t begin, size_t end) const {
+
+#ifdef _WIN32
+    // clean pages of a read-only view are trimmed from the working set by the OS on its own
+    (void)begin;
+    (void)end;
+#else
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    begin = (begin + page - 1) / page * page;
+    end = (end < _size) ? end / page * page : _size;
+    if (_data != nullptr && begin < end)
+        madvise((void*)(_data + begin), end - begin, MADV_DONTNEED);
+#endif
+}
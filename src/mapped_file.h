@@ -0,0 +1,38 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+
+// read-only memory mapping of a whole file, shared with other processes through the page cache
+class MappedFile {
+private:
+    const unsigned char* _data;
+    size_t _size;
+#ifdef _WIN32
+    void* _file;
+    void* _mapping;
+#endif
+
+    // not copyable, owns the mapping
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // maps the file (which must not be empty)
+    // sequential: the file will be read front to back, so the OS may read ahead aggressively
+    bool open(const char* filename, bool sequential = false);
+    void close();
+    bool is_open() const { return _data != nullptr; }
+
+    const unsigned char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+    // tells the OS that the bytes in [begin, end) will not be read again, so their pages can be dropped
+    // (streaming readers keep their resident memory bounded this way); whole pages only
+    void release(size_t begin, size_t end) const;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "model_file.h"
+
+static size_t align_up(size_t value) {
+    return (value + MODEL_FILE_ALIGNMENT - 1) & ~(size_t)(MODEL_FILE_ALIGNMENT - 1);
+}
+
+uint64_t ModelFile::checksum(const void* data, size_t size, uint64_t hash) {
+
+    // 64-bit FNV-1a
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool ModelFile::open(const char* filename, bool verify_checksum) {
+
+    if (!_file.open(filename))
+        return false;
+
+    const char* env = getenv("LENET5_VERIFY_MODEL");
+    if (env != NULL && strcmp(env, "0") != 0)
+        verify_checksum = true;
+    if (!validate(filename, verify_checksum)) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void ModelFile::close() {
+    _file.close();
+}
+
+bool ModelFile::validate(const char* filename, bool verify_checksum) {
+
+    const ModelFileHeader* hdr = header();
+    if (_file.size() < sizeof(ModelFileHeader) || memcmp(hdr->magic, MODEL_FILE_MAGIC, 8) != 0) {
+        fprintf(stderr, "'%s' is not a model file\n", filename);
+        return false;
+    }
+    if (hdr->version != MODEL_FILE_VERSION) {
+        fprintf(stderr, "'%s': unsupported model file version %u (expected %d)\n", filename, hdr->version, MODEL_FILE_VERSION);
+        return false;
+    }
+    if (hdr->header_size != sizeof(ModelFileHeader) || hdr->entry_size != sizeof(ModelTensorEntry)
+        || hdr->file_size != _file.size()
+        || sizeof(ModelFileHeader) + (uint64_t)hdr->num_tensors * sizeof(ModelTensorEntry) > _file.size()) {
+        fprintf(stderr, "'%s': corrupt or truncated model file\n", filename);
+        return false;
+    }
+
+    // no sum or product below may wrap around: a crafted entry must not pass for a small in-bounds tensor
+    const ModelTensorEntry* table = entries();
+    for (uint32_t t = 0; t < hdr->num_tensors; ++t) {
+        uint64_t count = 1;
+        bool fits = true;   // count <= the file size
+        for (int d = 0; d < 4; ++d) {
+            if (table[t].dims[d] != 0 && count > _file.size() / table[t].dims[d])
+                fits = false;
+            else
+                count *= table[t].dims[d];
+        }
+        if (table[t].offset % MODEL_FILE_ALIGNMENT != 0 || !fits || table[t].size != count * sizeof(float)
+            || table[t].offset > _file.size() || table[t].size > _file.size() - table[t].offset) {
+            fprintf(stderr, "'%s': bad tensor entry %u\n", filename, t);
+            return false;
+        }
+    }
+
+    if (verify_checksum) {
+        const char* body = (const char*)_file.data() + sizeof(ModelFileHeader);
+        if (checksum(body, _file.size() - sizeof(ModelFileHeader)) != hdr->checksum) {
+            fprintf(stderr, "'%s': checksum mismatch\n", filename);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const float* ModelFile::tensor(const char* name, int n, int c, int h, int w) const {
+
+    if (!_file.is_open())
+        return nullptr;
+
+    const ModelTensorEntry* table = entries();
+    for (uint32_t t = 0; t < header()->num_tensors; ++t) {
+        if (strncmp(table[t].name, name, MODEL_TENSOR_NAME_LEN) == 0) {
+            if (table[t].dims[0] != (uint32_t)n || table[t].dims[1] != (uint32_t)c
+                || table[t].dims[2] != (uint32_t)h || table[t].dims[3] != (uint32_t)w) {
+                fprintf(stderr, "model tensor '%s' has shape %ux%ux%ux%u, expected %dx%dx%dx%d\n", name,
+                    table[t].dims[0], table[t].dims[1], table[t].dims[2], table[t].dims[3], n, c, h, w);
+                return nullptr;
+            }
+            return (const float*)((const char*)_file.data() + table[t].offset);
+        }
+    }
+
+    fprintf(stderr, "model tensor '%s' not found\n", name);
+    return nullptr;
+}
+
+const float* ModelFile::tensor(const char* name, size_t count) const {
+
+    if (!_file.is_open())
+        return nullptr;
+
+    const ModelTensorEntry* table = entries();
+    for (uint32_t t = 0; t < header()->num_tensors; ++t) {
+        if (strncmp(table[t].name, name, MODEL_TENSOR_NAME_LEN) == 0) {
+            if (table[t].size != count * sizeof(float)) {
+                fprintf(stderr, "model tensor '%s' has %u floats, expected %u\n", name,
+                    (unsigned)(table[t].size / sizeof(float)), (unsigned)count);
+                return nullptr;
+            }
+            return (const float*)((const char*)_file.data() + table[t].offset);
+        }
+    }
+
+    fprintf(stderr, "model tensor '%s' not found\n", name);
+    return nullptr;
+}
+
+bool ModelFile::write(const char* filename, const std::vector<ModelTensorData>& tensors) {
+
+    // lay out the file in memory, then write it in one go
+    size_t tableEnd = sizeof(ModelFileHeader) + tensors.size() * sizeof(ModelTensorEntry);
+    std::vector<ModelTensorEntry> table(tensors.size());
+    size_t offset = align_up(tableEnd);
+    for (size_t t = 0; t < tensors.size(); ++t) {
+        memset(&table[t], 0, sizeof(ModelTensorEntry));
+        size_t nameLength = strlen(tensors[t].name);
+        if (nameLength > MODEL_TENSOR_NAME_LEN - 1)
+            nameLength = MODEL_TENSOR_NAME_LEN - 1;
+        memcpy(table[t].name, tensors[t].name, nameLength);
+        size_t count = 1;
+        for (int d = 0; d < 4; ++d) {
+            table[t].dims[d] = (uint32_t)tensors[t].dims[d];
+            count *= tensors[t].dims[d];
+        }
+        table[t].offset = offset;
+        table[t].size = count * sizeof(float);
+        offset = align_up(offset + table[t].size);
+    }
+
+    std::vector<char> file(offset, 0);
+    memcpy(&file[sizeof(ModelFileHeader)], table.data(), table.size() * sizeof(ModelTensorEntry));
+    for (size_t t = 0; t < tensors.size(); ++t) {
+        memcpy(&file[table[t].offset], tensors[t].data, table[t].size);
+    }
+
+    ModelFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MODEL_FILE_MAGIC, 8);
+    hdr.version = MODEL_FILE_VERSION;
+    hdr.header_size = sizeof(ModelFileHeader);
+    hdr.num_tensors = (uint32_t)tensors.size();
+    hdr.entry_size = sizeof(ModelTensorEntry);
+    hdr.file_size = file.size();
+    hdr.checksum = checksum(&file[sizeof(ModelFileHeader)], file.size() - sizeof(ModelFileHeader));
+    memcpy(&file[0], &hdr, sizeof(hdr));
+
+    FILE* fp;
+    errno_t err;
+    if ((err = fopen_s(&fp, filename, "wb")) != 0) {
+        fprintf(stderr, "cannot open file '%s'\n", filename);
+        return false;
+    }
+    bool ok = fwrite(file.data(), 1, file.size(), fp) == file.size();
+    fclose(fp);
+    if (!ok)
+        fprintf(stderr, "cannot write file '%s'\n", filename);
+
+    return ok;
+}
@@ -0,0 +1,92 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "mapped_file.h"
+
+// Single-file binary model format (little-endian)
+//
+//   ModelFileHeader                     64 bytes
+//   ModelTensorEntry x num_tensors      64 bytes each
+//   tensor data                         each tensor starts on a 64-byte boundary
+//
+// The checksum (64-bit FNV-1a) covers everything after the header, i.e. the tensor table
+// and the data. Tensors are raw float32 arrays that are used in place from the mapping,
+// so the file is shared read-only between processes through the page cache.
+//
+// Opening a model validates the header and the tensor table only, which touches the first
+// pages of the mapping; hashing the body would read every page of the weights at startup.
+// The checksum is verified on request: "lenet5 verify", or LENET5_VERIFY_MODEL=1 for every open.
+
+#define MODEL_FILE_MAGIC "LENET5W"  // + terminating 0 = 8 bytes
+#define MODEL_FILE_VERSION 1
+#define MODEL_FILE_ALIGNMENT 64
+#define MODEL_TENSOR_NAME_LEN 32
+#define MODEL_CHECKSUM_SEED 14695981039346656037ULL     // FNV-1a offset basis
+
+struct ModelFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;   // sizeof(ModelFileHeader)
+    uint32_t num_tensors;
+    uint32_t entry_size;    // sizeof(ModelTensorEntry)
+    uint64_t file_size;
+    uint64_t checksum;
+    uint8_t reserved[24];
+};
+
+struct ModelTensorEntry {
+    char name[MODEL_TENSOR_NAME_LEN];
+    uint32_t dims[4];       // n, c, h, w
+    uint64_t offset;        // from the start of the file
+    uint64_t size;          // in bytes
+};
+
+static_assert(sizeof(ModelFileHeader) == 64, "ModelFileHeader must be 64 bytes");
+static_assert(sizeof(ModelTensorEntry) == 64, "ModelTensorEntry must be 64 bytes");
+
+// tensor to be written by ModelFile::write
+struct ModelTensorData {
+    const char* name;
+    int dims[4];
+    const float* data;
+};
+
+// read-only memory mapping of a model file
+class ModelFile {
+private:
+    MappedFile _file;
+
+    const ModelFileHeader* header() const { return (const ModelFileHeader*)_file.data(); }
+    const ModelTensorEntry* entries() const { return (const ModelTensorEntry*)(_file.data() + sizeof(ModelFileHeader)); }
+
+    bool validate(const char* filename, bool verify_checksum);
+
+    // not copyable, owns the mapping
+    ModelFile(const ModelFile&);
+    ModelFile& operator=(const ModelFile&);
+
+public:
+    ModelFile() {}
+
+    // maps the file and validates its header and tensor table, and the checksum if verify_checksum
+    // or LENET5_VERIFY_MODEL=1
+    bool open(const char* filename, bool verify_checksum = false);
+    void close();
+    bool is_open() const { return _file.is_open(); }
+
+    // data of the named tensor, or nullptr if it is missing or its shape differs from (n, c, h, w)
+    const float* tensor(const char* name, int n, int c, int h, int w) const;
+    // data of the named tensor of count floats whatever its shape (e.g. C5 kernels used as a matrix), or nullptr
+    const float* tensor(const char* name, size_t count) const;
+
+    // writes tensors into a new model file
+    static bool write(const char* filename, const std::vector<ModelTensorData>& tensors);
+
+    // hash: the checksum of the data before, to checksum several blocks as one
+    static uint64_t checksum(const void* data, size_t size, uint64_t hash = MODEL_CHECKSUM_SEED);
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "numa.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+bool parse_cpu_list(const char* text, std::vector<int>& cpus) {
+
+    cpus.clear();
+    const char* p = text;
+    while (*p != '\0' && *p != '\n') {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first)
+                return false;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back((int)cpu);
+        if (*p == ',')
+            ++p;
+        else if (*p != '\0' && *p != '\n')
+            return false;
+    }
+    return true;
+}
+
+std::string format_cpu_list(const std::vector<int>& cpus) {
+
+    std::string text;
+    char range[32];
+    for (size_t i = 0; i < cpus.size(); ) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            ++j;
+        if (j > i)
+            snprintf(range, sizeof(range), "%s%d-%d", text.empty() ? "" : ",", cpus[i], cpus[j]);
+        else
+            snprintf(range, sizeof(range), "%s%d", text.empty() ? "" : ",", cpus[i]);
+        text += range;
+        i = j + 1;
+    }
+    return text;
+}
+
+#ifdef __linux__
+
+// CPUs this process may run on, in order
+static std::vector<int> allowed_cpus() {
+
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+static bool read_node_cpus(int node, std::vector<int>& cpus) {
+
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* fp;
+    errno_t err;
+    if ((err = fopen_s(&fp, path, "r")) != 0)
+        return false;
+    char line[4096];
+    bool ok = fgets(line, sizeof(line), fp) != nullptr && parse_cpu_list(line, cpus);
+    fclose(fp);
+    return ok;
+}
+
+// node<N> entries of the sysfs node directory, in order
+static std::vector<int> sysfs_nodes() {
+
+    std::vector<int> nodes;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir == nullptr)
+        return nodes;
+    while (dirent* entry = readdir(dir)) {
+        char* end;
+        if (strncmp(entry->d_name, "node", 4) == 0) {
+            long id = strtol(entry->d_name + 4, &end, 10);
+            if (end != entry->d_name + 4 && *end == '\0')
+                nodes.push_back((int)id);
+        }
+    }
+    closedir(dir);
+    std::sort(nodes.begin(), nodes.end());
+    return nodes;
+}
+
+#else
+
+static std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    int count = (int)std::thread::hardware_concurrency();
+    for (int cpu = 0; cpu < ((count > 0) ? count : 1); ++cpu)
+        cpus.push_back(cpu);
+    return cpus;
+}
+
+#endif
+
+NumaTopology NumaTopology::detect() {
+
+    NumaTopology topology;
+    std::vector<int> allowed = allowed_cpus();
+    if (allowed.empty())
+        allowed.push_back(0);
+
+    const char* env = getenv("LENET5_NUMA_NODES");
+    if (env != nullptr) {
+        // "0-7/8-15": one cpulist per node
+        std::string lists(env);
+        size_t begin = 0;
+        while (begin <= lists.size()) {
+            size_t end = lists.find('/', begin);
+            if (end == std::string::npos)
+                end = lists.size();
+            NumaNode node;
+            node.id = (int)topology.nodes.size();
+            if (!parse_cpu_list(lists.substr(begin, end - begin).c_str(), node.cpus) || node.cpus.empty()) {
+                fprintf(stderr, "invalid LENET5_NUMA_NODES '%s' (cpulists separated by '/'), using the detected nodes\n", env);
+                topology.nodes.clear();
+                break;
+            }
+            topology.nodes.push_back(node);
+            begin = end + 1;
+        }
+    }
+#ifdef __linux__
+    if (topology.nodes.empty()) {
+        for (int id : sysfs_nodes()) {
+            NumaNode node;
+            node.id = id;
+            std::vector<int> cpus;
+            if (!read_node_cpus(id, cpus))
+                continue;
+            for (int cpu : cpus) {
+                if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                    node.cpus.push_back(cpu);
+            }
+            if (!node.cpus.empty())    // memory-only nodes and nodes outside the affinity mask
+                topology.nodes.push_back(node);
+        }
+    }
+#endif
+    if (topology.nodes.empty()) {
+        NumaNode node;
+        node.id = 0;
+        node.cpus = allowed;
+        topology.nodes.push_back(node);
+    }
+
+    return topology;
+}
+
+int NumaTopology::num_cpus() const {
+    int count = 0;
+    for (const NumaNode& node : nodes)
+        count += (int)node.cpus.size();
+    return count;
+}
+
+std::string NumaTopology::to_string() const {
+    std::string text;
+    for (const NumaNode& node : nodes) {
+        char name[32];
+        snprintf(name, sizeof(name), "%snode %d: cpus ", text.empty() ? "" : "; ", node.id);
+        text += name + format_cpu_list(node.cpus);
+    }
+    return text;
+}
+
+bool pin_thread(int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;     // 0: the calling thread
+#else
+    return false;
+#endif
+}
+
+int numa_node_of(const void* p) {
+#if defined(__linux__) && defined(SYS_move_pages)
+    // move_pages without target nodes only reports where each page is
+    void* page = (void*)((uintptr_t)p & ~(uintptr_t)4095);
+    int status = -1;
+    if (syscall(SYS_move_pages, 0, 1UL, &page, nullptr, &status, 0) != 0)
+        return -1;
+    return (status >= 0) ? status : -1;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <string>
+#include <vector>
+
+// NUMA topology and thread pinning, without libnuma
+//
+// topology:   /sys/devices/system/node/node<N>/cpulist, restricted to the CPUs this process may run on
+//             (sched_getaffinity); one node holding every CPU where there is no such directory
+//             (not Linux, or a kernel without NUMA). LENET5_NUMA_NODES overrides it with cpulists separated
+//             by '/', e.g. "0-7/8-15", to try the per-node layout on a single-socket machine.
+// placement:  memory is placed on the node of the thread that first writes it (the Linux default policy),
+//             so a thread pinned to a node allocates and fills what it should own there
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+
+struct NumaTopology {
+    std::vector<NumaNode> nodes;    // only the nodes with usable CPUs
+
+    static NumaTopology detect();
+
+    int num_cpus() const;
+    // "node 0: cpus 0-15; node 1: cpus 16-31"
+    std::string to_string() const;
+};
+
+// parses a kernel cpulist such as "0-3,8,10-11"
+bool parse_cpu_list(const char* text, std::vector<int>& cpus);
+// "0-3,8,10-11"
+std::string format_cpu_list(const std::vector<int>& cpus);
+
+// pins the calling thread to one CPU; false where this is not supported or not allowed
+bool pin_thread(int cpu);
+// node holding the page of p (move_pages query), -1 if unknown or not yet touched
+int numa_node_of(const void* p);
+
+#endif
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* perf_event_name(int event) {
+    static const char* names[PERF_EVENT_COUNT] = { "cycles", "instructions", "l1d_loads", "l1d_misses", "llc_misses", "branch_misses" };
+    return (event >= 0 && event < PERF_EVENT_COUNT) ? names[event] : "?";
+}
+
+#ifdef __linux__
+
+// one counter group per thread, read with a single read() of the group leader
+struct PerfGroup {
+    bool opened;
+    bool available;
+    int leader;
+    int fds[PERF_EVENT_COUNT];
+    int slot[PERF_EVENT_COUNT];     // position of each event in the group read, -1 if it could not be opened
+    int numOpen;
+
+    PerfGroup() : opened(false), available(false), leader(-1), numOpen(0) {
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+            fds[e] = -1;
+            slot[e] = -1;
+        }
+    }
+
+    ~PerfGroup() {
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+            if (fds[e] >= 0)
+                close(fds[e]);
+        }
+    }
+};
+
+static thread_local PerfGroup perf_group;
+static std::atomic<bool> perf_warned(false);
+
+static int open_event(uint32_t type, uint64_t config, int groupFd) {
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (groupFd < 0);  // the leader starts the whole group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);   // calling thread, any CPU
+}
+
+static void open_group(PerfGroup& group) {
+
+    const uint64_t l1dRead = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8);
+    const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[PERF_EVENT_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, l1dRead | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16) },
+        { PERF_TYPE_HW_CACHE, l1dRead | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+
+    group.opened = true;
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+        int fd = open_event(events[e].type, events[e].config, group.leader);
+        if (fd < 0) {
+            if (e == PERF_CYCLES) {
+                // without cycles there is nothing to group the others under
+                if (!perf_warned.exchange(true))
+                    fprintf(stderr, "hardware performance counters are not available (perf_event_open: %s)\n", strerror(errno));
+                return;
+            }
+            continue;
+        }
+        group.fds[e] = fd;
+        group.slot[e] = group.numOpen++;
+        if (group.leader < 0)
+            group.leader = fd;
+    }
+
+    ioctl(group.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(group.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    group.available = true;
+}
+
+bool perf_counters_read(uint64_t values[PERF_EVENT_COUNT]) {
+
+    PerfGroup& group = perf_group;
+    if (!group.opened)
+        open_group(group);
+    if (!group.available)
+        return false;
+
+    // { number of events, value of each event in the order they were added }
+    uint64_t buffer[1 + PERF_EVENT_COUNT];
+    ssize_t bytes = read(group.leader, buffer, sizeof(buffer));
+    if (bytes < (ssize_t)((1 + group.numOpen) * sizeof(uint64_t)))
+        return false;
+
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+        values[e] = (group.slot[e] >= 0) ? buffer[1 + group.slot[e]] : 0;
+    return true;
+}
+
+#else
+
+bool perf_counters_read(uint64_t values[PERF_EVENT_COUNT]) {
+    for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+        values[e] = 0;
+    return false;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+
+// Hardware performance counters of the calling thread, read through Linux perf_event_open.
+// Used by LayerTimer to count events per layer when built with LENET5_PERF_COUNTERS;
+// the counters are user space only and follow the thread on any CPU.
+
+enum PerfEvent {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_LOADS,
+    PERF_L1D_MISSES,        // L1 data cache load misses
+    PERF_LLC_MISSES,        // last level cache misses
+    PERF_BRANCH_MISSES,
+    PERF_EVENT_COUNT
+};
+
+const char* perf_event_name(int event);
+
+// current counter values of the calling thread (the counters are opened on the first call of each thread)
+// returns false if they are not available: not Linux, no PMU (e.g. some VMs) or kernel.perf_event_paranoid too high;
+// events the CPU does not support read as 0
+bool perf_counters_read(uint64_t values[PERF_EVENT_COUNT]);
+
+#endif
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include "pipeline.h"
+#include "bounded_queue.h"
+#include "lenet5_dims.h"
+
+#define PIPELINE_END -1                 // item index sent down the queues after the last image
+#define PIPELINE_YIELDS 64              // a waiting thread yields this many times before it sleeps
+#define PIPELINE_SLEEP_US 50
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// one image on its way through the stages
+struct PipelineItem {
+    size_t index;
+    size_t record;
+    char label;
+    unsigned char pixels[DATASET_IMAGE_LEN * DATASET_IMAGE_LEN];
+    ImageMap image;
+    int digit;
+    double seconds;
+
+    PipelineItem() : index(0), record(0), label(0), image(Lenet5Dims::IN_LEN), digit(-1), seconds(0.0) {}
+};
+
+// time of one thread: total, and the parts spent waiting on each side
+struct StageClock {
+    Clock::time_point start;
+    double starved;
+    double blocked;
+    size_t items;
+
+    StageClock() : start(Clock::now()), starved(0.0), blocked(0.0), items(0) {}
+};
+
+static void backoff(int& waits) {
+    if (++waits < PIPELINE_YIELDS)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(PIPELINE_SLEEP_US));
+}
+
+static int pop(BoundedQueue<int>& queue, double& waited) {
+    int item;
+    if (queue.try_pop(item))
+        return item;
+    Clock::time_point start = Clock::now();
+    int waits = 0;
+    while (!queue.try_pop(item))
+        backoff(waits);
+    waited += seconds_since(start);
+    return item;
+}
+
+static void push(BoundedQueue<int>& queue, int item, double& waited) {
+    if (queue.try_push(item))
+        return;
+    Clock::time_point start = Clock::now();
+    int waits = 0;
+    while (!queue.try_push(item))
+        backoff(waits);
+    waited += seconds_since(start);
+}
+
+static void add_stage(PipelineStats& stats, const char* name, const std::vector<StageClock>& clocks, Clock::time_point end) {
+    PipelineStageStats stage = { name, (int)clocks.size(), 0, 0.0, 0.0, 0.0 };
+    for (const StageClock& clock : clocks) {
+        stage.items += clock.items;
+        stage.seconds += std::chrono::duration<double>(end - clock.start).count();
+        stage.starved += clock.starved;
+        stage.blocked += clock.blocked;
+    }
+    stats.stages.push_back(stage);
+}
+
+void run_pipeline(DatasetReader& reader, const PipelineOptions& options, const PipelineStartFn& start,
+    const PipelineInferFn& infer, const PipelineEmitFn& emit, PipelineStats& stats)
+{
+    const int numWorkers = (options.workers > 0) ? options.workers : 1;
+    const int depth = (options.queue_depth > 0) ? options.queue_depth : 1;
+    // enough items to fill every queue and keep every worker busy
+    const int numItems = 3 * depth + 2 * numWorkers;
+    std::vector<std::unique_ptr<PipelineItem>> items(numItems);
+    for (int i = 0; i < numItems; ++i)
+        items[i].reset(new PipelineItem());
+
+    BoundedQueue<int> freeItems(numItems);
+    BoundedQueue<int> parsed(depth);
+    BoundedQueue<int> padded(depth);
+    BoundedQueue<int> done(depth);
+    for (int i = 0; i < numItems; ++i)
+        freeItems.try_push(i);
+
+    // ends: each stage's threads write their own clocks and the end time of the stage
+    std::vector<StageClock> ingestClock(1), preprocessClock(1), inferClocks(numWorkers), emitClock(1);
+    Clock::time_point ingestEnd, preprocessEnd, emitEnd;
+    std::vector<Clock::time_point> workerEnds(numWorkers);
+    Clock::time_point begin = Clock::now();
+
+    std::thread ingest([&]() {
+        StageClock& clock = ingestClock[0];
+        clock.start = Clock::now();
+        size_t index = 0;
+        for (;;) {
+            int item = pop(freeItems, clock.blocked);   // no free item: the later stages are behind
+            PipelineItem& it = *items[item];
+            if (!reader.next_raw(it.pixels, it.label)) {
+                push(freeItems, item, clock.blocked);
+                break;
+            }
+            it.index = index++;
+            it.record = reader.record() - 1;
+            ++clock.items;
+            push(parsed, item, clock.blocked);
+        }
+        push(parsed, PIPELINE_END, clock.blocked);
+        ingestEnd = Clock::now();
+    });
+
+    std::thread preprocess([&]() {
+        StageClock& clock = preprocessClock[0];
+        clock.start = Clock::now();
+        for (;;) {
+            int item = pop(parsed, clock.starved);
+            if (item == PIPELINE_END)
+                break;
+            PipelineItem& it = *items[item];
+            pad_dataset_image(it.pixels, it.image.data());
+            it.image.set_label(it.label);
+            ++clock.items;
+            push(padded, item, clock.blocked);
+        }
+        for (int w = 0; w < numWorkers; ++w)
+            push(padded, PIPELINE_END, clock.blocked);
+        preprocessEnd = Clock::now();
+    });
+
+    std::vector<std::thread> workers;
+    for (int w = 0; w < numWorkers; ++w) {
+        workers.push_back(std::thread([&, w]() {
+            if (start)
+                start(w);
+            StageClock& clock = inferClocks[w];
+            clock.start = Clock::now();
+            for (;;) {
+                int item = pop(padded, clock.starved);
+                if (item == PIPELINE_END)
+                    break;
+                PipelineItem& it = *items[item];
+                Clock::time_point t0 = Clock::now();
+                it.digit = infer(&it.image, w);
+                it.seconds = seconds_since(t0);
+                ++clock.items;
+                push(done, item, clock.blocked);
+            }
+            push(done, PIPELINE_END, clock.blocked);
+            workerEnds[w] = Clock::now();
+        }));
+    }
+
+    std::thread writer([&]() {
+        StageClock& clock = emitClock[0];
+        clock.start = Clock::now();
+        // results arrive in any order; each waits in the slot of its index until the ones before it are out
+        // (at most numItems images are in flight, so the slots never collide)
+        std::vector<int> waiting(numItems, -1);
+        size_t next = 0;
+        int ended = 0;
+        while (ended < numWorkers) {
+            int item = pop(done, clock.starved);
+            if (item == PIPELINE_END) {
+                ++ended;
+                continue;
+            }
+            waiting[items[item]->index % numItems] = item;
+            for (;;) {
+                int& slot = waiting[next % numItems];
+                if (slot < 0 || items[slot]->index != next)
+                    break;
+                const PipelineItem& it = *items[slot];
+                PipelineResult result = { it.index, it.record, it.label, it.digit, it.seconds };
+                emit(result);
+                ++clock.items;
+                push(freeItems, slot, clock.blocked);
+                slot = -1;
+                ++next;
+            }
+        }
+        emitEnd = Clock::now();
+    });
+
+    ingest.join();
+    preprocess.join();
+    for (size_t w = 0; w < workers.size(); ++w)
+        workers[w].join();
+    writer.join();
+
+    stats.seconds = seconds_since(begin);
+    stats.images = emitClock[0].items;
+    stats.queue_depth = depth;
+    stats.stages.clear();
+    add_stage(stats, "ingest", ingestClock, ingestEnd);
+    add_stage(stats, "preprocess", preprocessClock, preprocessEnd);
+    PipelineStageStats inferStage = { "infer", numWorkers, 0, 0.0, 0.0, 0.0 };
+    for (int w = 0; w < numWorkers; ++w) {
+        inferStage.items += inferClocks[w].items;
+        inferStage.seconds += std::chrono::duration<double>(workerEnds[w] - inferClocks[w].start).count();
+        inferStage.starved += inferClocks[w].starved;
+        inferStage.blocked += inferClocks[w].blocked;
+    }
+    stats.stages.push_back(inferStage);
+    add_stage(stats, "emit", emitClock, emitEnd);
+}
+
+std::string PipelineStats::to_string() const {
+
+    std::string text;
+    char line[160];
+    snprintf(line, sizeof(line), "pipeline: %zu images in %.3f s (%.0f images/s), queue depth %d\n", images, seconds,
+        (seconds > 0.0) ? images / seconds : 0.0, queue_depth);
+    text += line;
+    snprintf(line, sizeof(line), "  %-12s %7s %9s %8s %8s %8s\n", "stage", "threads", "items", "busy", "starved", "blocked");
+    text += line;
+    for (const PipelineStageStats& s : stages) {
+        double total = (s.seconds > 0.0) ? s.seconds : 1.0;
+        snprintf(line, sizeof(line), "  %-12s %7d %9zu %7.1f%% %7.1f%% %7.1f%%\n", s.name, s.threads, s.items,
+            100.0 * s.busy() / total, 100.0 * s.starved / total, 100.0 * s.blocked / total);
+        text += line;
+    }
+    return text;
+}
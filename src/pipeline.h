@@ -0,0 +1,70 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "imagemap.h"
+#include "dataset_reader.h"
+
+// Staged streaming of a dataset through the network (run_lenet5_dataset)
+//
+// ingest:      one thread parses the dataset (DatasetReader::next_raw) into free items
+// preprocess:  one thread pads the 28 x 28 pixels of each item into its 32 x 32 input image (the network takes raw
+//              0-255 pixels, the 1/255 of training is folded into the C1 weights, so there is nothing to normalize)
+// infer:       N worker threads run the network on the items as they come
+// emit:        one thread puts the results back in dataset order and hands them to the emit callback, e.g. a writer
+//              into a large stdio buffer, so output never waits on a flush per image
+//
+// Items come from a fixed pool and move between the stages as indices in BoundedQueues (lock-free); a stage
+// whose output queue is full waits for it to drain, and ingest waits for emitted items to come back, so memory
+// stays bounded however large the dataset and however slow the consumer (backpressure). A waiting thread yields,
+// then sleeps for 50 us at a time. Each thread adds up the time it waited for input (starved) and for room in
+// its output (blocked); the rest of its time is busy.
+
+struct PipelineOptions {
+    int workers;        // inference threads
+    int queue_depth;    // capacity of each queue between two stages
+
+    PipelineOptions() : workers(1), queue_depth(64) {}
+};
+
+struct PipelineResult {
+    size_t index;       // image number in dataset order
+    size_t record;      // dataset record (DatasetReader::record)
+    char label;
+    int digit;
+    double seconds;     // time spent in the network
+};
+
+struct PipelineStageStats {
+    const char* name;
+    int threads;
+    size_t items;
+    double seconds;     // summed over the stage's threads
+    double starved;
+    double blocked;
+
+    double busy() const { return seconds - starved - blocked; }
+};
+
+struct PipelineStats {
+    double seconds;
+    size_t images;
+    int queue_depth;
+    std::vector<PipelineStageStats> stages;
+
+    // one line per stage with its busy / starved / blocked share of its threads' time
+    std::string to_string() const;
+};
+
+typedef std::function<void(int worker)> PipelineStartFn;    // on each worker thread before its first image
+typedef std::function<int(const ImageMap* image, int worker)> PipelineInferFn;
+typedef std::function<void(const PipelineResult& result)> PipelineEmitFn;     // on the emit thread, in order
+
+// streams every remaining image of the (open) reader through the stages
+void run_pipeline(DatasetReader& reader, const PipelineOptions& options, const PipelineStartFn& start,
+    const PipelineInferFn& infer, const PipelineEmitFn& emit, PipelineStats& stats);
+
+#endif
@@ -0,0 +1,462 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "shard_eval.h"
+#include "lenet5.h"
+#include "dataset_reader.h"
+#include "model_file.h"
+#include "thread_pool.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+ShardOptions::ShardOptions() : program("lenet5"), model_path(nullptr), dataset_path("./dataset/test_dataset.csv"),
+    dir("shards"), conv_algorithms(nullptr), predictions_path(nullptr), num_shards(0), shard(-1), jobs(1), threads(0) {}
+
+void print_shard_usage() {
+    printf("usage: lenet5 shard -n shards [options]     score a dataset split into shards, one process per shard\n");
+    printf("       lenet5 merge [options]               merge the shard files into one result\n");
+    printf("  -d dataset         CSV or MNIST IDX images file (default ./dataset/test_dataset.csv)\n");
+    printf("  -m model.bin       binary model (default params/*.txt)\n");
+    printf("  -o dir             directory of the shard files (default shards)\n");
+    printf("  -n shards          number of shards (merge: default from shard 0)\n");
+    printf("  -i shard           run only this shard (0 to shards - 1), e.g. on another machine\n");
+    printf("  -j processes       shard processes run at a time on this machine (default 1)\n");
+    printf("  -t threads         threads per process, 0 = hardware threads / processes (default 0)\n");
+    printf("  -c algorithms      C1 / C3 convolution, e.g. winograd4 or c1=direct,c3=fft (default direct)\n");
+    printf("  -p predictions.csv merge: write record,label,digit for every record\n");
+    printf("shards that already have a complete file are skipped, so rerunning resumes a failed run\n");
+}
+
+bool parse_shard_args(int argc, char* argv[], ShardOptions& options) {
+
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc)
+            return false;
+        const char* arg = argv[i];
+        const char* value = argv[++i];
+        int number = atoi(value);
+        if (strcmp(arg, "-d") == 0) {
+            options.dataset_path = value;
+        }
+        else if (strcmp(arg, "-m") == 0) {
+            options.model_path = value;
+        }
+        else if (strcmp(arg, "-o") == 0) {
+            options.dir = value;
+        }
+        else if (strcmp(arg, "-c") == 0) {
+            options.conv_algorithms = value;
+        }
+        else if (strcmp(arg, "-p") == 0) {
+            options.predictions_path = value;
+        }
+        else if (strcmp(arg, "-n") == 0 && number > 0) {
+            options.num_shards = number;
+        }
+        else if (strcmp(arg, "-i") == 0 && number >= 0) {
+            options.shard = number;
+        }
+        else if (strcmp(arg, "-j") == 0 && number > 0) {
+            options.jobs = number;
+        }
+        else if (strcmp(arg, "-t") == 0 && number >= 0) {
+            options.threads = number;
+        }
+        else {
+            return false;
+        }
+    }
+
+    return options.shard < options.num_shards || options.num_shards == 0;
+}
+
+std::string shard_file_name(const char* dir, int shard) {
+    char name[32];
+    snprintf(name, sizeof(name), "/shard-%04d.bin", shard);
+    return std::string(dir) + name;
+}
+
+static uint64_t wall_clock_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool make_directory(const char* dir) {
+#ifdef _WIN32
+    int result = _mkdir(dir);
+#else
+    int result = mkdir(dir, 0777);
+#endif
+    if (result != 0 && errno != EEXIST) {
+        fprintf(stderr, "cannot create directory '%s'\n", dir);
+        return false;
+    }
+    return true;
+}
+
+bool read_shard_file(const char* filename, ShardFileHeader& header, std::vector<ShardRecord>& records, bool quiet) {
+
+    FILE* fp;
+    errno_t err;
+    if ((err = fopen_s(&fp, filename, "rb")) != 0) {
+        if (!quiet)
+            fprintf(stderr, "cannot open file '%s'\n", filename);
+        return false;
+    }
+
+    const char* problem = nullptr;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, SHARD_FILE_MAGIC, 8) != 0) {
+        problem = "not a shard file";
+    }
+    else if (header.version != SHARD_FILE_VERSION || header.header_size != sizeof(ShardFileHeader)) {
+        problem = "unsupported version";
+    }
+    else if (header.num_shards == 0 || header.shard >= header.num_shards
+        || header.first_record + header.num_records > header.total_records) {
+        problem = "invalid header";
+    }
+    else {
+        records.resize(header.num_records);
+        if (fread(records.data(), sizeof(ShardRecord), records.size(), fp) != records.size() || fgetc(fp) != EOF)
+            problem = "truncated or too long";
+        else if (ModelFile::checksum(records.data(), records.size() * sizeof(ShardRecord)) != header.checksum)
+            problem = "checksum mismatch";
+    }
+    fclose(fp);
+
+    if (problem != nullptr && !quiet)
+        fprintf(stderr, "'%s': %s\n", filename, problem);
+    return problem == nullptr;
+}
+
+// writes the shard to a temporary file and renames it, so that the shard file is never incomplete
+static bool write_shard_file(const char* filename, ShardFileHeader& header, const std::vector<ShardRecord>& records) {
+
+    header.checksum = ModelFile::checksum(records.data(), records.size() * sizeof(ShardRecord));
+    std::string temporary = std::string(filename) + ".tmp";
+
+    FILE* fp;
+    errno_t err;
+    if ((err = fopen_s(&fp, temporary.c_str(), "wb")) != 0) {
+        fprintf(stderr, "cannot open file '%s'\n", temporary.c_str());
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(records.data(), sizeof(ShardRecord), records.size(), fp) == records.size();
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "cannot write file '%s'\n", temporary.c_str());
+        remove(temporary.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    remove(filename);   // rename does not replace files on Windows
+#endif
+    if (rename(temporary.c_str(), filename) != 0) {
+        fprintf(stderr, "cannot rename '%s' to '%s'\n", temporary.c_str(), filename);
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool run_shard(const ShardOptions& options, int shard) {
+
+    DatasetReader reader;
+    if (!reader.open(options.dataset_path))
+        return false;
+    uint64_t total = reader.num_records();
+    uint64_t first = total * shard / options.num_shards;
+    uint64_t end = total * (shard + 1) / options.num_shards;
+
+    Lenet5Model lenet5(options.model_path);
+    if (!lenet5.is_loaded()) {
+        fprintf(stderr, "cannot score shards: some parameters of the model are missing\n");
+        return false;
+    }
+    if (options.conv_algorithms != nullptr && !lenet5.set_conv_algorithms(options.conv_algorithms))
+        return false;
+
+    ShardFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SHARD_FILE_MAGIC, 8);
+    header.version = SHARD_FILE_VERSION;
+    header.header_size = sizeof(ShardFileHeader);
+    header.shard = (uint32_t)shard;
+    header.num_shards = (uint32_t)options.num_shards;
+    header.first_record = first;
+    header.num_records = end - first;
+    header.total_records = total;
+    header.dataset_id = reader.fingerprint();
+    header.model_id = lenet5.fingerprint();
+
+    // a complete file of the same run: nothing to do
+    std::string filename = shard_file_name(options.dir, shard);
+    ShardFileHeader done;
+    std::vector<ShardRecord> records;
+    if (read_shard_file(filename.c_str(), done, records, true) && done.shard == header.shard
+        && done.num_shards == header.num_shards && done.total_records == total
+        && done.dataset_id == header.dataset_id && done.model_id == header.model_id) {
+        printf("shard %d / %d: already done (%s)\n", shard, options.num_shards, filename.c_str());
+        return true;
+    }
+    if (!make_directory(options.dir))
+        return false;
+
+    // the images are streamed through a ring like in run_lenet5_dataset; every result goes to its record
+    records.assign(end - first, ShardRecord());
+    memset(records.data(), SHARD_UNKNOWN, records.size() * sizeof(ShardRecord));
+    ThreadPool pool(options.threads);
+    std::vector<InferenceContext> contexts(pool.size());
+    ImageRing ring(pool.size() * 4);
+    uint32_t images = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    header.start_ns = wall_clock_ns();
+    if (first > 0)
+        reader.skip(first);
+    while (reader.record() < end) {
+        int slot = ring.acquire();
+        ImageMap* image = ring.image(slot);
+        // a malformed row makes next() read the following one, which can belong to the next shard
+        if (!reader.next(image) || reader.record() > end) {
+            ring.release(slot);
+            break;
+        }
+        ShardRecord* record = &records[reader.record() - 1 - first];
+        unsigned label = (unsigned)(image->get_label() - '0');
+        record->label = (label < 10) ? (uint8_t)label : SHARD_UNKNOWN;
+        ++images;
+
+        pool.submit([&, slot, record](int worker) {
+            record->digit = (uint8_t)lenet5.run_inference(ring.image(slot), contexts[worker]);
+            ring.release(slot);
+        });
+    }
+    pool.wait();
+    header.end_ns = wall_clock_ns();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    header.threads = (uint32_t)pool.size();
+    header.images = images;
+
+    if (!write_shard_file(filename.c_str(), header, records))
+        return false;
+    printf("shard %d / %d: records %llu to %llu, %u images in %.3f s (%.0f images/s) -> %s\n", shard, options.num_shards,
+        (unsigned long long)first, (unsigned long long)end - 1, images, seconds, images / seconds, filename.c_str());
+    return true;
+}
+
+// runs every shard in a process of its own, options.jobs at a time
+static bool run_shard_processes(const ShardOptions& options) {
+
+    int threads = options.threads;
+    if (threads == 0) {
+        int hardware = (int)std::thread::hardware_concurrency();
+        threads = (hardware / options.jobs > 0) ? hardware / options.jobs : 1;
+    }
+
+#ifdef _WIN32
+    // no fork: the shards run one after another in this process
+    ShardOptions one = options;
+    one.threads = threads;
+    bool ok = true;
+    for (int shard = 0; shard < options.num_shards; ++shard)
+        ok = run_shard(one, shard) && ok;
+    return ok;
+#else
+    char shards[16], threadCount[16];
+    snprintf(shards, sizeof(shards), "%d", options.num_shards);
+    snprintf(threadCount, sizeof(threadCount), "%d", threads);
+
+    int running = 0;
+    int failed = 0;
+    auto wait_one = [&]() {
+        int status;
+        if (wait(&status) > 0) {
+            --running;
+            failed += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        }
+    };
+
+    fflush(stdout);
+    for (int shard = 0; shard < options.num_shards; ++shard) {
+        if (running == options.jobs)
+            wait_one();
+
+        char index[16];
+        snprintf(index, sizeof(index), "%d", shard);
+        std::vector<const char*> args = { options.program, "shard", "-d", options.dataset_path, "-o", options.dir,
+            "-n", shards, "-i", index, "-t", threadCount };
+        if (options.model_path != nullptr) {
+            args.push_back("-m");
+            args.push_back(options.model_path);
+        }
+        if (options.conv_algorithms != nullptr) {
+            args.push_back("-c");
+            args.push_back(options.conv_algorithms);
+        }
+        args.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            execvp(options.program, (char* const*)args.data());
+            fprintf(stderr, "cannot start '%s': %s\n", options.program, strerror(errno));
+            _exit(127);
+        }
+        if (pid < 0) {
+            fprintf(stderr, "cannot start shard %d: %s\n", shard, strerror(errno));
+            ++failed;
+            continue;
+        }
+        ++running;
+    }
+    while (running > 0)
+        wait_one();
+
+    if (failed > 0)
+        fprintf(stderr, "%d of %d shards failed; run the command again to redo them\n", failed, options.num_shards);
+    return failed == 0;
+#endif
+}
+
+bool run_shards(const ShardOptions& options) {
+
+    if (options.num_shards <= 0) {
+        fprintf(stderr, "the number of shards (-n) is missing\n");
+        return false;
+    }
+    if (options.shard >= 0)
+        return run_shard(options, options.shard);
+    return run_shard_processes(options);
+}
+
+bool merge_shards(const ShardOptions& options) {
+
+    int numShards = options.num_shards;
+    ShardFileHeader header;
+    std::vector<ShardRecord> records;
+    if (numShards == 0) {
+        if (!read_shard_file(shard_file_name(options.dir, 0).c_str(), header, records))
+            return false;
+        numShards = (int)header.num_shards;
+    }
+
+    // every shard must be there, from the same dataset, model and split
+    std::vector<ShardFileHeader> headers(numShards);
+    std::vector<ShardRecord> all;
+    std::vector<int> missing;
+    const ShardFileHeader* reference = nullptr;    // the first valid shard
+    for (int shard = 0; shard < numShards; ++shard) {
+        std::string filename = shard_file_name(options.dir, shard);
+        ShardFileHeader& h = headers[shard];
+        if (!read_shard_file(filename.c_str(), h, records)) {
+            missing.push_back(shard);
+            continue;
+        }
+        uint64_t begin = h.total_records * shard / numShards;
+        if (h.shard != (uint32_t)shard || h.num_shards != (uint32_t)numShards || h.first_record != begin
+            || h.first_record + h.num_records != h.total_records * (shard + 1) / numShards) {
+            fprintf(stderr, "'%s': shard %u of %u, expected %d of %d\n", filename.c_str(), h.shard, h.num_shards, shard, numShards);
+            missing.push_back(shard);
+            continue;
+        }
+        if (reference == nullptr)
+            reference = &h;
+        if (h.total_records != reference->total_records || h.dataset_id != reference->dataset_id
+            || h.model_id != reference->model_id) {
+            fprintf(stderr, "'%s': from another dataset or model than the shards before it\n", filename.c_str());
+            missing.push_back(shard);
+            continue;
+        }
+        all.insert(all.end(), records.begin(), records.end());
+    }
+    if (!missing.empty()) {
+        fprintf(stderr, "%d of %d shards are missing or invalid:", (int)missing.size(), numShards);
+        for (int shard : missing)
+            fprintf(stderr, " %d", shard);
+        fprintf(stderr, "\nrerun them with lenet5 shard -n %d -i <shard> (or all missing ones with lenet5 shard -n %d)\n",
+            numShards, numShards);
+        return false;
+    }
+
+    int confusion[10][10] = {};
+    uint64_t images = 0, labeled = 0, correct = 0;
+    for (const ShardRecord& r : all) {
+        if (r.digit == SHARD_UNKNOWN)
+            continue;
+        ++images;
+        if (r.label == SHARD_UNKNOWN || r.digit >= 10)
+            continue;
+        ++labeled;
+        correct += (r.label == r.digit);
+        ++confusion[r.label][r.digit];
+    }
+
+    printf("%d shards in %s: %llu records, %llu images (%llu malformed rows), model %016llx\n", numShards, options.dir,
+        (unsigned long long)all.size(), (unsigned long long)images, (unsigned long long)(all.size() - images),
+        (unsigned long long)headers[0].model_id);
+    if (labeled > 0)
+        printf("accuracy: %llu / %llu = %.2f%%\n", (unsigned long long)correct, (unsigned long long)labeled, 100.0 * correct / labeled);
+    printf("confusion matrix (rows: label, columns: predicted digit)\n      ");
+    for (int d = 0; d < 10; ++d)
+        printf("%7d", d);
+    printf("\n");
+    for (int l = 0; l < 10; ++l) {
+        printf("  %d   ", l);
+        for (int d = 0; d < 10; ++d)
+            printf("%7d", confusion[l][d]);
+        printf("\n");
+    }
+
+    // wall time from the first start to the last end (the shards may have run one after another, or on
+    // machines whose clocks differ a little), and the sum of the shard times
+    uint64_t start = headers[0].start_ns, end = headers[0].end_ns;
+    double shardSeconds = 0.0;
+    for (const ShardFileHeader& h : headers) {
+        start = (h.start_ns < start) ? h.start_ns : start;
+        end = (h.end_ns > end) ? h.end_ns : end;
+        shardSeconds += (h.end_ns - h.start_ns) * 1e-9;
+    }
+    double wallSeconds = (end - start) * 1e-9;
+    printf("throughput: %llu images in %.3f s wall = %.0f images/s; %.3f s of shard time = %.0f images/s per process\n",
+        (unsigned long long)images, wallSeconds, wallSeconds > 0.0 ? images / wallSeconds : 0.0,
+        shardSeconds, shardSeconds > 0.0 ? images / shardSeconds : 0.0);
+
+    if (options.predictions_path != nullptr) {
+        FILE* fp;
+        errno_t err;
+        if ((err = fopen_s(&fp, options.predictions_path, "w")) != 0) {
+            fprintf(stderr, "cannot open file '%s'\n", options.predictions_path);
+            return false;
+        }
+        fprintf(fp, "record,label,digit\n");
+        for (size_t i = 0; i < all.size(); ++i) {
+            fprintf(fp, "%llu,", (unsigned long long)i);
+            if (all[i].label != SHARD_UNKNOWN)
+                fprintf(fp, "%d", all[i].label);
+            fprintf(fp, ",");
+            if (all[i].digit != SHARD_UNKNOWN)
+                fprintf(fp, "%d", all[i].digit);
+            fprintf(fp, "\n");
+        }
+        bool ok = fclose(fp) == 0;
+        if (!ok) {
+            fprintf(stderr, "cannot write file '%s'\n", options.predictions_path);
+            return false;
+        }
+        printf("predictions written to %s\n", options.predictions_path);
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef SHARD_EVAL_H
+#define SHARD_EVAL_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Evaluation of one dataset split over several processes ("lenet5 shard" and "lenet5 merge")
+//
+// shards:     the records of the dataset (IDX images or non-empty CSV rows, see DatasetReader::record) are split
+//             into num_shards contiguous ranges, shard i holding [total * i / n, total * (i + 1) / n); every process
+//             only needs the dataset and the model, so the shards can run on any machine that shares the directory
+// results:    each shard writes <dir>/shard-NNNN.bin (a ShardFileHeader and one ShardRecord per record) through a
+//             temporary file that is renamed when complete, so a shard file is either whole or missing
+// restarts:   a shard whose file is already there for the same dataset, model and split is not run again, so
+//             rerunning the whole command after a failure only redoes the shards that did not finish
+// merge:      checks that every shard is there and belongs to the same run, then prints the accuracy,
+//             the confusion matrix and the throughput, and writes the predictions in dataset order
+
+#define SHARD_FILE_MAGIC "LENET5R"  // + terminating 0 = 8 bytes
+#define SHARD_FILE_VERSION 1
+#define SHARD_UNKNOWN 0xff          // label of an unlabeled image, digit of a malformed row
+
+struct ShardFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;   // sizeof(ShardFileHeader)
+    uint32_t shard;
+    uint32_t num_shards;
+    uint64_t first_record;
+    uint64_t num_records;
+    uint64_t total_records; // of the whole dataset
+    uint64_t dataset_id;    // DatasetReader::fingerprint
+    uint64_t model_id;      // Lenet5Model::fingerprint
+    uint64_t start_ns;      // wall clock (ns since the epoch) when inference started and ended
+    uint64_t end_ns;
+    uint32_t threads;
+    uint32_t images;        // images scored (num_records minus the malformed rows)
+    uint64_t checksum;      // of the records (64-bit FNV-1a)
+};
+
+struct ShardRecord {
+    uint8_t label;          // 0-9 or SHARD_UNKNOWN
+    uint8_t digit;          // predicted digit or SHARD_UNKNOWN
+};
+
+static_assert(sizeof(ShardFileHeader) == 96, "ShardFileHeader must be 96 bytes");
+static_assert(sizeof(ShardRecord) == 2, "ShardRecord must be 2 bytes");
+
+struct ShardOptions {
+    const char* program;        // this executable, to start the shard processes (argv[0])
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;
+    const char* dir;            // directory of the shard files
+    const char* conv_algorithms;    // nullptr: LENET5_CONV or direct
+    const char* predictions_path;   // merge: CSV of every record, nullptr: none
+    int num_shards;             // merge: 0 takes it from shard 0
+    int shard;                  // shard to run, -1: all of them, jobs processes at a time
+    int jobs;
+    int threads;                // per process, 0: the hardware threads divided among the jobs
+
+    ShardOptions();
+};
+
+// parses the arguments of "lenet5 shard" / "lenet5 merge" (argv[0] is the first one after the command)
+bool parse_shard_args(int argc, char* argv[], ShardOptions& options);
+void print_shard_usage();
+
+// runs one shard, or starts every shard as a process of its own
+bool run_shards(const ShardOptions& options);
+bool merge_shards(const ShardOptions& options);
+
+// <dir>/shard-NNNN.bin
+std::string shard_file_name(const char* dir, int shard);
+
+// reads and validates a shard file; prints why it cannot be used unless quiet
+bool read_shard_file(const char* filename, ShardFileHeader& header, std::vector<ShardRecord>& records, bool quiet = false);
+
+#endif
@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "simd.h"
+
+#ifdef LENET5_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+
+#ifdef LENET5_X86
+static void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int i = 0; i < 4; ++i)
+        regs[i] = (unsigned int)r[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// register state the OS saves on context switches (XCR0)
+static unsigned long long xgetbv0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif
+
+SimdLevel detect_simd_level() {
+
+#ifdef LENET5_X86
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    unsigned int maxLeaf = regs[0];
+    if (maxLeaf < 1)
+        return SIMD_SCALAR;
+
+    cpuid(1, 0, regs);
+    bool sse42 = (regs[2] >> 20) & 1;
+    bool fma = (regs[2] >> 12) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+    bool avx = (regs[2] >> 28) & 1;
+    bool f16c = (regs[2] >> 29) & 1;
+    if (!sse42)
+        return SIMD_SCALAR;
+    if (!osxsave || !avx || maxLeaf < 7)
+        return SIMD_SSE42;
+
+    unsigned long long xcr0 = xgetbv0();
+    bool osYmm = (xcr0 & 0x6) == 0x6;       // XMM and YMM state
+    bool osZmm = (xcr0 & 0xe6) == 0xe6;     // + opmask and ZMM state
+
+    cpuid(7, 0, regs);
+    bool avx2 = (regs[1] >> 5) & 1;
+    bool avx512f = (regs[1] >> 16) & 1;
+    bool avx512bw = (regs[1] >> 30) & 1;
+    bool avx512vl = (regs[1] >> 31) & 1;
+    bool avx512vnni = (regs[2] >> 11) & 1;
+    unsigned int maxSubleaf = regs[0];
+    bool avx512bf16 = false;
+    if (maxSubleaf >= 1) {
+        cpuid(7, 1, regs);
+        avx512bf16 = (regs[0] >> 5) & 1;
+    }
+
+    if (avx512f && avx512bw && avx512vl && avx512vnni && avx512bf16 && osZmm)
+        return SIMD_AVX512_BF16;
+    if (avx512f && avx512bw && avx512vl && avx512vnni && osZmm)
+        return SIMD_AVX512_VNNI;
+    if (avx512f && osZmm)
+        return SIMD_AVX512;
+    if (avx2 && fma && f16c && osYmm)
+        return SIMD_AVX2;
+    return SIMD_SSE42;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+    case SIMD_SSE42: return "sse4.2";
+    case SIMD_AVX2: return "avx2";
+    case SIMD_AVX512: return "avx512";
+    case SIMD_AVX512_VNNI: return "avx512vnni";
+    case SIMD_AVX512_BF16: return "avx512bf16";
+    default: return "scalar";
+    }
+}
+
+// kernels of every level, filled in once
+struct SimdKernelTable {
+    SimdKernels levels[SIMD_AVX512_BF16 + 1];
+
+    SimdKernelTable() {
+        get_scalar_kernels(levels[SIMD_SCALAR]);
+#ifdef LENET5_X86
+        get_sse42_kernels(levels[SIMD_SSE42]);
+        get_avx2_kernels(levels[SIMD_AVX2]);
+        get_avx512_kernels(levels[SIMD_AVX512]);
+        get_avx512_vnni_kernels(levels[SIMD_AVX512_VNNI]);
+        get_avx512_bf16_kernels(levels[SIMD_AVX512_BF16]);
+#else
+        levels[SIMD_SSE42] = levels[SIMD_AVX2] = levels[SIMD_AVX512] = levels[SIMD_AVX512_VNNI] = levels[SIMD_AVX512_BF16] =
+            levels[SIMD_SCALAR];
+#endif
+    }
+};
+
+const SimdKernels& simd_kernels(SimdLevel level) {
+    static const SimdKernelTable table;
+    return table.levels[level];
+}
+
+static SimdLevel select_simd_level() {
+
+    SimdLevel level = detect_simd_level();
+
+    // allow forcing a lower level, e.g. to compare against the scalar path
+    const char* env = getenv("LENET5_SIMD");
+    if (env != NULL) {
+        for (int l = SIMD_SCALAR; l <= SIMD_AVX512_BF16; ++l) {
+            if (strcmp(env, simd_level_name((SimdLevel)l)) == 0) {
+                if (l <= level)
+                    level = (SimdLevel)l;
+                else
+                    fprintf(stderr, "LENET5_SIMD=%s is not supported on this CPU, using %s\n", env, simd_level_name(level));
+            }
+        }
+    }
+
+    return level;
+}
+
+const SimdKernels& simd_kernels() {
+    static const SimdKernels& selected = simd_kernels(select_simd_level());
+    return selected;
+}
+
+
+// scalar kernels (fallback)
+
+static void conv5x5_scalar(const float* in, int inLength, const float* weights, float* out, int outLength, bool relu) {
+
+    for (int i = 0; i < outLength; ++i) {
+        for (int j = 0; j < outLength; ++j) {
+            float convResult = 0;
+            for (int ki = 0; ki < 5; ++ki) {
+                const float* row = in + (i + ki) * inLength + j;
+                for (int kj = 0; kj < 5; ++kj) {
+                    convResult += row[kj] * weights[ki * 5 + kj];
+                }
+            }
+            float v = out[i * outLength + j] + convResult;
+            out[i * outLength + j] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+template<int InLength, int OutLength, int NumInputs>
+static void conv5x5_relu_pool_scalar(const float* const* in, const float* const* weights, float bias, float* out,
+    int firstRow, int endRow)
+{
+    for (int i = firstRow; i < endRow; ++i) {
+        for (int j = 0; j < OutLength; ++j) {
+            // the 2x2 window of convolution outputs, each summed over all inputs
+            float max = 0.f;
+            for (int d = 0; d < 4; ++d) {
+                int ci = i * 2 + d / 2;
+                int cj = j * 2 + d % 2;
+                float v = bias;
+                for (int k = 0; k < NumInputs; ++k) {
+                    float convResult = 0;
+                    for (int ki = 0; ki < 5; ++ki) {
+                        const float* row = in[k] + (ci + ki) * InLength + cj;
+                        for (int kj = 0; kj < 5; ++kj) {
+                            convResult += row[kj] * weights[k][ki * 5 + kj];
+                        }
+                    }
+                    v = v + convResult;
+                }
+                if (d == 0 || v > max)
+                    max = v;
+            }
+            out[i * OutLength + j] = (max < 0.f) ? 0.f : max;  // relu(max) == max of relu
+        }
+    }
+}
+
+static void relu_scalar(float* data, int n) {
+    for (int i = 0; i < n; ++i) {
+        data[i] = (data[i] < 0.f) ? 0.f : data[i];
+    }
+}
+
+static void max_pool_2x2_scalar(const float* in, float* out, int outLength) {
+
+    int inLength = outLength * 2;
+    for (int i = 0; i < outLength; ++i) {
+        const float* r0 = in + (i * 2) * inLength;
+        const float* r1 = r0 + inLength;
+        for (int j = 0; j < outLength; ++j) {
+            float max = r0[j * 2];
+            if (r0[j * 2 + 1] > max) max = r0[j * 2 + 1];
+            if (r1[j * 2] > max) max = r1[j * 2];
+            if (r1[j * 2 + 1] > max) max = r1[j * 2 + 1];
+            out[i * outLength + j] = max;
+        }
+    }
+}
+
+static float dot_scalar(const float* a, const float* b, int n) {
+    float sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+void pack_gemv_panels(const float* weights, int numRows, int n, float* panels) {
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        float* p = panels + r0 * n;
+        for (int i = 0; i < n; ++i) {
+            for (int r = 0; r < GEMV_PANEL; ++r) {
+                p[i * GEMV_PANEL + r] = (r0 + r < numRows) ? weights[(r0 + r) * n + i] : 0.f;
+            }
+        }
+    }
+}
+
+static void gemv_scalar(const float* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const float* p = panels + r0 * n;
+        float sums[GEMV_PANEL] = { 0 };
+        for (int i = 0; i < n; ++i) {
+            for (int r = 0; r < GEMV_PANEL; ++r) {
+                sums[r] += x[i] * p[i * GEMV_PANEL + r];
+            }
+        }
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+void pack_gemv_panels_half(const float* weights, int numRows, int n, StoragePrecision precision, uint16_t* panels) {
+    memset(panels, 0, gemv_half_panels_size(numRows, n, precision) * sizeof(uint16_t));
+    for (int row = 0; row < numRows; ++row) {
+        for (int i = 0; i < n; ++i) {
+            panels[gemv_half_panel_index(row, i, n, precision)] = float_to_half(weights[row * n + i], precision);
+        }
+    }
+}
+
+static void gemv_fp16_scalar(const uint16_t* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const uint16_t* p = panels + r0 * n;
+        float sums[GEMV_PANEL] = { 0 };
+        for (int i = 0; i < n; ++i) {
+            for (int r = 0; r < GEMV_PANEL; ++r) {
+                sums[r] += x[i] * fp16_to_float(p[i * GEMV_PANEL + r]);
+            }
+        }
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+static void gemv_bf16_scalar(const uint16_t* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+    int n2 = (n + 1) / 2;
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const uint16_t* p = panels + r0 * n2 * 2;
+        float sums[GEMV_PANEL] = { 0 };
+        for (int i = 0; i < n; ++i) {
+            const uint16_t* column = p + (i / 2) * GEMV_PANEL * 2 + (i & 1);
+            for (int r = 0; r < GEMV_PANEL; ++r) {
+                sums[r] += x[i] * bf16_to_float(column[r * 2]);
+            }
+        }
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+static void gemv_block_sparse_scalar(const float* values, const uint16_t* columns, const int* panelStart, const float* x,
+    const float* bias, float* out, int numRows, bool relu) {
+    for (int r0 = 0, p = 0; r0 < numRows; r0 += GEMV_PANEL, ++p) {
+        float sums[GEMV_PANEL] = { 0 };
+        for (int j = panelStart[p]; j < panelStart[p + 1]; ++j) {
+            float xj = x[columns[j]];
+            for (int r = 0; r < GEMV_PANEL; ++r) {
+                sums[r] += xj * values[j * GEMV_PANEL + r];
+            }
+        }
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+static void gemv_csr_scalar(const float* values, const uint16_t* columns, const int* rowStart, const float* x,
+    const float* bias, float* out, int numRows, bool relu) {
+    for (int r = 0; r < numRows; ++r) {
+        // 4 partial sums, so the gathered products do not wait on one another
+        float s0 = 0.f, s1 = 0.f, s2 = 0.f, s3 = 0.f;
+        int j = rowStart[r], end = rowStart[r + 1];
+        for (; j + 4 <= end; j += 4) {
+            s0 += values[j] * x[columns[j]];
+            s1 += values[j + 1] * x[columns[j + 1]];
+            s2 += values[j + 2] * x[columns[j + 2]];
+            s3 += values[j + 3] * x[columns[j + 3]];
+        }
+        for (; j < end; ++j)
+            s0 += values[j] * x[columns[j]];
+        float v = bias[r] + ((s0 + s1) + (s2 + s3));
+        out[r] = (relu && v < 0.f) ? 0.f : v;
+    }
+}
+
+static void dot_u8s8_scalar(const unsigned char* a, const signed char* b, int n, int numRows, int* out) {
+    for (int r = 0; r < numRows; ++r) {
+        const signed char* row = b + r * n;
+        int sum = 0;
+        for (int i = 0; i < n; ++i) {
+            sum += (int)a[i] * (int)row[i];
+        }
+        out[r] = sum;
+    }
+}
+
+static void gemm_u8s8_scalar(const unsigned char* cols, const signed char* weights, int k, int numRows, int numCols, int* out) {
+
+    int stride = (numCols + 15) & ~15;
+    for (int r = 0; r < numRows; ++r) {
+        const signed char* w = weights + r * k;
+        for (int p = 0; p < numCols; ++p) {
+            int sum = 0;
+            for (int i = 0; i < k; ++i) {
+                sum += (int)cols[i * stride + p] * w[i];
+            }
+            out[r * numCols + p] = sum;
+        }
+    }
+}
+
+static void requantize_scalar(const int* acc, int bias, float multiplier, unsigned char* out, int n) {
+    for (int i = 0; i < n; ++i) {
+        float v = (float)(acc[i] + bias) * multiplier;
+        v = (v < 0.f) ? 0.f : ((v > 255.f) ? 255.f : v);
+        out[i] = (unsigned char)lrintf(v);     // nearest even, like the SIMD conversions
+    }
+}
+
+// the products are exact in int64, the sums are taken in uint64 so that they wrap instead of overflowing
+static void dot_i32_scalar(const int32_t* x, const int32_t* w, int n, int numRows, int64_t* out) {
+    for (int r = 0; r < numRows; ++r) {
+        const int32_t* row = w + r * n;
+        uint64_t sum = 0;
+        for (int i = 0; i < n; ++i) {
+            sum += (uint64_t)((int64_t)x[i] * row[i]);
+        }
+        out[r] = (int64_t)sum;
+    }
+}
+
+static void gemm_i32_scalar(const int32_t* cols, const int32_t* weights, int k, int numRows, int numCols, int64_t* out) {
+    for (int r = 0; r < numRows; ++r) {
+        const int32_t* w = weights + r * k;
+        uint64_t* o = (uint64_t*)(out + r * numCols);
+        for (int p = 0; p < numCols; ++p)
+            o[p] = 0;
+        for (int i = 0; i < k; ++i) {
+            const int32_t* c = cols + i * numCols;
+            for (int p = 0; p < numCols; ++p)
+                o[p] += (uint64_t)((int64_t)c[p] * w[i]);
+        }
+    }
+}
+
+// 6 x 8 tiles, the sums in a local array the compiler can keep in registers
+static void sgemm_kernel_scalar(int kc, const float* a, const float* b, float* c, int ldc, bool load_c, bool relu) {
+    const int NR = 8;
+    float acc[GEMM_MR][NR];
+    for (int r = 0; r < GEMM_MR; ++r)
+        for (int j = 0; j < NR; ++j)
+            acc[r][j] = load_c ? c[r * ldc + j] : 0.f;
+    for (int p = 0; p < kc; ++p, a += GEMM_MR, b += NR) {
+        for (int r = 0; r < GEMM_MR; ++r)
+            for (int j = 0; j < NR; ++j)
+                acc[r][j] += a[r] * b[j];
+    }
+    for (int r = 0; r < GEMM_MR; ++r)
+        for (int j = 0; j < NR; ++j)
+            c[r * ldc + j] = (relu && acc[r][j] < 0.f) ? 0.f : acc[r][j];
+}
+
+static void pack_panel_scalar(const float* src, const int* rowOffset, int kc, const PanelRuns& runs, int cols, int nr, float* dst) {
+    for (int p = 0; p < kc; ++p, dst += nr) {
+        const float* row = src + rowOffset[p];
+        for (int r = 0; r < runs.count; ++r)
+            memcpy(dst + runs.column[r], row + runs.offset[r], runs.length[r] * sizeof(float));
+        for (int j = cols; j < nr; ++j)
+            dst[j] = 0.f;
+    }
+}
+
+void get_scalar_kernels(SimdKernels& kernels) {
+    kernels.level = SIMD_SCALAR;
+    kernels.conv5x5 = conv5x5_scalar;
+    SIMD_CONV_RELU_POOL_KERNELS(kernels, conv5x5_relu_pool_scalar);
+    kernels.relu = relu_scalar;
+    kernels.max_pool_2x2 = max_pool_2x2_scalar;
+    kernels.dot = dot_scalar;
+    kernels.gemv = gemv_scalar;
+    kernels.gemv_fp16 = gemv_fp16_scalar;
+    kernels.gemv_bf16 = gemv_bf16_scalar;
+    kernels.gemv_bf16_pairs = nullptr;
+    kernels.gemv_block_sparse = gemv_block_sparse_scalar;
+    kernels.gemv_csr = gemv_csr_scalar;
+    kernels.dot_u8s8 = dot_u8s8_scalar;
+    kernels.gemm_u8s8 = gemm_u8s8_scalar;
+    kernels.requantize = requantize_scalar;
+    kernels.dot_i32 = dot_i32_scalar;
+    kernels.gemm_i32 = gemm_i32_scalar;
+    kernels.sgemm_kernel = sgemm_kernel_scalar;
+    kernels.sgemm_nr = 8;
+    kernels.pack_panel = pack_panel_scalar;
+}
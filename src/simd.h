@@ -0,0 +1,209 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lenet5_dims.h"
+#include "half_precision.h"
+
+// x86 builds get the SSE4.2 / AVX2 / AVX-512 kernels, everything else only the scalar ones
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define LENET5_X86
+#endif
+
+// lets a single function use instructions beyond the compiler's baseline
+// (MSVC accepts every intrinsic without flags, GCC/Clang need a per-function target)
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_SSE42,
+    SIMD_AVX2,      // AVX2 + FMA + F16C
+    SIMD_AVX512,    // AVX-512F
+    SIMD_AVX512_VNNI,   // AVX-512F + BW + VL + VNNI (int8 dot products)
+    SIMD_AVX512_BF16    // + AVX512_BF16 (bf16 dot products)
+};
+
+// out[i][j] += sum of the 5x5 window of in at (i, j) times weights, for an outLength x outLength output
+// the window sum starts from 0 and is added to out afterwards, so calling it once per input map
+// after filling out with the bias matches bias + conv_0 + conv_1 + ...
+// relu: clamp the result at 0 (for the last input map of an output map)
+typedef void (*Conv5x5Fn)(const float* in, int inLength, const float* weights, float* out, int outLength, bool relu);
+// fused convolution + ReLU + 2x2 max pooling of one output map over its input maps:
+// out = max_pool_2x2(relu(bias + conv5x5(in[0], weights[0]) + conv5x5(in[1], weights[1]) + ...))
+// Each entry is instantiated for one layer shape (input length, output length, number of input maps),
+// so the (outLength * 2) x (outLength * 2) map before pooling is never stored and every loop bound is a constant.
+// Every pre-pool value is summed exactly like filling with bias and calling conv5x5 once per input,
+// so the result equals conv5x5 followed by max_pool_2x2
+typedef void (*ConvReluPoolFn)(const float* const* in, const float* const* weights, float bias, float* out);
+// the same for the output rows [firstRow, endRow) only, the other rows of out are left untouched; every output
+// is computed exactly as by the whole-map entry, so a map can be updated a few rows at a time
+typedef void (*ConvReluPoolRowsFn)(const float* const* in, const float* const* weights, float bias, float* out,
+    int firstRow, int endRow);
+// data[i] = max(data[i], 0)
+typedef void (*ReluFn)(float* data, int n);
+// 2x2 max pooling with stride 2 of an (outLength * 2) x (outLength * 2) map
+typedef void (*MaxPoolFn)(const float* in, float* out, int outLength);
+// sum of a[i] * b[i]
+typedef float (*DotFn)(const float* a, const float* b, int n);
+// out[r] = bias[r] + sum of x[i] * W[r][i] for the numRows x n matrix W packed by pack_gemv_panels
+// relu: clamp the results at 0
+typedef void (*GemvFn)(const float* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu);
+// the same with fp16 or bf16 weights packed by pack_gemv_panels_half, converted to float and accumulated in fp32
+typedef void (*GemvHalfFn)(const uint16_t* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu);
+// the same with bf16 weights and bf16 x, packed in pairs: x2[i] = bf16 x[2i] | bf16 x[2i + 1] << 16 ((n + 1) / 2 pairs)
+typedef void (*GemvBf16PairsFn)(const uint16_t* panels, const uint32_t* x2, int n, const float* bias, float* out, int numRows, bool relu);
+// block-sparse GEMV: panel p keeps the columns columns[panelStart[p] .. panelStart[p + 1]) of its GEMV_PANEL rows,
+// values[j * GEMV_PANEL + r] being the weight of row p * GEMV_PANEL + r for kept column j (see BlockSparsePanels)
+// out[row] = bias[row] + sum over the kept columns of x[column] * weight, clamped at 0 if relu
+typedef void (*GemvBlockSparseFn)(const float* values, const uint16_t* columns, const int* panelStart, const float* x,
+    const float* bias, float* out, int numRows, bool relu);
+// CSR GEMV: out[r] = bias[r] + sum of values[j] * x[columns[j]] for j in [rowStart[r], rowStart[r + 1]),
+// clamped at 0 if relu (see CsrMatrix)
+typedef void (*GemvCsrFn)(const float* values, const uint16_t* columns, const int* rowStart, const float* x,
+    const float* bias, float* out, int numRows, bool relu);
+// out[r] = sum of a[i] * b[r * n + i] for numRows rows of int8 weights, accumulated exactly in int32
+// n must be a multiple of 32 (pad both operands with zeros)
+typedef void (*DotU8S8Fn)(const unsigned char* a, const signed char* b, int n, int numRows, int* out);
+// out[r * numCols + p] = sum of cols[i * stride + p] * weights[r * k + i] for numRows rows and numCols columns (e.g. image patches)
+// stride = numCols rounded up to a multiple of 16 (the padding columns are read but not stored), k must be a multiple of 4
+typedef void (*GemmU8S8Fn)(const unsigned char* cols, const signed char* weights, int k, int numRows, int numCols, int* out);
+// out[i] = (acc[i] + bias) * multiplier, clamped to [0, 255] and rounded to nearest even (requantize + ReLU)
+typedef void (*RequantizeFn)(const int* acc, int bias, float multiplier, unsigned char* out, int n);
+// fixed-point words of up to 32 bits (see lenet5_fixed.h): out[r] = sum of x[i] * w[r * n + i] for numRows rows,
+// every product exact in 64 bits and the sums wrapping modulo 2^64, so any summation order gives the same bits
+typedef void (*DotI32Fn)(const int32_t* x, const int32_t* w, int n, int numRows, int64_t* out);
+// out[r * numCols + p] = sum of cols[i * numCols + p] * weights[r * k + i] for numRows rows, exact like DotI32Fn
+typedef void (*GemmI32Fn)(const int32_t* cols, const int32_t* weights, int k, int numRows, int numCols, int64_t* out);
+
+// sgemm micro-kernel (see gemm.cpp): the GEMM_MR x nr tile c (row stride ldc) = A * B over kc steps, nr being
+// SimdKernels::sgemm_nr, with A and B packed in panels a[p * GEMM_MR + r] = A[r][p] and b[p * nr + j] = B[p][j]
+// load_c: add the products onto c instead of overwriting it; relu: clamp the sums at 0 as they are stored
+typedef void (*SgemmKernelFn)(int kc, const float* a, const float* b, float* c, int ldc, bool load_c, bool relu);
+
+// rows of the sgemm tiles: C1 has 6 maps and C5 (120) and F6 (84) are multiples of 6, and 6 rows of 2 vectors
+// of sums leave registers for the row of B and the broadcast element of A
+#define GEMM_MR 6
+#define GEMM_NR_MAX 32  // columns of the widest tiles (AVX-512: 2 vectors of 16)
+// the columns of an sgemm panel of B as runs of consecutive floats in memory (see sgemm_conv):
+// the length[r] columns from column[r] on are the floats from offset[r] on
+struct PanelRuns {
+    int count;
+    int offset[GEMM_NR_MAX];
+    int column[GEMM_NR_MAX];
+    int length[GEMM_NR_MAX];
+};
+// packs kc rows of an sgemm panel of B: dst[p * nr + runs.column[r] + q] = src[rowOffset[p] + runs.offset[r] + q],
+// the columns from cols to nr zeroed
+typedef void (*PackPanelFn)(const float* src, const int* rowOffset, int kc, const PanelRuns& runs, int cols, int nr, float* dst);
+
+// GEMV weights are packed in panels of GEMV_PANEL rows, interleaved column by column:
+// panels[(p * n + i) * GEMV_PANEL + r] = W[p * GEMV_PANEL + r][i], with zero padding rows in the last panel,
+// so one pass over x updates a whole panel of outputs and the weights are read strictly sequentially
+#define GEMV_PANEL 16   // one AVX-512 register, two AVX2 or four SSE registers of outputs
+
+// number of panels of a matrix with numRows rows
+inline int gemv_num_panels(int numRows) {
+    return (numRows + GEMV_PANEL - 1) / GEMV_PANEL;
+}
+// packs the row-major numRows x n matrix weights into panels (gemv_num_panels(numRows) * n * GEMV_PANEL floats)
+void pack_gemv_panels(const float* weights, int numRows, int n, float* panels);
+
+// fp16 panels have the layout of the float ones. bf16 panels interleave pairs of consecutive columns,
+// so that one 32-bit lane holds the two weights a bf16 dot product instruction multiplies with x[i], x[i + 1]:
+// panels[((p * n2 + i / 2) * GEMV_PANEL + r) * 2 + i % 2] = W[p * GEMV_PANEL + r][i], n2 = (n + 1) / 2,
+// with a zero column after an odd n
+inline size_t gemv_half_panels_size(int numRows, int n, StoragePrecision precision) {
+    int columns = (precision == PRECISION_BF16) ? (n + 1) / 2 * 2 : n;
+    return (size_t)gemv_num_panels(numRows) * columns * GEMV_PANEL;
+}
+// index of W[row][i] in half panels
+inline size_t gemv_half_panel_index(int row, int i, int n, StoragePrecision precision) {
+    int p = row / GEMV_PANEL, r = row % GEMV_PANEL;
+    if (precision == PRECISION_BF16)
+        return (((size_t)p * ((n + 1) / 2) + i / 2) * GEMV_PANEL + r) * 2 + (i & 1);
+    return ((size_t)p * n + i) * GEMV_PANEL + r;
+}
+// packs the row-major numRows x n matrix weights into fp16 or bf16 panels (gemv_half_panels_size halves)
+void pack_gemv_panels_half(const float* weights, int numRows, int n, StoragePrecision precision, uint16_t* panels);
+
+struct SimdKernels {
+    SimdLevel level;
+    Conv5x5Fn conv5x5;
+    ConvReluPoolFn conv_relu_pool_c1;     // 32x32 input image -> 14x14 S2 map
+    ConvReluPoolFn conv_relu_pool_c3[Lenet5Dims::C1_MAPS + 1];    // [no. of S2 inputs] 14x14 maps -> 5x5 S4 map
+    ConvReluPoolRowsFn conv_relu_pool_rows_c1;
+    ConvReluPoolRowsFn conv_relu_pool_rows_c3[Lenet5Dims::C1_MAPS + 1];
+    ReluFn relu;
+    MaxPoolFn max_pool_2x2;
+    DotFn dot;
+    GemvFn gemv;
+    GemvHalfFn gemv_fp16;
+    GemvHalfFn gemv_bf16;
+    GemvBf16PairsFn gemv_bf16_pairs;    // nullptr below SIMD_AVX512_BF16
+    GemvBlockSparseFn gemv_block_sparse;
+    GemvCsrFn gemv_csr;
+    DotU8S8Fn dot_u8s8;
+    GemmU8S8Fn gemm_u8s8;
+    RequantizeFn requantize;
+    DotI32Fn dot_i32;
+    GemmI32Fn gemm_i32;
+    SgemmKernelFn sgemm_kernel;
+    int sgemm_nr;       // columns of the sgemm_kernel tiles
+    PackPanelFn pack_panel;
+};
+
+// whole-map entry of a fused kernel computing a range of rows
+template<int OutLength, ConvReluPoolRowsFn Rows>
+static void conv_relu_pool_all_rows(const float* const* in, const float* const* weights, float bias, float* out) {
+    Rows(in, weights, bias, out, 0, OutLength);
+}
+
+// instantiates a level's fused kernel template<int InLength, int OutLength, int NumInputs>(..., firstRow, endRow)
+// for C1 -> S2 and for every possible number of S2 inputs of a C3 map, as the row-range and the whole-map entries
+#define SIMD_CONV_RELU_POOL_KERNELS(kernels, fn) \
+    do { \
+        (kernels).conv_relu_pool_rows_c1 = fn<Lenet5Dims::IN_LEN, Lenet5Dims::S2_LEN, 1>; \
+        (kernels).conv_relu_pool_rows_c3[0] = nullptr; \
+        (kernels).conv_relu_pool_rows_c3[1] = fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 1>; \
+        (kernels).conv_relu_pool_rows_c3[2] = fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 2>; \
+        (kernels).conv_relu_pool_rows_c3[3] = fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 3>; \
+        (kernels).conv_relu_pool_rows_c3[4] = fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 4>; \
+        (kernels).conv_relu_pool_rows_c3[5] = fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 5>; \
+        (kernels).conv_relu_pool_rows_c3[6] = fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 6>; \
+        (kernels).conv_relu_pool_c1 = conv_relu_pool_all_rows<Lenet5Dims::S2_LEN, fn<Lenet5Dims::IN_LEN, Lenet5Dims::S2_LEN, 1>>; \
+        (kernels).conv_relu_pool_c3[0] = nullptr; \
+        (kernels).conv_relu_pool_c3[1] = conv_relu_pool_all_rows<Lenet5Dims::S4_LEN, fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 1>>; \
+        (kernels).conv_relu_pool_c3[2] = conv_relu_pool_all_rows<Lenet5Dims::S4_LEN, fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 2>>; \
+        (kernels).conv_relu_pool_c3[3] = conv_relu_pool_all_rows<Lenet5Dims::S4_LEN, fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 3>>; \
+        (kernels).conv_relu_pool_c3[4] = conv_relu_pool_all_rows<Lenet5Dims::S4_LEN, fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 4>>; \
+        (kernels).conv_relu_pool_c3[5] = conv_relu_pool_all_rows<Lenet5Dims::S4_LEN, fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 5>>; \
+        (kernels).conv_relu_pool_c3[6] = conv_relu_pool_all_rows<Lenet5Dims::S4_LEN, fn<Lenet5Dims::S2_LEN, Lenet5Dims::S4_LEN, 6>>; \
+    } while (0)
+static_assert(Lenet5Dims::C1_MAPS == 6, "SIMD_CONV_RELU_POOL_KERNELS instantiates 1 to 6 C3 inputs");
+
+// best level supported by the CPU and OS
+SimdLevel detect_simd_level();
+const char* simd_level_name(SimdLevel level);
+
+// kernels for the given level (falls back to lower levels if not compiled in)
+const SimdKernels& simd_kernels(SimdLevel level);
+// kernels selected once at startup: the detected level, unless lowered by
+// the LENET5_SIMD environment variable (scalar, sse4.2, avx2, avx512, avx512vnni, avx512bf16)
+const SimdKernels& simd_kernels();
+
+// per-level implementations
+void get_scalar_kernels(SimdKernels& kernels);
+#ifdef LENET5_X86
+void get_sse42_kernels(SimdKernels& kernels);
+void get_avx2_kernels(SimdKernels& kernels);
+void get_avx512_kernels(SimdKernels& kernels);
+void get_avx512_vnni_kernels(SimdKernels& kernels);
+void get_avx512_bf16_kernels(SimdKernels& kernels);
+#endif
+
+#endif
@@ -0,0 +1,1639 @@
+#include "simd.h"
+
+#ifdef LENET5_X86
+#include <string.h>
+#include <immintrin.h>
+
+// SSE4.2 / AVX2 / AVX-512 kernels.
+// The 5x5 convolution is vectorized across output columns: each vector holds
+// neighbouring outputs of one row, and every weight is broadcast and multiplied
+// against an (unaligned) load of the input row shifted by the kernel column.
+// The 5 kernel rows use separate accumulators so the adds are not one long dependency chain.
+//
+// The uint8 x int8 dot products widen both operands to int16 and use pmaddwd below VNNI:
+// pmaddubsw would be one instruction less, but it saturates the sum of two products at int16,
+// which full-range activations (255 * 127 * 2) exceed. VNNI's vpdpbusd accumulates the
+// products straight into int32, so every level gives exactly the same sums.
+// The int8 GEMMs put one column (image patch) in each int32 lane, so no horizontal sums are needed:
+// the bytes of 2 (pmaddwd) or 4 (vpdpbusd) consecutive cols rows are interleaved per column and
+// multiplied against the broadcast weights of those rows. Blocks of rows share every load of cols;
+// the last block repeats the last row instead of branching on the row count.
+
+// 4 int8 weights as one int32, for broadcasting
+static inline int load_weights4(const signed char* w) {
+    int v;
+    memcpy(&v, w, 4);
+    return v;
+}
+
+#define GEMM_U8S8_KC 128    // k block of the pmaddwd GEMMs, whose broadcast weights are prepared once per block
+
+// row r0 + j of a block, past the last row repeat the last row
+static inline int block_row(int r0, int j, int numRows) {
+    return (r0 + j < numRows) ? r0 + j : numRows - 1;
+}
+
+
+// ---------------------------------------------------------------- SSE4.2
+
+SIMD_TARGET("sse4.2")
+static inline __m128 conv5x5_sse42_vec(const float* in, int inLength, const float* weights) {
+
+    __m128 acc[5];
+    for (int ki = 0; ki < 5; ++ki) {
+        const float* row = in + ki * inLength;
+        const float* w = weights + ki * 5;
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(row), _mm_set1_ps(w[0]));
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(row + 1), _mm_set1_ps(w[1])));
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(row + 2), _mm_set1_ps(w[2])));
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(row + 3), _mm_set1_ps(w[3])));
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(row + 4), _mm_set1_ps(w[4])));
+        acc[ki] = a;
+    }
+    __m128 sum = _mm_add_ps(_mm_add_ps(acc[0], acc[1]), _mm_add_ps(acc[2], acc[3]));
+    return _mm_add_ps(sum, acc[4]);
+}
+
+// window sum of one output, for the columns left over after the 4-wide vectors
+static inline float conv5x5_sse42_tail(const float* in, int inLength, const float* weights) {
+    float convResult = 0;
+    for (int ki = 0; ki < 5; ++ki)
+        for (int kj = 0; kj < 5; ++kj)
+            convResult += in[ki * inLength + kj] * weights[ki * 5 + kj];
+    return convResult;
+}
+
+SIMD_TARGET("sse4.2")
+static void conv5x5_sse42(const float* in, int inLength, const float* weights, float* out, int outLength, bool relu) {
+
+    const __m128 zero = _mm_setzero_ps();
+    for (int i = 0; i < outLength; ++i) {
+        const float* row = in + i * inLength;
+        float* o = out + i * outLength;
+        int j = 0;
+        for (; j + 4 <= outLength; j += 4) {
+            __m128 v = _mm_add_ps(_mm_loadu_ps(o + j), conv5x5_sse42_vec(row + j, inLength, weights));
+            if (relu)
+                v = _mm_max_ps(v, zero);
+            _mm_storeu_ps(o + j, v);
+        }
+        // remaining columns
+        for (; j < outLength; ++j) {
+            float v = o[j] + conv5x5_sse42_tail(row + j, inLength, weights);
+            o[j] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+template<int InLength, int OutLength, int NumInputs>
+SIMD_TARGET("sse4.2")
+static void conv5x5_relu_pool_sse42(const float* const* in, const float* const* weights, float bias, float* out,
+    int firstRow, int endRow)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 b = _mm_set1_ps(bias);
+    const int convLength = OutLength * 2;
+    for (int i = firstRow; i < endRow; ++i) {
+        int r0 = (i * 2) * InLength;    // first input row of the two convolution rows
+        int r1 = r0 + InLength;
+        float* o = out + i * OutLength;
+        int j = 0;
+        // 8 convolution columns -> 4 outputs
+        for (; j * 2 + 8 <= convLength; j += 4) {
+            __m128 a0 = b, a1 = b, c0 = b, c1 = b;
+            for (int k = 0; k < NumInputs; ++k) {
+                a0 = _mm_add_ps(a0, conv5x5_sse42_vec(in[k] + r0 + j * 2, InLength, weights[k]));
+                a1 = _mm_add_ps(a1, conv5x5_sse42_vec(in[k] + r0 + j * 2 + 4, InLength, weights[k]));
+                c0 = _mm_add_ps(c0, conv5x5_sse42_vec(in[k] + r1 + j * 2, InLength, weights[k]));
+                c1 = _mm_add_ps(c1, conv5x5_sse42_vec(in[k] + r1 + j * 2 + 4, InLength, weights[k]));
+            }
+            __m128 lo = _mm_max_ps(a0, c0);
+            __m128 hi = _mm_max_ps(a1, c1);
+            __m128 max = _mm_max_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm_storeu_ps(o + j, _mm_max_ps(max, zero));
+        }
+        // 4 convolution columns -> 2 outputs
+        if (j * 2 + 4 <= convLength) {
+            __m128 a0 = b, c0 = b;
+            for (int k = 0; k < NumInputs; ++k) {
+                a0 = _mm_add_ps(a0, conv5x5_sse42_vec(in[k] + r0 + j * 2, InLength, weights[k]));
+                c0 = _mm_add_ps(c0, conv5x5_sse42_vec(in[k] + r1 + j * 2, InLength, weights[k]));
+            }
+            __m128 v = _mm_max_ps(a0, c0);
+            __m128 max = _mm_max_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm_storel_pi((__m64*)(o + j), _mm_max_ps(max, zero));
+            j += 2;
+        }
+        // remaining columns, summed like the scalar tail of conv5x5_sse42
+        for (; j < OutLength; ++j) {
+            float max = 0.f;
+            for (int d = 0; d < 4; ++d) {
+                int offset = ((d < 2) ? r0 : r1) + j * 2 + d % 2;
+                float v = bias;
+                for (int k = 0; k < NumInputs; ++k)
+                    v = v + conv5x5_sse42_tail(in[k] + offset, InLength, weights[k]);
+                if (d == 0 || v > max)
+                    max = v;
+            }
+            o[j] = (max < 0.f) ? 0.f : max;
+        }
+    }
+}
+
+SIMD_TARGET("sse4.2")
+static void relu_sse42(float* data, int n) {
+
+    const __m128 zero = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(data + i, _mm_max_ps(_mm_loadu_ps(data + i), zero));
+    for (; i < n; ++i)
+        data[i] = (data[i] < 0.f) ? 0.f : data[i];
+}
+
+SIMD_TARGET("sse4.2")
+static void max_pool_2x2_sse42(const float* in, float* out, int outLength) {
+
+    int inLength = outLength * 2;
+    for (int i = 0; i < outLength; ++i) {
+        const float* r0 = in + (i * 2) * inLength;
+        const float* r1 = r0 + inLength;
+        float* o = out + i * outLength;
+        int j = 0;
+        for (; j + 4 <= outLength; j += 4) {
+            // vertical max of 8 input columns, then max of the even and odd columns
+            __m128 lo = _mm_max_ps(_mm_loadu_ps(r0 + j * 2), _mm_loadu_ps(r1 + j * 2));
+            __m128 hi = _mm_max_ps(_mm_loadu_ps(r0 + j * 2 + 4), _mm_loadu_ps(r1 + j * 2 + 4));
+            __m128 even = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 odd = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_storeu_ps(o + j, _mm_max_ps(even, odd));
+        }
+        for (; j < outLength; ++j) {
+            float a = (r0[j * 2] > r0[j * 2 + 1]) ? r0[j * 2] : r0[j * 2 + 1];
+            float b = (r1[j * 2] > r1[j * 2 + 1]) ? r1[j * 2] : r1[j * 2 + 1];
+            o[j] = (a > b) ? a : b;
+        }
+    }
+}
+
+SIMD_TARGET("sse4.2")
+static float dot_sse42(const float* a, const float* b, int n) {
+
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    __m128 acc = _mm_add_ps(acc0, acc1);
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    float sum = _mm_cvtss_f32(acc);
+    for (; i < n; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+// one panel per pass: 4 registers of outputs, each fed by a broadcast of x[i]
+SIMD_TARGET("sse4.2")
+static void gemv_sse42(const float* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const float* p = panels + r0 * n;
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+        for (int i = 0; i < n; ++i, p += GEMV_PANEL) {
+            __m128 xi = _mm_set1_ps(x[i]);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(p), xi));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(p + 4), xi));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(p + 8), xi));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(p + 12), xi));
+        }
+        float sums[GEMV_PANEL];
+        _mm_storeu_ps(sums, acc0);
+        _mm_storeu_ps(sums + 4, acc1);
+        _mm_storeu_ps(sums + 8, acc2);
+        _mm_storeu_ps(sums + 12, acc3);
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+// bf16 panels: every 32-bit lane holds a row's weights for x[i] (low half) and x[i + 1] (high half),
+// which become floats with a shift and a mask
+SIMD_TARGET("sse4.2")
+static void gemv_bf16_sse42(const uint16_t* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+
+    int n2 = (n + 1) / 2;
+    const __m128i high = _mm_set1_epi32((int)0xffff0000);
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const uint16_t* p = panels + r0 * n2 * 2;
+        __m128 acc[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        for (int j = 0; j < n2; ++j, p += GEMV_PANEL * 2) {
+            __m128 x0 = _mm_set1_ps(x[j * 2]);
+            __m128 x1 = _mm_set1_ps(j * 2 + 1 < n ? x[j * 2 + 1] : 0.f);
+            for (int k = 0; k < 4; ++k) {
+                __m128i w = _mm_loadu_si128((const __m128i*)(p + k * 8));
+                acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(w, 16)), x0));
+                acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(_mm_castsi128_ps(_mm_and_si128(w, high)), x1));
+            }
+        }
+        float sums[GEMV_PANEL];
+        for (int k = 0; k < 4; ++k)
+            _mm_storeu_ps(sums + k * 4, acc[k]);
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+// block-sparse panels: the dense panel loop over the kept columns, with x gathered by column
+SIMD_TARGET("sse4.2")
+static void gemv_block_sparse_sse42(const float* values, const uint16_t* columns, const int* panelStart, const float* x,
+    const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r0 = 0, b = 0; r0 < numRows; r0 += GEMV_PANEL, ++b) {
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+        for (int j = panelStart[b]; j < panelStart[b + 1]; ++j) {
+            const float* p = values + j * GEMV_PANEL;
+            __m128 xj = _mm_set1_ps(x[columns[j]]);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(p), xj));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(p + 4), xj));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(p + 8), xj));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(p + 12), xj));
+        }
+        float sums[GEMV_PANEL];
+        _mm_storeu_ps(sums, acc0);
+        _mm_storeu_ps(sums + 4, acc1);
+        _mm_storeu_ps(sums + 8, acc2);
+        _mm_storeu_ps(sums + 12, acc3);
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+SIMD_TARGET("sse4.2")
+static void dot_u8s8_sse42(const unsigned char* a, const signed char* b, int n, int numRows, int* out) {
+
+    for (int r = 0; r < numRows; ++r) {
+        const signed char* row = b + r * n;
+        __m128i acc0 = _mm_setzero_si128();
+        __m128i acc1 = _mm_setzero_si128();
+        for (int i = 0; i < n; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(row + i));
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_cvtepu8_epi16(va), _mm_cvtepi8_epi16(vb)));
+            acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(va, 8)), _mm_cvtepi8_epi16(_mm_srli_si128(vb, 8))));
+        }
+        __m128i acc = _mm_add_epi32(acc0, acc1);
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        out[r] = _mm_cvtsi128_si32(acc);
+    }
+}
+
+SIMD_TARGET("sse4.2")
+static void gemm_u8s8_sse42(const unsigned char* cols, const signed char* weights, int k, int numRows, int numCols, int* out) {
+
+    int stride = (numCols + 15) & ~15;
+    __m128i wv[GEMM_U8S8_KC / 4 * 8];   // int16 weight pairs (i, i + 1) and (i + 2, i + 3) of the 4 rows, broadcast
+    for (int r0 = 0; r0 < numRows; r0 += 4) {
+        int* o[4];
+        for (int j = 0; j < 4; ++j)
+            o[j] = out + block_row(r0, j, numRows) * numCols;
+
+        for (int k0 = 0; k0 < k; k0 += GEMM_U8S8_KC) {
+            int kc = (k - k0 < GEMM_U8S8_KC) ? k - k0 : GEMM_U8S8_KC;
+            for (int i = 0; i < kc; i += 4) {
+                for (int j = 0; j < 4; ++j) {
+                    __m128i w16 = _mm_cvtepi8_epi16(_mm_cvtsi32_si128(load_weights4(weights + block_row(r0, j, numRows) * k + k0 + i)));
+                    wv[(i / 4) * 8 + j * 2] = _mm_shuffle_epi32(w16, 0x00);
+                    wv[(i / 4) * 8 + j * 2 + 1] = _mm_shuffle_epi32(w16, 0x55);
+                }
+            }
+
+            for (int p = 0; p < numCols; p += 4) {
+                int count = (numCols - p < 4) ? numCols - p : 4;
+                __m128i acc0, acc1, acc2, acc3;
+                if (k0 == 0) {
+                    acc0 = acc1 = acc2 = acc3 = _mm_setzero_si128();
+                }
+                else {
+                    int tmp[4][4] = {};
+                    for (int j = 0; j < 4; ++j)
+                        memcpy(tmp[j], o[j] + p, count * sizeof(int));
+                    acc0 = _mm_loadu_si128((const __m128i*)tmp[0]);
+                    acc1 = _mm_loadu_si128((const __m128i*)tmp[1]);
+                    acc2 = _mm_loadu_si128((const __m128i*)tmp[2]);
+                    acc3 = _mm_loadu_si128((const __m128i*)tmp[3]);
+                }
+
+                for (int i = 0; i < kc; i += 4) {
+                    // 4 columns of rows i, i + 1 and i + 2, i + 3 as interleaved int16 pairs
+                    const unsigned char* c = cols + (k0 + i) * stride + p;
+                    int c0, c1, c2, c3;
+                    memcpy(&c0, c, 4); memcpy(&c1, c + stride, 4); memcpy(&c2, c + 2 * stride, 4); memcpy(&c3, c + 3 * stride, 4);
+                    __m128i v01 = _mm_cvtepu8_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(c0), _mm_cvtsi32_si128(c1)));
+                    __m128i v23 = _mm_cvtepu8_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(c2), _mm_cvtsi32_si128(c3)));
+                    const __m128i* wp = wv + (i / 4) * 8;
+                    acc0 = _mm_add_epi32(acc0, _mm_add_epi32(_mm_madd_epi16(v01, wp[0]), _mm_madd_epi16(v23, wp[1])));
+                    acc1 = _mm_add_epi32(acc1, _mm_add_epi32(_mm_madd_epi16(v01, wp[2]), _mm_madd_epi16(v23, wp[3])));
+                    acc2 = _mm_add_epi32(acc2, _mm_add_epi32(_mm_madd_epi16(v01, wp[4]), _mm_madd_epi16(v23, wp[5])));
+                    acc3 = _mm_add_epi32(acc3, _mm_add_epi32(_mm_madd_epi16(v01, wp[6]), _mm_madd_epi16(v23, wp[7])));
+                }
+
+                __m128i acc[4] = { acc0, acc1, acc2, acc3 };
+                for (int j = 0; j < 4 && r0 + j < numRows; ++j) {
+                    int tmp[4];
+                    _mm_storeu_si128((__m128i*)tmp, acc[j]);
+                    memcpy(o[j] + p, tmp, count * sizeof(int));
+                }
+            }
+        }
+    }
+}
+
+SIMD_TARGET("sse4.2")
+static void requantize_sse42(const int* acc, int bias, float multiplier, unsigned char* out, int n) {
+
+    const __m128i b = _mm_set1_epi32(bias);
+    const __m128 m = _mm_set1_ps(multiplier);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max = _mm_set1_ps(255.f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 v0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(acc + i)), b)), m);
+        __m128 v1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(acc + i + 4)), b)), m);
+        __m128i q0 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v0, zero), max));
+        __m128i q1 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v1, zero), max));
+        _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(q0, q1), _mm_setzero_si128()));
+    }
+    for (; i < n; ++i) {
+        __m128 v = _mm_mul_ss(_mm_cvtsi32_ss(zero, acc[i] + bias), m);
+        out[i] = (unsigned char)_mm_cvtss_si32(_mm_min_ss(_mm_max_ss(v, zero), max));
+    }
+}
+
+// _mm_mul_epi32 multiplies the sign-extended low 32 bits of each 64-bit lane into the exact 64-bit product
+SIMD_TARGET("sse4.2")
+static void dot_i32_sse42(const int32_t* x, const int32_t* w, int n, int numRows, int64_t* out) {
+
+    for (int r = 0; r < numRows; ++r) {
+        const int32_t* row = w + r * n;
+        __m128i acc0 = _mm_setzero_si128();
+        __m128i acc1 = _mm_setzero_si128();
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc0 = _mm_add_epi64(acc0, _mm_mul_epi32(_mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)(x + i))),
+                _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)(row + i)))));
+            acc1 = _mm_add_epi64(acc1, _mm_mul_epi32(_mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)(x + i + 2))),
+                _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)(row + i + 2)))));
+        }
+        __m128i acc = _mm_add_epi64(acc0, acc1);
+        uint64_t sum = (uint64_t)_mm_cvtsi128_si64(acc) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+        for (; i < n; ++i)
+            sum += (uint64_t)((int64_t)x[i] * row[i]);
+        out[r] = (int64_t)sum;
+    }
+}
+
+SIMD_TARGET("sse4.2")
+static void gemm_i32_sse42(const int32_t* cols, const int32_t* weights, int k, int numRows, int numCols, int64_t* out) {
+
+    for (int r = 0; r < numRows; ++r) {
+        const int32_t* w = weights + r * k;
+        int64_t* o = out + r * numCols;
+        int p = 0;
+        for (; p + 8 <= numCols; p += 8) {
+            __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+            __m128i acc2 = _mm_setzero_si128(), acc3 = _mm_setzero_si128();
+            for (int i = 0; i < k; ++i) {
+                const int32_t* c = cols + i * numCols + p;
+                __m128i wv = _mm_set1_epi64x(w[i]);
+                acc0 = _mm_add_epi64(acc0, _mm_mul_epi32(_mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)c)), wv));
+                acc1 = _mm_add_epi64(acc1, _mm_mul_epi32(_mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)(c + 2))), wv));
+                acc2 = _mm_add_epi64(acc2, _mm_mul_epi32(_mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)(c + 4))), wv));
+                acc3 = _mm_add_epi64(acc3, _mm_mul_epi32(_mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)(c + 6))), wv));
+            }
+            _mm_storeu_si128((__m128i*)(o + p), acc0);
+            _mm_storeu_si128((__m128i*)(o + p + 2), acc1);
+            _mm_storeu_si128((__m128i*)(o + p + 4), acc2);
+            _mm_storeu_si128((__m128i*)(o + p + 6), acc3);
+        }
+        for (; p < numCols; ++p) {
+            uint64_t sum = 0;
+            for (int i = 0; i < k; ++i)
+                sum += (uint64_t)((int64_t)cols[i * numCols + p] * w[i]);
+            o[p] = (int64_t)sum;
+        }
+    }
+}
+
+// 6 x 8 tiles: 6 rows of 2 vectors of sums, each step broadcasts one element of A per row
+SIMD_TARGET("sse4.2")
+static void sgemm_kernel_sse42(int kc, const float* a, const float* b, float* c, int ldc, bool load_c, bool relu) {
+
+    // one named accumulator per vector of the tile, so that they stay in registers
+    __m128 c00, c01, c10, c11, c20, c21, c30, c31, c40, c41, c50, c51;
+    if (load_c) {
+        c00 = _mm_loadu_ps(c); c01 = _mm_loadu_ps(c + 4);
+        c10 = _mm_loadu_ps(c + ldc); c11 = _mm_loadu_ps(c + ldc + 4);
+        c20 = _mm_loadu_ps(c + 2 * ldc); c21 = _mm_loadu_ps(c + 2 * ldc + 4);
+        c30 = _mm_loadu_ps(c + 3 * ldc); c31 = _mm_loadu_ps(c + 3 * ldc + 4);
+        c40 = _mm_loadu_ps(c + 4 * ldc); c41 = _mm_loadu_ps(c + 4 * ldc + 4);
+        c50 = _mm_loadu_ps(c + 5 * ldc); c51 = _mm_loadu_ps(c + 5 * ldc + 4);
+    }
+    else {
+        c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = c40 = c41 = c50 = c51 = _mm_setzero_ps();
+    }
+    for (int p = 0; p < kc; ++p, a += GEMM_MR, b += 8) {
+        __m128 b0 = _mm_loadu_ps(b), b1 = _mm_loadu_ps(b + 4), ar;
+        ar = _mm_load1_ps(a); c00 = _mm_add_ps(c00, _mm_mul_ps(ar, b0)); c01 = _mm_add_ps(c01, _mm_mul_ps(ar, b1));
+        ar = _mm_load1_ps(a + 1); c10 = _mm_add_ps(c10, _mm_mul_ps(ar, b0)); c11 = _mm_add_ps(c11, _mm_mul_ps(ar, b1));
+        ar = _mm_load1_ps(a + 2); c20 = _mm_add_ps(c20, _mm_mul_ps(ar, b0)); c21 = _mm_add_ps(c21, _mm_mul_ps(ar, b1));
+        ar = _mm_load1_ps(a + 3); c30 = _mm_add_ps(c30, _mm_mul_ps(ar, b0)); c31 = _mm_add_ps(c31, _mm_mul_ps(ar, b1));
+        ar = _mm_load1_ps(a + 4); c40 = _mm_add_ps(c40, _mm_mul_ps(ar, b0)); c41 = _mm_add_ps(c41, _mm_mul_ps(ar, b1));
+        ar = _mm_load1_ps(a + 5); c50 = _mm_add_ps(c50, _mm_mul_ps(ar, b0)); c51 = _mm_add_ps(c51, _mm_mul_ps(ar, b1));
+    }
+    if (relu) {
+        const __m128 z = _mm_setzero_ps();
+        c00 = _mm_max_ps(c00, z); c01 = _mm_max_ps(c01, z); c10 = _mm_max_ps(c10, z); c11 = _mm_max_ps(c11, z);
+        c20 = _mm_max_ps(c20, z); c21 = _mm_max_ps(c21, z); c30 = _mm_max_ps(c30, z); c31 = _mm_max_ps(c31, z);
+        c40 = _mm_max_ps(c40, z); c41 = _mm_max_ps(c41, z); c50 = _mm_max_ps(c50, z); c51 = _mm_max_ps(c51, z);
+    }
+    _mm_storeu_ps(c, c00); _mm_storeu_ps(c + 4, c01);
+    _mm_storeu_ps(c + ldc, c10); _mm_storeu_ps(c + ldc + 4, c11);
+    _mm_storeu_ps(c + 2 * ldc, c20); _mm_storeu_ps(c + 2 * ldc + 4, c21);
+    _mm_storeu_ps(c + 3 * ldc, c30); _mm_storeu_ps(c + 3 * ldc + 4, c31);
+    _mm_storeu_ps(c + 4 * ldc, c40); _mm_storeu_ps(c + 4 * ldc + 4, c41);
+    _mm_storeu_ps(c + 5 * ldc, c50); _mm_storeu_ps(c + 5 * ldc + 4, c51);
+}
+
+void get_sse42_kernels(SimdKernels& kernels) {
+    kernels.level = SIMD_SSE42;
+    kernels.conv5x5 = conv5x5_sse42;
+    SIMD_CONV_RELU_POOL_KERNELS(kernels, conv5x5_relu_pool_sse42);
+    kernels.relu = relu_sse42;
+    kernels.max_pool_2x2 = max_pool_2x2_sse42;
+    kernels.dot = dot_sse42;
+    kernels.gemv = gemv_sse42;
+    // fp16 needs F16C to convert, which comes with the AVX2 level
+    SimdKernels scalar;
+    get_scalar_kernels(scalar);
+    kernels.gemv_fp16 = scalar.gemv_fp16;
+    kernels.gemv_bf16 = gemv_bf16_sse42;
+    kernels.gemv_bf16_pairs = nullptr;
+    kernels.gemv_block_sparse = gemv_block_sparse_sse42;
+    kernels.gemv_csr = scalar.gemv_csr;     // no gathers before AVX2
+    kernels.dot_u8s8 = dot_u8s8_sse42;
+    kernels.gemm_u8s8 = gemm_u8s8_sse42;
+    kernels.requantize = requantize_sse42;
+    kernels.dot_i32 = dot_i32_sse42;
+    kernels.gemm_i32 = gemm_i32_sse42;
+    kernels.sgemm_kernel = sgemm_kernel_sse42;
+    kernels.sgemm_nr = 8;
+    kernels.pack_panel = scalar.pack_panel;
+}
+
+
+// ---------------------------------------------------------------- AVX2 + FMA
+
+// lanes [0, count) set, for masked loads/stores of the last partial vector
+SIMD_TARGET("avx2")
+static inline __m256i avx2_tail_mask(int count) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(count), lanes);
+}
+
+SIMD_TARGET("avx2,fma")
+static inline __m256 conv5x5_avx2_vec(const float* in, int inLength, const float* weights, __m256i mask) {
+
+    __m256 acc[5];
+    for (int ki = 0; ki < 5; ++ki) {
+        const float* row = in + ki * inLength;
+        const float* w = weights + ki * 5;
+        __m256 a = _mm256_mul_ps(_mm256_maskload_ps(row, mask), _mm256_set1_ps(w[0]));
+        a = _mm256_fmadd_ps(_mm256_maskload_ps(row + 1, mask), _mm256_set1_ps(w[1]), a);
+        a = _mm256_fmadd_ps(_mm256_maskload_ps(row + 2, mask), _mm256_set1_ps(w[2]), a);
+        a = _mm256_fmadd_ps(_mm256_maskload_ps(row + 3, mask), _mm256_set1_ps(w[3]), a);
+        a = _mm256_fmadd_ps(_mm256_maskload_ps(row + 4, mask), _mm256_set1_ps(w[4]), a);
+        acc[ki] = a;
+    }
+    __m256 sum = _mm256_add_ps(_mm256_add_ps(acc[0], acc[1]), _mm256_add_ps(acc[2], acc[3]));
+    return _mm256_add_ps(sum, acc[4]);
+}
+
+SIMD_TARGET("avx2,fma")
+static void conv5x5_avx2(const float* in, int inLength, const float* weights, float* out, int outLength, bool relu) {
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i full = _mm256_set1_epi32(-1);
+    const __m256i tail = avx2_tail_mask(outLength % 8);
+    for (int i = 0; i < outLength; ++i) {
+        const float* row = in + i * inLength;
+        float* o = out + i * outLength;
+        for (int j = 0; j < outLength; j += 8) {
+            __m256i mask = (j + 8 <= outLength) ? full : tail;
+            __m256 v = _mm256_add_ps(_mm256_maskload_ps(o + j, mask), conv5x5_avx2_vec(row + j, inLength, weights, mask));
+            if (relu)
+                v = _mm256_max_ps(v, zero);
+            _mm256_maskstore_ps(o + j, mask, v);
+        }
+    }
+}
+
+template<int InLength, int OutLength, int NumInputs>
+SIMD_TARGET("avx2,fma")
+static void conv5x5_relu_pool_avx2(const float* const* in, const float* const* weights, float bias, float* out,
+    int firstRow, int endRow)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 b = _mm256_set1_ps(bias);
+    const int convLength = OutLength * 2;
+    for (int i = firstRow; i < endRow; ++i) {
+        int r0 = (i * 2) * InLength;    // first input row of the two convolution rows
+        int r1 = r0 + InLength;
+        float* o = out + i * OutLength;
+        // 16 convolution columns -> 8 outputs
+        for (int j = 0; j < OutLength; j += 8) {
+            int count = convLength - j * 2;
+            __m256i loMask = avx2_tail_mask((count < 8) ? count : 8);
+            __m256i hiMask = avx2_tail_mask(count - 8);
+            __m256 a0 = b, a1 = b, c0 = b, c1 = b;
+            for (int k = 0; k < NumInputs; ++k) {
+                a0 = _mm256_add_ps(a0, conv5x5_avx2_vec(in[k] + r0 + j * 2, InLength, weights[k], loMask));
+                a1 = _mm256_add_ps(a1, conv5x5_avx2_vec(in[k] + r0 + j * 2 + 8, InLength, weights[k], hiMask));
+                c0 = _mm256_add_ps(c0, conv5x5_avx2_vec(in[k] + r1 + j * 2, InLength, weights[k], loMask));
+                c1 = _mm256_add_ps(c1, conv5x5_avx2_vec(in[k] + r1 + j * 2 + 8, InLength, weights[k], hiMask));
+            }
+            __m256 lo = _mm256_max_ps(a0, c0);
+            __m256 hi = _mm256_max_ps(a1, c1);
+            // even/odd columns per 128-bit lane, then restore the output order across the lanes (as in max_pool_2x2_avx2)
+            __m256 max = _mm256_max_ps(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)), _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+            max = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(max), _MM_SHUFFLE(3, 1, 2, 0)));
+            _mm256_maskstore_ps(o + j, avx2_tail_mask(OutLength - j), _mm256_max_ps(max, zero));
+        }
+    }
+}
+
+SIMD_TARGET("avx2")
+static void relu_avx2(float* data, int n) {
+
+    const __m256 zero = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(data + i, _mm256_max_ps(_mm256_loadu_ps(data + i), zero));
+    if (i < n) {
+        __m256i mask = avx2_tail_mask(n - i);
+        _mm256_maskstore_ps(data + i, mask, _mm256_max_ps(_mm256_maskload_ps(data + i, mask), zero));
+    }
+}
+
+SIMD_TARGET("avx2")
+static void max_pool_2x2_avx2(const float* in, float* out, int outLength) {
+
+    int inLength = outLength * 2;
+    for (int i = 0; i < outLength; ++i) {
+        const float* r0 = in + (i * 2) * inLength;
+        const float* r1 = r0 + inLength;
+        float* o = out + i * outLength;
+        int j = 0;
+        for (; j + 8 <= outLength; j += 8) {
+            __m256 lo = _mm256_max_ps(_mm256_loadu_ps(r0 + j * 2), _mm256_loadu_ps(r1 + j * 2));
+            __m256 hi = _mm256_max_ps(_mm256_loadu_ps(r0 + j * 2 + 8), _mm256_loadu_ps(r1 + j * 2 + 8));
+            // even/odd columns per 128-bit lane: [0 2 8 10 | 4 6 12 14] and [1 3 9 11 | 5 7 13 15]
+            __m256 even = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+            __m256 odd = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+            __m256 max = _mm256_max_ps(even, odd);
+            // restore the output order across the two lanes
+            max = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(max), _MM_SHUFFLE(3, 1, 2, 0)));
+            _mm256_storeu_ps(o + j, max);
+        }
+        for (; j + 4 <= outLength; j += 4) {
+            __m128 lo = _mm_max_ps(_mm_loadu_ps(r0 + j * 2), _mm_loadu_ps(r1 + j * 2));
+            __m128 hi = _mm_max_ps(_mm_loadu_ps(r0 + j * 2 + 4), _mm_loadu_ps(r1 + j * 2 + 4));
+            _mm_storeu_ps(o + j, _mm_max_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)),
+                _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+        }
+        for (; j < outLength; ++j) {
+            float a = (r0[j * 2] > r0[j * 2 + 1]) ? r0[j * 2] : r0[j * 2 + 1];
+            float b = (r1[j * 2] > r1[j * 2 + 1]) ? r1[j * 2] : r1[j * 2 + 1];
+            o[j] = (a > b) ? a : b;
+        }
+    }
+}
+
+SIMD_TARGET("avx2,fma")
+static float dot_avx2(const float* a, const float* b, int n) {
+
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    if (i + 8 <= n) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        i += 8;
+    }
+    if (i < n) {
+        __m256i mask = avx2_tail_mask(n - i);
+        acc1 = _mm256_fmadd_ps(_mm256_maskload_ps(a + i, mask), _mm256_maskload_ps(b + i, mask), acc1);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+// one panel per pass, two registers of outputs with separate accumulators for even and odd i
+SIMD_TARGET("avx2,fma")
+static void gemv_avx2(const float* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const float* p = panels + r0 * n;
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 2 <= n; i += 2, p += 2 * GEMV_PANEL) {
+            __m256 x0 = _mm256_set1_ps(x[i]);
+            __m256 x1 = _mm256_set1_ps(x[i + 1]);
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(p), x0, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(p + 8), x0, acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(p + 16), x1, acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(p + 24), x1, acc3);
+        }
+        if (i < n) {
+            __m256 x0 = _mm256_set1_ps(x[i]);
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(p), x0, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(p + 8), x0, acc1);
+        }
+        float sums[GEMV_PANEL];
+        _mm256_storeu_ps(sums, _mm256_add_ps(acc0, acc2));
+        _mm256_storeu_ps(sums + 8, _mm256_add_ps(acc1, acc3));
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+// fp16 panels: 16 halves per column, converted by F16C
+SIMD_TARGET("avx2,fma,f16c")
+static void gemv_fp16_avx2(const uint16_t* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const uint16_t* p = panels + r0 * n;
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 2 <= n; i += 2, p += 2 * GEMV_PANEL) {
+            __m256 x0 = _mm256_set1_ps(x[i]);
+            __m256 x1 = _mm256_set1_ps(x[i + 1]);
+            acc0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p)), x0, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(p + 8))), x0, acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(p + 16))), x1, acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(p + 24))), x1, acc3);
+        }
+        if (i < n) {
+            __m256 x0 = _mm256_set1_ps(x[i]);
+            acc0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p)), x0, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(p + 8))), x0, acc1);
+        }
+        float sums[GEMV_PANEL];
+        _mm256_storeu_ps(sums, _mm256_add_ps(acc0, acc2));
+        _mm256_storeu_ps(sums + 8, _mm256_add_ps(acc1, acc3));
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+// bf16 panels: the low halves of the 32-bit lanes multiply x[i], the high halves x[i + 1]
+SIMD_TARGET("avx2,fma")
+static void gemv_bf16_avx2(const uint16_t* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+
+    int n2 = (n + 1) / 2;
+    const __m256i high = _mm256_set1_epi32((int)0xffff0000);
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const uint16_t* p = panels + r0 * n2 * 2;
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        for (int j = 0; j < n2; ++j, p += GEMV_PANEL * 2) {
+            __m256 x0 = _mm256_set1_ps(x[j * 2]);
+            __m256 x1 = _mm256_set1_ps(j * 2 + 1 < n ? x[j * 2 + 1] : 0.f);
+            __m256i w0 = _mm256_loadu_si256((const __m256i*)p);
+            __m256i w1 = _mm256_loadu_si256((const __m256i*)(p + 16));
+            acc0 = _mm256_fmadd_ps(_mm256_castsi256_ps(_mm256_slli_epi32(w0, 16)), x0, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_castsi256_ps(_mm256_slli_epi32(w1, 16)), x0, acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_castsi256_ps(_mm256_and_si256(w0, high)), x1, acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_castsi256_ps(_mm256_and_si256(w1, high)), x1, acc3);
+        }
+        float sums[GEMV_PANEL];
+        _mm256_storeu_ps(sums, _mm256_add_ps(acc0, acc2));
+        _mm256_storeu_ps(sums + 8, _mm256_add_ps(acc1, acc3));
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+SIMD_TARGET("avx2,fma")
+static void gemv_block_sparse_avx2(const float* values, const uint16_t* columns, const int* panelStart, const float* x,
+    const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r0 = 0, b = 0; r0 < numRows; r0 += GEMV_PANEL, ++b) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        int j = panelStart[b], end = panelStart[b + 1];
+        for (; j + 2 <= end; j += 2) {
+            const float* p = values + j * GEMV_PANEL;
+            __m256 x0 = _mm256_set1_ps(x[columns[j]]);
+            __m256 x1 = _mm256_set1_ps(x[columns[j + 1]]);
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(p), x0, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(p + 8), x0, acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(p + 16), x1, acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(p + 24), x1, acc3);
+        }
+        if (j < end) {
+            const float* p = values + j * GEMV_PANEL;
+            __m256 x0 = _mm256_set1_ps(x[columns[j]]);
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(p), x0, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(p + 8), x0, acc1);
+        }
+        float sums[GEMV_PANEL];
+        _mm256_storeu_ps(sums, _mm256_add_ps(acc0, acc2));
+        _mm256_storeu_ps(sums + 8, _mm256_add_ps(acc1, acc3));
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+// 16 nonzeros per step, x gathered by their columns
+SIMD_TARGET("avx2,fma")
+static void gemv_csr_avx2(const float* values, const uint16_t* columns, const int* rowStart, const float* x,
+    const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r = 0; r < numRows; ++r) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        int j = rowStart[r], end = rowStart[r + 1];
+        for (; j + 16 <= end; j += 16) {
+            __m256i cols = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(columns + j)));
+            __m256i cols1 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(columns + j + 8)));
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(values + j), _mm256_i32gather_ps(x, cols, 4), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(values + j + 8), _mm256_i32gather_ps(x, cols1, 4), acc1);
+        }
+        __m256 acc = _mm256_add_ps(acc0, acc1);
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+        float tail = 0.f;
+        for (; j < end; ++j)
+            tail += values[j] * x[columns[j]];
+        float v = bias[r] + (_mm_cvtss_f32(sum) + tail);
+        out[r] = (relu && v < 0.f) ? 0.f : v;
+    }
+}
+
+SIMD_TARGET("avx2")
+static void dot_u8s8_avx2(const unsigned char* a, const signed char* b, int n, int numRows, int* out) {
+
+    for (int r = 0; r < numRows; ++r) {
+        const signed char* row = b + r * n;
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        for (int i = 0; i < n; i += 32) {
+            __m128i a0 = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i a1 = _mm_loadu_si128((const __m128i*)(a + i + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i*)(row + i));
+            __m128i b1 = _mm_loadu_si128((const __m128i*)(row + i + 16));
+            acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_cvtepu8_epi16(a0), _mm256_cvtepi8_epi16(b0)));
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_cvtepu8_epi16(a1), _mm256_cvtepi8_epi16(b1)));
+        }
+        __m256i acc = _mm256_add_epi32(acc0, acc1);
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        out[r] = _mm_cvtsi128_si32(sum);
+    }
+}
+
+SIMD_TARGET("avx2")
+static void gemm_u8s8_avx2(const unsigned char* cols, const signed char* weights, int k, int numRows, int numCols, int* out) {
+
+    int stride = (numCols + 15) & ~15;
+    __m256i wv[GEMM_U8S8_KC / 4 * 8];   // int16 weight pairs (i, i + 1) and (i + 2, i + 3) of the 4 rows, broadcast
+    for (int r0 = 0; r0 < numRows; r0 += 4) {
+        int* o[4];
+        for (int j = 0; j < 4; ++j)
+            o[j] = out + block_row(r0, j, numRows) * numCols;
+
+        for (int k0 = 0; k0 < k; k0 += GEMM_U8S8_KC) {
+            int kc = (k - k0 < GEMM_U8S8_KC) ? k - k0 : GEMM_U8S8_KC;
+            for (int i = 0; i < kc; i += 4) {
+                for (int j = 0; j < 4; ++j) {
+                    __m256i w16 = _mm256_cvtepi8_epi16(_mm_set1_epi32(load_weights4(weights + block_row(r0, j, numRows) * k + k0 + i)));
+                    wv[(i / 4) * 8 + j * 2] = _mm256_shuffle_epi32(w16, 0x00);
+                    wv[(i / 4) * 8 + j * 2 + 1] = _mm256_shuffle_epi32(w16, 0x55);
+                }
+            }
+
+            for (int p = 0; p < numCols; p += 8) {
+                __m256i mask = avx2_tail_mask(numCols - p);
+                __m256i acc0, acc1, acc2, acc3;
+                if (k0 == 0) {
+                    acc0 = acc1 = acc2 = acc3 = _mm256_setzero_si256();
+                }
+                else {
+                    acc0 = _mm256_maskload_epi32(o[0] + p, mask);
+                    acc1 = _mm256_maskload_epi32(o[1] + p, mask);
+                    acc2 = _mm256_maskload_epi32(o[2] + p, mask);
+                    acc3 = _mm256_maskload_epi32(o[3] + p, mask);
+                }
+
+                for (int i = 0; i < kc; i += 4) {
+                    // 8 columns of rows i, i + 1 and i + 2, i + 3 as interleaved int16 pairs
+                    const unsigned char* c = cols + (k0 + i) * stride + p;
+                    __m256i v01 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)c), _mm_loadl_epi64((const __m128i*)(c + stride))));
+                    __m256i v23 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(c + 2 * stride)), _mm_loadl_epi64((const __m128i*)(c + 3 * stride))));
+                    const __m256i* wp = wv + (i / 4) * 8;
+                    acc0 = _mm256_add_epi32(acc0, _mm256_add_epi32(_mm256_madd_epi16(v01, wp[0]), _mm256_madd_epi16(v23, wp[1])));
+                    acc1 = _mm256_add_epi32(acc1, _mm256_add_epi32(_mm256_madd_epi16(v01, wp[2]), _mm256_madd_epi16(v23, wp[3])));
+                    acc2 = _mm256_add_epi32(acc2, _mm256_add_epi32(_mm256_madd_epi16(v01, wp[4]), _mm256_madd_epi16(v23, wp[5])));
+                    acc3 = _mm256_add_epi32(acc3, _mm256_add_epi32(_mm256_madd_epi16(v01, wp[6]), _mm256_madd_epi16(v23, wp[7])));
+                }
+
+                __m256i acc[4] = { acc0, acc1, acc2, acc3 };
+                for (int j = 0; j < 4 && r0 + j < numRows; ++j)
+                    _mm256_maskstore_epi32(o[j] + p, mask, acc[j]);
+            }
+        }
+    }
+}
+
+SIMD_TARGET("avx2")
+static void requantize_avx2(const int* acc, int bias, float multiplier, unsigned char* out, int n) {
+
+    const __m256i b = _mm256_set1_epi32(bias);
+    const __m256 m = _mm256_set1_ps(multiplier);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 max = _mm256_set1_ps(255.f);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i q[4];
+        for (int j = 0; j < 4; ++j) {
+            __m256 v = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(acc + i + j * 8)), b)), m);
+            q[j] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, zero), max));
+        }
+        // the packs work within 128-bit lanes, the permute puts the 4-byte groups back in order
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_permutevar8x32_epi32(packed, order));
+    }
+    for (; i < n; ++i) {
+        __m128 v = _mm_mul_ss(_mm_cvtsi32_ss(_mm_setzero_ps(), acc[i] + bias), _mm256_castps256_ps128(m));
+        out[i] = (unsigned char)_mm_cvtss_si32(_mm_min_ss(_mm_max_ss(v, _mm_setzero_ps()), _mm256_castps256_ps128(max)));
+    }
+}
+
+SIMD_TARGET("avx2")
+static void dot_i32_avx2(const int32_t* x, const int32_t* w, int n, int numRows, int64_t* out) {
+
+    for (int r = 0; r < numRows; ++r) {
+        const int32_t* row = w + r * n;
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = _mm256_add_epi64(acc0, _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(x + i))),
+                _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(row + i)))));
+            acc1 = _mm256_add_epi64(acc1, _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(x + i + 4))),
+                _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(row + i + 4)))));
+        }
+        __m256i acc = _mm256_add_epi64(acc0, acc1);
+        __m128i sum2 = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        uint64_t sum = (uint64_t)_mm_cvtsi128_si64(sum2) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sum2, sum2));
+        for (; i < n; ++i)
+            sum += (uint64_t)((int64_t)x[i] * row[i]);
+        out[r] = (int64_t)sum;
+    }
+}
+
+// 16 columns (4 vectors of 4 int64 sums) per pass over k, the sums stay in registers
+SIMD_TARGET("avx2")
+static void gemm_i32_avx2(const int32_t* cols, const int32_t* weights, int k, int numRows, int numCols, int64_t* out) {
+
+    for (int r = 0; r < numRows; ++r) {
+        const int32_t* w = weights + r * k;
+        int64_t* o = out + r * numCols;
+        int p = 0;
+        for (; p + 16 <= numCols; p += 16) {
+            __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+            __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+            for (int i = 0; i < k; ++i) {
+                const int32_t* c = cols + i * numCols + p;
+                __m256i wv = _mm256_set1_epi64x(w[i]);
+                acc0 = _mm256_add_epi64(acc0, _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)c)), wv));
+                acc1 = _mm256_add_epi64(acc1, _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(c + 4))), wv));
+                acc2 = _mm256_add_epi64(acc2, _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(c + 8))), wv));
+                acc3 = _mm256_add_epi64(acc3, _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(c + 12))), wv));
+            }
+            _mm256_storeu_si256((__m256i*)(o + p), acc0);
+            _mm256_storeu_si256((__m256i*)(o + p + 4), acc1);
+            _mm256_storeu_si256((__m256i*)(o + p + 8), acc2);
+            _mm256_storeu_si256((__m256i*)(o + p + 12), acc3);
+        }
+        for (; p + 4 <= numCols; p += 4) {
+            __m256i acc = _mm256_setzero_si256();
+            for (int i = 0; i < k; ++i)
+                acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(cols + i * numCols + p))),
+                    _mm256_set1_epi64x(w[i])));
+            _mm256_storeu_si256((__m256i*)(o + p), acc);
+        }
+        for (; p < numCols; ++p) {
+            uint64_t sum = 0;
+            for (int i = 0; i < k; ++i)
+                sum += (uint64_t)((int64_t)cols[i * numCols + p] * w[i]);
+            o[p] = (int64_t)sum;
+        }
+    }
+}
+
+// 6 x 16 tiles: 12 accumulators, the 2 vectors of the B row and the broadcast fill 15 of the 16 ymm registers
+SIMD_TARGET("avx2,fma")
+static void sgemm_kernel_avx2(int kc, const float* a, const float* b, float* c, int ldc, bool load_c, bool relu) {
+
+    // one named accumulator per vector of the tile, so that they stay in registers
+    __m256 c00, c01, c10, c11, c20, c21, c30, c31, c40, c41, c50, c51;
+    if (load_c) {
+        c00 = _mm256_loadu_ps(c); c01 = _mm256_loadu_ps(c + 8);
+        c10 = _mm256_loadu_ps(c + ldc); c11 = _mm256_loadu_ps(c + ldc + 8);
+        c20 = _mm256_loadu_ps(c + 2 * ldc); c21 = _mm256_loadu_ps(c + 2 * ldc + 8);
+        c30 = _mm256_loadu_ps(c + 3 * ldc); c31 = _mm256_loadu_ps(c + 3 * ldc + 8);
+        c40 = _mm256_loadu_ps(c + 4 * ldc); c41 = _mm256_loadu_ps(c + 4 * ldc + 8);
+        c50 = _mm256_loadu_ps(c + 5 * ldc); c51 = _mm256_loadu_ps(c + 5 * ldc + 8);
+    }
+    else {
+        c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = c40 = c41 = c50 = c51 = _mm256_setzero_ps();
+    }
+    for (int p = 0; p < kc; ++p, a += GEMM_MR, b += 16) {
+        __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b + 8), ar;
+        ar = _mm256_broadcast_ss(a); c00 = _mm256_fmadd_ps(ar, b0, c00); c01 = _mm256_fmadd_ps(ar, b1, c01);
+        ar = _mm256_broadcast_ss(a + 1); c10 = _mm256_fmadd_ps(ar, b0, c10); c11 = _mm256_fmadd_ps(ar, b1, c11);
+        ar = _mm256_broadcast_ss(a + 2); c20 = _mm256_fmadd_ps(ar, b0, c20); c21 = _mm256_fmadd_ps(ar, b1, c21);
+        ar = _mm256_broadcast_ss(a + 3); c30 = _mm256_fmadd_ps(ar, b0, c30); c31 = _mm256_fmadd_ps(ar, b1, c31);
+        ar = _mm256_broadcast_ss(a + 4); c40 = _mm256_fmadd_ps(ar, b0, c40); c41 = _mm256_fmadd_ps(ar, b1, c41);
+        ar = _mm256_broadcast_ss(a + 5); c50 = _mm256_fmadd_ps(ar, b0, c50); c51 = _mm256_fmadd_ps(ar, b1, c51);
+    }
+    if (relu) {
+        const __m256 z = _mm256_setzero_ps();
+        c00 = _mm256_max_ps(c00, z); c01 = _mm256_max_ps(c01, z); c10 = _mm256_max_ps(c10, z); c11 = _mm256_max_ps(c11, z);
+        c20 = _mm256_max_ps(c20, z); c21 = _mm256_max_ps(c21, z); c30 = _mm256_max_ps(c30, z); c31 = _mm256_max_ps(c31, z);
+        c40 = _mm256_max_ps(c40, z); c41 = _mm256_max_ps(c41, z); c50 = _mm256_max_ps(c50, z); c51 = _mm256_max_ps(c51, z);
+    }
+    _mm256_storeu_ps(c, c00); _mm256_storeu_ps(c + 8, c01);
+    _mm256_storeu_ps(c + ldc, c10); _mm256_storeu_ps(c + ldc + 8, c11);
+    _mm256_storeu_ps(c + 2 * ldc, c20); _mm256_storeu_ps(c + 2 * ldc + 8, c21);
+    _mm256_storeu_ps(c + 3 * ldc, c30); _mm256_storeu_ps(c + 3 * ldc + 8, c31);
+    _mm256_storeu_ps(c + 4 * ldc, c40); _mm256_storeu_ps(c + 4 * ldc + 8, c41);
+    _mm256_storeu_ps(c + 5 * ldc, c50); _mm256_storeu_ps(c + 5 * ldc + 8, c51);
+}
+
+// each run is copied with full vectors and a masked one for its tail
+SIMD_TARGET("avx2")
+static void pack_panel_avx2(const float* src, const int* rowOffset, int kc, const PanelRuns& runs, int cols, int nr, float* dst) {
+
+    const __m256 zero = _mm256_setzero_ps();
+    for (int p = 0; p < kc; ++p, dst += nr) {
+        const float* row = src + rowOffset[p];
+        for (int r = 0; r < runs.count; ++r) {
+            const float* from = row + runs.offset[r];
+            float* to = dst + runs.column[r];
+            int q = 0;
+            for (; q + 8 <= runs.length[r]; q += 8)
+                _mm256_storeu_ps(to + q, _mm256_loadu_ps(from + q));
+            if (q < runs.length[r]) {
+                __m256i mask = avx2_tail_mask(runs.length[r] - q);
+                _mm256_maskstore_ps(to + q, mask, _mm256_maskload_ps(from + q, mask));
+            }
+        }
+        for (int j = cols; j < nr; j += 8)
+            _mm256_maskstore_ps(dst + j, avx2_tail_mask(nr - j), zero);
+    }
+}
+
+void get_avx2_kernels(SimdKernels& kernels) {
+    kernels.level = SIMD_AVX2;
+    kernels.conv5x5 = conv5x5_avx2;
+    SIMD_CONV_RELU_POOL_KERNELS(kernels, conv5x5_relu_pool_avx2);
+    kernels.relu = relu_avx2;
+    kernels.max_pool_2x2 = max_pool_2x2_avx2;
+    kernels.dot = dot_avx2;
+    kernels.gemv = gemv_avx2;
+    kernels.gemv_fp16 = gemv_fp16_avx2;
+    kernels.gemv_bf16 = gemv_bf16_avx2;
+    kernels.gemv_bf16_pairs = nullptr;
+    kernels.gemv_block_sparse = gemv_block_sparse_avx2;
+    kernels.gemv_csr = gemv_csr_avx2;
+    kernels.dot_u8s8 = dot_u8s8_avx2;
+    kernels.gemm_u8s8 = gemm_u8s8_avx2;
+    kernels.requantize = requantize_avx2;
+    kernels.dot_i32 = dot_i32_avx2;
+    kernels.gemm_i32 = gemm_i32_avx2;
+    kernels.sgemm_kernel = sgemm_kernel_avx2;
+    kernels.sgemm_nr = 16;
+    kernels.pack_panel = pack_panel_avx2;
+}
+
+
+// ---------------------------------------------------------------- AVX-512
+
+SIMD_TARGET("avx512f")
+static inline __m512 conv5x5_avx512_vec(const float* in, int inLength, const float* weights, __mmask16 mask) {
+
+    __m512 acc[5];
+    for (int ki = 0; ki < 5; ++ki) {
+        const float* row = in + ki * inLength;
+        const float* w = weights + ki * 5;
+        __m512 a = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, row), _mm512_set1_ps(w[0]));
+        a = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, row + 1), _mm512_set1_ps(w[1]), a);
+        a = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, row + 2), _mm512_set1_ps(w[2]), a);
+        a = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, row + 3), _mm512_set1_ps(w[3]), a);
+        a = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, row + 4), _mm512_set1_ps(w[4]), a);
+        acc[ki] = a;
+    }
+    __m512 sum = _mm512_add_ps(_mm512_add_ps(acc[0], acc[1]), _mm512_add_ps(acc[2], acc[3]));
+    return _mm512_add_ps(sum, acc[4]);
+}
+
+SIMD_TARGET("avx512f")
+static void conv5x5_avx512(const float* in, int inLength, const float* weights, float* out, int outLength, bool relu) {
+
+    const __m512 zero = _mm512_setzero_ps();
+    for (int i = 0; i < outLength; ++i) {
+        const float* row = in + i * inLength;
+        float* o = out + i * outLength;
+        for (int j = 0; j < outLength; j += 16) {
+            int count = (outLength - j < 16) ? outLength - j : 16;
+            __mmask16 mask = (__mmask16)((1u << count) - 1);
+            __m512 v = _mm512_add_ps(_mm512_maskz_loadu_ps(mask, o + j), conv5x5_avx512_vec(row + j, inLength, weights, mask));
+            if (relu)
+                v = _mm512_max_ps(v, zero);
+            _mm512_mask_storeu_ps(o + j, mask, v);
+        }
+    }
+}
+
+template<int InLength, int OutLength, int NumInputs>
+SIMD_TARGET("avx512f")
+static void conv5x5_relu_pool_avx512(const float* const* in, const float* const* weights, float bias, float* out,
+    int firstRow, int endRow)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 b = _mm512_set1_ps(bias);
+    const __m512i evenIdx = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i oddIdx = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    for (int i = firstRow; i < endRow; ++i) {
+        int r0 = (i * 2) * InLength;    // first input row of the two convolution rows
+        int r1 = r0 + InLength;
+        float* o = out + i * OutLength;
+        // 32 convolution columns -> 16 outputs
+        for (int j = 0; j < OutLength; j += 16) {
+            int count = (OutLength - j < 16) ? OutLength - j : 16;
+            int loCount = (count * 2 < 16) ? count * 2 : 16;
+            int hiCount = count * 2 - loCount;
+            __mmask16 loMask = (__mmask16)((1u << loCount) - 1);
+            __mmask16 hiMask = (__mmask16)((1u << hiCount) - 1);
+            __m512 a0 = b, a1 = b, c0 = b, c1 = b;
+            for (int k = 0; k < NumInputs; ++k) {
+                a0 = _mm512_add_ps(a0, conv5x5_avx512_vec(in[k] + r0 + j * 2, InLength, weights[k], loMask));
+                c0 = _mm512_add_ps(c0, conv5x5_avx512_vec(in[k] + r1 + j * 2, InLength, weights[k], loMask));
+                if (hiCount > 0) {
+                    a1 = _mm512_add_ps(a1, conv5x5_avx512_vec(in[k] + r0 + j * 2 + 16, InLength, weights[k], hiMask));
+                    c1 = _mm512_add_ps(c1, conv5x5_avx512_vec(in[k] + r1 + j * 2 + 16, InLength, weights[k], hiMask));
+                }
+            }
+            __m512 lo = _mm512_max_ps(a0, c0);
+            __m512 hi = _mm512_max_ps(a1, c1);
+            __m512 max = _mm512_max_ps(_mm512_permutex2var_ps(lo, evenIdx, hi), _mm512_permutex2var_ps(lo, oddIdx, hi));
+            _mm512_mask_storeu_ps(o + j, (__mmask16)((1u << count) - 1), _mm512_max_ps(max, zero));
+        }
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void relu_avx512(float* data, int n) {
+
+    const __m512 zero = _mm512_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+        int count = (n - i < 16) ? n - i : 16;
+        __mmask16 mask = (__mmask16)((1u << count) - 1);
+        _mm512_mask_storeu_ps(data + i, mask, _mm512_max_ps(_mm512_maskz_loadu_ps(mask, data + i), zero));
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void max_pool_2x2_avx512(const float* in, float* out, int outLength) {
+
+    int inLength = outLength * 2;
+    const __m512i evenIdx = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i oddIdx = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    for (int i = 0; i < outLength; ++i) {
+        const float* r0 = in + (i * 2) * inLength;
+        const float* r1 = r0 + inLength;
+        float* o = out + i * outLength;
+        for (int j = 0; j < outLength; j += 16) {
+            int count = (outLength - j < 16) ? outLength - j : 16;
+            // 2 * count input columns, split over two vectors
+            int loCount = (count * 2 < 16) ? count * 2 : 16;
+            int hiCount = count * 2 - loCount;
+            __mmask16 loMask = (__mmask16)((1u << loCount) - 1);
+            __mmask16 hiMask = (__mmask16)((1u << hiCount) - 1);
+            __m512 lo = _mm512_max_ps(_mm512_maskz_loadu_ps(loMask, r0 + j * 2), _mm512_maskz_loadu_ps(loMask, r1 + j * 2));
+            __m512 hi = _mm512_max_ps(_mm512_maskz_loadu_ps(hiMask, r0 + j * 2 + 16), _mm512_maskz_loadu_ps(hiMask, r1 + j * 2 + 16));
+            __m512 max = _mm512_max_ps(_mm512_permutex2var_ps(lo, evenIdx, hi), _mm512_permutex2var_ps(lo, oddIdx, hi));
+            _mm512_mask_storeu_ps(o + j, (__mmask16)((1u << count) - 1), max);
+        }
+    }
+}
+
+SIMD_TARGET("avx512f")
+static float dot_avx512(const float* a, const float* b, int n) {
+
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i < n; i += 16) {
+        int count = (n - i < 16) ? n - i : 16;
+        __mmask16 mask = (__mmask16)((1u << count) - 1);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+// one panel = one register of outputs, 4 accumulators over i to hide the FMA latency
+SIMD_TARGET("avx512f")
+static void gemv_avx512(const float* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const float* p = panels + r0 * n;
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= n; i += 4, p += 4 * GEMV_PANEL) {
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(p), _mm512_set1_ps(x[i]), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(p + 16), _mm512_set1_ps(x[i + 1]), acc1);
+            acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(p + 32), _mm512_set1_ps(x[i + 2]), acc2);
+            acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(p + 48), _mm512_set1_ps(x[i + 3]), acc3);
+        }
+        for (; i < n; ++i, p += GEMV_PANEL)
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(p), _mm512_set1_ps(x[i]), acc0);
+        float sums[GEMV_PANEL];
+        _mm512_storeu_ps(sums, _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void gemv_fp16_avx512(const uint16_t* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const uint16_t* p = panels + r0 * n;
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= n; i += 4, p += 4 * GEMV_PANEL) {
+            acc0 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)p)), _mm512_set1_ps(x[i]), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(p + 16))), _mm512_set1_ps(x[i + 1]), acc1);
+            acc2 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(p + 32))), _mm512_set1_ps(x[i + 2]), acc2);
+            acc3 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(p + 48))), _mm512_set1_ps(x[i + 3]), acc3);
+        }
+        for (; i < n; ++i, p += GEMV_PANEL)
+            acc0 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)p)), _mm512_set1_ps(x[i]), acc0);
+        float sums[GEMV_PANEL];
+        _mm512_storeu_ps(sums, _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+// one column pair per register, two accumulators for each of x[i] and x[i + 1]
+SIMD_TARGET("avx512f")
+static void gemv_bf16_avx512(const uint16_t* panels, const float* x, int n, const float* bias, float* out, int numRows, bool relu) {
+
+    int n2 = (n + 1) / 2;
+    const __m512i high = _mm512_set1_epi32((int)0xffff0000);
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const uint16_t* p = panels + r0 * n2 * 2;
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        int j = 0;
+        for (; j + 2 <= n2; j += 2, p += 2 * GEMV_PANEL * 2) {
+            __m512i w0 = _mm512_loadu_si512(p);
+            __m512i w1 = _mm512_loadu_si512(p + GEMV_PANEL * 2);
+            acc0 = _mm512_fmadd_ps(_mm512_castsi512_ps(_mm512_slli_epi32(w0, 16)), _mm512_set1_ps(x[j * 2]), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_castsi512_ps(_mm512_and_si512(w0, high)), _mm512_set1_ps(x[j * 2 + 1]), acc1);
+            acc2 = _mm512_fmadd_ps(_mm512_castsi512_ps(_mm512_slli_epi32(w1, 16)), _mm512_set1_ps(x[j * 2 + 2]), acc2);
+            acc3 = _mm512_fmadd_ps(_mm512_castsi512_ps(_mm512_and_si512(w1, high)),
+                _mm512_set1_ps(j * 2 + 3 < n ? x[j * 2 + 3] : 0.f), acc3);
+        }
+        if (j < n2) {
+            __m512i w0 = _mm512_loadu_si512(p);
+            acc0 = _mm512_fmadd_ps(_mm512_castsi512_ps(_mm512_slli_epi32(w0, 16)), _mm512_set1_ps(x[j * 2]), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_castsi512_ps(_mm512_and_si512(w0, high)),
+                _mm512_set1_ps(j * 2 + 1 < n ? x[j * 2 + 1] : 0.f), acc1);
+        }
+        float sums[GEMV_PANEL];
+        _mm512_storeu_ps(sums, _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void gemv_block_sparse_avx512(const float* values, const uint16_t* columns, const int* panelStart, const float* x,
+    const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r0 = 0, b = 0; r0 < numRows; r0 += GEMV_PANEL, ++b) {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        int j = panelStart[b], end = panelStart[b + 1];
+        const float* p = values + j * GEMV_PANEL;
+        for (; j + 4 <= end; j += 4, p += 4 * GEMV_PANEL) {
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(p), _mm512_set1_ps(x[columns[j]]), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(p + 16), _mm512_set1_ps(x[columns[j + 1]]), acc1);
+            acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(p + 32), _mm512_set1_ps(x[columns[j + 2]]), acc2);
+            acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(p + 48), _mm512_set1_ps(x[columns[j + 3]]), acc3);
+        }
+        for (; j < end; ++j, p += GEMV_PANEL)
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(p), _mm512_set1_ps(x[columns[j]]), acc0);
+        float sums[GEMV_PANEL];
+        _mm512_storeu_ps(sums, _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void gemv_csr_avx512(const float* values, const uint16_t* columns, const int* rowStart, const float* x,
+    const float* bias, float* out, int numRows, bool relu) {
+
+    for (int r = 0; r < numRows; ++r) {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        int j = rowStart[r], end = rowStart[r + 1];
+        for (; j + 32 <= end; j += 32) {
+            __m512i cols = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(columns + j)));
+            __m512i cols1 = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(columns + j + 16)));
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(values + j), _mm512_i32gather_ps(cols, x, 4), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(values + j + 16), _mm512_i32gather_ps(cols1, x, 4), acc1);
+        }
+        if (j + 16 <= end) {
+            __m512i cols = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(columns + j)));
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(values + j), _mm512_i32gather_ps(cols, x, 4), acc0);
+            j += 16;
+        }
+        float tail = 0.f;
+        for (; j < end; ++j)
+            tail += values[j] * x[columns[j]];
+        float v = bias[r] + (_mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)) + tail);
+        out[r] = (relu && v < 0.f) ? 0.f : v;
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void requantize_avx512(const int* acc, int bias, float multiplier, unsigned char* out, int n) {
+
+    const __m512i b = _mm512_set1_epi32(bias);
+    const __m512 m = _mm512_set1_ps(multiplier);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 max = _mm512_set1_ps(255.f);
+    for (int i = 0; i < n; i += 16) {
+        int count = (n - i < 16) ? n - i : 16;
+        __mmask16 mask = (__mmask16)((1u << count) - 1);
+        __m512 v = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_maskz_loadu_epi32(mask, acc + i), b)), m);
+        __m512i q = _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(v, zero), max));
+        _mm512_mask_cvtusepi32_storeu_epi8(out + i, mask, q);
+    }
+}
+
+// 8 x int32 of a row (the first count of them, the others 0) sign-extended to 8 x int64
+SIMD_TARGET("avx512f")
+static inline __m512i load_i32_epi64(const int32_t* p, int count) {
+    __mmask16 mask = (__mmask16)((1u << count) - 1);
+    return _mm512_cvtepi32_epi64(_mm512_castsi512_si256(_mm512_maskz_loadu_epi32(mask, p)));
+}
+
+// 4 rows at a time, so each load of x is shared by 4 multiplies
+SIMD_TARGET("avx512f")
+static void dot_i32_avx512(const int32_t* x, const int32_t* w, int n, int numRows, int64_t* out) {
+
+    int r = 0;
+    for (; r + 4 <= numRows; r += 4) {
+        const int32_t* row = w + r * n;
+        __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+        __m512i acc2 = _mm512_setzero_si512(), acc3 = _mm512_setzero_si512();
+        for (int i = 0; i < n; i += 8) {
+            int count = (n - i < 8) ? n - i : 8;
+            __m512i vx = load_i32_epi64(x + i, count);
+            acc0 = _mm512_add_epi64(acc0, _mm512_mul_epi32(vx, load_i32_epi64(row + i, count)));
+            acc1 = _mm512_add_epi64(acc1, _mm512_mul_epi32(vx, load_i32_epi64(row + n + i, count)));
+            acc2 = _mm512_add_epi64(acc2, _mm512_mul_epi32(vx, load_i32_epi64(row + 2 * n + i, count)));
+            acc3 = _mm512_add_epi64(acc3, _mm512_mul_epi32(vx, load_i32_epi64(row + 3 * n + i, count)));
+        }
+        out[r] = _mm512_reduce_add_epi64(acc0);
+        out[r + 1] = _mm512_reduce_add_epi64(acc1);
+        out[r + 2] = _mm512_reduce_add_epi64(acc2);
+        out[r + 3] = _mm512_reduce_add_epi64(acc3);
+    }
+    for (; r < numRows; ++r) {
+        const int32_t* row = w + r * n;
+        __m512i acc = _mm512_setzero_si512();
+        for (int i = 0; i < n; i += 8) {
+            int count = (n - i < 8) ? n - i : 8;
+            acc = _mm512_add_epi64(acc, _mm512_mul_epi32(load_i32_epi64(x + i, count), load_i32_epi64(row + i, count)));
+        }
+        out[r] = _mm512_reduce_add_epi64(acc);
+    }
+}
+
+// 32 columns (4 vectors of 8 int64 sums) per pass over k, then 8 at a time with a masked last vector
+SIMD_TARGET("avx512f")
+static void gemm_i32_avx512(const int32_t* cols, const int32_t* weights, int k, int numRows, int numCols, int64_t* out) {
+
+    for (int r = 0; r < numRows; ++r) {
+        const int32_t* w = weights + r * k;
+        int64_t* o = out + r * numCols;
+        int p = 0;
+        for (; p + 32 <= numCols; p += 32) {
+            __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+            __m512i acc2 = _mm512_setzero_si512(), acc3 = _mm512_setzero_si512();
+            for (int i = 0; i < k; ++i) {
+                const int32_t* c = cols + i * numCols + p;
+                __m512i wv = _mm512_set1_epi64(w[i]);
+                acc0 = _mm512_add_epi64(acc0, _mm512_mul_epi32(_mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*)c)), wv));
+                acc1 = _mm512_add_epi64(acc1, _mm512_mul_epi32(_mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*)(c + 8))), wv));
+                acc2 = _mm512_add_epi64(acc2, _mm512_mul_epi32(_mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*)(c + 16))), wv));
+                acc3 = _mm512_add_epi64(acc3, _mm512_mul_epi32(_mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*)(c + 24))), wv));
+            }
+            _mm512_storeu_si512(o + p, acc0);
+            _mm512_storeu_si512(o + p + 8, acc1);
+            _mm512_storeu_si512(o + p + 16, acc2);
+            _mm512_storeu_si512(o + p + 24, acc3);
+        }
+        for (; p < numCols; p += 8) {
+            int count = (numCols - p < 8) ? numCols - p : 8;
+            __m512i acc = _mm512_setzero_si512();
+            for (int i = 0; i < k; ++i)
+                acc = _mm512_add_epi64(acc, _mm512_mul_epi32(load_i32_epi64(cols + i * numCols + p, count), _mm512_set1_epi64(w[i])));
+            _mm512_mask_storeu_epi64(o + p, (__mmask8)((1u << count) - 1), acc);
+        }
+    }
+}
+
+// 6 x 32 tiles, 2 vectors of 16 sums per row
+SIMD_TARGET("avx512f")
+static void sgemm_kernel_avx512(int kc, const float* a, const float* b, float* c, int ldc, bool load_c, bool relu) {
+
+    // one named accumulator per vector of the tile, so that they stay in registers
+    __m512 c00, c01, c10, c11, c20, c21, c30, c31, c40, c41, c50, c51;
+    if (load_c) {
+        c00 = _mm512_loadu_ps(c); c01 = _mm512_loadu_ps(c + 16);
+        c10 = _mm512_loadu_ps(c + ldc); c11 = _mm512_loadu_ps(c + ldc + 16);
+        c20 = _mm512_loadu_ps(c + 2 * ldc); c21 = _mm512_loadu_ps(c + 2 * ldc + 16);
+        c30 = _mm512_loadu_ps(c + 3 * ldc); c31 = _mm512_loadu_ps(c + 3 * ldc + 16);
+        c40 = _mm512_loadu_ps(c + 4 * ldc); c41 = _mm512_loadu_ps(c + 4 * ldc + 16);
+        c50 = _mm512_loadu_ps(c + 5 * ldc); c51 = _mm512_loadu_ps(c + 5 * ldc + 16);
+    }
+    else {
+        c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = c40 = c41 = c50 = c51 = _mm512_setzero_ps();
+    }
+    for (int p = 0; p < kc; ++p, a += GEMM_MR, b += 32) {
+        __m512 b0 = _mm512_loadu_ps(b), b1 = _mm512_loadu_ps(b + 16), ar;
+        ar = _mm512_set1_ps(a[0]); c00 = _mm512_fmadd_ps(ar, b0, c00); c01 = _mm512_fmadd_ps(ar, b1, c01);
+        ar = _mm512_set1_ps(a[1]); c10 = _mm512_fmadd_ps(ar, b0, c10); c11 = _mm512_fmadd_ps(ar, b1, c11);
+        ar = _mm512_set1_ps(a[2]); c20 = _mm512_fmadd_ps(ar, b0, c20); c21 = _mm512_fmadd_ps(ar, b1, c21);
+        ar = _mm512_set1_ps(a[3]); c30 = _mm512_fmadd_ps(ar, b0, c30); c31 = _mm512_fmadd_ps(ar, b1, c31);
+        ar = _mm512_set1_ps(a[4]); c40 = _mm512_fmadd_ps(ar, b0, c40); c41 = _mm512_fmadd_ps(ar, b1, c41);
+        ar = _mm512_set1_ps(a[5]); c50 = _mm512_fmadd_ps(ar, b0, c50); c51 = _mm512_fmadd_ps(ar, b1, c51);
+    }
+    if (relu) {
+        const __m512 z = _mm512_setzero_ps();
+        c00 = _mm512_max_ps(c00, z); c01 = _mm512_max_ps(c01, z); c10 = _mm512_max_ps(c10, z); c11 = _mm512_max_ps(c11, z);
+        c20 = _mm512_max_ps(c20, z); c21 = _mm512_max_ps(c21, z); c30 = _mm512_max_ps(c30, z); c31 = _mm512_max_ps(c31, z);
+        c40 = _mm512_max_ps(c40, z); c41 = _mm512_max_ps(c41, z); c50 = _mm512_max_ps(c50, z); c51 = _mm512_max_ps(c51, z);
+    }
+    _mm512_storeu_ps(c, c00); _mm512_storeu_ps(c + 16, c01);
+    _mm512_storeu_ps(c + ldc, c10); _mm512_storeu_ps(c + ldc + 16, c11);
+    _mm512_storeu_ps(c + 2 * ldc, c20); _mm512_storeu_ps(c + 2 * ldc + 16, c21);
+    _mm512_storeu_ps(c + 3 * ldc, c30); _mm512_storeu_ps(c + 3 * ldc + 16, c31);
+    _mm512_storeu_ps(c + 4 * ldc, c40); _mm512_storeu_ps(c + 4 * ldc + 16, c41);
+    _mm512_storeu_ps(c + 5 * ldc, c50); _mm512_storeu_ps(c + 5 * ldc + 16, c51);
+}
+
+SIMD_TARGET("avx512f")
+static void pack_panel_avx512(const float* src, const int* rowOffset, int kc, const PanelRuns& runs, int cols, int nr, float* dst) {
+
+    const __m512 zero = _mm512_setzero_ps();
+    for (int p = 0; p < kc; ++p, dst += nr) {
+        const float* row = src + rowOffset[p];
+        for (int r = 0; r < runs.count; ++r) {
+            const float* from = row + runs.offset[r];
+            float* to = dst + runs.column[r];
+            for (int q = 0; q < runs.length[r]; q += 16) {
+                int count = (runs.length[r] - q < 16) ? runs.length[r] - q : 16;
+                __mmask16 mask = (__mmask16)((1u << count) - 1);
+                _mm512_mask_storeu_ps(to + q, mask, _mm512_maskz_loadu_ps(mask, from + q));
+            }
+        }
+        for (int j = cols; j < nr; j += 16) {
+            int count = (nr - j < 16) ? nr - j : 16;
+            _mm512_mask_storeu_ps(dst + j, (__mmask16)((1u << count) - 1), zero);
+        }
+    }
+}
+
+void get_avx512_kernels(SimdKernels& kernels) {
+    kernels.level = SIMD_AVX512;
+    kernels.conv5x5 = conv5x5_avx512;
+    SIMD_CONV_RELU_POOL_KERNELS(kernels, conv5x5_relu_pool_avx512);
+    kernels.relu = relu_avx512;
+    kernels.max_pool_2x2 = max_pool_2x2_avx512;
+    kernels.dot = dot_avx512;
+    kernels.gemv = gemv_avx512;
+    kernels.gemv_fp16 = gemv_fp16_avx512;
+    kernels.gemv_bf16 = gemv_bf16_avx512;
+    kernels.gemv_bf16_pairs = nullptr;
+    kernels.gemv_block_sparse = gemv_block_sparse_avx512;
+    kernels.gemv_csr = gemv_csr_avx512;
+    // the int16 widening needs AVX-512BW, so plain AVX-512F keeps the AVX2 versions
+    kernels.dot_u8s8 = dot_u8s8_avx2;
+    kernels.gemm_u8s8 = gemm_u8s8_avx2;
+    kernels.requantize = requantize_avx512;
+    kernels.dot_i32 = dot_i32_avx512;
+    kernels.gemm_i32 = gemm_i32_avx512;
+    kernels.sgemm_kernel = sgemm_kernel_avx512;
+    kernels.sgemm_nr = 32;
+    kernels.pack_panel = pack_panel_avx512;
+}
+
+
+// ---------------------------------------------------------------- AVX-512 VNNI
+
+// 4 rows at a time, so each load of a is shared by 4 vpdpbusd
+SIMD_TARGET("avx512f,avx512bw,avx512vl,avx512vnni")
+static void dot_u8s8_vnni(const unsigned char* a, const signed char* b, int n, int numRows, int* out) {
+
+    int r = 0;
+    for (; r + 4 <= numRows; r += 4) {
+        const signed char* row = b + r * n;
+        __m512i acc0 = _mm512_setzero_si512();
+        __m512i acc1 = _mm512_setzero_si512();
+        __m512i acc2 = _mm512_setzero_si512();
+        __m512i acc3 = _mm512_setzero_si512();
+        for (int i = 0; i < n; i += 64) {
+            // the last step may cover only 32 bytes
+            __mmask64 mask = (n - i >= 64) ? ~(__mmask64)0 : (((__mmask64)1 << (n - i)) - 1);
+            __m512i va = _mm512_maskz_loadu_epi8(mask, a + i);
+            acc0 = _mm512_dpbusd_epi32(acc0, va, _mm512_maskz_loadu_epi8(mask, row + i));
+            acc1 = _mm512_dpbusd_epi32(acc1, va, _mm512_maskz_loadu_epi8(mask, row + n + i));
+            acc2 = _mm512_dpbusd_epi32(acc2, va, _mm512_maskz_loadu_epi8(mask, row + 2 * n + i));
+            acc3 = _mm512_dpbusd_epi32(acc3, va, _mm512_maskz_loadu_epi8(mask, row + 3 * n + i));
+        }
+        out[r] = _mm512_reduce_add_epi32(acc0);
+        out[r + 1] = _mm512_reduce_add_epi32(acc1);
+        out[r + 2] = _mm512_reduce_add_epi32(acc2);
+        out[r + 3] = _mm512_reduce_add_epi32(acc3);
+    }
+    for (; r < numRows; ++r) {
+        const signed char* row = b + r * n;
+        __m512i acc = _mm512_setzero_si512();
+        for (int i = 0; i < n; i += 64) {
+            __mmask64 mask = (n - i >= 64) ? ~(__mmask64)0 : (((__mmask64)1 << (n - i)) - 1);
+            acc = _mm512_dpbusd_epi32(acc, _mm512_maskz_loadu_epi8(mask, a + i), _mm512_maskz_loadu_epi8(mask, row + i));
+        }
+        out[r] = _mm512_reduce_add_epi32(acc);
+    }
+}
+
+// 16 columns of rows i to i + 3, interleaved into the 4 bytes of each int32 lane
+SIMD_TARGET("avx512f")
+static inline __m512i vnni_cols(const unsigned char* c, int stride) {
+    __m128i r0 = _mm_loadu_si128((const __m128i*)c);
+    __m128i r1 = _mm_loadu_si128((const __m128i*)(c + stride));
+    __m128i r2 = _mm_loadu_si128((const __m128i*)(c + 2 * stride));
+    __m128i r3 = _mm_loadu_si128((const __m128i*)(c + 3 * stride));
+    __m128i lo01 = _mm_unpacklo_epi8(r0, r1), hi01 = _mm_unpackhi_epi8(r0, r1);
+    __m128i lo23 = _mm_unpacklo_epi8(r2, r3), hi23 = _mm_unpackhi_epi8(r2, r3);
+    __m512i v = _mm512_castsi128_si512(_mm_unpacklo_epi16(lo01, lo23));
+    v = _mm512_inserti32x4(v, _mm_unpackhi_epi16(lo01, lo23), 1);
+    v = _mm512_inserti32x4(v, _mm_unpacklo_epi16(hi01, hi23), 2);
+    return _mm512_inserti32x4(v, _mm_unpackhi_epi16(hi01, hi23), 3);
+}
+
+SIMD_TARGET("avx512f,avx512bw,avx512vl,avx512vnni")
+static void gemm_u8s8_vnni(const unsigned char* cols, const signed char* weights, int k, int numRows, int numCols, int* out) {
+
+    int stride = (numCols + 15) & ~15;
+    for (int p = 0; p < numCols; p += 16) {
+        int count = (numCols - p < 16) ? numCols - p : 16;
+        __mmask16 mask = (__mmask16)((1u << count) - 1);
+        for (int r0 = 0; r0 < numRows; r0 += 8) {
+            const signed char* w[8];
+            for (int j = 0; j < 8; ++j)
+                w[j] = weights + block_row(r0, j, numRows) * k;
+
+            __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+            __m512i acc2 = _mm512_setzero_si512(), acc3 = _mm512_setzero_si512();
+            __m512i acc4 = _mm512_setzero_si512(), acc5 = _mm512_setzero_si512();
+            __m512i acc6 = _mm512_setzero_si512(), acc7 = _mm512_setzero_si512();
+            for (int i = 0; i < k; i += 4) {
+                __m512i v = vnni_cols(cols + i * stride + p, stride);
+                acc0 = _mm512_dpbusd_epi32(acc0, v, _mm512_set1_epi32(load_weights4(w[0] + i)));
+                acc1 = _mm512_dpbusd_epi32(acc1, v, _mm512_set1_epi32(load_weights4(w[1] + i)));
+                acc2 = _mm512_dpbusd_epi32(acc2, v, _mm512_set1_epi32(load_weights4(w[2] + i)));
+                acc3 = _mm512_dpbusd_epi32(acc3, v, _mm512_set1_epi32(load_weights4(w[3] + i)));
+                acc4 = _mm512_dpbusd_epi32(acc4, v, _mm512_set1_epi32(load_weights4(w[4] + i)));
+                acc5 = _mm512_dpbusd_epi32(acc5, v, _mm512_set1_epi32(load_weights4(w[5] + i)));
+                acc6 = _mm512_dpbusd_epi32(acc6, v, _mm512_set1_epi32(load_weights4(w[6] + i)));
+                acc7 = _mm512_dpbusd_epi32(acc7, v, _mm512_set1_epi32(load_weights4(w[7] + i)));
+            }
+
+            __m512i acc[8] = { acc0, acc1, acc2, acc3, acc4, acc5, acc6, acc7 };
+            for (int j = 0; j < 8 && r0 + j < numRows; ++j)
+                _mm512_mask_storeu_epi32(out + (r0 + j) * numCols + p, mask, acc[j]);
+        }
+    }
+}
+
+void get_avx512_vnni_kernels(SimdKernels& kernels) {
+    get_avx512_kernels(kernels);
+    kernels.level = SIMD_AVX512_VNNI;
+    kernels.dot_u8s8 = dot_u8s8_vnni;
+    kernels.gemm_u8s8 = gemm_u8s8_vnni;
+}
+
+
+// ---------------------------------------------------------------- AVX-512 BF16
+
+// vdpbf16ps: each 32-bit lane adds (weight for x[i]) * x[i] + (weight for x[i + 1]) * x[i + 1],
+// which is exactly the pair layout of the bf16 panels, with x2[j] broadcast to every lane
+SIMD_TARGET("avx512f,avx512bf16")
+static void gemv_bf16_pairs_avx512bf16(const uint16_t* panels, const uint32_t* x2, int n, const float* bias, float* out, int numRows, bool relu) {
+
+    int n2 = (n + 1) / 2;
+    for (int r0 = 0; r0 < numRows; r0 += GEMV_PANEL) {
+        const uint16_t* p = panels + r0 * n2 * 2;
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        int j = 0;
+        for (; j + 4 <= n2; j += 4, p += 4 * GEMV_PANEL * 2) {
+            acc0 = _mm512_dpbf16_ps(acc0, (__m512bh)_mm512_loadu_si512(p), (__m512bh)_mm512_set1_epi32((int)x2[j]));
+            acc1 = _mm512_dpbf16_ps(acc1, (__m512bh)_mm512_loadu_si512(p + 32), (__m512bh)_mm512_set1_epi32((int)x2[j + 1]));
+            acc2 = _mm512_dpbf16_ps(acc2, (__m512bh)_mm512_loadu_si512(p + 64), (__m512bh)_mm512_set1_epi32((int)x2[j + 2]));
+            acc3 = _mm512_dpbf16_ps(acc3, (__m512bh)_mm512_loadu_si512(p + 96), (__m512bh)_mm512_set1_epi32((int)x2[j + 3]));
+        }
+        for (; j < n2; ++j, p += GEMV_PANEL * 2)
+            acc0 = _mm512_dpbf16_ps(acc0, (__m512bh)_mm512_loadu_si512(p), (__m512bh)_mm512_set1_epi32((int)x2[j]));
+        float sums[GEMV_PANEL];
+        _mm512_storeu_ps(sums, _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+        int count = (numRows - r0 < GEMV_PANEL) ? numRows - r0 : GEMV_PANEL;
+        for (int r = 0; r < count; ++r) {
+            float v = bias[r0 + r] + sums[r];
+            out[r0 + r] = (relu && v < 0.f) ? 0.f : v;
+        }
+    }
+}
+
+void get_avx512_bf16_kernels(SimdKernels& kernels) {
+    get_avx512_vnni_kernels(kernels);
+    kernels.level = SIMD_AVX512_BF16;
+    kernels.gemv_bf16_pairs = gemv_bf16_pairs_avx512bf16;
+}
+
+#endif
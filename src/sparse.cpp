@@ -0,0 +1,150 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "sparse.h"
+#include "simd.h"
+
+const char* sparse_format_name(int format) {
+    switch (format) {
+    case SPARSE_NONE: return "dense";
+    case SPARSE_CSR: return "csr";
+    case SPARSE_BLOCK: return "block";
+    default: return "?";
+    }
+}
+
+bool parse_sparse_format(const char* name, SparseFormat& format) {
+    for (int f = 0; f < SPARSE_FORMAT_COUNT; ++f) {
+        if (strcmp(name, sparse_format_name(f)) == 0) {
+            format = (SparseFormat)f;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CsrMatrix::build(const float* weights, int rows, int cols) {
+
+    this->rows = rows;
+    this->cols = cols;
+    row_start.assign(1, 0);
+    columns.clear();
+    values.clear();
+    for (int r = 0; r < rows; ++r) {
+        for (int i = 0; i < cols; ++i) {
+            if (weights[r * cols + i] != 0.f) {
+                columns.push_back((uint16_t)i);
+                values.push_back(weights[r * cols + i]);
+            }
+        }
+        row_start.push_back((int)values.size());
+    }
+}
+
+size_t CsrMatrix::bytes() const {
+    return row_start.size() * sizeof(int) + columns.size() * sizeof(uint16_t) + values.size() * sizeof(float);
+}
+
+void csr_gemm(const CsrMatrix& A, const float* B, int n, float* C) {
+
+    for (int r = 0; r < A.rows; ++r) {
+        float* c = C + r * n;
+        for (int b = 0; b < n; ++b)
+            c[b] = 0.f;
+        for (int j = A.row_start[r]; j < A.row_start[r + 1]; ++j) {
+            float v = A.values[j];
+            const float* row = B + A.columns[j] * n;
+            for (int b = 0; b < n; ++b)
+                c[b] += v * row[b];
+        }
+    }
+}
+
+void BlockSparsePanels::build(const float* weights, int rows, int cols) {
+
+    this->rows = rows;
+    this->cols = cols;
+    panel_start.assign(1, 0);
+    columns.clear();
+    values.clear();
+    for (int r0 = 0; r0 < rows; r0 += GEMV_PANEL) {
+        for (int i = 0; i < cols; ++i) {
+            bool zero = true;
+            for (int r = r0; r < r0 + GEMV_PANEL && r < rows; ++r)
+                zero &= (weights[r * cols + i] == 0.f);
+            if (zero)
+                continue;
+            columns.push_back((uint16_t)i);
+            for (int r = r0; r < r0 + GEMV_PANEL; ++r)
+                values.push_back((r < rows) ? weights[r * cols + i] : 0.f);
+        }
+        panel_start.push_back((int)columns.size());
+    }
+}
+
+size_t BlockSparsePanels::bytes() const {
+    return panel_start.size() * sizeof(int) + columns.size() * sizeof(uint16_t) + values.size() * sizeof(float);
+}
+
+int prune_magnitude(float* weights, int rows, int cols, float sparsity) {
+
+    int n = rows * cols;
+    int count = (int)ceil((double)sparsity * n);
+    count = (count < 0) ? 0 : ((count > n) ? n : count);
+
+    // the count smallest magnitudes, in index order among equal ones so the result is deterministic
+    std::vector<int> order(n);
+    for (int i = 0; i < n; ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [weights](int a, int b) { return fabsf(weights[a]) < fabsf(weights[b]); });
+    for (int i = 0; i < count; ++i)
+        weights[order[i]] = 0.f;
+
+    int zeros = 0;
+    for (int i = 0; i < n; ++i)
+        zeros += (weights[i] == 0.f);
+    return zeros;
+}
+
+int prune_blocks(float* weights, int rows, int cols, float sparsity) {
+
+    // block (p, i) = rows [p * GEMV_PANEL, (p + 1) * GEMV_PANEL) of column i
+    int numPanels = gemv_num_panels(rows);
+    int numBlocks = numPanels * cols;
+    std::vector<float> norms(numBlocks, 0.f);
+    for (int r = 0; r < rows; ++r) {
+        for (int i = 0; i < cols; ++i)
+            norms[(r / GEMV_PANEL) * cols + i] += weights[r * cols + i] * weights[r * cols + i];
+    }
+
+    // smallest blocks first, until the zeroed weights reach the target
+    std::vector<int> order(numBlocks);
+    for (int b = 0; b < numBlocks; ++b)
+        order[b] = b;
+    std::stable_sort(order.begin(), order.end(), [&norms](int a, int b) { return norms[a] < norms[b]; });
+    double target = (double)sparsity * rows * cols;
+    int zeroed = 0;
+    for (int k = 0; k < numBlocks && zeroed < target; ++k) {
+        int p = order[k] / cols, i = order[k] % cols;
+        for (int r = p * GEMV_PANEL; r < (p + 1) * GEMV_PANEL && r < rows; ++r) {
+            weights[r * cols + i] = 0.f;
+            ++zeroed;
+        }
+    }
+
+    int zeros = 0;
+    for (int i = 0; i < rows * cols; ++i)
+        zeros += (weights[i] == 0.f);
+    return zeros;
+}
+
+int prune_threshold(float* weights, int rows, int cols, float threshold) {
+
+    int zeros = 0;
+    for (int i = 0; i < rows * cols; ++i) {
+        if (fabsf(weights[i]) < threshold)
+            weights[i] = 0.f;
+        zeros += (weights[i] == 0.f);
+    }
+    return zeros;
+}
@@ -0,0 +1,100 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stdint.h>
+#include <vector>
+
+// Pruning and sparse storage of the C5, F6 and OUTPUT weight matrices (see Lenet5Model::set_sparse)
+//
+// csr:     compressed sparse rows, only the nonzero weights and their column; the GEMV (SimdKernels::gemv_csr)
+//          gathers x by column
+//          and the batched path adds every nonzero weight times a whole row of the input matrix
+// block:   the GEMV panels of 16 rows (see pack_gemv_panels) with the columns that are zero in all 16 rows
+//          left out; the kept columns run at the speed of the dense kernels, so this pays off when the
+//          weights were pruned in 16 x 1 blocks (prune_blocks) rather than one by one
+//
+// Both formats skip zeros exactly, so the outputs only differ from the dense kernels by float rounding.
+
+enum SparseFormat {
+    SPARSE_NONE = 0,    // dense kernels
+    SPARSE_CSR,
+    SPARSE_BLOCK,
+    SPARSE_FORMAT_COUNT
+};
+
+const char* sparse_format_name(int format);
+// "dense", "csr" or "block"
+bool parse_sparse_format(const char* name, SparseFormat& format);
+
+struct CsrMatrix {
+    int rows, cols;
+    std::vector<int> row_start;     // rows + 1 offsets into columns / values
+    std::vector<uint16_t> columns;  // the layers have at most 400 inputs
+    std::vector<float> values;
+
+    CsrMatrix() : rows(0), cols(0) {}
+
+    // keeps the nonzero elements of the row-major rows x cols matrix weights
+    void build(const float* weights, int rows, int cols);
+    size_t nonzeros() const { return values.size(); }
+    size_t bytes() const;
+};
+
+// C[rows x n] = A * B[cols x n] (row-major, no bias)
+void csr_gemm(const CsrMatrix& A, const float* B, int n, float* C);
+
+struct BlockSparsePanels {
+    int rows, cols;
+    std::vector<int> panel_start;   // gemv_num_panels(rows) + 1 offsets into columns, in blocks
+    std::vector<uint16_t> columns;  // kept columns of every panel
+    std::vector<float> values;      // GEMV_PANEL weights per kept column (zero padding rows in the last panel)
+
+    BlockSparsePanels() : rows(0), cols(0) {}
+
+    void build(const float* weights, int rows, int cols);
+    size_t blocks() const { return columns.size(); }
+    size_t bytes() const;
+};
+
+// zeroes the sparsity * rows * cols (rounded up) weights of smallest magnitude of the row-major rows x cols matrix
+// returns the number of zero weights
+int prune_magnitude(float* weights, int rows, int cols, float sparsity);
+// the same with the 16 x 1 blocks of the GEMV panels (GEMV_PANEL consecutive rows of one column)
+// ranked by their L2 norm, so whole blocks are zeroed
+int prune_blocks(float* weights, int rows, int cols, float sparsity);
+// zeroes the weights with |w| < threshold; returns the number of zero weights
+int prune_threshold(float* weights, int rows, int cols, float threshold);
+
+// "lenet5 prune" and "lenet5 sparse", defined in lenet5_sparse.cpp
+struct PruneOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* out_path;
+    float sparsity;             // fraction of zero weights, or < 0 to prune below threshold
+    float threshold;
+    bool blocks;                // prune 16 x 1 blocks (sparsity only)
+
+    PruneOptions() : model_path(nullptr), out_path("params/lenet5_pruned.bin"), sparsity(-1.f), threshold(-1.f), blocks(false) {}
+};
+
+// parses the arguments of "lenet5 prune" (argv[0] is the first one after the command)
+bool parse_prune_args(int argc, char* argv[], PruneOptions& options);
+void print_prune_usage();
+
+// prunes C5, F6 and OUTPUT to the sparsity or below the threshold and writes the pruned model
+bool prune_model(const PruneOptions& options);
+
+struct SparseReportOptions {
+    const char* model_path;     // nullptr: params/*.txt
+    const char* dataset_path;   // nullptr: the two CSV files
+
+    SparseReportOptions() : model_path(nullptr), dataset_path(nullptr) {}
+};
+
+// parses the arguments of "lenet5 sparse" (argv[0] is the first one after the command)
+bool parse_sparse_args(int argc, char* argv[], SparseReportOptions& options);
+void print_sparse_usage();
+
+// accuracy and time of the dense and sparse kernels at several sparsity levels
+bool run_sparse_report(const SparseReportOptions& options);
+
+#endif
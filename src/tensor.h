@@ -0,0 +1,162 @@
+#ifndef TENSOR_H
+#define TENSOR_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "arena.h"
+#include "alloc_counter.h"
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+#define TENSOR_ALIGNMENT 64     // cache line; also the width of an AVX-512 register
+
+// element order of a 4-D tensor
+enum TensorLayout {
+    LAYOUT_NCHW,    // each (n, c) is a contiguous h x w plane
+    LAYOUT_NHWC     // each (n, h, w) is a contiguous vector of c channels
+};
+
+inline void* aligned_malloc(size_t bytes) {
+    if (bytes == 0)
+        bytes = TENSOR_ALIGNMENT;
+    count_allocation();
+#ifdef _MSC_VER
+    void* ptr = _aligned_malloc(bytes, TENSOR_ALIGNMENT);
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, TENSOR_ALIGNMENT, bytes) != 0)
+        ptr = nullptr;
+#endif
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+inline void aligned_free(void* ptr) {
+#ifdef _MSC_VER
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// contiguous, 64-byte aligned tensor of up to 4 dimensions (n, c, h, w)
+// lower-rank tensors leave the outer dimensions at 1, e.g. a 5x5 map is (1, 1, 5, 5)
+// T must be a plain data type (float, unsigned char, ...)
+// memory comes from the heap, or from an Arena after set_arena (then it is only given back with the arena)
+template<class T>
+class Tensor {
+private:
+    int _n, _c, _h, _w;
+    TensorLayout _layout;
+    size_t _size;       // number of elements in use
+    size_t _capacity;   // number of elements allocated
+    T* _data;
+    bool _owner;        // false when viewing memory owned by someone else
+    Arena* _arena;      // allocations come from here instead of the heap, nullptr: heap
+
+    void release() {
+        if (_owner && _data != nullptr && _arena == nullptr)
+            aligned_free(_data);
+        _data = nullptr;
+        _capacity = 0;
+        _owner = true;
+    }
+
+public:
+    Tensor() : _n(0), _c(0), _h(0), _w(0), _layout(LAYOUT_NCHW),
+        _size(0), _capacity(0), _data(nullptr), _owner(true), _arena(nullptr) {}
+
+    Tensor(int n, int c, int h, int w, TensorLayout layout = LAYOUT_NCHW) : Tensor() {
+        init(n, c, h, w, layout);
+    }
+
+    // copies always own their data (on the heap), even when copied from a view or an arena tensor
+    Tensor(const Tensor& other) : Tensor() {
+        *this = other;
+    }
+
+    Tensor& operator=(const Tensor& other) {
+        if (this != &other) {
+            init(other._n, other._c, other._h, other._w, other._layout);
+            if (_size > 0)
+                memcpy(_data, other._data, _size * sizeof(T));
+        }
+        return *this;
+    }
+
+    ~Tensor() {
+        release();
+    }
+
+    // (re)shapes the tensor; memory is only reallocated when it grows
+    // contents are left uninitialized
+    void init(int n, int c, int h, int w, TensorLayout layout = LAYOUT_NCHW) {
+        size_t size = (size_t)n * c * h * w;
+        if (!_owner || size > _capacity) {
+            release();
+            _data = (_arena != nullptr) ? (T*)_arena->allocate(size * sizeof(T), TENSOR_ALIGNMENT)
+                : (T*)aligned_malloc(size * sizeof(T));
+            _capacity = size;
+        }
+        _n = n; _c = c; _h = h; _w = w;
+        _layout = layout;
+        _size = size;
+    }
+
+    // takes the memory of this and every later (larger) shape from arena, which must outlive the tensor
+    // (nullptr: the heap again); the contents are lost
+    void set_arena(Arena* arena) {
+        release();
+        _arena = arena;
+        init(_n, _c, _h, _w, _layout);
+    }
+
+    // makes this tensor a (non-owning) view over external memory
+    void wrap(T* data, int n, int c, int h, int w, TensorLayout layout = LAYOUT_NCHW) {
+        release();
+        _owner = false;
+        _data = data;
+        _n = n; _c = c; _h = h; _w = w;
+        _layout = layout;
+        _size = (size_t)n * c * h * w;
+        _capacity = _size;
+    }
+
+    void zero() {
+        if (_size > 0)
+            memset(_data, 0, _size * sizeof(T));
+    }
+
+    int n() const { return _n; }
+    int c() const { return _c; }
+    int h() const { return _h; }
+    int w() const { return _w; }
+    TensorLayout layout() const { return _layout; }
+    size_t size() const { return _size; }
+
+    T* data() { return _data; }
+    const T* data() const { return _data; }
+
+    size_t index(int n, int c, int h, int w) const {
+        if (_layout == LAYOUT_NCHW)
+            return (((size_t)n * _c + c) * _h + h) * _w + w;
+        else
+            return (((size_t)n * _h + h) * _w + w) * _c + c;
+    }
+
+    T& at(int n, int c, int h, int w) { return _data[index(n, c, h, w)]; }
+    const T& at(int n, int c, int h, int w) const { return _data[index(n, c, h, w)]; }
+
+    // start of the contiguous h x w plane of (n, c); NCHW only
+    T* plane(int n, int c) { return _data + ((size_t)n * _c + c) * _h * _w; }
+    const T* plane(int n, int c) const { return _data + ((size_t)n * _c + c) * _h * _w; }
+
+    T& operator[](size_t i) { return _data[i]; }
+    const T& operator[](size_t i) const { return _data[i]; }
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "thread_pool.h"
+
+// index of the pool worker running on this thread, -1 on other threads
+static thread_local int current_worker = -1;
+static thread_local const ThreadPool* current_pool = nullptr;
+
+ThreadPool::ThreadPool(int numThreads) : ThreadPool(numThreads, nullptr) {}
+
+ThreadPool::ThreadPool(int numThreads, const std::function<void(int worker)>& onStart) :
+    queued(0), pending(0), next_queue(0), stopping(false)
+{
+
+    if (numThreads <= 0) {
+        numThreads = (int)std::thread::hardware_concurrency();
+        if (numThreads <= 0)
+            numThreads = 1;
+    }
+
+    for (int i = 0; i < numThreads; ++i)
+        queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    std::atomic<int> started(0);
+    for (int i = 0; i < numThreads; ++i)
+        threads.push_back(std::thread(&ThreadPool::worker_loop, this, i, onStart ? &onStart : nullptr, &started));
+
+    if (onStart) {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        all_done.wait(lock, [&] { return started.load() == numThreads; });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+}
+
+void ThreadPool::submit(Task task) {
+
+    int target;
+    if (current_pool == this)
+        target = current_worker;
+    else
+        target = (int)(next_queue.fetch_add(1) % queues.size());
+
+    pending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+        // queued is updated under wake_mutex so a worker about to sleep cannot miss it
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        queued.fetch_add(1);
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::try_pop(int worker, Task& task) {
+
+    // own deque first, newest task (LIFO, still warm in cache)
+    {
+        WorkerQueue& own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // steal the oldest task of another worker
+    int n = (int)queues.size();
+    for (int i = 1; i < n; ++i) {
+        WorkerQueue& victim = *queues[(worker + i) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::worker_loop(int worker, const std::function<void(int worker)>* onStart, std::atomic<int>* started) {
+
+    current_worker = worker;
+    current_pool = this;
+    if (onStart != nullptr) {
+        (*onStart)(worker);
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        started->fetch_add(1);
+        all_done.notify_all();
+    }
+
+    for (;;) {
+        Task task;
+        if (try_pop(worker, task)) {
+            task(worker);
+            if (pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+                all_done.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() == 0)
+            return;
+    }
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    all_done.wait(lock, [this] { return pending.load() == 0; });
+}
+
+void ThreadPool::parallel_for(int count, int grain, const std::function<void(int begin, int end, int worker)>& func) {
+
+    if (grain <= 0)
+        grain = 1;
+    for (int begin = 0; begin < count; begin += grain) {
+        int end = (begin + grain < count) ? begin + grain : count;
+        submit([&func, begin, end](int worker) { func(begin, end, worker); });
+    }
+    wait();
+}
@@ -0,0 +1,64 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.
+// Every worker has its own task deque: it pops its newest task from the back and,
+// when its deque is empty, steals the oldest task from the front of another worker's deque.
+// Tasks receive the index of the worker running them, so callers can keep per-worker state
+// (e.g. one InferenceContext per worker) without any locking.
+class ThreadPool {
+public:
+    typedef std::function<void(int worker)> Task;
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex wake_mutex;
+    std::condition_variable wake;       // signalled when tasks are queued or on shutdown
+    std::condition_variable all_done;   // signalled when the last pending task finishes
+    std::atomic<int> queued;            // tasks sitting in the deques
+    std::atomic<int> pending;           // tasks submitted but not yet finished
+    std::atomic<unsigned> next_queue;   // round-robin target for submissions from outside the pool
+    bool stopping;
+
+    bool try_pop(int worker, Task& task);
+    void worker_loop(int worker, const std::function<void(int worker)>* onStart, std::atomic<int>* started);
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+public:
+    // numThreads <= 0: one worker per hardware thread
+    explicit ThreadPool(int numThreads = 0);
+    // every worker first runs onStart(worker) on its own thread, e.g. to pin itself to a CPU and allocate
+    // its per-worker state there; the constructor returns once all of them have
+    ThreadPool(int numThreads, const std::function<void(int worker)>& onStart);
+    ~ThreadPool();
+
+    int size() const { return (int)threads.size(); }
+
+    // queues a task; tasks submitted from a worker go to that worker's own deque
+    void submit(Task task);
+    // blocks until every submitted task has finished (must not be called from a worker)
+    void wait();
+
+    // runs func(begin, end, worker) over [0, count) in chunks of at most grain items and waits for all of them
+    void parallel_for(int count, int grain, const std::function<void(int begin, int end, int worker)>& func);
+};
+
+#endif